@@ -0,0 +1,443 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "aws_iot_fragment_interface.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "timer_interface.h"
+#include "aws_iot_log.h"
+#include "aws_iot_config.h"
+
+#define FRAGMENT_MAGIC_0 'F'
+#define FRAGMENT_MAGIC_1 'G'
+#define FRAGMENT_VERSION 1
+
+/* Worst case MQTT PUBLISH overhead: fixed header, 4 byte remaining length, topic length and packet id */
+#define FRAGMENT_MQTT_PUBLISH_OVERHEAD (1 + 4 + 2 + 2)
+
+#define FRAGMENT_STATE_IDLE 0
+#define FRAGMENT_STATE_INITIALIZING 1
+#define FRAGMENT_STATE_RECEIVING 2
+#define FRAGMENT_STATE_COMPLETE 3
+
+const FragmentPublishParams FragmentPublishParamsDefault = {
+		.pTopic = NULL,
+		.transferId = 0,
+		.chunkPayloadLen = 0,
+		.windowSize = AWS_IOT_FRAGMENT_DEFAULT_WINDOW,
+		.timeout_ms = 60000
+};
+
+typedef struct {
+	uint16_t transferId;
+	uint16_t chunkPayloadLen;
+	uint32_t chunkIndex;
+	uint32_t chunkCount;
+	uint32_t totalLength;
+	uint32_t checksum;
+} FragmentHeader_t;
+
+static const uint32_t crc32NibbleTable[16] = {
+		0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+		0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+static uint32_t crc32(const uint8_t *pData, uint32_t length) {
+	uint32_t crc = 0xFFFFFFFF;
+	uint32_t i;
+
+	for (i = 0; i < length; i++) {
+		crc ^= pData[i];
+		crc = (crc >> 4) ^ crc32NibbleTable[crc & 0x0F];
+		crc = (crc >> 4) ^ crc32NibbleTable[crc & 0x0F];
+	}
+
+	return ~crc;
+}
+
+static void writeUint16(uint8_t *pBuf, uint16_t value) {
+	pBuf[0] = (uint8_t) (value >> 8);
+	pBuf[1] = (uint8_t) value;
+}
+
+static void writeUint32(uint8_t *pBuf, uint32_t value) {
+	pBuf[0] = (uint8_t) (value >> 24);
+	pBuf[1] = (uint8_t) (value >> 16);
+	pBuf[2] = (uint8_t) (value >> 8);
+	pBuf[3] = (uint8_t) value;
+}
+
+static uint16_t readUint16(const uint8_t *pBuf) {
+	return (uint16_t) (((uint16_t) pBuf[0] << 8) | pBuf[1]);
+}
+
+static uint32_t readUint32(const uint8_t *pBuf) {
+	return ((uint32_t) pBuf[0] << 24) | ((uint32_t) pBuf[1] << 16) | ((uint32_t) pBuf[2] << 8) | pBuf[3];
+}
+
+static void serializeHeader(uint8_t *pBuf, const FragmentHeader_t *pHeader) {
+	pBuf[0] = FRAGMENT_MAGIC_0;
+	pBuf[1] = FRAGMENT_MAGIC_1;
+	pBuf[2] = FRAGMENT_VERSION;
+	pBuf[3] = 0;
+	writeUint16(pBuf + 4, pHeader->transferId);
+	writeUint16(pBuf + 6, pHeader->chunkPayloadLen);
+	writeUint32(pBuf + 8, pHeader->chunkIndex);
+	writeUint32(pBuf + 12, pHeader->chunkCount);
+	writeUint32(pBuf + 16, pHeader->totalLength);
+	writeUint32(pBuf + 20, pHeader->checksum);
+}
+
+static bool deserializeHeader(const uint8_t *pBuf, uint32_t length, FragmentHeader_t *pHeader) {
+	if (length < AWS_IOT_FRAGMENT_HEADER_LEN || FRAGMENT_MAGIC_0 != pBuf[0] || FRAGMENT_MAGIC_1 != pBuf[1]
+			|| FRAGMENT_VERSION != pBuf[2]) {
+		return false;
+	}
+	pHeader->transferId = readUint16(pBuf + 4);
+	pHeader->chunkPayloadLen = readUint16(pBuf + 6);
+	pHeader->chunkIndex = readUint32(pBuf + 8);
+	pHeader->chunkCount = readUint32(pBuf + 12);
+	pHeader->totalLength = readUint32(pBuf + 16);
+	pHeader->checksum = readUint32(pBuf + 20);
+	return true;
+}
+
+/* Largest chunk data length for which the whole PUBLISH packet fits into both the TX and the RX buffer */
+static uint32_t maxChunkPayloadLen(const char *pTopic) {
+	uint32_t bufLen = (AWS_IOT_MQTT_TX_BUF_LEN < AWS_IOT_MQTT_RX_BUF_LEN) ? AWS_IOT_MQTT_TX_BUF_LEN : AWS_IOT_MQTT_RX_BUF_LEN;
+	uint32_t overhead = FRAGMENT_MQTT_PUBLISH_OVERHEAD + (uint32_t) strlen(pTopic) + AWS_IOT_FRAGMENT_HEADER_LEN + 1;
+	uint32_t maxLen;
+
+	if (bufLen <= overhead) {
+		return 0;
+	}
+	maxLen = bufLen - overhead;
+	return (maxLen > UINT16_MAX) ? UINT16_MAX : maxLen;
+}
+
+static IoT_Error_t waitForPubacks(MQTTClient_t *pClient, Timer *pTransferTimer) {
+	IoT_Error_t rc;
+
+	if (expired(pTransferTimer)) {
+		return FRAGMENT_TIMEOUT_ERROR;
+	}
+
+	/* A reconnect drops the unacknowledged chunks, so anything but a clean yield aborts the transfer */
+	rc = pClient->yield(AWS_IOT_FRAGMENT_YIELD_TIMEOUT_MS);
+	if (NONE_ERROR != rc) {
+		return (RECONNECT_SUCCESSFUL == rc) ? NETWORK_DISCONNECTED : rc;
+	}
+
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_fragment_publish(MQTTClient_t *pClient, FragmentPublishParams *pParams, const void *pData,
+		uint32_t length, FragmentTransferStats *pStats) {
+	IoT_Error_t rc = NONE_ERROR;
+	uint8_t chunkBuf[AWS_IOT_MQTT_TX_BUF_LEN];
+	const uint8_t *pBytes = (const uint8_t *) pData;
+	FragmentHeader_t header;
+	MQTTPublishParams publishParams = MQTTPublishParamsDefault;
+	Timer transferTimer;
+	uint32_t maxLen;
+	uint32_t window;
+	uint32_t offset;
+	uint32_t dataLen;
+	uint32_t chunksSent = 0;
+	uint32_t windowStalls = 0;
+	uint64_t startTime_us;
+	uint64_t elapsed_us;
+
+	if (NULL == pClient || NULL == pParams || NULL == pParams->pTopic || (NULL == pData && 0 != length)) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if (NULL == pClient->publishAsync || NULL == pClient->getInflightPublishCount || NULL == pClient->yield) {
+		return NULL_VALUE_ERROR;
+	}
+
+	maxLen = maxChunkPayloadLen(pParams->pTopic);
+	if (0 == maxLen) {
+		return FRAGMENT_BUFFER_TOO_SMALL;
+	}
+
+	window = (0 == pParams->windowSize) ? AWS_IOT_FRAGMENT_DEFAULT_WINDOW : pParams->windowSize;
+	if (window > AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH) {
+		window = AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH;
+	}
+
+	header.transferId = pParams->transferId;
+	header.chunkPayloadLen = (uint16_t) ((0 == pParams->chunkPayloadLen || pParams->chunkPayloadLen > maxLen) ?
+			maxLen : pParams->chunkPayloadLen);
+	/* An empty blob is still sent as a single empty chunk so the receiver completes */
+	header.chunkCount = (0 == length) ? 1 : (uint32_t) (((uint64_t) length + header.chunkPayloadLen - 1) / header.chunkPayloadLen);
+	header.totalLength = length;
+	header.checksum = crc32(pBytes, length);
+
+	publishParams.pTopic = pParams->pTopic;
+	publishParams.MessageParams.qos = QOS_1;
+	publishParams.MessageParams.pPayload = chunkBuf;
+
+	InitTimer(&transferTimer);
+	countdown_ms(&transferTimer, pParams->timeout_ms);
+	startTime_us = timestamp_us();
+
+	for (header.chunkIndex = 0; header.chunkIndex < header.chunkCount && NONE_ERROR == rc;) {
+		if (pClient->getInflightPublishCount() >= window) {
+			windowStalls++;
+			rc = waitForPubacks(pClient, &transferTimer);
+			continue;
+		}
+
+		offset = header.chunkIndex * header.chunkPayloadLen;
+		dataLen = ((length - offset) < header.chunkPayloadLen) ? (length - offset) : header.chunkPayloadLen;
+		serializeHeader(chunkBuf, &header);
+		if (0 != dataLen) {
+			memcpy(chunkBuf + AWS_IOT_FRAGMENT_HEADER_LEN, pBytes + offset, dataLen);
+		}
+		publishParams.MessageParams.PayloadLen = AWS_IOT_FRAGMENT_HEADER_LEN + dataLen;
+
+		rc = pClient->publishAsync(&publishParams);
+		if (PUBLISH_WINDOW_FULL == rc || PUBLISH_WOULD_BLOCK == rc) {
+			/* Other asynchronous publishes share the client's in-flight slots and send queue */
+			windowStalls++;
+			rc = waitForPubacks(pClient, &transferTimer);
+			continue;
+		}
+		if (NONE_ERROR == rc) {
+			chunksSent++;
+			header.chunkIndex++;
+		}
+	}
+
+	while (NONE_ERROR == rc && 0 != pClient->getInflightPublishCount()) {
+		rc = waitForPubacks(pClient, &transferTimer);
+	}
+
+	if (NULL != pStats) {
+		elapsed_us = timestamp_us() - startTime_us;
+		pStats->chunksSent = chunksSent;
+		pStats->bytesSent = (chunksSent >= header.chunkCount) ? length : chunksSent * header.chunkPayloadLen;
+		pStats->windowStalls = windowStalls;
+		pStats->elapsed_ms = (uint32_t) (elapsed_us / 1000);
+		pStats->throughputMBps = (0 != elapsed_us) ? (double) pStats->bytesSent / (double) elapsed_us : 0.0;
+	}
+
+	if (NONE_ERROR != rc) {
+		ERROR("Fragmented transfer %u aborted after %u of %u chunks - %d", header.transferId, chunksSent,
+				header.chunkCount, rc);
+	}
+
+	return rc;
+}
+
+IoT_Error_t aws_iot_fragment_publish_file(MQTTClient_t *pClient, FragmentPublishParams *pParams, const char *pFilePath,
+		FragmentTransferStats *pStats) {
+	IoT_Error_t rc = NONE_ERROR;
+	struct stat fileStat;
+	void *pMapped = NULL;
+	int fd;
+
+	if (NULL == pFilePath) {
+		return NULL_VALUE_ERROR;
+	}
+
+	fd = open(pFilePath, O_RDONLY);
+	if (fd < 0) {
+		ERROR("Unable to open %s", pFilePath);
+		return GENERIC_ERROR;
+	}
+
+	if (0 != fstat(fd, &fileStat) || (uint64_t) fileStat.st_size > UINT32_MAX) {
+		ERROR("Unable to send %s, size unknown or bigger than 4GB", pFilePath);
+		close(fd);
+		return GENERIC_ERROR;
+	}
+
+	if (0 != fileStat.st_size) {
+		pMapped = mmap(NULL, (size_t) fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (MAP_FAILED == pMapped) {
+			ERROR("Unable to map %s", pFilePath);
+			close(fd);
+			return GENERIC_ERROR;
+		}
+		madvise(pMapped, (size_t) fileStat.st_size, MADV_SEQUENTIAL);
+	}
+
+	rc = aws_iot_fragment_publish(pClient, pParams, pMapped, (uint32_t) fileStat.st_size, pStats);
+
+	if (NULL != pMapped) {
+		munmap(pMapped, (size_t) fileStat.st_size);
+	}
+	close(fd);
+
+	return rc;
+}
+
+IoT_Error_t aws_iot_fragment_reassembler_init(FragmentReassembler *pReassembler, uint8_t *pBuffer, uint32_t bufferLen,
+		uint32_t *pBitmap, uint32_t bitmapWords) {
+	if (NULL == pReassembler || NULL == pBitmap || 0 == bitmapWords || (NULL == pBuffer && 0 != bufferLen)) {
+		return NULL_VALUE_ERROR;
+	}
+
+	pReassembler->pBuffer = pBuffer;
+	pReassembler->bufferLen = bufferLen;
+	pReassembler->pBitmap = pBitmap;
+	pReassembler->bitmapWords = bitmapWords;
+	pReassembler->chunksReceived = 0;
+	pReassembler->transferId = 0;
+	pReassembler->chunkPayloadLen = 0;
+	pReassembler->chunkCount = 0;
+	pReassembler->totalLength = 0;
+	pReassembler->checksum = 0;
+	__sync_synchronize();
+	pReassembler->state = FRAGMENT_STATE_IDLE;
+
+	return NONE_ERROR;
+}
+
+/* Called by the one thread that moved the reassembler out of the idle state */
+static IoT_Error_t startTransfer(FragmentReassembler *pReassembler, const FragmentHeader_t *pHeader) {
+	uint32_t expectedCount;
+
+	if (0 == pHeader->chunkPayloadLen) {
+		return FRAGMENT_INVALID_CHUNK;
+	}
+
+	expectedCount = (0 == pHeader->totalLength) ? 1 :
+			(uint32_t) (((uint64_t) pHeader->totalLength + pHeader->chunkPayloadLen - 1) / pHeader->chunkPayloadLen);
+	if (expectedCount != pHeader->chunkCount) {
+		return FRAGMENT_INVALID_CHUNK;
+	}
+
+	if (pHeader->totalLength > pReassembler->bufferLen || pHeader->chunkCount > pReassembler->bitmapWords * 32) {
+		return FRAGMENT_BUFFER_TOO_SMALL;
+	}
+
+	memset(pReassembler->pBitmap, 0, ((pHeader->chunkCount + 31) / 32) * sizeof(uint32_t));
+	pReassembler->transferId = pHeader->transferId;
+	pReassembler->chunkPayloadLen = pHeader->chunkPayloadLen;
+	pReassembler->chunkCount = pHeader->chunkCount;
+	pReassembler->totalLength = pHeader->totalLength;
+	pReassembler->checksum = pHeader->checksum;
+	pReassembler->chunksReceived = 0;
+
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_fragment_reassembler_feed(FragmentReassembler *pReassembler, const void *pPayload,
+		uint32_t payloadLen) {
+	IoT_Error_t rc;
+	FragmentHeader_t header;
+	uint32_t offset;
+	uint32_t dataLen;
+	uint32_t bit;
+	uint32_t previousWord;
+
+	if (NULL == pReassembler || NULL == pPayload) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if (!deserializeHeader((const uint8_t *) pPayload, payloadLen, &header)) {
+		return FRAGMENT_INVALID_CHUNK;
+	}
+
+	/* The first chunk of a transfer, whichever it is, defines the transfer */
+	if (__sync_bool_compare_and_swap(&pReassembler->state, FRAGMENT_STATE_IDLE, FRAGMENT_STATE_INITIALIZING)) {
+		rc = startTransfer(pReassembler, &header);
+		__sync_synchronize();
+		pReassembler->state = (NONE_ERROR == rc) ? FRAGMENT_STATE_RECEIVING : FRAGMENT_STATE_IDLE;
+		if (NONE_ERROR != rc) {
+			return rc;
+		}
+	}
+	while (FRAGMENT_STATE_INITIALIZING == pReassembler->state) {
+		__sync_synchronize();
+	}
+	if (FRAGMENT_STATE_IDLE == pReassembler->state) {
+		/* A concurrent first chunk was rejected, let this one try again */
+		return aws_iot_fragment_reassembler_feed(pReassembler, pPayload, payloadLen);
+	}
+
+	if (header.transferId != pReassembler->transferId || header.chunkCount != pReassembler->chunkCount
+			|| header.totalLength != pReassembler->totalLength || header.checksum != pReassembler->checksum
+			|| header.chunkPayloadLen != pReassembler->chunkPayloadLen || header.chunkIndex >= pReassembler->chunkCount) {
+		return FRAGMENT_INVALID_CHUNK;
+	}
+
+	offset = header.chunkIndex * (uint32_t) pReassembler->chunkPayloadLen;
+	dataLen = pReassembler->totalLength - offset;
+	if (dataLen > pReassembler->chunkPayloadLen) {
+		dataLen = pReassembler->chunkPayloadLen;
+	}
+	if (payloadLen - AWS_IOT_FRAGMENT_HEADER_LEN != dataLen) {
+		return FRAGMENT_INVALID_CHUNK;
+	}
+
+	if (FRAGMENT_STATE_COMPLETE == pReassembler->state) {
+		/* Late duplicate of an already reassembled transfer */
+		return NONE_ERROR;
+	}
+
+	/* Chunks cover disjoint ranges so concurrent copies never overlap */
+	if (0 != dataLen) {
+		memcpy(pReassembler->pBuffer + offset, (const uint8_t *) pPayload + AWS_IOT_FRAGMENT_HEADER_LEN, dataLen);
+	}
+
+	bit = 1u << (header.chunkIndex & 31);
+	previousWord = __sync_fetch_and_or(&pReassembler->pBitmap[header.chunkIndex >> 5], bit);
+	if (0 != (previousWord & bit)) {
+		return NONE_ERROR;
+	}
+
+	if (__sync_add_and_fetch(&pReassembler->chunksReceived, 1) != pReassembler->chunkCount) {
+		return NONE_ERROR;
+	}
+
+	if (crc32(pReassembler->pBuffer, pReassembler->totalLength) != pReassembler->checksum) {
+		return FRAGMENT_CHECKSUM_MISMATCH;
+	}
+
+	pReassembler->state = FRAGMENT_STATE_COMPLETE;
+	return FRAGMENT_TRANSFER_COMPLETE;
+}
+
+bool aws_iot_fragment_reassembler_is_complete(FragmentReassembler *pReassembler) {
+	if (NULL == pReassembler) {
+		return false;
+	}
+	return FRAGMENT_STATE_COMPLETE == pReassembler->state;
+}
+
+uint32_t aws_iot_fragment_reassembler_next_missing(FragmentReassembler *pReassembler, uint32_t fromIndex) {
+	uint32_t index;
+
+	if (NULL == pReassembler) {
+		return 0;
+	}
+
+	for (index = fromIndex; index < pReassembler->chunkCount; index++) {
+		if (0 == (pReassembler->pBitmap[index >> 5] & (1u << (index & 31)))) {
+			break;
+		}
+	}
+
+	return (index < pReassembler->chunkCount) ? index : pReassembler->chunkCount;
+}
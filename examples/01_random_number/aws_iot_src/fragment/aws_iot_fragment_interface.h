@@ -0,0 +1,160 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+#ifndef AWS_IOT_SDK_SRC_IOT_FRAGMENT_H_
+#define AWS_IOT_SDK_SRC_IOT_FRAGMENT_H_
+
+/**
+ * @file aws_iot_fragment_interface.h
+ * @brief Interface for fragmented transfer of large payloads
+ *
+ * A single MQTT message can not be bigger than the MQTT TX/RX buffers. To move a bigger blob
+ * the sender splits it into numbered chunks, each carrying a small header, and publishes them
+ * as QoS 1 messages while keeping a bounded number of them in flight. The receiver feeds every
+ * chunk it gets into a reassembler which copies it into a preallocated buffer, tracks missing
+ * chunks in a bitmap and validates the CRC-32 of the whole blob once the last chunk arrives.
+ *
+ * Chunk header (all fields big endian):
+ * magic "FG" (2) | version (1) | reserved (1) | transfer id (2) | chunk payload length (2) |
+ * chunk index (4) | chunk count (4) | total length (4) | CRC-32 of the whole blob (4)
+ */
+#include "aws_iot_mqtt_interface.h"
+
+#define AWS_IOT_FRAGMENT_HEADER_LEN 24 ///< Size of the header prepended to every chunk
+
+/**
+ * @brief Fragmented publish parameters
+ *
+ * @note Always use the \c FragmentPublishParamsDefault to initialize this struct
+ */
+typedef struct {
+	char *pTopic;				///< Topic all chunks are published on
+	uint16_t transferId;		///< Identifies the transfer so the receiver can reject chunks of other transfers
+	uint16_t chunkPayloadLen;	///< Data bytes per chunk. 0 = the largest size that fits into the MQTT TX and RX buffers
+	uint32_t windowSize;		///< Maximum number of unacknowledged chunks. 0 = AWS_IOT_FRAGMENT_DEFAULT_WINDOW
+	uint32_t timeout_ms;		///< Time allowed for the whole transfer including the last PUBACK
+} FragmentPublishParams;
+extern const FragmentPublishParams FragmentPublishParamsDefault;
+
+/**
+ * @brief Statistics of a fragmented publish
+ */
+typedef struct {
+	uint32_t chunksSent;		///< Number of chunks published
+	uint32_t bytesSent;			///< Number of blob bytes published, headers excluded
+	uint32_t windowStalls;		///< Number of times the sender had to wait for PUBACKs
+	uint32_t elapsed_ms;		///< Time from the first chunk until the last PUBACK
+	double throughputMBps;		///< Blob bytes per second, in MB (10^6 bytes)
+} FragmentTransferStats;
+
+/**
+ * @brief Reassembly state of one incoming fragmented transfer
+ *
+ * The reassembler does not allocate, the caller supplies the data buffer and the bitmap.
+ * Chunks may be fed concurrently from several threads, e.g. one per MQTT client.
+ */
+typedef struct {
+	uint8_t *pBuffer;			///< Destination of the reassembled blob
+	uint32_t bufferLen;			///< Size of pBuffer
+	uint32_t *pBitmap;			///< One bit per chunk, set once the chunk has been received
+	uint32_t bitmapWords;		///< Number of 32 bit words in pBitmap
+
+	volatile uint32_t state;			///< Idle, initializing, receiving or complete
+	volatile uint32_t chunksReceived;	///< Number of distinct chunks received
+	uint16_t transferId;
+	uint16_t chunkPayloadLen;
+	uint32_t chunkCount;
+	uint32_t totalLength;
+	uint32_t checksum;
+} FragmentReassembler;
+
+/**
+ * @brief Publish a buffer as a fragmented transfer
+ *
+ * Blocks until every chunk has been acknowledged, an error occurs or the transfer times out.
+ * The MQTT client is yielded to while waiting for PUBACKs so incoming messages keep being processed.
+ *
+ * @param pClient	MQTT Client used as the protocol layer
+ * @param pParams	Fragmented publish parameters
+ * @param pData		Data to send
+ * @param length	Number of bytes in pData
+ * @param pStats	Receives the transfer statistics, may be NULL
+ * @return An IoT Error Type defining successful/failed transfer
+ */
+IoT_Error_t aws_iot_fragment_publish(MQTTClient_t *pClient, FragmentPublishParams *pParams, const void *pData,
+		uint32_t length, FragmentTransferStats *pStats);
+
+/**
+ * @brief Publish a file as a fragmented transfer
+ *
+ * The file is memory mapped read only so chunks are copied straight from the page cache into the MQTT TX buffer.
+ *
+ * @param pClient	MQTT Client used as the protocol layer
+ * @param pParams	Fragmented publish parameters
+ * @param pFilePath	Path of the file to send
+ * @param pStats	Receives the transfer statistics, may be NULL
+ * @return An IoT Error Type defining successful/failed transfer
+ */
+IoT_Error_t aws_iot_fragment_publish_file(MQTTClient_t *pClient, FragmentPublishParams *pParams, const char *pFilePath,
+		FragmentTransferStats *pStats);
+
+/**
+ * @brief Prepare a reassembler for a new transfer
+ *
+ * The transfer parameters are learnt from the first chunk fed in.
+ *
+ * @param pReassembler	Reassembler to initialize
+ * @param pBuffer		Buffer receiving the blob, must be at least as big as the transfer
+ * @param bufferLen		Size of pBuffer
+ * @param pBitmap		Missing chunk bitmap, at least (chunk count + 31) / 32 words
+ * @param bitmapWords	Number of words in pBitmap
+ * @return An IoT Error Type defining successful/failed initialization
+ */
+IoT_Error_t aws_iot_fragment_reassembler_init(FragmentReassembler *pReassembler, uint8_t *pBuffer, uint32_t bufferLen,
+		uint32_t *pBitmap, uint32_t bitmapWords);
+
+/**
+ * @brief Feed one received chunk into a reassembler
+ *
+ * Meant to be called from the subscription callback with the message payload. Duplicate chunks are ignored.
+ *
+ * @param pReassembler	Reassembler of the transfer
+ * @param pPayload		Payload of the received MQTT message
+ * @param payloadLen	Length of the payload
+ * @return NONE_ERROR when the chunk was stored, FRAGMENT_TRANSFER_COMPLETE when it was the last missing chunk
+ *         and the checksum matched, otherwise an IoT Error Type describing why the chunk was rejected
+ */
+IoT_Error_t aws_iot_fragment_reassembler_feed(FragmentReassembler *pReassembler, const void *pPayload,
+		uint32_t payloadLen);
+
+/**
+ * @brief Has every chunk of the transfer been received and validated?
+ *
+ * @param pReassembler	Reassembler of the transfer
+ * @return true = the blob in the reassembly buffer is complete, false = chunks are missing
+ */
+bool aws_iot_fragment_reassembler_is_complete(FragmentReassembler *pReassembler);
+
+/**
+ * @brief Find the next chunk that has not been received yet
+ *
+ * Can be used to request retransmission of lost chunks.
+ *
+ * @param pReassembler	Reassembler of the transfer
+ * @param fromIndex		Chunk index to start searching at
+ * @return Index of the first missing chunk at or after fromIndex, or the chunk count if there is none
+ */
+uint32_t aws_iot_fragment_reassembler_next_missing(FragmentReassembler *pReassembler, uint32_t fromIndex);
+
+#endif /* AWS_IOT_SDK_SRC_IOT_FRAGMENT_H_ */
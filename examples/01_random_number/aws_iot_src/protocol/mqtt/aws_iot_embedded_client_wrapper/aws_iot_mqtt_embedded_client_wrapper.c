@@ -17,6 +17,7 @@
 #include "aws_iot_mqtt_interface.h"
 #include "MQTTClient.h"
 #include "aws_iot_config.h"
+#include <string.h>
 
 static Client c;
 
@@ -25,6 +26,16 @@ static iot_disconnect_handler clientDisconnectHandler;
 static unsigned char writebuf[AWS_IOT_MQTT_TX_BUF_LEN];
 static unsigned char readbuf[AWS_IOT_MQTT_RX_BUF_LEN];
 
+#define SEND_QUEUE_BLOCK_COUNT ((AWS_IOT_MQTT_SEND_QUEUE_SIZE + SEND_QUEUE_BLOCK_SIZE - 1) / SEND_QUEUE_BLOCK_SIZE)
+#if SEND_QUEUE_BLOCK_COUNT > 0
+static SendQueueBlock sendQueueBlocks[SEND_QUEUE_BLOCK_COUNT];
+#endif
+
+static bool isTopicStatsEnabled = false;
+static TopicStats publishedTopicStats;
+static TopicStats receivedTopicStats;
+static TopicStats subscriptionTopicStats;
+
 const MQTTConnectParams MQTTConnectParamsDefault = {
 		.enableAutoReconnect = 0,
 		.pHostURL = AWS_IOT_MQTT_HOST,
@@ -43,6 +54,7 @@ const MQTTConnectParams MQTTConnectParamsDefault = {
 		.mqttCommandTimeout_ms = 1000,
 		.tlsHandshakeTimeout_ms = 2000,
 		.isSSLHostnameVerify = true,
+		.pSessionCacheLocation = NULL,
 		.disconnectHandler = NULL
 };
 
@@ -53,7 +65,8 @@ const MQTTPublishParams MQTTPublishParamsDefault={
 const MQTTSubscribeParams MQTTSubscribeParamsDefault={
 		.pTopic = NULL,
 		.qos = QOS_0,
-		.mHandler = NULL
+		.mHandler = NULL,
+		.pFilter = NULL
 };
 const MQTTCallbackParams MQTTCallbackParamsDefault={
 		.pTopicName = NULL,
@@ -80,6 +93,15 @@ void pahoMessageCallback(MessageData* md) {
 	MQTTMessage* message = md->message;
 	MQTTCallbackParams params;
 
+	if (isTopicStatsEnabled && NULL != message) {
+		aws_iot_topic_stats_record(&receivedTopicStats, md->topicName->lenstring.data,
+				(uint16_t)(md->topicName->lenstring.len), (uint32_t)message->payloadlen);
+		if (NULL != md->topicFilter) {
+			aws_iot_topic_stats_record(&subscriptionTopicStats, md->topicFilter, (uint16_t)strlen(md->topicFilter),
+					(uint32_t)message->payloadlen);
+		}
+	}
+
 	// early exit if we do not have a valid callback pointer
 	if (md->applicationHandler == NULL) {
 		return;
@@ -125,6 +147,7 @@ IoT_Error_t aws_iot_mqtt_connect(MQTTConnectParams *pParams) {
 	TLSParams.pRootCALocation = pParams->pRootCALocation;
 	TLSParams.timeout_ms = pParams->tlsHandshakeTimeout_ms;
 	TLSParams.ServerVerificationFlag = pParams->isSSLHostnameVerify;
+	TLSParams.pSessionCacheLocation = pParams->pSessionCacheLocation;
 
 	// This implementation assumes you are not going to switch between cleansession 1 to 0
 	// As we don't have a default subscription handler support in the MQTT client every time a device power cycles it has to re-subscribe to let the MQTT client to pass the message up to the application callback.
@@ -136,6 +159,12 @@ IoT_Error_t aws_iot_mqtt_connect(MQTTConnectParams *pParams) {
 		if(SUCCESS != pahoRc) {
 			return CONNECTION_ERROR;
 		}
+#if SEND_QUEUE_BLOCK_COUNT > 0
+		pahoRc = MQTTSetSendQueue(&c, sendQueueBlocks, SEND_QUEUE_BLOCK_COUNT, AWS_IOT_MQTT_SEND_QUEUE_HIGH_WATER_MARK);
+		if(SUCCESS != pahoRc) {
+			return CONNECTION_ERROR;
+		}
+#endif
 		isPowerCycle = false;
 	}
 
@@ -181,14 +210,20 @@ IoT_Error_t aws_iot_mqtt_connect(MQTTConnectParams *pParams) {
 IoT_Error_t aws_iot_mqtt_subscribe(MQTTSubscribeParams *pParams) {
 	IoT_Error_t rc = NONE_ERROR;
 
-	if (0 != MQTTSubscribe(&c, pParams->pTopic, (enum QoS)pParams->qos, pahoMessageCallback, (void (*)(void))(pParams->mHandler))) {
-			rc = SUBSCRIBE_ERROR;
+	MQTTReturnCode pahoRc = MQTTSubscribeWithFilter(&c, pParams->pTopic, (enum QoS)pParams->qos, pahoMessageCallback,
+			(void (*)(void))(pParams->mHandler), pParams->pFilter);
+
+	if (MQTT_FILTER_SYNTAX_ERROR == pahoRc) {
+		rc = SUBSCRIBE_FILTER_ERROR;
+	} else if (0 != pahoRc) {
+		rc = SUBSCRIBE_ERROR;
 	}
 	return rc;
 }
 
 IoT_Error_t aws_iot_mqtt_publish(MQTTPublishParams *pParams) {
 	IoT_Error_t rc = NONE_ERROR;
+	MQTTReturnCode pahoRc = SUCCESS;
 
 	MQTTMessage Message;
 	Message.dup = pParams->MessageParams.isDuplicate;
@@ -198,13 +233,61 @@ IoT_Error_t aws_iot_mqtt_publish(MQTTPublishParams *pParams) {
 	Message.qos = (enum QoS)pParams->MessageParams.qos;
 	Message.retained = pParams->MessageParams.isRetained;
 
-	if(0 != MQTTPublish(&c, pParams->pTopic, &Message)){
+	pahoRc = MQTTPublish(&c, pParams->pTopic, &Message);
+	if(MQTT_RATE_LIMITED == pahoRc) {
+		rc = PUBLISH_RATE_LIMITED;
+	} else if(SUCCESS != pahoRc){
 		rc = PUBLISH_ERROR;
+	} else if(isTopicStatsEnabled) {
+		aws_iot_topic_stats_record(&publishedTopicStats, pParams->pTopic, (uint16_t)strlen(pParams->pTopic),
+				pParams->MessageParams.PayloadLen);
 	}
 
 	return rc;
 }
 
+IoT_Error_t aws_iot_mqtt_publish_async(MQTTPublishParams *pParams) {
+	IoT_Error_t rc = NONE_ERROR;
+	MQTTReturnCode pahoRc = SUCCESS;
+
+	if(NULL == pParams) {
+		return NULL_VALUE_ERROR;
+	}
+
+	MQTTMessage Message;
+	Message.dup = pParams->MessageParams.isDuplicate;
+	Message.id = pParams->MessageParams.id;
+	Message.payload = pParams->MessageParams.pPayload;
+	Message.payloadlen = pParams->MessageParams.PayloadLen;
+	Message.qos = (enum QoS)pParams->MessageParams.qos;
+	Message.retained = pParams->MessageParams.isRetained;
+
+	pahoRc = MQTTPublishAsync(&c, pParams->pTopic, &Message);
+	if(MQTT_INFLIGHT_WINDOW_FULL == pahoRc) {
+		rc = PUBLISH_WINDOW_FULL;
+	} else if(MQTT_WOULD_BLOCK == pahoRc) {
+		rc = PUBLISH_WOULD_BLOCK;
+	} else if(MQTT_RATE_LIMITED == pahoRc) {
+		rc = PUBLISH_RATE_LIMITED;
+	} else if(MQTT_NETWORK_DISCONNECTED_ERROR == pahoRc) {
+		rc = NETWORK_DISCONNECTED;
+	} else if(SUCCESS != pahoRc) {
+		rc = PUBLISH_ERROR;
+	} else {
+		pParams->MessageParams.id = Message.id;
+		if(isTopicStatsEnabled) {
+			aws_iot_topic_stats_record(&publishedTopicStats, pParams->pTopic, (uint16_t)strlen(pParams->pTopic),
+					pParams->MessageParams.PayloadLen);
+		}
+	}
+
+	return rc;
+}
+
+uint32_t aws_iot_mqtt_get_inflight_publish_count(void) {
+	return MQTTGetInflightPublishCount(&c);
+}
+
 IoT_Error_t aws_iot_mqtt_unsubscribe(char *pTopic) {
 	IoT_Error_t rc = NONE_ERROR;
 
@@ -288,6 +371,203 @@ bool aws_iot_is_autoreconnect_enabled(void) {
 	return MQTTIsAutoReconnectEnabled(&c);
 }
 
+void aws_iot_mqtt_topic_stats_set_enabled(bool value) {
+	isTopicStatsEnabled = value;
+}
+
+uint32_t aws_iot_mqtt_get_top_topics(TopicStatsCategory_t category, TopicStatsOrder_t order,
+		TopicStatsEntry *pEntries, uint32_t maxEntries) {
+	switch (category) {
+	case TOPIC_STATS_PUBLISHED:
+		return aws_iot_topic_stats_top(&publishedTopicStats, order, pEntries, maxEntries);
+	case TOPIC_STATS_RECEIVED:
+		return aws_iot_topic_stats_top(&receivedTopicStats, order, pEntries, maxEntries);
+	case TOPIC_STATS_SUBSCRIPTIONS:
+		return aws_iot_topic_stats_top(&subscriptionTopicStats, order, pEntries, maxEntries);
+	default:
+		return 0;
+	}
+}
+
+void aws_iot_mqtt_reset_topic_stats(void) {
+	aws_iot_topic_stats_reset(&publishedTopicStats);
+	aws_iot_topic_stats_reset(&receivedTopicStats);
+	aws_iot_topic_stats_reset(&subscriptionTopicStats);
+}
+
+IoT_Error_t aws_iot_mqtt_set_callback_budgets(uint32_t messageHandlerBudget_ms, uint32_t disconnectHandlerBudget_ms) {
+	if(SUCCESS != MQTTSetCallbackBudgets(&c, messageHandlerBudget_ms, disconnectHandlerBudget_ms)) {
+		return NULL_VALUE_ERROR;
+	}
+
+	return NONE_ERROR;
+}
+
+static void copyCallbackTimingStats(CallbackTimingStats_t *pDestination, const CallbackTimingStats *pSource) {
+	uint32_t i;
+
+	for(i = 0; i < IOT_CALLBACK_HISTOGRAM_BUCKETS && i < CALLBACK_HISTOGRAM_BUCKETS; i++) {
+		pDestination->histogram[i] = pSource->histogram[i];
+	}
+	pDestination->budget_ms = pSource->budgetMs;
+	pDestination->overruns = pSource->overruns;
+	pDestination->maxDuration_ms = pSource->maxDurationMs;
+}
+
+IoT_Error_t aws_iot_mqtt_get_callback_stats(MQTTCallbackStats_t *pStats) {
+	const MQTTCallbackStats *pPahoStats = MQTTGetCallbackStats(&c);
+
+	if(NULL == pStats || NULL == pPahoStats) {
+		return NULL_VALUE_ERROR;
+	}
+
+	copyCallbackTimingStats(&(pStats->messageHandlers), &(pPahoStats->messageHandlers));
+	copyCallbackTimingStats(&(pStats->disconnectHandler), &(pPahoStats->disconnectHandler));
+	pStats->yieldWatchdogTriggers = pPahoStats->yieldWatchdogTriggers;
+	pStats->maxYieldIteration_ms = pPahoStats->maxYieldIterationMs;
+
+	return NONE_ERROR;
+}
+
+void aws_iot_mqtt_reset_callback_stats(void) {
+	MQTTResetCallbackStats(&c);
+}
+
+IoT_Error_t aws_iot_mqtt_set_auto_cork(uint32_t latencyBudget_ms, uint32_t flushThreshold_bytes) {
+	if(0 != latencyBudget_ms && 0 == SEND_QUEUE_BLOCK_COUNT) {
+		return GENERIC_ERROR;
+	}
+
+	if(SUCCESS != MQTTSetAutoCork(&c, latencyBudget_ms, flushThreshold_bytes)) {
+		return NULL_VALUE_ERROR;
+	}
+
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_mqtt_get_auto_cork_stats(MQTTAutoCorkStats_t *pStats) {
+	const MQTTAutoCorkStats *pPahoStats = MQTTGetAutoCorkStats(&c);
+	uint32_t holds = 0;
+	uint32_t i;
+
+	if(NULL == pStats || NULL == pPahoStats) {
+		return NULL_VALUE_ERROR;
+	}
+
+	pStats->flushesBySize = pPahoStats->flushes[AUTO_CORK_FLUSH_SIZE];
+	pStats->flushesByLatency = pPahoStats->flushes[AUTO_CORK_FLUSH_LATENCY];
+	pStats->flushesByWindow = pPahoStats->flushes[AUTO_CORK_FLUSH_WINDOW];
+	pStats->flushesBySync = pPahoStats->flushes[AUTO_CORK_FLUSH_SYNC];
+	pStats->heldMessages = pPahoStats->heldPackets;
+	for(i = 0; i < AUTO_CORK_FLUSH_REASONS; i++) {
+		holds += pPahoStats->flushes[i];
+	}
+	pStats->averageHold_us = (0 != holds) ? (uint32_t)(pPahoStats->totalHoldUs / holds) : 0;
+	pStats->maxHold_us = pPahoStats->maxHoldUs;
+
+	return NONE_ERROR;
+}
+
+void aws_iot_mqtt_reset_auto_cork_stats(void) {
+	MQTTResetAutoCorkStats(&c);
+}
+
+IoT_Error_t aws_iot_mqtt_get_wakeup_stats(MQTTWakeupStats_t *pStats) {
+	MQTTWakeupStats pahoStats;
+
+	if(NULL == pStats) {
+		return NULL_VALUE_ERROR;
+	}
+
+	MQTTGetWakeupStats(&pahoStats);
+	pStats->waits = pahoStats.waits;
+	pStats->idleWakeups = pahoStats.idleWakeups;
+	pStats->idleWakeupsPerHour = pahoStats.idleWakeupsPerHour;
+	pStats->elapsed_s = (0 != pahoStats.sinceUs) ? (uint32_t)((timestamp_us() - pahoStats.sinceUs) / 1000000) : 0;
+
+	return NONE_ERROR;
+}
+
+void aws_iot_mqtt_reset_wakeup_stats(void) {
+	MQTTResetWakeupStats();
+}
+
+IoT_Error_t aws_iot_mqtt_get_filter_stats(const char *pTopic, MQTTFilterStats_t *pStats) {
+	MQTTFilterStats pahoStats;
+
+	if(NULL == pTopic || NULL == pStats) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if(SUCCESS != MQTTGetFilterStats(&c, pTopic, &pahoStats)) {
+		return GENERIC_ERROR;
+	}
+
+	pStats->evaluated = pahoStats.evaluated;
+	pStats->matched = pahoStats.matched;
+	pStats->dropped = pahoStats.evaluated - pahoStats.matched;
+	pStats->invalidPayloads = pahoStats.invalidPayloads;
+	pStats->hitRatePercent = (0 != pahoStats.evaluated)
+			? (uint32_t)((uint64_t)pahoStats.matched * 100 / pahoStats.evaluated) : 0;
+
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_mqtt_set_rate_control(uint32_t minRate_per_s, uint32_t maxRate_per_s) {
+	if(SUCCESS != MQTTSetRateControl(&c, minRate_per_s, maxRate_per_s)) {
+		return NULL_VALUE_ERROR;
+	}
+
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_mqtt_get_rate_control_stats(MQTTRateControlStats_t *pStats) {
+	const MQTTRateControl *pRateControl = MQTTGetRateControl(&c);
+
+	if(NULL == pStats || NULL == pRateControl) {
+		return NULL_VALUE_ERROR;
+	}
+
+	pStats->rate_per_s = pRateControl->rate;
+	pStats->window = pRateControl->window;
+	pStats->smoothedAckLatency_us = pRateControl->smoothedLatencyUs;
+	pStats->baseAckLatency_us = pRateControl->baseLatencyUs;
+	pStats->increases = pRateControl->stats.increases;
+	pStats->decreasesByLatency = pRateControl->stats.decreases[RATE_CONTROL_LATENCY];
+	pStats->decreasesByTimeout = pRateControl->stats.decreases[RATE_CONTROL_TIMEOUT];
+	pStats->decreasesByDisconnect = pRateControl->stats.decreases[RATE_CONTROL_DISCONNECT];
+	pStats->limitedPublishes = pRateControl->stats.limitedPublishes;
+
+	return NONE_ERROR;
+}
+
+void aws_iot_mqtt_reset_rate_control_stats(void) {
+	MQTTResetRateControlStats(&c);
+}
+
+void aws_iot_mqtt_set_trace_sampling(uint32_t sampleRate) {
+	MQTTSetTraceSampling(sampleRate);
+}
+
+IoT_Error_t aws_iot_mqtt_dump_trace(FILE *pFile, MQTTTraceFormat_t format) {
+	MQTTReturnCode pahoRc;
+
+	if(NULL == pFile) {
+		return NULL_VALUE_ERROR;
+	}
+
+	pahoRc = MQTTTraceDump(pFile, (MQTT_TRACE_FORMAT_CHROME == format) ? TRACE_FORMAT_CHROME : TRACE_FORMAT_JSON);
+	if(SUCCESS != pahoRc) {
+		return GENERIC_ERROR;
+	}
+
+	return NONE_ERROR;
+}
+
+void aws_iot_mqtt_reset_trace(void) {
+	MQTTTraceReset();
+}
+
 void aws_iot_mqtt_init(MQTTClient_t *pClient){
 	pClient->connect = aws_iot_mqtt_connect;
 	pClient->disconnect = aws_iot_mqtt_disconnect;
@@ -299,4 +579,6 @@ void aws_iot_mqtt_init(MQTTClient_t *pClient){
 	pClient->yield = aws_iot_mqtt_yield;
 	pClient->isAutoReconnectEnabled = aws_iot_is_autoreconnect_enabled;
 	pClient->setAutoReconnectStatus = aws_iot_mqtt_autoreconnect_set_status;
+	pClient->publishAsync = aws_iot_mqtt_publish_async;
+	pClient->getInflightPublishCount = aws_iot_mqtt_get_inflight_publish_count;
 }
@@ -24,6 +24,9 @@
 #ifndef __NETWORK_INTERFACE_H_
 #define __NETWORK_INTERFACE_H_
 
+// Add the platform specific TLS includes to define the TLSDataParams struct
+#include "network_platform.h"
+
 /**
  * @brief Network Type
  *
@@ -45,8 +48,18 @@ typedef struct{
 	int DestinationPort;				///< Integer defining the connection port of the MQTT service.
 	unsigned int timeout_ms;			///< Unsigned integer defining the TLS handshake timeout value in milliseconds.
 	unsigned char ServerVerificationFlag;	///< Boolean.  True = perform server certificate hostname validation.  False = skip validation \b NOT recommended.
+	char* pSessionCacheLocation;		///< Pointer to string containing the filename (including path) of the TLS session cache, NULL to always do a full handshake.  Ignored by TLS implementations without a session cache.
 }TLSConnectParams;
 
+/**
+ * @brief TLS Connection Data
+ *
+ * Forward declaration of the per connection TLS state.  The definition of this
+ * struct is platform dependent.  When porting to a new platform add this definition
+ * in "network_platform.h" of that platform and include that file above.
+ */
+typedef struct _TLSDataParams TLSDataParams;
+
 /**
  * @brief Network Structure
  *
@@ -54,9 +67,11 @@ typedef struct{
  */
 struct Network{
 	int my_socket;	///< Integer holding the socket file descriptor
+	TLSDataParams tlsDataParams;	///< TLS state of this connection.  Keeping it per Network allows several connections in one process
 	int (*connect) (Network *, TLSConnectParams);
 	int (*mqttread) (Network*, unsigned char*, int, int);	///< Function pointer pointing to the network function to read from the network
 	int (*mqttwrite) (Network*, unsigned char*, int, int);	///< Function pointer pointing to the network function to write to the network
+	int (*mqtttrywrite) (Network*, unsigned char*, int);	///< Function pointer pointing to the network function writing only what the network accepts without blocking
 	void (*disconnect) (Network*);		///< Function pointer pointing to the network function to disconnect from the network
 	int (*isConnected) (Network*);     ///< Function pointer pointing to the network function to check if physical layer is connected
 	int (*destroy) (Network*);		///< Function pointer pointing to the network function to destroy the network object
@@ -96,6 +111,19 @@ int iot_tls_connect(Network *pNetwork, TLSConnectParams TLSParams);
  */
 int iot_tls_write(Network*, unsigned char*, int, int);
 
+/**
+ * @brief Write bytes to the network socket without blocking
+ *
+ * Writes as much of the buffer as the connection accepts right now. When 0 is
+ * returned the same bytes have to be offered again by the next call.
+ *
+ * @param Network - Pointer to a Network struct defining the network interface.
+ * @param unsigned char pointer - buffer to write to socket
+ * @param integer - number of bytes to write
+ * @return integer - number of bytes written, 0 if the socket is not writable, or TLS error
+ */
+int iot_tls_try_write(Network*, unsigned char*, int);
+
 /**
  * @brief Read bytes from the network socket
  *
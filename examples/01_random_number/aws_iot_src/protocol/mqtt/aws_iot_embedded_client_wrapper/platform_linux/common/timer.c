@@ -19,7 +19,9 @@
  */
 
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
+#include <time.h>
 
 #include "timer_linux.h"
 
@@ -37,6 +39,27 @@ void countdown_ms(Timer* timer, unsigned int timeout) {
 	timeradd(&now, &interval, &timer->end_time);
 }
 
+void countdown_ms_slack(Timer* timer, unsigned int timeout, unsigned int slack) {
+	struct timeval now;
+	uint64_t end_ms;
+	uint64_t granule_ms = 1;
+
+	if(0 == slack) {
+		countdown_ms(timer, timeout);
+		return;
+	}
+
+	while(granule_ms * 2 <= slack) {
+		granule_ms *= 2;
+	}
+	gettimeofday(&now, NULL);
+	// Rounded up from the next whole millisecond, the timer never expires before timeout
+	end_ms = (uint64_t)now.tv_sec * 1000 + ((uint64_t)now.tv_usec + 999) / 1000 + timeout;
+	end_ms = (end_ms + granule_ms - 1) / granule_ms * granule_ms;
+	timer->end_time.tv_sec = (time_t)(end_ms / 1000);
+	timer->end_time.tv_usec = (suseconds_t)(end_ms % 1000) * 1000;
+}
+
 void countdown(Timer* timer, unsigned int timeout) {
 	struct timeval now;
 	gettimeofday(&now, NULL);
@@ -54,3 +77,9 @@ int left_ms(Timer* timer) {
 void InitTimer(Timer* timer) {
 	timer->end_time = (struct timeval ) { 0, 0 };
 }
+
+uint64_t timestamp_us(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
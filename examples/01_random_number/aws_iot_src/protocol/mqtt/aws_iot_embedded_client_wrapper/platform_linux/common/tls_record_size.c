@@ -0,0 +1,74 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "tls_record_size.h"
+
+#include <stddef.h>
+
+#include "timer_interface.h"
+#include "aws_iot_config.h"
+
+static uint32_t startSize(void) {
+	// A minimum of 0 turns the policy off, every record may then be as large as the maximum
+	if (0 == AWS_IOT_TLS_RECORD_MIN_SIZE || AWS_IOT_TLS_RECORD_MIN_SIZE > AWS_IOT_TLS_RECORD_MAX_SIZE) {
+		return AWS_IOT_TLS_RECORD_MAX_SIZE;
+	}
+	return AWS_IOT_TLS_RECORD_MIN_SIZE;
+}
+
+void iot_tls_record_sizer_init(TLSRecordSizer *pSizer) {
+	if (NULL == pSizer) {
+		return;
+	}
+
+	pSizer->recordSize = startSize();
+	pSizer->bytesAtSize = 0;
+	pSizer->lastWrite_us = 0;
+}
+
+uint32_t iot_tls_record_size_next(TLSRecordSizer *pSizer) {
+	if (NULL == pSizer) {
+		return AWS_IOT_TLS_RECORD_MAX_SIZE;
+	}
+
+	// After a pause the congestion window may have shrunk again, start small as after connecting
+	if (0 != pSizer->lastWrite_us
+			&& timestamp_us() - pSizer->lastWrite_us > (uint64_t) AWS_IOT_TLS_RECORD_IDLE_RESET_MS * 1000) {
+		pSizer->recordSize = startSize();
+		pSizer->bytesAtSize = 0;
+	}
+
+	return pSizer->recordSize;
+}
+
+void iot_tls_record_sizer_sent(TLSRecordSizer *pSizer, uint32_t bytes) {
+	if (NULL == pSizer) {
+		return;
+	}
+
+	pSizer->lastWrite_us = timestamp_us();
+	if (pSizer->recordSize >= AWS_IOT_TLS_RECORD_MAX_SIZE) {
+		return;
+	}
+
+	pSizer->bytesAtSize += bytes;
+	if (pSizer->bytesAtSize >= AWS_IOT_TLS_RECORD_GROWTH_BYTES) {
+		pSizer->recordSize *= 2;
+		if (pSizer->recordSize > AWS_IOT_TLS_RECORD_MAX_SIZE) {
+			pSizer->recordSize = AWS_IOT_TLS_RECORD_MAX_SIZE;
+		}
+		pSizer->bytesAtSize = 0;
+	}
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_COMMON_TLS_RECORD_SIZE_H_
+#define SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_COMMON_TLS_RECORD_SIZE_H_
+
+/**
+ * @file tls_record_size.h
+ * @brief Record size policy shared by the TLS wrappers
+ *
+ * A TLS record can only be decrypted once all of it has arrived, so a 16 KB record spread over a
+ * dozen TCP segments delays the first byte by every lost segment among them.  After connecting and
+ * after the connection was idle, records are kept to AWS_IOT_TLS_RECORD_MIN_SIZE, about one segment.
+ * Each AWS_IOT_TLS_RECORD_GROWTH_BYTES sent doubles the size up to AWS_IOT_TLS_RECORD_MAX_SIZE, so
+ * sustained transfers end up with the lowest per record overhead.  The wrappers only change the
+ * size between writes, never while a write is waiting to be retried.
+ */
+
+#include <stdint.h>
+
+/**
+ * @brief Record size state of one connection
+ */
+typedef struct {
+	uint32_t recordSize;	///< Largest payload of the records written next
+	uint32_t bytesAtSize;	///< Bytes written since recordSize last changed
+	uint64_t lastWrite_us;	///< When the last write completed, 0 before the first one
+} TLSRecordSizer;
+
+/**
+ * @brief Start with small records, called for every new connection
+ */
+void iot_tls_record_sizer_init(TLSRecordSizer *pSizer);
+
+/**
+ * @brief Record size for the next write, back at the minimum if the connection was idle
+ */
+uint32_t iot_tls_record_size_next(TLSRecordSizer *pSizer);
+
+/**
+ * @brief Account for bytes handed to the TLS library, growing the record size
+ */
+void iot_tls_record_sizer_sent(TLSRecordSizer *pSizer, uint32_t bytes);
+
+#endif /* SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_COMMON_TLS_RECORD_SIZE_H_ */
@@ -15,6 +15,7 @@
 
 #include <stdbool.h>
 #include <string.h>
+#include <poll.h>
 
 #include "aws_iot_error.h"
 #include "aws_iot_log.h"
@@ -52,35 +53,25 @@ static int myCertVerify(void *data, mbedtls_x509_crt *crt, int depth, uint32_t *
 	return (0);
 }
 
-static int ret = 0, i;
-static mbedtls_entropy_context entropy;
-static mbedtls_ctr_drbg_context ctr_drbg;
-static mbedtls_ssl_context ssl;
-static mbedtls_ssl_config conf;
-static uint32_t flags;
-static mbedtls_x509_crt cacert;
-static mbedtls_x509_crt clicert;
-static mbedtls_pk_context pkey;
-static mbedtls_net_context server_fd;
-
 int iot_tls_init(Network *pNetwork) {
+	TLSDataParams *tlsDataParams = &(pNetwork->tlsDataParams);
 	IoT_Error_t ret_val = NONE_ERROR;
 	const char *pers = "aws_iot_tls_wrapper";
 	unsigned char buf[MBEDTLS_SSL_MAX_CONTENT_LEN + 1];
 
-	mbedtls_net_init(&server_fd);
-	mbedtls_ssl_init(&ssl);
-	mbedtls_ssl_config_init(&conf);
-	mbedtls_ctr_drbg_init(&ctr_drbg);
-	mbedtls_x509_crt_init(&cacert);
-	mbedtls_x509_crt_init(&clicert);
-	mbedtls_pk_init(&pkey);
+	mbedtls_net_init(&(tlsDataParams->server_fd));
+	mbedtls_ssl_init(&(tlsDataParams->ssl));
+	mbedtls_ssl_config_init(&(tlsDataParams->conf));
+	mbedtls_ctr_drbg_init(&(tlsDataParams->ctr_drbg));
+	mbedtls_x509_crt_init(&(tlsDataParams->cacert));
+	mbedtls_x509_crt_init(&(tlsDataParams->clicert));
+	mbedtls_pk_init(&(tlsDataParams->pkey));
 
 	DEBUG("\n  . Seeding the random number generator...");
-	mbedtls_entropy_init(&entropy);
-	if ((ret_val = mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, (const unsigned char *) pers,
+	mbedtls_entropy_init(&(tlsDataParams->entropy));
+	if ((ret_val = mbedtls_ctr_drbg_seed(&(tlsDataParams->ctr_drbg), mbedtls_entropy_func, &(tlsDataParams->entropy), (const unsigned char *) pers,
 			strlen(pers))) != 0) {
-		ERROR(" failed\n  ! mbedtls_ctr_drbg_seed returned -0x%x\n", -ret);
+		ERROR(" failed\n  ! mbedtls_ctr_drbg_seed returned -0x%x\n", -ret_val);
 		return ret_val;
 	} DEBUG("ok\n");
 
@@ -88,6 +79,7 @@ int iot_tls_init(Network *pNetwork) {
 	pNetwork->connect = iot_tls_connect;
 	pNetwork->mqttread = iot_tls_read;
 	pNetwork->mqttwrite = iot_tls_write;
+	pNetwork->mqtttrywrite = iot_tls_try_write;
 	pNetwork->disconnect = iot_tls_disconnect;
 	pNetwork->isConnected = iot_tls_is_connected;
 	pNetwork->destroy = iot_tls_destroy;
@@ -101,77 +93,80 @@ int iot_tls_is_connected(Network *pNetwork) {
 }
 
 int iot_tls_connect(Network *pNetwork, TLSConnectParams params) {
+	TLSDataParams *tlsDataParams = &(pNetwork->tlsDataParams);
+	int ret = 0;
 	const char *pers = "aws_iot_tls_wrapper";
 	unsigned char buf[MBEDTLS_SSL_MAX_CONTENT_LEN + 1];
 
 	DEBUG("  . Loading the CA root certificate ...");
-	ret = mbedtls_x509_crt_parse_file(&cacert, params.pRootCALocation);
+	ret = mbedtls_x509_crt_parse_file(&(tlsDataParams->cacert), params.pRootCALocation);
 	if (ret < 0) {
 		ERROR(" failed\n  !  mbedtls_x509_crt_parse returned -0x%x\n\n", -ret);
 		return ret;
 	} DEBUG(" ok (%d skipped)\n", ret);
 
 	DEBUG("  . Loading the client cert. and key...");
-	ret = mbedtls_x509_crt_parse_file(&clicert, params.pDeviceCertLocation);
+	ret = mbedtls_x509_crt_parse_file(&(tlsDataParams->clicert), params.pDeviceCertLocation);
 	if (ret != 0) {
 		ERROR(" failed\n  !  mbedtls_x509_crt_parse returned -0x%x\n\n", -ret);
 		return ret;
 	}
 
-	ret = mbedtls_pk_parse_keyfile(&pkey, params.pDevicePrivateKeyLocation, "");
+	ret = mbedtls_pk_parse_keyfile(&(tlsDataParams->pkey), params.pDevicePrivateKeyLocation, "");
 	if (ret != 0) {
 		ERROR(" failed\n  !  mbedtls_pk_parse_key returned -0x%x\n\n", -ret);
 		return ret;
 	} DEBUG(" ok\n");
 	char portBuffer[6];
 	sprintf(portBuffer, "%d", params.DestinationPort); DEBUG("  . Connecting to %s/%s...", params.pDestinationURL, portBuffer);
-	if ((ret = mbedtls_net_connect(&server_fd, params.pDestinationURL, portBuffer, MBEDTLS_NET_PROTO_TCP)) != 0) {
+	if ((ret = mbedtls_net_connect(&(tlsDataParams->server_fd), params.pDestinationURL, portBuffer, MBEDTLS_NET_PROTO_TCP)) != 0) {
 		ERROR(" failed\n  ! mbedtls_net_connect returned -0x%x\n\n", -ret);
 		return ret;
 	}
+	pNetwork->my_socket = tlsDataParams->server_fd.fd;
 
-	ret = mbedtls_net_set_block(&server_fd);
+	ret = mbedtls_net_set_block(&(tlsDataParams->server_fd));
 	if (ret != 0) {
 		ERROR(" failed\n  ! net_set_(non)block() returned -0x%x\n\n", -ret);
 		return ret;
 	} DEBUG(" ok\n");
 
 	DEBUG("  . Setting up the SSL/TLS structure...");
-	if ((ret = mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+	if ((ret = mbedtls_ssl_config_defaults(&(tlsDataParams->conf), MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
 			MBEDTLS_SSL_PRESET_DEFAULT)) != 0) {
 		ERROR(" failed\n  ! mbedtls_ssl_config_defaults returned -0x%x\n\n", -ret);
 		return ret;
 	}
 
-	mbedtls_ssl_conf_verify(&conf, myCertVerify, NULL);
+	mbedtls_ssl_conf_verify(&(tlsDataParams->conf), myCertVerify, NULL);
 	if (params.ServerVerificationFlag == true) {
-		mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+		mbedtls_ssl_conf_authmode(&(tlsDataParams->conf), MBEDTLS_SSL_VERIFY_REQUIRED);
 	} else {
-		mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_OPTIONAL);
+		mbedtls_ssl_conf_authmode(&(tlsDataParams->conf), MBEDTLS_SSL_VERIFY_OPTIONAL);
 	}
-	mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &ctr_drbg);
+	mbedtls_ssl_conf_rng(&(tlsDataParams->conf), mbedtls_ctr_drbg_random, &(tlsDataParams->ctr_drbg));
 
-	mbedtls_ssl_conf_ca_chain(&conf, &cacert, NULL);
-	if ((ret = mbedtls_ssl_conf_own_cert(&conf, &clicert, &pkey)) != 0) {
+	mbedtls_ssl_conf_ca_chain(&(tlsDataParams->conf), &(tlsDataParams->cacert), NULL);
+	if ((ret = mbedtls_ssl_conf_own_cert(&(tlsDataParams->conf), &(tlsDataParams->clicert), &(tlsDataParams->pkey))) != 0) {
 		ERROR(" failed\n  ! mbedtls_ssl_conf_own_cert returned %d\n\n", ret);
 		return ret;
 	}
 
-	mbedtls_ssl_conf_read_timeout(&conf, params.timeout_ms);
+	mbedtls_ssl_conf_read_timeout(&(tlsDataParams->conf), params.timeout_ms);
 
-	if ((ret = mbedtls_ssl_setup(&ssl, &conf)) != 0) {
+	if ((ret = mbedtls_ssl_setup(&(tlsDataParams->ssl), &(tlsDataParams->conf))) != 0) {
 		ERROR(" failed\n  ! mbedtls_ssl_setup returned -0x%x\n\n", -ret);
 		return ret;
 	}
-	if ((ret = mbedtls_ssl_set_hostname(&ssl, params.pDestinationURL)) != 0) {
+	if ((ret = mbedtls_ssl_set_hostname(&(tlsDataParams->ssl), params.pDestinationURL)) != 0) {
 		ERROR(" failed\n  ! mbedtls_ssl_set_hostname returned %d\n\n", ret);
 		return ret;
 	}
-	mbedtls_ssl_set_bio(&ssl, &server_fd, mbedtls_net_send, NULL, mbedtls_net_recv_timeout);
+	mbedtls_ssl_set_bio(&(tlsDataParams->ssl), &(tlsDataParams->server_fd), mbedtls_net_send, NULL, mbedtls_net_recv_timeout);
 	DEBUG(" ok\n");
 
 	DEBUG("  . Performing the SSL/TLS handshake...");
-	while ((ret = mbedtls_ssl_handshake(&ssl)) != 0) {
+	while ((ret = mbedtls_ssl_handshake(&(tlsDataParams->ssl))) != 0) {
 		if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
 			ERROR(" failed\n  ! mbedtls_ssl_handshake returned -0x%x\n", -ret);
 			if (ret == MBEDTLS_ERR_X509_CERT_VERIFY_FAILED) {
@@ -186,8 +181,8 @@ int iot_tls_connect(Network *pNetwork, TLSConnectParams params) {
 		}
 	}
 
-	DEBUG(" ok\n    [ Protocol is %s ]\n    [ Ciphersuite is %s ]\n", mbedtls_ssl_get_version(&ssl), mbedtls_ssl_get_ciphersuite(&ssl));
-	if ((ret = mbedtls_ssl_get_record_expansion(&ssl)) >= 0) {
+	DEBUG(" ok\n    [ Protocol is %s ]\n    [ Ciphersuite is %s ]\n", mbedtls_ssl_get_version(&(tlsDataParams->ssl)), mbedtls_ssl_get_ciphersuite(&(tlsDataParams->ssl)));
+	if ((ret = mbedtls_ssl_get_record_expansion(&(tlsDataParams->ssl))) >= 0) {
 		DEBUG("    [ Record expansion is %d ]\n", ret);
 	} else {
 		DEBUG("    [ Record expansion is unknown (compression) ]\n");
@@ -196,10 +191,10 @@ int iot_tls_connect(Network *pNetwork, TLSConnectParams params) {
 	DEBUG("  . Verifying peer X.509 certificate...");
 
 	if (params.ServerVerificationFlag == true) {
-		if ((flags = mbedtls_ssl_get_verify_result(&ssl)) != 0) {
+		if ((tlsDataParams->flags = mbedtls_ssl_get_verify_result(&(tlsDataParams->ssl))) != 0) {
 			char vrfy_buf[512];
 			ERROR(" failed\n");
-			mbedtls_x509_crt_verify_info(vrfy_buf, sizeof(vrfy_buf), "  ! ", flags);
+			mbedtls_x509_crt_verify_info(vrfy_buf, sizeof(vrfy_buf), "  ! ", tlsDataParams->flags);
 			ERROR("%s\n", vrfy_buf);
 		} else {
 			DEBUG(" ok\n");
@@ -210,42 +205,101 @@ int iot_tls_connect(Network *pNetwork, TLSConnectParams params) {
 		ret = NONE_ERROR;
 	}
 
-	if (mbedtls_ssl_get_peer_cert(&ssl) != NULL) {
+	if (mbedtls_ssl_get_peer_cert(&(tlsDataParams->ssl)) != NULL) {
 		DEBUG("  . Peer certificate information    ...\n");
-		mbedtls_x509_crt_info((char *) buf, sizeof(buf) - 1, "      ", mbedtls_ssl_get_peer_cert(&ssl));
+		mbedtls_x509_crt_info((char *) buf, sizeof(buf) - 1, "      ", mbedtls_ssl_get_peer_cert(&(tlsDataParams->ssl)));
 		DEBUG("%s\n", buf);
 	}
 
-	mbedtls_ssl_conf_read_timeout(&conf, 10);
+	mbedtls_ssl_conf_read_timeout(&(tlsDataParams->conf), 10);
+	iot_tls_record_sizer_init(&(tlsDataParams->recordSizer));
+	tlsDataParams->pendingWriteLen = 0;
 
 	return ret;
 }
 
+/* mbedtls_ssl_write sends one record per call, limiting its length sets the record size. A write that
+ * returned WANT_READ or WANT_WRITE has to be called again with the same length */
+static int recordWriteLen(TLSDataParams *tlsDataParams, int len) {
+	uint32_t recordSize;
+
+	if (0 != tlsDataParams->pendingWriteLen && tlsDataParams->pendingWriteLen <= len) {
+		return tlsDataParams->pendingWriteLen;
+	}
+
+	recordSize = iot_tls_record_size_next(&(tlsDataParams->recordSizer));
+	if ((uint32_t) len > recordSize) {
+		return (int) recordSize;
+	}
+	return len;
+}
+
 int iot_tls_write(Network *pNetwork, unsigned char *pMsg, int len, int timeout_ms) {
+	TLSDataParams *tlsDataParams = &(pNetwork->tlsDataParams);
+	int ret = 0;
 
 	int written;
 	int frags;
+	int recordLen;
 
 	for (written = 0, frags = 0; written < len; written += ret, frags++) {
-		while ((ret = mbedtls_ssl_write(&ssl, pMsg + written, len - written)) <= 0) {
+		recordLen = recordWriteLen(tlsDataParams, len - written);
+		while ((ret = mbedtls_ssl_write(&(tlsDataParams->ssl), pMsg + written, recordLen)) <= 0) {
 			if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
 				ERROR(" failed\n  ! mbedtls_ssl_write returned -0x%x\n\n", -ret);
 				return ret;
 			}
 		}
+		tlsDataParams->pendingWriteLen = 0;
+		iot_tls_record_sizer_sent(&(tlsDataParams->recordSizer), (uint32_t) ret);
 	}
 	return written;
 }
 
+int iot_tls_try_write(Network *pNetwork, unsigned char *pMsg, int len) {
+	TLSDataParams *tlsDataParams = &(pNetwork->tlsDataParams);
+	struct pollfd writeFd;
+	int recordLen;
+	int ret;
+
+	/* The socket is blocking, only write once it has room */
+	writeFd.fd = tlsDataParams->server_fd.fd;
+	writeFd.events = POLLOUT;
+	writeFd.revents = 0;
+	ret = poll(&writeFd, 1, 0);
+	if (0 > ret || 0 != (writeFd.revents & (POLLERR | POLLHUP | POLLNVAL))) {
+		return SSL_WRITE_ERROR;
+	}
+	if (0 == ret) {
+		return 0;
+	}
+
+	recordLen = recordWriteLen(tlsDataParams, len);
+	ret = mbedtls_ssl_write(&(tlsDataParams->ssl), pMsg, recordLen);
+	if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+		tlsDataParams->pendingWriteLen = recordLen;
+		return 0;
+	}
+	if (0 > ret) {
+		ERROR(" failed\n  ! mbedtls_ssl_write returned -0x%x\n\n", -ret);
+		return ret;
+	}
+	tlsDataParams->pendingWriteLen = 0;
+	iot_tls_record_sizer_sent(&(tlsDataParams->recordSizer), (uint32_t) ret);
+	return ret;
+}
+
 int iot_tls_read(Network *pNetwork, unsigned char *pMsg, int len, int timeout_ms) {
+	TLSDataParams *tlsDataParams = &(pNetwork->tlsDataParams);
+	int ret = 0;
 	int rxLen = 0;
 	bool isErrorFlag = false;
 	bool isCompleteFlag = false;
 
-//	mbedtls_ssl_conf_read_timeout(&conf, timeout_ms);
+//	mbedtls_ssl_conf_read_timeout(&(tlsDataParams->conf), timeout_ms);
 
 	do {
-		ret = mbedtls_ssl_read(&ssl, pMsg, len);
+		ret = mbedtls_ssl_read(&(tlsDataParams->ssl), pMsg, len);
 		if (ret > 0) {
 			rxLen += ret;
 		} else if (ret != MBEDTLS_ERR_SSL_WANT_READ) {
@@ -260,22 +314,25 @@ int iot_tls_read(Network *pNetwork, unsigned char *pMsg, int len, int timeout_ms
 }
 
 void iot_tls_disconnect(Network *pNetwork) {
+	TLSDataParams *tlsDataParams = &(pNetwork->tlsDataParams);
+	int ret = 0;
 	do {
-		ret = mbedtls_ssl_close_notify(&ssl);
+		ret = mbedtls_ssl_close_notify(&(tlsDataParams->ssl));
 	} while (ret == MBEDTLS_ERR_SSL_WANT_WRITE);
 }
 
 int iot_tls_destroy(Network *pNetwork) {
+	TLSDataParams *tlsDataParams = &(pNetwork->tlsDataParams);
 
-	mbedtls_net_free(&server_fd);
+	mbedtls_net_free(&(tlsDataParams->server_fd));
 
-	mbedtls_x509_crt_free(&clicert);
-	mbedtls_x509_crt_free(&cacert);
-	mbedtls_pk_free(&pkey);
-	mbedtls_ssl_free(&ssl);
-	mbedtls_ssl_config_free(&conf);
-	mbedtls_ctr_drbg_free(&ctr_drbg);
-	mbedtls_entropy_free(&entropy);
+	mbedtls_x509_crt_free(&(tlsDataParams->clicert));
+	mbedtls_x509_crt_free(&(tlsDataParams->cacert));
+	mbedtls_pk_free(&(tlsDataParams->pkey));
+	mbedtls_ssl_free(&(tlsDataParams->ssl));
+	mbedtls_ssl_config_free(&(tlsDataParams->conf));
+	mbedtls_ctr_drbg_free(&(tlsDataParams->ctr_drbg));
+	mbedtls_entropy_free(&(tlsDataParams->entropy));
 
 	return 0;
 }
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_MBEDTLS_NETWORK_PLATFORM_H_
+#define SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_MBEDTLS_NETWORK_PLATFORM_H_
+
+/**
+ * @file network_platform.h
+ */
+#include "mbedtls/config.h"
+
+#include "mbedtls/net.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/x509.h"
+
+#include "tls_record_size.h"
+
+/**
+ * definition of the TLSDataParams struct. Platform specific
+ */
+struct _TLSDataParams{
+	mbedtls_entropy_context entropy;	///< Entropy source used to seed the random number generator
+	mbedtls_ctr_drbg_context ctr_drbg;	///< Random number generator of this connection
+	mbedtls_ssl_context ssl;			///< mbedTLS handle of the connection
+	mbedtls_ssl_config conf;			///< mbedTLS configuration of the connection
+	uint32_t flags;						///< Result of the server certificate verification
+	mbedtls_x509_crt cacert;			///< Root CA certificate
+	mbedtls_x509_crt clicert;			///< Device certificate
+	mbedtls_pk_context pkey;			///< Device private key
+	mbedtls_net_context server_fd;		///< Underlying TCP socket
+	TLSRecordSizer recordSizer;			///< Record size policy of the connection
+	int pendingWriteLen;				///< Length of a mbedtls_ssl_write that has to be retried unchanged, 0 if none
+};
+
+#endif /* SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_MBEDTLS_NETWORK_PLATFORM_H_ */
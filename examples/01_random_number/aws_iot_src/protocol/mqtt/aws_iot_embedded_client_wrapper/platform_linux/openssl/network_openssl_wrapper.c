@@ -26,48 +26,64 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "aws_iot_error.h"
 #include "aws_iot_log.h"
 #include "network_interface.h"
 #include "openssl_hostname_validation.h"
+#include "openssl_session_cache.h"
 
-static SSL_CTX *pSSLContext;
-static SSL *pSSLHandle;
-static int server_TCPSocket;
-static char* pDestinationURL;
+static pthread_once_t sslLibraryInitOnce = PTHREAD_ONCE_INIT;
+static int sslLibraryInitStatus = 0;
 
 static int Create_TCPSocket(void);
 static IoT_Error_t Connect_TCPSocket(int socket_fd, char *pURLString, int port);
 static IoT_Error_t setSocketToNonBlocking(int server_fd);
-static IoT_Error_t ConnectOrTimeoutOrExitOnError(SSL *pSSL, int timeout_ms);
-static IoT_Error_t ReadOrTimeoutOrExitOnError(SSL *pSSL, unsigned char *msg, int totalLen, int timeout_ms);
+static IoT_Error_t ConnectOrTimeoutOrExitOnError(SSL *pSSL, int server_fd, int timeout_ms);
+static IoT_Error_t WriteOrTimeoutOrExitOnError(TLSDataParams *pTLSData, unsigned char *msg, int totalLen, int timeout_ms);
+static IoT_Error_t ReadOrTimeoutOrExitOnError(SSL *pSSL, int server_fd, unsigned char *msg, int totalLen, int timeout_ms);
 
-int iot_tls_init(Network *pNetwork) {
-
-	IoT_Error_t ret_val = NONE_ERROR;
-	const SSL_METHOD *method;
+/* OpenSSL rejects fragments below 512 bytes */
+#define TLS_MIN_SEND_FRAGMENT 512
 
+/* The library wide initialization must only run once, even when several connections are set up in parallel */
+static void initializeSSLLibrary(void) {
 	OpenSSL_add_all_algorithms();
 	ERR_load_BIO_strings();
 	ERR_load_crypto_strings();
 	SSL_load_error_strings();
 
-	if (SSL_library_init() < 0) {
+	sslLibraryInitStatus = SSL_library_init();
+}
+
+int iot_tls_init(Network *pNetwork) {
+
+	IoT_Error_t ret_val = NONE_ERROR;
+	const SSL_METHOD *method;
+
+	pthread_once(&sslLibraryInitOnce, initializeSSLLibrary);
+	if (sslLibraryInitStatus < 0) {
 		ret_val = SSL_INIT_ERROR;
 	}
 
 	method = TLSv1_2_method();
 
-	if ((pSSLContext = SSL_CTX_new(method)) == NULL) {
+	if ((pNetwork->tlsDataParams.pSSLContext = SSL_CTX_new(method)) == NULL) {
 		ERROR(" SSL INIT Failed - Unable to create SSL Context");
 		ret_val = SSL_INIT_ERROR;
 	}
 
+	pNetwork->tlsDataParams.pSSLHandle = NULL;
+	pNetwork->tlsDataParams.server_TCPSocket = -1;
+	pNetwork->tlsDataParams.pDestinationURL = NULL;
+
 	pNetwork->my_socket = 0;
 	pNetwork->connect = iot_tls_connect;
 	pNetwork->mqttread = iot_tls_read;
 	pNetwork->mqttwrite = iot_tls_write;
+	pNetwork->mqtttrywrite = iot_tls_try_write;
 	pNetwork->disconnect = iot_tls_disconnect;
 	pNetwork->isConnected = iot_tls_is_connected;
 	pNetwork->destroy = iot_tls_destroy;
@@ -90,8 +106,11 @@ int tls_server_certificate_verify(int preverify_ok, X509_STORE_CTX *pX509CTX){
 	if((X509_STORE_CTX_get_error_depth(pX509CTX) == 0) && (preverify_ok == 1)){
 		X509 *pX509Cert;
 		HostnameValidationResult result;
+		// the connection being verified carries its own Network as application data
+		SSL *pSSL = X509_STORE_CTX_get_ex_data(pX509CTX, SSL_get_ex_data_X509_STORE_CTX_idx());
+		Network *pNetwork = (Network *) SSL_get_app_data(pSSL);
 		pX509Cert = X509_STORE_CTX_get_current_cert(pX509CTX);
-		result = validate_hostname(pDestinationURL, pX509Cert);
+		result = validate_hostname(pNetwork->tlsDataParams.pDestinationURL, pX509Cert);
 		if(MatchFound == result){
 			verification_return = 1;
 		}
@@ -107,12 +126,17 @@ int iot_tls_connect(Network *pNetwork, TLSConnectParams params) {
 
 	IoT_Error_t ret_val = NONE_ERROR;
 	int connect_status = 0;
+	TLSDataParams *pTLSData = &(pNetwork->tlsDataParams);
+	SSL_CTX *pSSLContext = pTLSData->pSSLContext;
+	unsigned char sessionCacheKey[TLS_SESSION_CACHE_KEY_LEN];
+	int isSessionCacheUsed = 0;
 
-	server_TCPSocket = Create_TCPSocket();
-	if(-1 == server_TCPSocket){
+	pTLSData->server_TCPSocket = Create_TCPSocket();
+	if(-1 == pTLSData->server_TCPSocket){
 		ret_val = TCP_SETUP_ERROR;
 		return ret_val;
 	}
+	pNetwork->my_socket = pTLSData->server_TCPSocket;
 
 	if (!SSL_CTX_load_verify_locations(pSSLContext, params.pRootCALocation, NULL)) {
 		ERROR(" Root CA Loading error");
@@ -135,58 +159,133 @@ int iot_tls_connect(Network *pNetwork, TLSConnectParams params) {
 		SSL_CTX_set_verify(pSSLContext, SSL_VERIFY_PEER, NULL);
 	}
 
-	pSSLHandle = SSL_new(pSSLContext);
+	pTLSData->pSSLHandle = SSL_new(pSSLContext);
+	SSL_set_app_data(pTLSData->pSSLHandle, pNetwork);
+
+	// resuming the session of an earlier process skips the certificate exchange and key agreement
+	if(NULL != params.pSessionCacheLocation && NONE_ERROR == ret_val){
+		isSessionCacheUsed = iot_tls_session_cache_key(pSSLContext, params.pDestinationURL, params.DestinationPort,
+				sessionCacheKey);
+		if(isSessionCacheUsed){
+			iot_tls_session_cache_load(params.pSessionCacheLocation, sessionCacheKey, pTLSData->pSSLHandle);
+		}
+	}
 
-	pDestinationURL = params.pDestinationURL;
-	ret_val = Connect_TCPSocket(server_TCPSocket, params.pDestinationURL, params.DestinationPort);
+	pTLSData->pDestinationURL = params.pDestinationURL;
+	ret_val = Connect_TCPSocket(pTLSData->server_TCPSocket, params.pDestinationURL, params.DestinationPort);
 	if(NONE_ERROR != ret_val){
 		ERROR(" TCP Connection error");
 		return ret_val;
 	}
 
-	SSL_set_fd(pSSLHandle, server_TCPSocket);
+	SSL_set_fd(pTLSData->pSSLHandle, pTLSData->server_TCPSocket);
+	/* Writes are resumed from queued buffers, possibly with more bytes appended, after a partial write */
+	SSL_set_mode(pTLSData->pSSLHandle, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	iot_tls_record_sizer_init(&(pTLSData->recordSizer));
+	pTLSData->maxSendFragment = 0;
+	pTLSData->isWritePending = 0;
 
 	if(ret_val == NONE_ERROR){
-		ret_val = setSocketToNonBlocking(server_TCPSocket);
+		ret_val = setSocketToNonBlocking(pTLSData->server_TCPSocket);
 		if(ret_val != NONE_ERROR){
 			ERROR(" Unable to set the socket to Non-Blocking");
 		}
 	}
 
 	if(NONE_ERROR == ret_val){
-		ret_val = ConnectOrTimeoutOrExitOnError(pSSLHandle, params.timeout_ms);
-		if(X509_V_OK != SSL_get_verify_result(pSSLHandle)){
+		ret_val = ConnectOrTimeoutOrExitOnError(pTLSData->pSSLHandle, pTLSData->server_TCPSocket, params.timeout_ms);
+		if(X509_V_OK != SSL_get_verify_result(pTLSData->pSSLHandle)){
 			ERROR(" Server Certificate Verification failed");
 			ret_val = SSL_CONNECT_ERROR;
 		}
 		else{
 			// ensure you have a valid certificate returned, otherwise no certificate exchange happened
-			if(NULL == SSL_get_peer_certificate(pSSLHandle)){
+			if(NULL == SSL_get_peer_certificate(pTLSData->pSSLHandle)){
 				ERROR(" No certificate exchange happened");
 				ret_val = SSL_CONNECT_ERROR;
 			}
 		}
 	}
+
+	if(NONE_ERROR == ret_val && isSessionCacheUsed && !SSL_session_reused(pTLSData->pSSLHandle)){
+		iot_tls_session_cache_store(params.pSessionCacheLocation, sessionCacheKey, pTLSData->pSSLHandle);
+	}
 	return ret_val;
 }
 
+/* Sets the fragment size for the next records. Only called when no record is waiting to be retried,
+ * OpenSSL expects a retried SSL_write to find the same settings */
+static void applyRecordSize(TLSDataParams *pTLSData) {
+	uint32_t recordSize = iot_tls_record_size_next(&(pTLSData->recordSizer));
+
+	if(TLS_MIN_SEND_FRAGMENT > recordSize){
+		recordSize = TLS_MIN_SEND_FRAGMENT;
+	}
+	/* Lowering the maximum also lowers the split fragment, which is not raised again with the maximum */
+	if(recordSize != pTLSData->maxSendFragment && SSL_set_max_send_fragment(pTLSData->pSSLHandle, recordSize)
+			&& SSL_set_split_send_fragment(pTLSData->pSSLHandle, recordSize)){
+		pTLSData->maxSendFragment = recordSize;
+	}
+}
+
+/* SSL_write with the record size policy applied, partial writes return after every record */
+static int writeRecords(TLSDataParams *pTLSData, unsigned char *pMsg, int len) {
+	int rc;
+
+	if(!pTLSData->isWritePending){
+		applyRecordSize(pTLSData);
+	}
+
+	rc = SSL_write(pTLSData->pSSLHandle, pMsg, len);
+	if(0 < rc){
+		pTLSData->isWritePending = 0;
+		iot_tls_record_sizer_sent(&(pTLSData->recordSizer), (uint32_t) rc);
+	}
+	else{
+		pTLSData->isWritePending = 1;
+	}
+
+	return rc;
+}
+
 int iot_tls_write(Network *pNetwork, unsigned char *pMsg, int len, int timeout_ms){
 
-	return WriteOrTimeoutOrExitOnError(pSSLHandle, pMsg, len, timeout_ms);
+	return WriteOrTimeoutOrExitOnError(&(pNetwork->tlsDataParams), pMsg, len, timeout_ms);
+}
+
+int iot_tls_try_write(Network *pNetwork, unsigned char *pMsg, int len) {
+	SSL *pSSL = pNetwork->tlsDataParams.pSSLHandle;
+	int rc;
+	int errorCode;
+
+	rc = writeRecords(&(pNetwork->tlsDataParams), pMsg, len);
+	if(0 < rc) {
+		return rc;
+	}
+
+	errorCode = SSL_get_error(pSSL, rc);
+	if(SSL_ERROR_WANT_WRITE == errorCode || SSL_ERROR_WANT_READ == errorCode) {
+		return 0;
+	}
+
+	return SSL_WRITE_ERROR;
 }
 
 int iot_tls_read(Network *pNetwork, unsigned char *pMsg, int len, int timeout_ms) {
-	return ReadOrTimeoutOrExitOnError(pSSLHandle, pMsg, len, timeout_ms);
+	return ReadOrTimeoutOrExitOnError(pNetwork->tlsDataParams.pSSLHandle, pNetwork->tlsDataParams.server_TCPSocket,
+			pMsg, len, timeout_ms);
 }
 
 void iot_tls_disconnect(Network *pNetwork){
-	SSL_shutdown(pSSLHandle);
-	close(server_TCPSocket);
+	SSL_shutdown(pNetwork->tlsDataParams.pSSLHandle);
+	close(pNetwork->tlsDataParams.server_TCPSocket);
 }
 
 int iot_tls_destroy(Network *pNetwork) {
-	SSL_free(pSSLHandle);
-	SSL_CTX_free(pSSLContext);
+	SSL_free(pNetwork->tlsDataParams.pSSLHandle);
+	SSL_CTX_free(pNetwork->tlsDataParams.pSSLContext);
+	pNetwork->tlsDataParams.pSSLHandle = NULL;
+	pNetwork->tlsDataParams.pSSLContext = NULL;
 	return 0;
 }
 
@@ -199,16 +298,19 @@ int Create_TCPSocket(void) {
 IoT_Error_t Connect_TCPSocket(int socket_fd, char *pURLString, int port) {
 	IoT_Error_t ret_val = TCP_CONNECT_ERROR;
 	int connect_status = -1;
-	struct hostent *host;
+	struct addrinfo hints;
+	struct addrinfo *pResult = NULL;
 	struct sockaddr_in dest_addr;
 
-	host = gethostbyname(pURLString);
+	// getaddrinfo is used instead of gethostbyname as it is safe to call from several threads
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
 
-	if (NULL != host) {
-		dest_addr.sin_family = AF_INET;
+	if (0 == getaddrinfo(pURLString, NULL, &hints, &pResult) && NULL != pResult) {
+		memcpy(&dest_addr, pResult->ai_addr, sizeof(dest_addr));
 		dest_addr.sin_port = htons(port);
-		dest_addr.sin_addr.s_addr = *(long*) (host->h_addr);
-		memset(&(dest_addr.sin_zero), '\0', 8);
+		freeaddrinfo(pResult);
 
 		connect_status = connect(socket_fd, (struct sockaddr *) &dest_addr,
 				sizeof(struct sockaddr));
@@ -219,18 +321,18 @@ IoT_Error_t Connect_TCPSocket(int socket_fd, char *pURLString, int port) {
 	return ret_val;
 }
 
-IoT_Error_t setSocketToNonBlocking( server_fd) {
+IoT_Error_t setSocketToNonBlocking(int server_fd) {
 
 	int flags, status;
 	IoT_Error_t ret_val = NONE_ERROR;
 
-	flags = fcntl(server_TCPSocket, F_GETFL, 0);
+	flags = fcntl(server_fd, F_GETFL, 0);
 	// set underlying socket to non blocking
 	if (flags < 0) {
 		ret_val = TCP_CONNECT_ERROR;
 	}
 
-	status = fcntl(server_TCPSocket, F_SETFL, flags | O_NONBLOCK);
+	status = fcntl(server_fd, F_SETFL, flags | O_NONBLOCK);
 	if (status < 0) {
 		ERROR("fcntl - %s", strerror(errno));
 		ret_val = TCP_CONNECT_ERROR;
@@ -239,7 +341,7 @@ IoT_Error_t setSocketToNonBlocking( server_fd) {
 	return ret_val;
 }
 
-IoT_Error_t ConnectOrTimeoutOrExitOnError(SSL *pSSL, int timeout_ms){
+IoT_Error_t ConnectOrTimeoutOrExitOnError(SSL *pSSL, int server_fd, int timeout_ms){
 
 	enum{
 		SSL_CONNECTED = 1,
@@ -267,8 +369,8 @@ IoT_Error_t ConnectOrTimeoutOrExitOnError(SSL *pSSL, int timeout_ms){
 
 		if(errorCode == SSL_ERROR_WANT_READ){
 			FD_ZERO(&readFds);
-			FD_SET(server_TCPSocket, &readFds);
-			select_retCode = select(server_TCPSocket + 1, (void *) &readFds, NULL, NULL, &timeout);
+			FD_SET(server_fd, &readFds);
+			select_retCode = select(server_fd + 1, (void *) &readFds, NULL, NULL, &timeout);
 			if (SELECT_TIMEOUT == select_retCode) {
 				ERROR(" SSL Connect time out while waiting for read");
 				ret_val = SSL_CONNECT_TIMEOUT_ERROR;
@@ -280,8 +382,8 @@ IoT_Error_t ConnectOrTimeoutOrExitOnError(SSL *pSSL, int timeout_ms){
 
 		else if(errorCode == SSL_ERROR_WANT_WRITE){
 			FD_ZERO(&writeFds);
-			FD_SET(server_TCPSocket, &writeFds);
-			select_retCode = select(server_TCPSocket + 1, NULL, (void *) &writeFds, NULL, &timeout);
+			FD_SET(server_fd, &writeFds);
+			select_retCode = select(server_fd + 1, NULL, (void *) &writeFds, NULL, &timeout);
 			if (SELECT_TIMEOUT == select_retCode) {
 				ERROR(" SSL Connect time out while waiting for write");
 				ret_val = SSL_CONNECT_TIMEOUT_ERROR;
@@ -300,8 +402,10 @@ IoT_Error_t ConnectOrTimeoutOrExitOnError(SSL *pSSL, int timeout_ms){
 	return ret_val;
 }
 
-IoT_Error_t WriteOrTimeoutOrExitOnError(SSL *pSSL, unsigned char *msg, int totalLen, int timeout_ms){
+IoT_Error_t WriteOrTimeoutOrExitOnError(TLSDataParams *pTLSData, unsigned char *msg, int totalLen, int timeout_ms){
 
+	SSL *pSSL = pTLSData->pSSLHandle;
+	int server_fd = pTLSData->server_TCPSocket;
 
 	IoT_Error_t errorStatus = NONE_ERROR;
 
@@ -318,7 +422,7 @@ IoT_Error_t WriteOrTimeoutOrExitOnError(SSL *pSSL, unsigned char *msg, int total
 	struct timeval timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
 
 	do{
-		rc = SSL_write(pSSL, msg, totalLen);
+		rc = writeRecords(pTLSData, msg + writtenLength, totalLen - writtenLength);
 
 		errorCode = SSL_get_error(pSSL, rc);
 
@@ -328,8 +432,8 @@ IoT_Error_t WriteOrTimeoutOrExitOnError(SSL *pSSL, unsigned char *msg, int total
 
 		else if (errorCode == SSL_ERROR_WANT_WRITE) {
 			FD_ZERO(&writeFds);
-			FD_SET(server_TCPSocket, &writeFds);
-			select_retCode = select(server_TCPSocket + 1, NULL, (void *) &writeFds, NULL, &timeout);
+			FD_SET(server_fd, &writeFds);
+			select_retCode = select(server_fd + 1, NULL, (void *) &writeFds, NULL, &timeout);
 			if (SELECT_TIMEOUT == select_retCode) {
 				errorStatus = SSL_WRITE_TIMEOUT_ERROR;
 			} else if (SELECT_ERROR == select_retCode) {
@@ -353,7 +457,7 @@ IoT_Error_t WriteOrTimeoutOrExitOnError(SSL *pSSL, unsigned char *msg, int total
 	return returnCode;
 }
 
-IoT_Error_t ReadOrTimeoutOrExitOnError(SSL *pSSL, unsigned char *msg, int totalLen, int timeout_ms){
+IoT_Error_t ReadOrTimeoutOrExitOnError(SSL *pSSL, int server_fd, unsigned char *msg, int totalLen, int timeout_ms){
 
 
 	IoT_Error_t errorStatus = NONE_ERROR;
@@ -380,8 +484,8 @@ IoT_Error_t ReadOrTimeoutOrExitOnError(SSL *pSSL, unsigned char *msg, int totalL
 
 		else if (errorCode == SSL_ERROR_WANT_READ) {
 			FD_ZERO(&readFds);
-			FD_SET(server_TCPSocket, &readFds);
-			select_retCode = select(server_TCPSocket + 1, (void *) &readFds, NULL, NULL, &timeout);
+			FD_SET(server_fd, &readFds);
+			select_retCode = select(server_fd + 1, (void *) &readFds, NULL, NULL, &timeout);
 			if (SELECT_TIMEOUT == select_retCode) {
 				errorStatus = SSL_READ_TIMEOUT_ERROR;
 			} else if (SELECT_ERROR == select_retCode) {
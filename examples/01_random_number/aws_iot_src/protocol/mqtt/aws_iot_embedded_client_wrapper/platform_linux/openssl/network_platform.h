@@ -0,0 +1,39 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_OPENSSL_NETWORK_PLATFORM_H_
+#define SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_OPENSSL_NETWORK_PLATFORM_H_
+
+/**
+ * @file network_platform.h
+ */
+#include <openssl/ssl.h>
+
+#include "tls_record_size.h"
+
+/**
+ * definition of the TLSDataParams struct. Platform specific
+ */
+struct _TLSDataParams{
+	SSL_CTX *pSSLContext;		///< OpenSSL context holding the loaded certificates
+	SSL *pSSLHandle;			///< OpenSSL handle of the connection
+	int server_TCPSocket;		///< Underlying TCP socket
+	char *pDestinationURL;		///< Endpoint used for server certificate hostname validation
+	TLSRecordSizer recordSizer;	///< Record size policy of the connection
+	uint32_t maxSendFragment;	///< Record size currently set on pSSLHandle, 0 for the OpenSSL default
+	int isWritePending;			///< An SSL_write returned WANT_WRITE and has to be retried unchanged
+};
+
+#endif /* SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_OPENSSL_NETWORK_PLATFORM_H_ */
@@ -0,0 +1,235 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "openssl_session_cache.h"
+
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_config.h"
+
+#define SESSION_CACHE_MAGIC 0x53544941	/* "AITS" */
+#define SESSION_CACHE_FORMAT_VERSION 1
+
+typedef struct {
+	unsigned char key[TLS_SESSION_CACHE_KEY_LEN];
+	uint64_t storedAt;			///< Seconds since the epoch, the oldest entry is replaced first
+	uint32_t sessionLength;		///< Length of the DER encoded session, 0 for an empty entry
+	unsigned char session[AWS_IOT_TLS_SESSION_CACHE_MAX_SESSION_LEN];
+} SessionCacheEntry_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t formatVersion;
+	uint32_t entryCount;
+	uint32_t maxSessionLength;
+	SessionCacheEntry_t entries[AWS_IOT_TLS_SESSION_CACHE_ENTRIES];
+} SessionCacheFile_t;
+
+int iot_tls_session_cache_key(SSL_CTX *pSSLContext, const char *pDestinationURL, int port, unsigned char *pKey) {
+	X509 *pCertificate = SSL_CTX_get0_certificate(pSSLContext);
+	unsigned char *pCertificateDer = NULL;
+	int certificateDerLength;
+	char portString[8];
+	EVP_MD_CTX *pDigestContext;
+	int ret_val = 0;
+
+	if (NULL == pCertificate || NULL == pDestinationURL) {
+		return 0;
+	}
+
+	certificateDerLength = i2d_X509(pCertificate, &pCertificateDer);
+	if (certificateDerLength <= 0) {
+		return 0;
+	}
+
+	snprintf(portString, sizeof(portString), ":%d", port);
+	pDigestContext = EVP_MD_CTX_create();
+	if (NULL != pDigestContext
+			&& 1 == EVP_DigestInit_ex(pDigestContext, EVP_sha256(), NULL)
+			&& 1 == EVP_DigestUpdate(pDigestContext, pDestinationURL, strlen(pDestinationURL))
+			&& 1 == EVP_DigestUpdate(pDigestContext, portString, strlen(portString))
+			&& 1 == EVP_DigestUpdate(pDigestContext, pCertificateDer, certificateDerLength)
+			&& 1 == EVP_DigestFinal_ex(pDigestContext, pKey, NULL)) {
+		ret_val = 1;
+	}
+
+	EVP_MD_CTX_destroy(pDigestContext);
+	OPENSSL_free(pCertificateDer);
+	return ret_val;
+}
+
+/* The file holds session secrets, so it is only used when nobody else can read or replace it */
+static int openCacheFile(const char *pCacheLocation, int isWritable) {
+	struct stat fileStatus;
+	int fd;
+
+	fd = open(pCacheLocation, (isWritable ? (O_RDWR | O_CREAT) : O_RDONLY) | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (0 != fstat(fd, &fileStatus) || !S_ISREG(fileStatus.st_mode) || fileStatus.st_uid != geteuid()
+			|| 0 != (fileStatus.st_mode & (S_IRWXG | S_IRWXO))) {
+		WARN("TLS session cache %s is not a private file of this user, not using it", pCacheLocation);
+		close(fd);
+		return -1;
+	}
+
+	if (0 != flock(fd, isWritable ? LOCK_EX : LOCK_SH)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static SessionCacheFile_t *mapCacheFile(int fd, int isWritable) {
+	struct stat fileStatus;
+	void *pMapping;
+
+	if (0 != fstat(fd, &fileStatus)) {
+		return NULL;
+	}
+
+	if (fileStatus.st_size != sizeof(SessionCacheFile_t)) {
+		if (!isWritable || 0 != ftruncate(fd, sizeof(SessionCacheFile_t))) {
+			return NULL;
+		}
+	}
+
+	pMapping = mmap(NULL, sizeof(SessionCacheFile_t), isWritable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED,
+			fd, 0);
+	if (MAP_FAILED == pMapping) {
+		return NULL;
+	}
+
+	return (SessionCacheFile_t *) pMapping;
+}
+
+static int isCacheFormatMatching(const SessionCacheFile_t *pCache) {
+	return (SESSION_CACHE_MAGIC == pCache->magic && SESSION_CACHE_FORMAT_VERSION == pCache->formatVersion
+			&& AWS_IOT_TLS_SESSION_CACHE_ENTRIES == pCache->entryCount
+			&& AWS_IOT_TLS_SESSION_CACHE_MAX_SESSION_LEN == pCache->maxSessionLength);
+}
+
+int iot_tls_session_cache_load(const char *pCacheLocation, const unsigned char *pKey, SSL *pSSL) {
+	SessionCacheFile_t *pCache;
+	SSL_SESSION *pSession = NULL;
+	const unsigned char *pSessionDer;
+	int fd;
+	int i;
+	int isSessionSet = 0;
+
+	fd = openCacheFile(pCacheLocation, 0);
+	if (fd < 0) {
+		return 0;
+	}
+
+	pCache = mapCacheFile(fd, 0);
+	if (NULL != pCache) {
+		for (i = 0; isCacheFormatMatching(pCache) && i < AWS_IOT_TLS_SESSION_CACHE_ENTRIES; i++) {
+			SessionCacheEntry_t *pEntry = &(pCache->entries[i]);
+			if (0 != pEntry->sessionLength && pEntry->sessionLength <= AWS_IOT_TLS_SESSION_CACHE_MAX_SESSION_LEN
+					&& 0 == memcmp(pEntry->key, pKey, TLS_SESSION_CACHE_KEY_LEN)) {
+				pSessionDer = pEntry->session;
+				pSession = d2i_SSL_SESSION(NULL, &pSessionDer, pEntry->sessionLength);
+				break;
+			}
+		}
+		munmap(pCache, sizeof(SessionCacheFile_t));
+	}
+	close(fd);
+
+	if (NULL != pSession) {
+		if ((long) time(NULL) < SSL_SESSION_get_time(pSession) + SSL_SESSION_get_timeout(pSession)) {
+			isSessionSet = SSL_set_session(pSSL, pSession);
+		}
+		SSL_SESSION_free(pSession);
+	}
+
+	DEBUG("TLS session cache %s", isSessionSet ? "hit" : "miss");
+	return isSessionSet;
+}
+
+void iot_tls_session_cache_store(const char *pCacheLocation, const unsigned char *pKey, SSL *pSSL) {
+	SessionCacheFile_t *pCache;
+	SessionCacheEntry_t *pEntry = NULL;
+	SSL_SESSION *pSession;
+	unsigned char *pSessionDer;
+	int sessionLength;
+	int fd;
+	int i;
+
+	pSession = SSL_get1_session(pSSL);
+	if (NULL == pSession) {
+		return;
+	}
+
+	sessionLength = i2d_SSL_SESSION(pSession, NULL);
+	if (sessionLength <= 0 || sessionLength > AWS_IOT_TLS_SESSION_CACHE_MAX_SESSION_LEN) {
+		WARN("TLS session of %d bytes does not fit the session cache", sessionLength);
+		SSL_SESSION_free(pSession);
+		return;
+	}
+
+	fd = openCacheFile(pCacheLocation, 1);
+	if (fd < 0) {
+		SSL_SESSION_free(pSession);
+		return;
+	}
+
+	pCache = mapCacheFile(fd, 1);
+	if (NULL != pCache) {
+		if (!isCacheFormatMatching(pCache)) {
+			memset(pCache, 0, sizeof(SessionCacheFile_t));
+			pCache->magic = SESSION_CACHE_MAGIC;
+			pCache->formatVersion = SESSION_CACHE_FORMAT_VERSION;
+			pCache->entryCount = AWS_IOT_TLS_SESSION_CACHE_ENTRIES;
+			pCache->maxSessionLength = AWS_IOT_TLS_SESSION_CACHE_MAX_SESSION_LEN;
+		}
+
+		for (i = 0; i < AWS_IOT_TLS_SESSION_CACHE_ENTRIES; i++) {
+			if (0 == memcmp(pCache->entries[i].key, pKey, TLS_SESSION_CACHE_KEY_LEN)) {
+				pEntry = &(pCache->entries[i]);
+				break;
+			}
+			if (NULL == pEntry || pCache->entries[i].storedAt < pEntry->storedAt) {
+				pEntry = &(pCache->entries[i]);
+			}
+		}
+
+		memcpy(pEntry->key, pKey, TLS_SESSION_CACHE_KEY_LEN);
+		pSessionDer = pEntry->session;
+		i2d_SSL_SESSION(pSession, &pSessionDer);
+		pEntry->sessionLength = (uint32_t) sessionLength;
+		pEntry->storedAt = (uint64_t) time(NULL);
+
+		munmap(pCache, sizeof(SessionCacheFile_t));
+	}
+	close(fd);
+
+	SSL_SESSION_free(pSession);
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file openssl_session_cache.h
+ * @brief TLS session cache shared between processes through a file
+ *
+ * Short lived clients connecting again and again to the same endpoint resume the TLS session of
+ * an earlier process instead of doing a full handshake.  Sessions are kept in a small file mapped
+ * into memory, with one entry per endpoint and client certificate.
+ */
+
+#ifndef SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_OPENSSL_OPENSSL_SESSION_CACHE_H_
+#define SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_OPENSSL_OPENSSL_SESSION_CACHE_H_
+
+#include <openssl/sha.h>
+#include <openssl/ssl.h>
+
+#define TLS_SESSION_CACHE_KEY_LEN SHA256_DIGEST_LENGTH
+
+/**
+ * @brief Derive the cache key of a connection from the endpoint and the client certificate
+ *
+ * @param pSSLContext Context with the client certificate loaded
+ * @param pDestinationURL Endpoint of the connection
+ * @param port Port of the connection
+ * @param pKey Filled with TLS_SESSION_CACHE_KEY_LEN bytes
+ * @return 1 on success, 0 if no key could be computed
+ */
+int iot_tls_session_cache_key(SSL_CTX *pSSLContext, const char *pDestinationURL, int port, unsigned char *pKey);
+
+/**
+ * @brief Set the cached session for the key on the connection, if there is one that has not expired
+ *
+ * @return 1 if a session was set, 0 otherwise
+ */
+int iot_tls_session_cache_load(const char *pCacheLocation, const unsigned char *pKey, SSL *pSSL);
+
+/**
+ * @brief Save the session of an established connection under the key
+ *
+ * Replaces the entry of the same key, or else the oldest entry.
+ */
+void iot_tls_session_cache_store(const char *pCacheLocation, const unsigned char *pKey, SSL *pSSL);
+
+#endif /* SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_OPENSSL_OPENSSL_SESSION_CACHE_H_ */
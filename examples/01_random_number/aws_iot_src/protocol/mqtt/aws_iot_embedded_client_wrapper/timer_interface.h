@@ -27,6 +27,8 @@
 #ifndef __TIMER_INTERFACE_H_
 #define __TIMER_INTERFACE_H_
 
+#include <stdint.h>
+
 // Add the platform specific timer includes to define the Timer struct
 #include "timer_linux.h"
 
@@ -60,6 +62,20 @@ char expired(Timer*);
  */
 void countdown_ms(Timer*, unsigned int);
 
+/**
+ * @brief Create a timer (milliseconds) that may expire a little late
+ *
+ * Sets the timer to expire no earlier than timeout and no later than timeout plus slack milliseconds.
+ * The expiry is rounded up to a multiple of the largest power of two milliseconds not above slack,
+ * counted on a clock shared by the whole process, so timers with a tolerance end up expiring together
+ * and a sleeping process wakes up once for all of them.
+ *
+ * @param Timer - pointer to the timer to be set to expire in milliseconds
+ * @param unsigned int - set the timer to expire in at least this number of milliseconds
+ * @param unsigned int - milliseconds the timer may expire late, 0 behaves like countdown_ms
+ */
+void countdown_ms_slack(Timer*, unsigned int, unsigned int);
+
 /**
  * @brief Create a timer (seconds)
  *
@@ -89,4 +105,15 @@ int left_ms(Timer*);
  */
 void InitTimer(Timer*);
 
+/**
+ * @brief Read a monotonic timestamp (microseconds)
+ *
+ * Returns the current value of a clock that is not affected by wall clock
+ * adjustments.  Only the difference between two readings is meaningful, which
+ * makes it suitable for measuring elapsed time.
+ *
+ * @return uint64_t - monotonic time in microseconds
+ */
+uint64_t timestamp_us(void);
+
 #endif //__TIMER_INTERFACE_H_
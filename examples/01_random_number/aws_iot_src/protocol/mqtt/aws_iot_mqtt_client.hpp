@@ -0,0 +1,552 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file aws_iot_mqtt_client.hpp
+ * @brief Header-only C++17 layer over the MQTT client interface.
+ *
+ * Thin wrappers around aws_iot_mqtt_interface.h, nothing here is compiled into the SDK.
+ * Every call goes through the MQTTClient_t function table, so a client swapped in with
+ * aws_iot_mqtt_init is used by C and C++ code alike.
+ *
+ * Topic filters known at compile time are validated and split into levels by constexpr code.
+ * A handler bound to such a filter is reached through a trampoline generated per filter and
+ * handler type, so a lambda costs one indirect call from the C client, the same as a C callback.
+ *
+ * @code
+ * static constexpr char kTemperature[] = "sensors/+/temperature";
+ *
+ * awsiot::Client client;
+ * awsiot::Session session(client, connectParams);
+ * auto subscription = session.subscribe<kTemperature>([&](awsiot::MessageView msg) {
+ *     auto sensor = awsiot::StaticFilter<kTemperature>::capture(msg.topic(), 0);
+ *     ...
+ * });
+ * while(session) {
+ *     session.yield(100);
+ * }
+ * @endcode
+ *
+ * @note The C client is a single connection per process, so are Session and the handler slots.
+ * Errors are reported as IoT_Error_t, no exceptions are thrown.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_HPP_
+#define AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+extern "C" {
+#include "aws_iot_mqtt_interface.h"
+}
+
+namespace awsiot {
+
+/**
+ * @brief Compile-time topic filter helpers
+ *
+ * Filters follow MQTT 3.1.1: levels are separated by '/', '+' has to fill a whole level and
+ * '#' has to be the whole last level.
+ */
+namespace filter {
+
+/// Maximum length of a topic or topic filter on the wire
+constexpr std::size_t MAX_LENGTH = 65535;
+
+/**
+ * @brief Check a topic filter
+ *
+ * @param f the filter
+ * @return true if f is a valid, non-empty MQTT topic filter
+ */
+constexpr bool isValid(std::string_view f) noexcept {
+	if(f.empty() || f.size() > MAX_LENGTH) {
+		return false;
+	}
+	for(std::size_t i = 0; i < f.size(); ++i) {
+		const bool levelStart = (0 == i || '/' == f[i - 1]);
+		const bool levelEnd = (f.size() == i + 1 || '/' == f[i + 1]);
+		if('+' == f[i] && !(levelStart && levelEnd)) {
+			return false;
+		}
+		if('#' == f[i] && !(levelStart && f.size() == i + 1)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Number of levels of a topic or filter, "a/b/c" has 3
+ */
+constexpr std::size_t levelCount(std::string_view f) noexcept {
+	std::size_t count = 1;
+	for(char ch : f) {
+		if('/' == ch) {
+			++count;
+		}
+	}
+	return count;
+}
+
+/**
+ * @brief Split a topic or filter into its levels
+ *
+ * @tparam N level count of f, see levelCount
+ * @param f the topic or filter
+ * @return the levels, pointing into f
+ */
+template <std::size_t N>
+constexpr std::array<std::string_view, N> split(std::string_view f) noexcept {
+	std::array<std::string_view, N> levels{};
+	std::size_t level = 0;
+	std::size_t start = 0;
+	for(std::size_t i = 0; i <= f.size(); ++i) {
+		if(f.size() == i || '/' == f[i]) {
+			if(level < N) {
+				levels[level++] = f.substr(start, i - start);
+			}
+			start = i + 1;
+		}
+	}
+	return levels;
+}
+
+/**
+ * @brief Match a topic against a filter split into levels
+ *
+ * Wildcards in the first level do not match topics starting with '$', as required by MQTT.
+ *
+ * @param levels the split filter
+ * @param topic the topic name of a received message
+ * @return true if the topic matches the filter
+ */
+template <std::size_t N>
+constexpr bool matches(const std::array<std::string_view, N> &levels, std::string_view topic) noexcept {
+	std::size_t pos = 0;
+	if(!topic.empty() && '$' == topic[0] && ("+" == levels[0] || "#" == levels[0])) {
+		return false;
+	}
+	for(std::size_t i = 0; i < N; ++i) {
+		if("#" == levels[i]) {
+			return true;
+		}
+		if(pos > topic.size()) {
+			return false;
+		}
+		std::size_t end = topic.find('/', pos);
+		if(std::string_view::npos == end) {
+			end = topic.size();
+		}
+		if("+" != levels[i] && levels[i] != topic.substr(pos, end - pos)) {
+			return false;
+		}
+		pos = end + 1;
+	}
+	/* Every topic level has to be consumed, "a/b" does not match "a/b/c" */
+	return pos == topic.size() + 1;
+}
+
+} // namespace filter
+
+/**
+ * @brief A topic filter fixed at compile time
+ *
+ * Rejects invalid filters with a static_assert and keeps the filter pre-split into levels.
+ *
+ * @tparam Filter null terminated filter with static storage duration.  The C client keeps the
+ * pointer for the lifetime of the subscription, which static storage guarantees.
+ */
+template <const char *Filter>
+struct StaticFilter {
+	static constexpr std::string_view text{Filter};
+	static_assert(filter::isValid(text), "invalid MQTT topic filter");
+
+	static constexpr std::size_t levelCount = filter::levelCount(text);
+	static constexpr std::array<std::string_view, levelCount> levels = filter::split<levelCount>(text);
+
+	/// True if topic matches this filter
+	static constexpr bool matches(std::string_view topic) noexcept {
+		return filter::matches(levels, topic);
+	}
+
+	/**
+	 * @brief Topic level matched by a '+' wildcard
+	 *
+	 * @param topic a topic matching this filter
+	 * @param n index of the '+' wildcard, counting from 0
+	 * @return the level of topic in place of the n-th '+', empty if there is none
+	 */
+	static constexpr std::string_view capture(std::string_view topic, std::size_t n) noexcept {
+		std::size_t pos = 0;
+		for(std::size_t i = 0; i < levelCount && pos <= topic.size(); ++i) {
+			std::size_t end = topic.find('/', pos);
+			if(std::string_view::npos == end) {
+				end = topic.size();
+			}
+			if("+" == levels[i]) {
+				if(0 == n) {
+					return topic.substr(pos, end - pos);
+				}
+				--n;
+			}
+			pos = end + 1;
+		}
+		return std::string_view();
+	}
+};
+
+/**
+ * @brief A received message
+ *
+ * Borrows the client's receive buffer: it is only valid until the handler it was passed to
+ * returns.  It can be moved to helpers called from the handler but not copied, which keeps the
+ * borrow from being duplicated into long lived storage by accident.
+ */
+class MessageView {
+public:
+	explicit MessageView(const MQTTCallbackParams &params) noexcept : pParams(&params) {}
+
+	MessageView(const MessageView &) = delete;
+	MessageView &operator=(const MessageView &) = delete;
+
+	MessageView(MessageView &&other) noexcept : pParams(other.pParams) {
+		other.pParams = nullptr;
+	}
+
+	MessageView &operator=(MessageView &&other) noexcept {
+		pParams = other.pParams;
+		other.pParams = nullptr;
+		return *this;
+	}
+
+	/// Actual topic the message was published on, not the subscription filter
+	std::string_view topic() const noexcept {
+		return std::string_view(pParams->pTopicName, pParams->TopicNameLen);
+	}
+
+	const unsigned char *data() const noexcept {
+		return static_cast<const unsigned char *>(pParams->MessageParams.pPayload);
+	}
+
+	std::size_t size() const noexcept {
+		return pParams->MessageParams.PayloadLen;
+	}
+
+	/// Payload as characters, for text and JSON messages
+	std::string_view payload() const noexcept {
+		return std::string_view(static_cast<const char *>(pParams->MessageParams.pPayload),
+				pParams->MessageParams.PayloadLen);
+	}
+
+	QoSLevel qos() const noexcept { return pParams->MessageParams.qos; }
+	bool isRetained() const noexcept { return pParams->MessageParams.isRetained; }
+	bool isDuplicate() const noexcept { return pParams->MessageParams.isDuplicate; }
+	uint16_t id() const noexcept { return pParams->MessageParams.id; }
+
+	/// The underlying C parameters
+	const MQTTCallbackParams &params() const noexcept { return *pParams; }
+
+private:
+	const MQTTCallbackParams *pParams;
+};
+
+namespace detail {
+
+/*
+ * One slot per filter and handler type.  The C client only passes MQTTCallbackParams to a
+ * callback, so the handler object lives in static storage where the trampoline can reach it.
+ * A slot holds the handler of at most one live Subscription, Session::subscribe refuses to bind
+ * a second one, so only the owning Subscription ever clears it.
+ */
+template <const char *Filter, typename Handler>
+struct HandlerSlot {
+	static inline std::optional<Handler> handler;
+
+	static bool isBound() noexcept {
+		return handler.has_value();
+	}
+
+	static int32_t trampoline(MQTTCallbackParams params) {
+		/* A message already read when the subscription went away finds the slot empty */
+		if(!handler) {
+			return 0;
+		}
+		if constexpr (std::is_void_v<std::invoke_result_t<Handler &, MessageView>>) {
+			(*handler)(MessageView(params));
+			return 0;
+		} else {
+			return static_cast<int32_t>((*handler)(MessageView(params)));
+		}
+	}
+
+	static void reset() noexcept {
+		handler.reset();
+	}
+};
+
+} // namespace detail
+
+/**
+ * @brief Client interface function table
+ *
+ * Filled by aws_iot_mqtt_init on construction.  get() can be handed to the C layers built on
+ * top of the client, e.g. Thing Shadow or fragmented transfer.
+ */
+class Client {
+public:
+	Client() noexcept {
+		aws_iot_mqtt_init(&table);
+	}
+
+	/// Use a different client implementation, e.g. a test double
+	explicit Client(const MQTTClient_t &implementation) noexcept : table(implementation) {}
+
+	Client(const Client &) = delete;
+	Client &operator=(const Client &) = delete;
+
+	MQTTClient_t *get() noexcept { return &table; }
+	const MQTTClient_t &functions() const noexcept { return table; }
+
+private:
+	MQTTClient_t table;
+};
+
+/**
+ * @brief Subscription to a topic filter, unsubscribed when destroyed
+ */
+class Subscription {
+public:
+	Subscription() noexcept = default;
+
+	Subscription(const Subscription &) = delete;
+	Subscription &operator=(const Subscription &) = delete;
+
+	Subscription(Subscription &&other) noexcept {
+		*this = std::move(other);
+	}
+
+	Subscription &operator=(Subscription &&other) noexcept {
+		if(this != &other) {
+			release();
+			pClient = std::exchange(other.pClient, nullptr);
+			pFilter = std::exchange(other.pFilter, nullptr);
+			resetHandler = std::exchange(other.resetHandler, nullptr);
+			rc = other.rc;
+		}
+		return *this;
+	}
+
+	~Subscription() {
+		release();
+	}
+
+	/// Result of the subscribe call
+	IoT_Error_t status() const noexcept { return rc; }
+	explicit operator bool() const noexcept { return nullptr != pFilter; }
+
+	/// Unsubscribe now instead of on destruction
+	IoT_Error_t unsubscribe() noexcept {
+		IoT_Error_t unsubscribeRc = NONE_ERROR;
+		if(nullptr != pFilter) {
+			unsubscribeRc = pClient->unsubscribe(const_cast<char *>(pFilter));
+			resetHandler();
+			pClient = nullptr;
+			pFilter = nullptr;
+			resetHandler = nullptr;
+		}
+		return unsubscribeRc;
+	}
+
+private:
+	friend class Session;
+
+	Subscription(const MQTTClient_t *client, const char *filter, void (*reset)(), IoT_Error_t result) noexcept
+			: pClient(client), pFilter(filter), resetHandler(reset), rc(result) {}
+
+	explicit Subscription(IoT_Error_t result) noexcept : rc(result) {}
+
+	void release() noexcept {
+		(void) unsubscribe();
+	}
+
+	const MQTTClient_t *pClient = nullptr;
+	const char *pFilter = nullptr;
+	void (*resetHandler)() = nullptr;
+	IoT_Error_t rc = NONE_ERROR;
+};
+
+/**
+ * @brief A connection to the MQTT service, disconnected when destroyed
+ */
+class Session {
+public:
+	/**
+	 * @brief Connect
+	 *
+	 * @param client function table of the client to use, has to outlive the session
+	 * @param params connection parameters, see aws_iot_mqtt_connect
+	 */
+	Session(Client &client, const MQTTConnectParams &params) noexcept : pClient(&client.functions()) {
+		MQTTConnectParams connectParams = params;
+		rc = pClient->connect(&connectParams);
+	}
+
+	Session(const Session &) = delete;
+	Session &operator=(const Session &) = delete;
+
+	Session(Session &&other) noexcept
+			: pClient(std::exchange(other.pClient, nullptr)), rc(other.rc) {}
+
+	Session &operator=(Session &&other) noexcept {
+		if(this != &other) {
+			disconnect();
+			pClient = std::exchange(other.pClient, nullptr);
+			rc = other.rc;
+		}
+		return *this;
+	}
+
+	~Session() {
+		disconnect();
+	}
+
+	/// Result of the connect call
+	IoT_Error_t status() const noexcept { return rc; }
+
+	/// True while the session is connected
+	explicit operator bool() const noexcept {
+		return nullptr != pClient && NONE_ERROR == rc && pClient->isConnected();
+	}
+
+	/**
+	 * @brief Subscribe to a compile-time filter
+	 *
+	 * @tparam Filter the topic filter, see StaticFilter
+	 * @param handler callable taking a MessageView, optionally returning an integer
+	 * @param qos subscription QoS
+	 * @return the subscription, check status() for the result.  SUBSCRIBE_ERROR without subscribing
+	 *         while another live subscription is bound to the same filter and handler type, e.g. a
+	 *         second std::function or the same lambda subscribed again in a loop
+	 */
+	template <const char *Filter, typename Handler>
+	Subscription subscribe(Handler &&handler, QoSLevel qos = QOS_0) noexcept {
+		using Slot = detail::HandlerSlot<Filter, std::decay_t<Handler>>;
+		static_assert(filter::isValid(Filter), "invalid MQTT topic filter");
+		static_assert(std::is_invocable_v<std::decay_t<Handler> &, MessageView>,
+				"handler has to be callable with an awsiot::MessageView");
+
+		if(nullptr == pClient) {
+			return Subscription(NETWORK_DISCONNECTED);
+		}
+		if(Slot::isBound()) {
+			return Subscription(SUBSCRIBE_ERROR);
+		}
+
+		Slot::handler.emplace(std::forward<Handler>(handler));
+
+		MQTTSubscribeParams subscribeParams = MQTTSubscribeParamsDefault;
+		subscribeParams.pTopic = const_cast<char *>(Filter);
+		subscribeParams.qos = qos;
+		subscribeParams.mHandler = &Slot::trampoline;
+		IoT_Error_t subscribeRc = pClient->subscribe(&subscribeParams);
+		if(NONE_ERROR != subscribeRc) {
+			Slot::reset();
+			return Subscription(subscribeRc);
+		}
+		return Subscription(pClient, Filter, &Slot::reset, subscribeRc);
+	}
+
+	/**
+	 * @brief Publish and wait for the PUBACK of a QoS 1 message
+	 *
+	 * @param topic null terminated topic name
+	 */
+	IoT_Error_t publish(const char *topic, const void *payload, std::size_t length, QoSLevel qos = QOS_0) noexcept {
+		if(nullptr == pClient) {
+			return NETWORK_DISCONNECTED;
+		}
+		MQTTPublishParams publishParams = makePublishParams(topic, payload, length, qos);
+		return pClient->publish(&publishParams);
+	}
+
+	/// Publish any contiguous container with data() and size()
+	template <typename Container>
+	IoT_Error_t publish(const char *topic, const Container &payload, QoSLevel qos = QOS_0) noexcept {
+		return publish(topic, std::data(payload), std::size(payload) * sizeof(*std::data(payload)), qos);
+	}
+
+	/**
+	 * @brief Publish without waiting, see aws_iot_mqtt_publish_async
+	 *
+	 * @return PUBLISH_WINDOW_FULL or PUBLISH_WOULD_BLOCK when the caller should yield and retry
+	 */
+	IoT_Error_t publishAsync(const char *topic, const void *payload, std::size_t length, QoSLevel qos = QOS_1) noexcept {
+		if(nullptr == pClient) {
+			return NETWORK_DISCONNECTED;
+		}
+		MQTTPublishParams publishParams = makePublishParams(topic, payload, length, qos);
+		return pClient->publishAsync(&publishParams);
+	}
+
+	IoT_Error_t yield(int timeout_ms) noexcept {
+		if(nullptr == pClient) {
+			return NETWORK_DISCONNECTED;
+		}
+		return pClient->yield(timeout_ms);
+	}
+
+	uint32_t inflightPublishCount() const noexcept {
+		if(nullptr == pClient) {
+			return 0;
+		}
+		return pClient->getInflightPublishCount();
+	}
+
+	/// Disconnect now instead of on destruction
+	IoT_Error_t disconnect() noexcept {
+		IoT_Error_t disconnectRc = NONE_ERROR;
+		if(nullptr != pClient && NONE_ERROR == rc) {
+			disconnectRc = pClient->disconnect();
+		}
+		pClient = nullptr;
+		return disconnectRc;
+	}
+
+private:
+	static MQTTPublishParams makePublishParams(const char *topic, const void *payload, std::size_t length,
+			QoSLevel qos) noexcept {
+		MQTTPublishParams publishParams = MQTTPublishParamsDefault;
+		publishParams.pTopic = const_cast<char *>(topic);
+		publishParams.MessageParams.qos = qos;
+		publishParams.MessageParams.pPayload = const_cast<void *>(payload);
+		publishParams.MessageParams.PayloadLen = static_cast<uint32_t>(length);
+		return publishParams;
+	}
+
+	const MQTTClient_t *pClient;
+	IoT_Error_t rc;
+};
+
+} // namespace awsiot
+
+#endif /* AWS_IOT_SDK_SRC_IOT_MQTT_CLIENT_HPP_ */
@@ -21,10 +21,12 @@
 #ifndef AWS_IOT_SDK_SRC_IOT_MQTT_INTERFACE_H_
 #define AWS_IOT_SDK_SRC_IOT_MQTT_INTERFACE_H_
 
+#include "stdio.h"
 #include "stddef.h"
 #include "stdbool.h"
 #include "stdint.h"
 #include "aws_iot_error.h"
+#include "aws_iot_topic_stats.h"
 
 /**
  * @brief MQTT Version Type
@@ -97,6 +99,7 @@ typedef struct {
 	uint32_t mqttCommandTimeout_ms;		///< Timeout for MQTT blocking calls.  In milliseconds.
 	uint32_t tlsHandshakeTimeout_ms;	///< TLS handshake timeout.  In milliseconds.
 	bool isSSLHostnameVerify;			///< Client should perform server certificate hostname validation.
+	char *pSessionCacheLocation;		///< Pointer to a string defining the TLS session cache file (full file, not path), shared by processes of the same user to resume TLS sessions.  NULL disables the cache
 	iot_disconnect_handler disconnectHandler;	///< Callback to be invoked upon connection loss.
 } MQTTConnectParams;
 extern const MQTTConnectParams MQTTConnectParamsDefault;
@@ -149,6 +152,7 @@ typedef struct {
 	char *pTopic;					///< Pointer to the string defining the desired subscription topic.
 	QoSLevel qos;					///< Quality of service of the subscription.
 	iot_message_handler mHandler;	///< Callback to be invoked upon receipt of a message on the subscribed topic.
+	char *pFilter;					///< Optional filter over fields of JSON payloads, such as "temperature > 80 && state == \"on\"". Messages that do not match are acknowledged but not passed to mHandler. NULL delivers every message
 } MQTTSubscribeParams;
 extern const MQTTSubscribeParams MQTTSubscribeParamsDefault;
 
@@ -181,12 +185,42 @@ IoT_Error_t aws_iot_mqtt_connect(MQTTConnectParams *pParams);
  * @note Call is blocking.  In the case of a QoS 0 message the function returns
  * after the message was successfully passed to the TLS layer.  In the case of QoS 1
  * the function returns after the receipt of the PUBACK control packet.
+ * With auto-cork on (see aws_iot_mqtt_set_auto_cork) a QoS 0 message is only queued and is
+ * written together with later messages within the latency budget.
+ * With rate control on (see aws_iot_mqtt_set_rate_control) the call first waits for the allowed rate.
  *
  * @param pParams	Pointer to MQTT publish parameters
- * @return An IoT Error Type defining successful/failed publish
+ * @return An IoT Error Type defining successful/failed publish.  PUBLISH_RATE_LIMITED if the rate
+ *         does not allow the message within the command timeout
  */
 IoT_Error_t aws_iot_mqtt_publish(MQTTPublishParams *pParams);
 
+/**
+ * @brief Publish an MQTT message on a topic without waiting for the PUBACK
+ *
+ * Called to publish a QoS 0 or QoS 1 message.  Unlike aws_iot_mqtt_publish a QoS 1 message
+ * does not block until its PUBACK arrives.  The PUBACK is processed by a later call to
+ * aws_iot_mqtt_yield (or any blocking call), which frees the in-flight slot.  At most
+ * AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH messages can be awaiting a PUBACK at any given time.
+ * The call does not block on the socket either: what the network does not accept right away
+ * is kept in a send queue of AWS_IOT_MQTT_SEND_QUEUE_SIZE bytes that aws_iot_mqtt_yield drains.
+ * @note Unacknowledged messages are not retransmitted after a reconnect.
+ *
+ * @param pParams	Pointer to MQTT publish parameters
+ * @return An IoT Error Type defining successful/failed publish.  PUBLISH_WINDOW_FULL if the
+ *         in-flight limit or the window of the rate control is reached, PUBLISH_RATE_LIMITED if
+ *         the rate control allows no message yet, PUBLISH_WOULD_BLOCK if the send queue is above
+ *         its high-water mark.  In all three cases the caller should yield and retry.
+ */
+IoT_Error_t aws_iot_mqtt_publish_async(MQTTPublishParams *pParams);
+
+/**
+ * @brief Number of asynchronous QoS 1 publishes awaiting a PUBACK
+ *
+ * @return Count of messages sent by aws_iot_mqtt_publish_async that have not been acknowledged yet
+ */
+uint32_t aws_iot_mqtt_get_inflight_publish_count(void);
+
 /**
  * @brief Subscribe to an MQTT topic.
  *
@@ -280,8 +314,283 @@ bool aws_iot_is_autoreconnect_enabled(void);
  */
 IoT_Error_t aws_iot_mqtt_autoreconnect_set_status(bool value);
 
+/**
+ * @brief Traffic categories tracked by the topic statistics
+ */
+typedef enum {
+	TOPIC_STATS_PUBLISHED,		///< Messages published by this client, per topic
+	TOPIC_STATS_RECEIVED,		///< Messages received by this client, per topic
+	TOPIC_STATS_SUBSCRIPTIONS	///< Messages received by this client, per matching subscription topic filter
+} TopicStatsCategory_t;
+
+/**
+ * @brief Enable or disable the per-topic traffic statistics
+ *
+ * Disabled by default.  When enabled every publish and every received message updates count-min
+ * sketches and top-K tables of bounded size, see aws_iot_topic_stats.h.
+ *
+ * @param value set to true for enabling and false for disabling
+ */
+void aws_iot_mqtt_topic_stats_set_enabled(bool value);
+
+/**
+ * @brief Read the topics carrying the most traffic
+ *
+ * @param category		Which traffic to report on
+ * @param order			Rank by estimated messages or by estimated bytes
+ * @param pEntries		Receives up to maxEntries entries, heaviest first
+ * @param maxEntries	Size of pEntries, at most AWS_IOT_TOPIC_STATS_TOP_K entries are tracked
+ * @return Number of entries written
+ */
+uint32_t aws_iot_mqtt_get_top_topics(TopicStatsCategory_t category, TopicStatsOrder_t order,
+		TopicStatsEntry *pEntries, uint32_t maxEntries);
+
+/**
+ * @brief Clear the per-topic traffic statistics
+ *
+ * Call periodically to look at recent traffic rather than traffic since start up.
+ */
+void aws_iot_mqtt_reset_topic_stats(void);
+
+#define IOT_CALLBACK_HISTOGRAM_BUCKETS 12 ///< Bucket i counts callbacks that ran for less than 2^i ms, the last bucket all longer ones
+
+/**
+ * @brief Execution time statistics of one kind of callback
+ */
+typedef struct {
+	uint32_t histogram[IOT_CALLBACK_HISTOGRAM_BUCKETS];	///< Distribution of callback durations
+	uint32_t budget_ms;			///< Callbacks running longer than this are logged as warnings
+	uint32_t overruns;			///< Number of callbacks that exceeded the budget
+	uint32_t maxDuration_ms;	///< Longest callback seen
+} CallbackTimingStats_t;
+
+/**
+ * @brief Callback stall watchdog statistics
+ *
+ * Slow callbacks run inside aws_iot_mqtt_yield and delay reading the PINGRESP, which can end in a disconnect.
+ */
+typedef struct {
+	CallbackTimingStats_t messageHandlers;		///< Subscription callbacks
+	CallbackTimingStats_t disconnectHandler;	///< Disconnect callback
+	uint32_t yieldWatchdogTriggers;	///< Yield iterations longer than AWS_IOT_MQTT_YIELD_WATCHDOG_MARGIN_PERCENT of the keepalive interval
+	uint32_t maxYieldIteration_ms;	///< Longest yield iteration seen, from the first byte of a packet to the end of its callbacks
+} MQTTCallbackStats_t;
+
+/**
+ * @brief Set the execution time budgets of the callbacks
+ *
+ * Defaults are AWS_IOT_MQTT_MESSAGE_HANDLER_BUDGET_MS and AWS_IOT_MQTT_DISCONNECT_HANDLER_BUDGET_MS.
+ * @note A clean session connect reinitializes the client, call this after aws_iot_mqtt_connect.
+ *
+ * @param messageHandlerBudget_ms		Budget of every subscription callback
+ * @param disconnectHandlerBudget_ms	Budget of the disconnect callback
+ * @return IoT_Error_t Type defining successful/failed API call
+ */
+IoT_Error_t aws_iot_mqtt_set_callback_budgets(uint32_t messageHandlerBudget_ms, uint32_t disconnectHandlerBudget_ms);
+
+/**
+ * @brief Read the callback stall watchdog statistics
+ *
+ * @param pStats	Receives the statistics
+ * @return IoT_Error_t Type defining successful/failed API call
+ */
+IoT_Error_t aws_iot_mqtt_get_callback_stats(MQTTCallbackStats_t *pStats);
+
+/**
+ * @brief Clear the callback stall watchdog statistics, keeping the budgets
+ */
+void aws_iot_mqtt_reset_callback_stats(void);
+
+/**
+ * @brief Auto-cork write coalescing statistics
+ *
+ * The flush counters tell which limit ended each hold, the hold times what the coalescing cost in latency.
+ */
+typedef struct {
+	uint32_t flushesBySize;		///< Held bytes reached the flush threshold
+	uint32_t flushesByLatency;	///< The oldest held message used up the latency budget
+	uint32_t flushesByWindow;	///< The QoS 1 in-flight window filled up
+	uint32_t flushesBySync;		///< A blocking call or keepalive ping had to be written
+	uint32_t heldMessages;		///< Messages that were held back to share a TLS record with later ones
+	uint32_t averageHold_us;	///< Average time from holding the first message to the flush
+	uint32_t maxHold_us;		///< Longest such time
+} MQTTAutoCorkStats_t;
+
+/**
+ * @brief Hold published messages back so several are written in one TLS record
+ *
+ * Messages from aws_iot_mqtt_publish_async and QoS 0 messages from aws_iot_mqtt_publish stay in the
+ * send queue until flushThreshold_bytes are queued, the oldest has waited latencyBudget_ms, the QoS 1
+ * in-flight window is full or another packet has to be written.  aws_iot_mqtt_yield enforces the
+ * budget, an application that stops yielding should not expect held messages to leave on time.
+ * Defaults are AWS_IOT_MQTT_AUTO_CORK_LATENCY_BUDGET_MS and AWS_IOT_MQTT_AUTO_CORK_FLUSH_BYTES.
+ * @note Needs AWS_IOT_MQTT_SEND_QUEUE_SIZE > 0.  A clean session connect reinitializes the client,
+ * call this after aws_iot_mqtt_connect.
+ *
+ * @param latencyBudget_ms		Longest a message is held back, 0 turns auto-cork off
+ * @param flushThreshold_bytes	Held bytes that are written right away
+ * @return IoT_Error_t Type defining successful/failed API call
+ */
+IoT_Error_t aws_iot_mqtt_set_auto_cork(uint32_t latencyBudget_ms, uint32_t flushThreshold_bytes);
+
+/**
+ * @brief Read the auto-cork statistics
+ *
+ * @param pStats	Receives the statistics
+ * @return IoT_Error_t Type defining successful/failed API call
+ */
+IoT_Error_t aws_iot_mqtt_get_auto_cork_stats(MQTTAutoCorkStats_t *pStats);
+
+/**
+ * @brief Clear the auto-cork statistics
+ */
+void aws_iot_mqtt_reset_auto_cork_stats(void);
+
+/**
+ * @brief Wakeup statistics of the process
+ *
+ * Every time aws_iot_mqtt_yield blocks it waits for input only until the next keepalive, reconnect or
+ * auto-cork deadline.  Those timers accept some slack, AWS_IOT_MQTT_KEEPALIVE_SLACK_MS and
+ * AWS_IOT_MQTT_RECONNECT_SLACK_PERCENT, and expire together on a shared grid, so an idle device wakes up
+ * as seldom as its timers allow.  Waits of the multi-connection scheduler are counted as well.
+ */
+typedef struct {
+	uint32_t waits;					///< Times the client blocked waiting for input or a timer
+	uint32_t idleWakeups;			///< Waits that ended without input, on a timer or the end of the yield
+	uint32_t idleWakeupsPerHour;	///< idleWakeups scaled to one hour of the measured period
+	uint32_t elapsed_s;				///< Length of the measured period, from the reset or the first wait
+} MQTTWakeupStats_t;
+
+/**
+ * @brief Read the wakeup statistics
+ *
+ * @param pStats	Receives the statistics
+ * @return IoT_Error_t Type defining successful/failed API call
+ */
+IoT_Error_t aws_iot_mqtt_get_wakeup_stats(MQTTWakeupStats_t *pStats);
+
+/**
+ * @brief Clear the wakeup statistics and start a new measured period
+ */
+void aws_iot_mqtt_reset_wakeup_stats(void);
+
+/**
+ * @brief Payload filter statistics of one subscription
+ *
+ * A filter given in MQTTSubscribeParams::pFilter is compiled once when subscribing and run on every
+ * message of the subscription before its handler.  Fields are found by scanning the payload for the
+ * member names the filter uses, without parsing the rest, and the first condition that decides the
+ * outcome ends the scan, so dropping a message costs much less than handing it to the application.
+ */
+typedef struct {
+	uint32_t evaluated;			///< Messages the filter was run on
+	uint32_t matched;			///< Messages passed on to the handler
+	uint32_t dropped;			///< Messages acknowledged without calling the handler
+	uint32_t invalidPayloads;	///< Payloads that were not a JSON object, every field counted as missing
+	uint32_t hitRatePercent;	///< Share of evaluated messages that matched
+} MQTTFilterStats_t;
+
+/**
+ * @brief Read the payload filter statistics of a subscription
+ *
+ * @param pTopic	Topic the subscription was made with
+ * @param pStats	Receives the statistics, all zero for a subscription without a filter
+ * @return IoT_Error_t Type defining successful/failed API call, GENERIC_ERROR if there is no such subscription
+ */
+IoT_Error_t aws_iot_mqtt_get_filter_stats(const char *pTopic, MQTTFilterStats_t *pStats);
+
+/**
+ * @brief State and statistics of the adaptive publish rate control
+ *
+ * The rate and the QoS 1 in-flight window grow by a step every time a full window of PUBACKs arrives
+ * while the smoothed PUBACK latency stays within AWS_IOT_MQTT_RATE_CONTROL_LATENCY_TOLERANCE_PERCENT of
+ * the lowest latency seen.  Rising latency, a PUBACK missing for AWS_IOT_MQTT_RATE_CONTROL_ACK_TIMEOUT_MS
+ * or a disconnect within AWS_IOT_MQTT_RATE_CONTROL_DISCONNECT_WINDOW_MS of a publish, the way a broker
+ * throttling the client shows, cut both to AWS_IOT_MQTT_RATE_CONTROL_DECREASE_PERCENT.
+ */
+typedef struct {
+	uint32_t rate_per_s;				///< Publishes per second allowed now, 0 while rate control is off
+	uint32_t window;					///< QoS 1 publishes allowed to await a PUBACK now
+	uint32_t smoothedAckLatency_us;		///< Moving average of the PUBACK latency
+	uint32_t baseAckLatency_us;			///< Lowest PUBACK latency, the reference for rising latency
+	uint32_t increases;					///< Times rate or window grew
+	uint32_t decreasesByLatency;		///< Cuts because the PUBACK latency rose
+	uint32_t decreasesByTimeout;		///< Cuts because a PUBACK did not arrive in time
+	uint32_t decreasesByDisconnect;		///< Cuts because the connection dropped while publishing
+	uint32_t limitedPublishes;			///< Publishes refused or delayed by the rate or the window
+} MQTTRateControlStats_t;
+
+/**
+ * @brief Adapt the publish rate to how fast the broker acknowledges
+ *
+ * Applies to aws_iot_mqtt_publish and aws_iot_mqtt_publish_async.  The controller restarts at half of
+ * maxRate_per_s and half of AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH.  Defaults are
+ * AWS_IOT_MQTT_RATE_CONTROL_MIN_RATE and AWS_IOT_MQTT_RATE_CONTROL_MAX_RATE.
+ * @note A clean session connect reinitializes the client, call this after aws_iot_mqtt_connect.
+ *
+ * @param minRate_per_s	Publishes per second the rate is never cut below
+ * @param maxRate_per_s	Publishes per second the rate never grows beyond, 0 turns rate control off
+ * @return IoT_Error_t Type defining successful/failed API call
+ */
+IoT_Error_t aws_iot_mqtt_set_rate_control(uint32_t minRate_per_s, uint32_t maxRate_per_s);
+
+/**
+ * @brief Read the current rate, window and statistics of the rate control
+ *
+ * @param pStats	Receives the statistics
+ * @return IoT_Error_t Type defining successful/failed API call
+ */
+IoT_Error_t aws_iot_mqtt_get_rate_control_stats(MQTTRateControlStats_t *pStats);
+
+/**
+ * @brief Clear the rate control counters, keeping the current rate and window
+ */
+void aws_iot_mqtt_reset_rate_control_stats(void);
+
+/**
+ * @brief Output formats of the message trace
+ */
+typedef enum {
+	MQTT_TRACE_FORMAT_CHROME,	///< Chrome trace event JSON for chrome://tracing or Perfetto, one span per wait of a message
+	MQTT_TRACE_FORMAT_JSON		///< JSON array of the raw events, one per stage a message passed
+} MQTTTraceFormat_t;
+
+/**
+ * @brief Trace the lifecycle of a sample of the messages
+ *
+ * A traced publish records when aws_iot_mqtt_publish or aws_iot_mqtt_publish_async was called, when it was
+ * serialized, when its first and last byte were written and when its PUBACK arrived.  A traced incoming
+ * message records when its first byte arrived, when it was parsed, when its handler was called and when the
+ * handler returned.  The events of all connections go into a ring of AWS_IOT_MQTT_TRACE_EVENTS entries that
+ * writers fill without locks, so the gaps between them show whether a slow message waited in the send queue,
+ * in TLS and the network, at the broker or in the application.  The default is AWS_IOT_MQTT_TRACE_SAMPLE_RATE.
+ *
+ * @param sampleRate	One in this many messages is traced, 0 stops tracing
+ */
+void aws_iot_mqtt_set_trace_sampling(uint32_t sampleRate);
+
+/**
+ * @brief Write the traced events, oldest first
+ *
+ * Safe to call while messages are being traced, events still being written are left out.
+ *
+ * @param pFile		Stream to write to
+ * @param format	Output format
+ * @return IoT_Error_t Type defining successful/failed API call
+ */
+IoT_Error_t aws_iot_mqtt_dump_trace(FILE *pFile, MQTTTraceFormat_t format);
+
+/**
+ * @brief Drop the traced events
+ *
+ * @note Stop sampling first, events recorded at the same time may survive torn.
+ */
+void aws_iot_mqtt_reset_trace(void);
+
 typedef IoT_Error_t (*pConnectFunc_t)(MQTTConnectParams *pParams);
 typedef IoT_Error_t (*pPublishFunc_t)(MQTTPublishParams *pParams);
+typedef IoT_Error_t (*pPublishAsyncFunc_t)(MQTTPublishParams *pParams);
+typedef uint32_t (*pGetInflightPublishCountFunc_t)(void);
 typedef IoT_Error_t (*pSubscribeFunc_t)(MQTTSubscribeParams *pParams);
 typedef IoT_Error_t (*pUnsubscribeFunc_t)(char *pTopic);
 typedef IoT_Error_t (*pDisconnectFunc_t)(void);
@@ -309,6 +618,8 @@ typedef struct{
 	pReconnectFunc_t reconnect;			///< function implementing the iot_mqtt_reconnect function
 	pIsAutoReconnectEnabledFunc_t isAutoReconnectEnabled;	///< function implementing the iot_is_autoreconnect_enabled function
 	pSetAutoReconnectStatusFunc_t setAutoReconnectStatus;	///< function implementing the iot_mqtt_autoreconnect_set_status function
+	pPublishAsyncFunc_t publishAsync;	///< function implementing the iot_mqtt_publish_async function
+	pGetInflightPublishCountFunc_t getInflightPublishCount;	///< function implementing the iot_mqtt_get_inflight_publish_count function
 }MQTTClient_t;
 
 
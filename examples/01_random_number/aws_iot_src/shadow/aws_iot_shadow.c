@@ -16,8 +16,10 @@
 #include "aws_iot_error.h"
 #include "aws_iot_log.h"
 #include "aws_iot_shadow_actions.h"
+#include "aws_iot_shadow_conflict_retry.h"
 #include "aws_iot_shadow_json.h"
 #include "aws_iot_shadow_key.h"
+#include "aws_iot_shadow_offline.h"
 #include "aws_iot_shadow_records.h"
 
 const ShadowParameters_t ShadowParametersDefault = {
@@ -57,6 +59,8 @@ IoT_Error_t aws_iot_shadow_init(MQTTClient_t *pClient) {
 	resetClientTokenSequenceNum();
 	aws_iot_shadow_reset_last_received_version();
 	initDeltaTokens();
+	iot_shadow_conflict_retry_reset();
+	iot_shadow_offline_reset();
 	return NONE_ERROR;
 }
 
@@ -115,9 +119,27 @@ IoT_Error_t aws_iot_shadow_register_delta(MQTTClient_t *pClient, jsonStruct_t *p
 	return rc;
 }
 
+IoT_Error_t aws_iot_shadow_register_delta_batch(MQTTClient_t *pClient, fpDeltaBatchCallback_t callback,
+		void *pContextData) {
+	if (!(pClient->isConnected())) {
+		return CONNECTION_ERROR;
+	}
+
+	return registerDeltaBatchCallback(callback, pContextData);
+}
+
 IoT_Error_t aws_iot_shadow_yield(MQTTClient_t *pClient, int timeout) {
+	IoT_Error_t rc;
+
 	HandleExpiredResponseCallbacks();
-	return pClient->yield(timeout);
+	iot_shadow_conflict_retry_process(pClient);
+	rc = pClient->yield(timeout);
+
+	// a reconnect made by the yield has resubscribed before it returned
+	if (pClient->isConnected()) {
+		iot_shadow_offline_flush(pClient);
+	}
+	return rc;
 }
 
 IoT_Error_t aws_iot_shadow_disconnect(MQTTClient_t *pClient) {
@@ -130,11 +152,27 @@ IoT_Error_t aws_iot_shadow_update(MQTTClient_t *pClient, const char *pThingName,
 	IoT_Error_t ret_val = NONE_ERROR;
 
 	if (!(pClient->isConnected())) {
-		return CONNECTION_ERROR;
+		return iot_shadow_offline_update(pThingName, pJsonString, callback, pContextData, timeout_seconds,
+				isPersistentSubscribe);
 	}
 
-	ret_val = iot_shadow_action(pClient, pThingName, SHADOW_UPDATE, pJsonString, callback, pContextData,
-			timeout_seconds, isPersistentSubscribe);
+	// sent behind the pending update, not ahead of the older values in it
+	if (iot_shadow_offline_is_pending(pThingName)) {
+		ret_val = iot_shadow_offline_update(pThingName, pJsonString, callback, pContextData, timeout_seconds,
+				isPersistentSubscribe);
+		if (NONE_ERROR == ret_val) {
+			iot_shadow_offline_flush(pClient);
+		}
+		return ret_val;
+	}
+
+	if (iot_shadow_conflict_retry_is_enabled()) {
+		ret_val = iot_shadow_conflict_retry_update(pClient, pThingName, pJsonString, callback, pContextData,
+				timeout_seconds, isPersistentSubscribe);
+	} else {
+		ret_val = iot_shadow_action(pClient, pThingName, SHADOW_UPDATE, pJsonString, callback, pContextData,
+				timeout_seconds, isPersistentSubscribe);
+	}
 
 	return ret_val;
 }
@@ -28,7 +28,6 @@ IoT_Error_t iot_shadow_action(MQTTClient_t *pClient, const char *pThingName, Sha
 	bool isCallbackPresent = false;
 	bool isClientTokenPresent = false;
 	bool isAckWaitListFree = false;
-	uint8_t indexAckWaitList;
 
 	if(pClient == NULL || pThingName == NULL || pJsonDocumentToBeSent == NULL){
 		return NULL_VALUE_ERROR;
@@ -42,9 +41,7 @@ IoT_Error_t iot_shadow_action(MQTTClient_t *pClient, const char *pThingName, Sha
 	isClientTokenPresent = extractClientToken(pJsonDocumentToBeSent, extractedClientToken);
 
 	if (isClientTokenPresent && isCallbackPresent) {
-		if (getNextFreeIndexOfAckWaitList(&indexAckWaitList)) {
-			isAckWaitListFree = true;
-		}
+		isAckWaitListFree = hasFreeAckWaitSlot();
 
 		if(isAckWaitListFree) {
 			if (!isSubscriptionPresent(pThingName, action)) {
@@ -64,7 +61,7 @@ IoT_Error_t iot_shadow_action(MQTTClient_t *pClient, const char *pThingName, Sha
 	}
 
 	if (isClientTokenPresent && isCallbackPresent && ret_val == NONE_ERROR && isAckWaitListFree) {
-		addToAckWaitList(indexAckWaitList, pThingName, action, extractedClientToken, callback, pCallbackContext,
+		ret_val = addToAckWaitList(pThingName, action, extractedClientToken, callback, pCallbackContext,
 				timeout_seconds);
 	}
 	return ret_val;
@@ -0,0 +1,220 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "aws_iot_shadow_bulk_get.h"
+
+#include <string.h>
+
+#include "timer_interface.h"
+#include "aws_iot_log.h"
+#include "aws_iot_shadow_json.h"
+#include "aws_iot_shadow_key.h"
+#include "aws_iot_shadow_records.h"
+#include "aws_iot_request.h"
+#include "aws_iot_config.h"
+
+#if AWS_IOT_REQUEST_MAX_PENDING < AWS_IOT_SHADOW_BULK_GET_MAX_WINDOW
+#error "AWS_IOT_REQUEST_MAX_PENDING must be at least AWS_IOT_SHADOW_BULK_GET_MAX_WINDOW"
+#endif
+
+const ShadowBulkGetParams_t ShadowBulkGetParamsDefault = {
+		.pThingNames = NULL,
+		.thingCount = 0,
+		.windowSize = AWS_IOT_SHADOW_BULK_GET_MAX_WINDOW,
+		.timeout_ms = 5000,
+		.callback = NULL,
+		.pContextData = NULL,
+		.isPersistentSubscribe = false
+};
+
+// GET requests in flight, correlated on the clientToken. Thing indexes are kept like the engine's table
+static RequestEngine_t bulkGetEngine;
+static uint32_t requestThingIndexes[AWS_IOT_REQUEST_MAX_PENDING];
+
+// Set while aws_iot_shadow_bulk_get runs, the acknowledgment handler has no context pointer
+static const ShadowBulkGetParams_t *pActiveParams = NULL;
+static ShadowBulkGetStats_t activeStats;
+
+static bool isTopicEndingWith(const char *pTopicName, uint16_t topicNameLen, const char *pSuffix) {
+	size_t suffixLen = strlen(pSuffix);
+	if (topicNameLen < suffixLen) {
+		return false;
+	}
+	return (0 == memcmp(pTopicName + topicNameLen - suffixLen, pSuffix, suffixLen));
+}
+
+static void completeRequest(const char *pCorrelationId, RequestStatus_t status, const char *pPayload,
+		size_t payloadLen, void *pContextData) {
+	uint32_t thingIndex = *(uint32_t *) pContextData;
+	Shadow_Ack_Status_t ackStatus = SHADOW_ACK_TIMEOUT;
+
+	if (REQUEST_ACCEPTED == status) {
+		ackStatus = SHADOW_ACK_ACCEPTED;
+		activeStats.accepted++;
+	} else if (REQUEST_REJECTED == status) {
+		ackStatus = SHADOW_ACK_REJECTED;
+		activeStats.rejected++;
+	} else {
+		activeStats.timedOut++;
+	}
+
+	if (NULL != pActiveParams->callback) {
+		pActiveParams->callback(pActiveParams->pThingNames[thingIndex], SHADOW_GET, ackStatus, pPayload,
+				pActiveParams->pContextData);
+	}
+}
+
+bool iot_shadow_bulk_get_handle_ack(const char *pTopicName, uint16_t topicNameLen, const char *pClientToken,
+		const char *pReceivedJsonDocument) {
+	RequestStatus_t status;
+
+	if (NULL == pActiveParams) {
+		return false;
+	}
+
+	if (isTopicEndingWith(pTopicName, topicNameLen, "/get/accepted")) {
+		status = REQUEST_ACCEPTED;
+	} else if (isTopicEndingWith(pTopicName, topicNameLen, "/get/rejected")) {
+		status = REQUEST_REJECTED;
+	} else {
+		return false;
+	}
+
+	return aws_iot_request_complete(&bulkGetEngine, pClientToken, status, pReceivedJsonDocument,
+			strlen(pReceivedJsonDocument));
+}
+
+static IoT_Error_t sendGetRequest(uint32_t thingIndex, uint32_t timeout_ms) {
+	IoT_Error_t rc;
+	int16_t slot = aws_iot_request_next_slot(&bulkGetEngine);
+	char getRequestJsonBuf[MAX_SIZE_CLIENT_TOKEN_CLIENT_SEQUENCE];
+	char clientToken[MAX_SIZE_CLIENT_ID_WITH_SEQUENCE];
+
+	if (slot < 0) {
+		return REQUEST_WINDOW_FULL;
+	}
+
+	iot_shadow_get_request_json(getRequestJsonBuf);
+	if (!extractClientToken(getRequestJsonBuf, clientToken)) {
+		return GENERIC_ERROR;
+	}
+
+	rc = publishToShadowAction(pActiveParams->pThingNames[thingIndex], SHADOW_GET, getRequestJsonBuf);
+	if (NONE_ERROR != rc) {
+		return rc;
+	}
+
+	requestThingIndexes[slot] = thingIndex;
+	return aws_iot_request_add(&bulkGetEngine, clientToken, timeout_ms, completeRequest, &requestThingIndexes[slot],
+			NULL);
+}
+
+IoT_Error_t aws_iot_shadow_bulk_get(MQTTClient_t *pClient, const ShadowBulkGetParams_t *pParams,
+		ShadowBulkGetStats_t *pStats) {
+	IoT_Error_t rc = NONE_ERROR;
+	RequestEngineParams_t requestParams = RequestEngineParamsDefault;
+	uint32_t nextThing = 0;
+	bool isNewSubscription = false;
+	Timer settleTimer;
+	uint64_t startTime_us;
+
+	if (NULL == pClient || NULL == pParams || (NULL == pParams->pThingNames && 0 != pParams->thingCount)) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if (!(pClient->isConnected())) {
+		return CONNECTION_ERROR;
+	}
+
+	if (NULL != pActiveParams) {
+		// Called from a callback of a bulk get in progress
+		return GENERIC_ERROR;
+	}
+
+	requestParams.pCorrelationKey = SHADOW_CLIENT_TOKEN_STRING;
+	requestParams.pAcceptedSuffix = "/get/accepted";
+	requestParams.pRejectedSuffix = "/get/rejected";
+	requestParams.window = pParams->windowSize;
+	if (0 == requestParams.window || AWS_IOT_SHADOW_BULK_GET_MAX_WINDOW < requestParams.window) {
+		requestParams.window = AWS_IOT_SHADOW_BULK_GET_MAX_WINDOW;
+	}
+	// Also drops requests a bulk get that stopped on an error left behind
+	aws_iot_request_init(&bulkGetEngine, &requestParams);
+	memset(&activeStats, 0, sizeof(activeStats));
+
+	rc = subscribeToBulkGetAcks(&isNewSubscription);
+	if (NONE_ERROR != rc) {
+		return rc;
+	}
+	pActiveParams = pParams;
+
+	if (isNewSubscription) {
+		// let the subscriptions take effect, serving other traffic instead of spinning
+		InitTimer(&settleTimer);
+		countdown_ms(&settleTimer, AWS_IOT_SHADOW_BULK_GET_SETTLE_MS);
+		while (NONE_ERROR == rc && !expired(&settleTimer)) {
+			rc = pClient->yield(AWS_IOT_SHADOW_BULK_GET_YIELD_TIMEOUT_MS);
+		}
+	}
+
+	startTime_us = timestamp_us();
+
+	while (NONE_ERROR == rc
+			&& (nextThing < pParams->thingCount || 0 != aws_iot_request_pending_count(&bulkGetEngine))) {
+		while (nextThing < pParams->thingCount && aws_iot_request_has_capacity(&bulkGetEngine)) {
+			if (strlen(pParams->pThingNames[nextThing]) >= MAX_SIZE_OF_THING_NAME) {
+				WARN("Thing name %s is too long, not requesting its shadow", pParams->pThingNames[nextThing]);
+				activeStats.skipped++;
+				nextThing++;
+				continue;
+			}
+			rc = sendGetRequest(nextThing, pParams->timeout_ms);
+			if (NONE_ERROR != rc) {
+				break;
+			}
+			nextThing++;
+		}
+
+		if (NONE_ERROR == rc) {
+			rc = pClient->yield(AWS_IOT_SHADOW_BULK_GET_YIELD_TIMEOUT_MS);
+		}
+		aws_iot_request_process_timeouts(&bulkGetEngine);
+	}
+
+	activeStats.maxInFlight = aws_iot_request_get_stats(&bulkGetEngine)->maxPending;
+	activeStats.elapsed_us = timestamp_us() - startTime_us;
+	if (0 != activeStats.elapsed_us) {
+		activeStats.responsesPerSecond = (uint32_t) (((uint64_t) (activeStats.accepted + activeStats.rejected)
+				* 1000000ULL) / activeStats.elapsed_us);
+	}
+
+	if (NONE_ERROR != rc) {
+		ERROR("Bulk get stopped after %u of %u things, error %d", nextThing, pParams->thingCount, rc);
+	}
+	DEBUG("Bulk get: %u accepted, %u rejected, %u timed out in %llu us", activeStats.accepted,
+			activeStats.rejected, activeStats.timedOut, (unsigned long long) activeStats.elapsed_us);
+
+	pActiveParams = NULL;
+
+	if (!pParams->isPersistentSubscribe) {
+		unsubscribeFromBulkGetAcks();
+	}
+
+	if (NULL != pStats) {
+		*pStats = activeStats;
+	}
+
+	return rc;
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef SRC_SHADOW_AWS_IOT_SHADOW_BULK_GET_H_
+#define SRC_SHADOW_AWS_IOT_SHADOW_BULK_GET_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "aws_iot_shadow_interface.h"
+
+bool iot_shadow_bulk_get_handle_ack(const char *pTopicName, uint16_t topicNameLen, const char *pClientToken,
+		const char *pReceivedJsonDocument);
+
+#endif /* SRC_SHADOW_AWS_IOT_SHADOW_BULK_GET_H_ */
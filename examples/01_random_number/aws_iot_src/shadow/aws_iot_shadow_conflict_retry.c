@@ -0,0 +1,226 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "aws_iot_shadow_conflict_retry.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "timer_interface.h"
+#include "aws_iot_log.h"
+#include "aws_iot_shadow_actions.h"
+#include "aws_iot_shadow_json.h"
+#include "aws_iot_config.h"
+
+const ShadowConflictRetryPolicy_t ShadowConflictRetryPolicyDefault = {
+		.maxRetries = 3,
+		.initialBackoff_ms = 100,
+		.maxBackoff_ms = 2000
+};
+
+typedef enum {
+	CONFLICT_RETRY_FREE,
+	CONFLICT_RETRY_WAIT_UPDATE_ACK,		///< update sent, waiting for accepted/rejected
+	CONFLICT_RETRY_BACKOFF,				///< conflict received, waiting before fetching the current version
+	CONFLICT_RETRY_SEND_GET,			///< backoff over, get to be sent from the next yield
+	CONFLICT_RETRY_WAIT_GET_ACK,		///< waiting for the current document
+	CONFLICT_RETRY_SEND_UPDATE			///< current version known, update to be resent from the next yield
+} ConflictRetryState_t;
+
+typedef struct {
+	ConflictRetryState_t state;
+	char thingName[MAX_SIZE_OF_THING_NAME];
+	char jsonDocument[AWS_IOT_MQTT_TX_BUF_LEN];
+	fpActionCallback_t callback;
+	void *pContextData;
+	uint8_t timeout_seconds;
+	bool isPersistentSubscribe;
+	uint8_t retryCount;
+	uint32_t backoff_ms;
+	uint32_t currentVersion;
+	Timer backoffTimer;
+} ConflictRetryRecord_t;
+
+static ConflictRetryRecord_t retryRecords[AWS_IOT_SHADOW_CONFLICT_RETRY_SLOTS];
+static ShadowConflictRetryPolicy_t retryPolicy;
+
+void aws_iot_shadow_set_conflict_retry_policy(const ShadowConflictRetryPolicy_t *pPolicy) {
+	if (NULL == pPolicy) {
+		retryPolicy.maxRetries = 0;
+	} else {
+		retryPolicy = *pPolicy;
+	}
+}
+
+bool iot_shadow_conflict_retry_is_enabled(void) {
+	return (0 != retryPolicy.maxRetries);
+}
+
+void iot_shadow_conflict_retry_reset(void) {
+	uint8_t i;
+	for (i = 0; i < AWS_IOT_SHADOW_CONFLICT_RETRY_SLOTS; i++) {
+		retryRecords[i].state = CONFLICT_RETRY_FREE;
+	}
+}
+
+static void completeRecord(ConflictRetryRecord_t *pRecord, Shadow_Ack_Status_t status,
+		const char *pReceivedJsonDocument) {
+	pRecord->state = CONFLICT_RETRY_FREE;
+	pRecord->callback(pRecord->thingName, SHADOW_UPDATE, status, pReceivedJsonDocument, pRecord->pContextData);
+}
+
+// Exponential backoff with jitter, so devices colliding on one shadow do not retry in lockstep
+static void startBackoff(ConflictRetryRecord_t *pRecord) {
+	uint32_t wait_ms = pRecord->backoff_ms / 2;
+	wait_ms += (uint32_t) (rand() % (pRecord->backoff_ms - wait_ms + 1));
+
+	InitTimer(&(pRecord->backoffTimer));
+	countdown_ms(&(pRecord->backoffTimer), wait_ms);
+	pRecord->state = CONFLICT_RETRY_BACKOFF;
+
+	pRecord->backoff_ms *= 2;
+	if (pRecord->backoff_ms > retryPolicy.maxBackoff_ms) {
+		pRecord->backoff_ms = retryPolicy.maxBackoff_ms;
+	}
+}
+
+// The acknowledgment callbacks only change state, the requests go out from aws_iot_shadow_yield
+static void updateAckCallback(const char *pThingName, ShadowActions_t action, Shadow_Ack_Status_t status,
+		const char *pReceivedJsonDocument, void *pContextData) {
+	ConflictRetryRecord_t *pRecord = (ConflictRetryRecord_t *) pContextData;
+
+	if (SHADOW_ACK_REJECTED == status && pRecord->retryCount < retryPolicy.maxRetries
+			&& isVersionConflict(pReceivedJsonDocument)) {
+		pRecord->retryCount++;
+		DEBUG("Version conflict on %s, retry %u of %u", pThingName, pRecord->retryCount, retryPolicy.maxRetries);
+		startBackoff(pRecord);
+		return;
+	}
+
+	completeRecord(pRecord, status, pReceivedJsonDocument);
+}
+
+static void getAckCallback(const char *pThingName, ShadowActions_t action, Shadow_Ack_Status_t status,
+		const char *pReceivedJsonDocument, void *pContextData) {
+	ConflictRetryRecord_t *pRecord = (ConflictRetryRecord_t *) pContextData;
+
+	if (SHADOW_ACK_ACCEPTED == status && extractTopLevelVersionNumber(pReceivedJsonDocument, &(pRecord->currentVersion))) {
+		pRecord->state = CONFLICT_RETRY_SEND_UPDATE;
+		return;
+	}
+
+	WARN("Could not fetch the current version of %s, giving up the update", pThingName);
+	completeRecord(pRecord, (SHADOW_ACK_TIMEOUT == status) ? SHADOW_ACK_TIMEOUT : SHADOW_ACK_REJECTED,
+			pReceivedJsonDocument);
+}
+
+static IoT_Error_t sendGet(MQTTClient_t *pClient, ConflictRetryRecord_t *pRecord) {
+	char getRequestJsonBuf[MAX_SIZE_CLIENT_TOKEN_CLIENT_SEQUENCE];
+
+	iot_shadow_get_request_json(getRequestJsonBuf);
+	pRecord->state = CONFLICT_RETRY_WAIT_GET_ACK;
+
+	return iot_shadow_action(pClient, pRecord->thingName, SHADOW_GET, getRequestJsonBuf, getAckCallback, pRecord,
+			pRecord->timeout_seconds, pRecord->isPersistentSubscribe);
+}
+
+static IoT_Error_t resendUpdate(MQTTClient_t *pClient, ConflictRetryRecord_t *pRecord) {
+	IoT_Error_t rc;
+
+	// the pending fields are kept as they are, the service merges them into the current document
+	rc = updateVersionAndClientToken(pRecord->jsonDocument, sizeof(pRecord->jsonDocument), pRecord->currentVersion);
+	if (NONE_ERROR != rc) {
+		return rc;
+	}
+
+	pRecord->state = CONFLICT_RETRY_WAIT_UPDATE_ACK;
+
+	return iot_shadow_action(pClient, pRecord->thingName, SHADOW_UPDATE, pRecord->jsonDocument, updateAckCallback,
+			pRecord, pRecord->timeout_seconds, pRecord->isPersistentSubscribe);
+}
+
+void iot_shadow_conflict_retry_process(MQTTClient_t *pClient) {
+	uint8_t i;
+	IoT_Error_t rc;
+	ConflictRetryRecord_t *pRecord;
+
+	for (i = 0; i < AWS_IOT_SHADOW_CONFLICT_RETRY_SLOTS; i++) {
+		pRecord = &retryRecords[i];
+
+		if (CONFLICT_RETRY_BACKOFF == pRecord->state && expired(&(pRecord->backoffTimer))) {
+			pRecord->state = CONFLICT_RETRY_SEND_GET;
+		}
+
+		if (CONFLICT_RETRY_SEND_GET == pRecord->state) {
+			rc = sendGet(pClient, pRecord);
+		} else if (CONFLICT_RETRY_SEND_UPDATE == pRecord->state) {
+			rc = resendUpdate(pClient, pRecord);
+		} else {
+			continue;
+		}
+
+		if (NONE_ERROR != rc) {
+			ERROR("Version conflict retry of %s failed, error %d", pRecord->thingName, rc);
+			completeRecord(pRecord, SHADOW_ACK_TIMEOUT, "");
+		}
+	}
+}
+
+static ConflictRetryRecord_t *getFreeRecord(void) {
+	uint8_t i;
+	for (i = 0; i < AWS_IOT_SHADOW_CONFLICT_RETRY_SLOTS; i++) {
+		if (CONFLICT_RETRY_FREE == retryRecords[i].state) {
+			return &retryRecords[i];
+		}
+	}
+	return NULL;
+}
+
+IoT_Error_t iot_shadow_conflict_retry_update(MQTTClient_t *pClient, const char *pThingName, const char *pJsonString,
+		fpActionCallback_t callback, void *pContextData, uint8_t timeout_seconds, bool isPersistentSubscribe) {
+	IoT_Error_t rc;
+	ConflictRetryRecord_t *pRecord = NULL;
+
+	if (NULL != callback && NULL != pThingName && NULL != pJsonString && strlen(pThingName) < MAX_SIZE_OF_THING_NAME
+			&& strlen(pJsonString) < AWS_IOT_MQTT_TX_BUF_LEN && isVersionedUpdateWithClientToken(pJsonString)) {
+		pRecord = getFreeRecord();
+		if (NULL == pRecord) {
+			DEBUG("No free conflict retry slot, sending the update without retry");
+		}
+	}
+
+	if (NULL == pRecord) {
+		return iot_shadow_action(pClient, pThingName, SHADOW_UPDATE, pJsonString, callback, pContextData,
+				timeout_seconds, isPersistentSubscribe);
+	}
+
+	strcpy(pRecord->thingName, pThingName);
+	strcpy(pRecord->jsonDocument, pJsonString);
+	pRecord->callback = callback;
+	pRecord->pContextData = pContextData;
+	pRecord->timeout_seconds = timeout_seconds;
+	pRecord->isPersistentSubscribe = isPersistentSubscribe;
+	pRecord->retryCount = 0;
+	pRecord->backoff_ms = retryPolicy.initialBackoff_ms;
+	pRecord->state = CONFLICT_RETRY_WAIT_UPDATE_ACK;
+
+	rc = iot_shadow_action(pClient, pThingName, SHADOW_UPDATE, pRecord->jsonDocument, updateAckCallback, pRecord,
+			timeout_seconds, isPersistentSubscribe);
+	if (NONE_ERROR != rc) {
+		pRecord->state = CONFLICT_RETRY_FREE;
+	}
+
+	return rc;
+}
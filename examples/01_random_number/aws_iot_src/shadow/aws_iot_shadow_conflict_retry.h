@@ -0,0 +1,30 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef SRC_SHADOW_AWS_IOT_SHADOW_CONFLICT_RETRY_H_
+#define SRC_SHADOW_AWS_IOT_SHADOW_CONFLICT_RETRY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "aws_iot_shadow_interface.h"
+
+bool iot_shadow_conflict_retry_is_enabled(void);
+IoT_Error_t iot_shadow_conflict_retry_update(MQTTClient_t *pClient, const char *pThingName, const char *pJsonString,
+		fpActionCallback_t callback, void *pContextData, uint8_t timeout_seconds, bool isPersistentSubscribe);
+void iot_shadow_conflict_retry_process(MQTTClient_t *pClient);
+void iot_shadow_conflict_retry_reset(void);
+
+#endif /* SRC_SHADOW_AWS_IOT_SHADOW_CONFLICT_RETRY_H_ */
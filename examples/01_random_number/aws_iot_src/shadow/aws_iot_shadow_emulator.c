@@ -0,0 +1,1000 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "aws_iot_shadow_emulator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "jsmn.h"
+#include "timer_interface.h"
+#include "aws_iot_log.h"
+#include "aws_iot_shadow_interface.h"
+#include "aws_iot_config.h"
+
+const ShadowEmulatorParams_t ShadowEmulatorParamsDefault = {
+		.responseLatency_ms = 0,
+		.latencyJitter_ms = 0,
+		.rejectPercent = 0,
+		.injectedRejectCode = 500,
+		.dropPercent = 0
+};
+
+#define EMULATOR_SHADOW_TOPIC_PREFIX "$aws/things/"
+#define EMULATOR_MAX_SUBSCRIPTIONS AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS
+
+typedef struct {
+	char thingName[MAX_SIZE_OF_THING_NAME];
+	bool isInUse;
+	bool exists;	///< false before the first update and after a delete, the version is kept
+	uint32_t version;
+	char desired[AWS_IOT_SHADOW_EMULATOR_MAX_STATE_LEN];
+	char reported[AWS_IOT_SHADOW_EMULATOR_MAX_STATE_LEN];
+} EmulatedShadow_t;
+
+typedef struct {
+	bool isInUse;
+	uint64_t deliverAt_us;
+	uint32_t sequence;	///< Keeps messages with the same delivery time in publishing order
+	char topic[MAX_SHADOW_TOPIC_LENGTH_BYTES];
+	char payload[AWS_IOT_MQTT_RX_BUF_LEN];
+	uint32_t payloadLen;
+} EmulatedMessage_t;
+
+typedef struct {
+	const char *pTopic;
+	iot_message_handler handler;
+} EmulatedSubscription_t;
+
+typedef struct {
+	const char *pJson;
+	jsmntok_t *pTokens;
+	int32_t tokenCount;
+} ParsedJson_t;
+
+typedef struct {
+	char *pBuf;
+	size_t len;
+	size_t max;
+	bool isTruncated;
+} JsonWriter_t;
+
+static const char *actionNames[] = { "get", "update", "delete" };
+
+static ShadowEmulatorParams_t emulatorParams;
+static ShadowEmulatorStats_t emulatorStats;
+static bool isEmulatorConnected = false;
+static bool isEmulatorAutoReconnectEnabled = false;
+
+static EmulatedShadow_t shadows[AWS_IOT_SHADOW_EMULATOR_MAX_THINGS];
+static EmulatedSubscription_t subscriptions[EMULATOR_MAX_SUBSCRIPTIONS];
+static EmulatedMessage_t messages[AWS_IOT_SHADOW_EMULATOR_QUEUE_DEPTH];
+static uint32_t queuedMessages = 0;
+static uint32_t nextSequence = 0;
+
+static char requestBuf[AWS_IOT_MQTT_TX_BUF_LEN + 1];
+static jsmntok_t requestTokens[MAX_JSON_TOKEN_EXPECTED];
+static jsmntok_t leftTokens[MAX_JSON_TOKEN_EXPECTED];
+static jsmntok_t rightTokens[MAX_JSON_TOKEN_EXPECTED];
+static char mergedDesired[AWS_IOT_SHADOW_EMULATOR_MAX_STATE_LEN];
+static char mergedReported[AWS_IOT_SHADOW_EMULATOR_MAX_STATE_LEN];
+
+// A subscription callback may publish, so a message is copied out of the queue before delivery
+static char deliveryTopic[MAX_SHADOW_TOPIC_LENGTH_BYTES];
+static char deliveryPayload[AWS_IOT_MQTT_RX_BUF_LEN];
+
+// ============================================================================
+// JSON helpers, on token arrays of their own so the shadow client's parse is never disturbed
+// ============================================================================
+
+static bool parseJson(ParsedJson_t *pParsed, const char *pJson, jsmntok_t *pTokens) {
+	jsmn_parser parser;
+
+	jsmn_init(&parser);
+	pParsed->pJson = pJson;
+	pParsed->pTokens = pTokens;
+	pParsed->tokenCount = jsmn_parse(&parser, pJson, strlen(pJson), pTokens, MAX_JSON_TOKEN_EXPECTED);
+
+	return (pParsed->tokenCount > 0 && JSMN_OBJECT == pTokens[0].type);
+}
+
+static int32_t nextSibling(const ParsedJson_t *pParsed, int32_t i) {
+	int32_t j = i + 1;
+	while (j < pParsed->tokenCount && pParsed->pTokens[j].start < pParsed->pTokens[i].end) {
+		j++;
+	}
+	return j;
+}
+
+static bool isMember(const ParsedJson_t *pParsed, int32_t object, int32_t key) {
+	return (key < pParsed->tokenCount && pParsed->pTokens[key].start < pParsed->pTokens[object].end);
+}
+
+static bool isTokenText(const ParsedJson_t *pParsed, int32_t i, const char *pText, size_t textLen) {
+	const jsmntok_t *pToken = &(pParsed->pTokens[i]);
+	return ((size_t) (pToken->end - pToken->start) == textLen
+			&& 0 == memcmp(pParsed->pJson + pToken->start, pText, textLen));
+}
+
+static bool isObject(const ParsedJson_t *pParsed, int32_t i) {
+	return (i >= 0 && i < pParsed->tokenCount && JSMN_OBJECT == pParsed->pTokens[i].type);
+}
+
+static bool isNull(const ParsedJson_t *pParsed, int32_t i) {
+	return (JSMN_PRIMITIVE == pParsed->pTokens[i].type && isTokenText(pParsed, i, "null", 4));
+}
+
+// Returns the token of the value of pKey in the object, -1 if it has no such member
+static int32_t findMember(const ParsedJson_t *pParsed, int32_t object, const char *pKey, size_t keyLen) {
+	int32_t key;
+
+	if (!isObject(pParsed, object)) {
+		return -1;
+	}
+
+	for (key = object + 1; isMember(pParsed, object, key); key = nextSibling(pParsed, key + 1)) {
+		if (isTokenText(pParsed, key, pKey, keyLen)) {
+			return key + 1;
+		}
+	}
+
+	return -1;
+}
+
+static int32_t findMemberOfKey(const ParsedJson_t *pParsed, int32_t object, const ParsedJson_t *pKeyJson, int32_t key) {
+	const jsmntok_t *pKey = &(pKeyJson->pTokens[key]);
+	return findMember(pParsed, object, pKeyJson->pJson + pKey->start, (size_t) (pKey->end - pKey->start));
+}
+
+static bool isValueEqual(const ParsedJson_t *pLeft, int32_t left, const ParsedJson_t *pRight, int32_t right) {
+	return (pLeft->pTokens[left].type == pRight->pTokens[right].type
+			&& isTokenText(pLeft, left, pRight->pJson + pRight->pTokens[right].start,
+					(size_t) (pRight->pTokens[right].end - pRight->pTokens[right].start)));
+}
+
+static void initWriter(JsonWriter_t *pWriter, char *pBuf, size_t max) {
+	pWriter->pBuf = pBuf;
+	pWriter->len = 0;
+	pWriter->max = max;
+	pWriter->isTruncated = false;
+	pBuf[0] = '\0';
+}
+
+static void writeBytes(JsonWriter_t *pWriter, const char *pBytes, size_t len) {
+	if (pWriter->isTruncated || pWriter->len + len >= pWriter->max) {
+		pWriter->isTruncated = true;
+		return;
+	}
+	memcpy(pWriter->pBuf + pWriter->len, pBytes, len);
+	pWriter->len += len;
+	pWriter->pBuf[pWriter->len] = '\0';
+}
+
+static void writeString(JsonWriter_t *pWriter, const char *pString) {
+	writeBytes(pWriter, pString, strlen(pString));
+}
+
+static void rewindWriter(JsonWriter_t *pWriter, size_t len) {
+	if (!pWriter->isTruncated) {
+		pWriter->len = len;
+		pWriter->pBuf[len] = '\0';
+	}
+}
+
+static void writeToken(JsonWriter_t *pWriter, const ParsedJson_t *pParsed, int32_t i) {
+	const jsmntok_t *pToken = &(pParsed->pTokens[i]);
+
+	// string tokens exclude the quotes
+	if (JSMN_STRING == pToken->type) {
+		writeBytes(pWriter, "\"", 1);
+	}
+	writeBytes(pWriter, pParsed->pJson + pToken->start, (size_t) (pToken->end - pToken->start));
+	if (JSMN_STRING == pToken->type) {
+		writeBytes(pWriter, "\"", 1);
+	}
+}
+
+static void writeKey(JsonWriter_t *pWriter, uint32_t *pMembers, const ParsedJson_t *pParsed, int32_t key) {
+	if (0 != *pMembers) {
+		writeBytes(pWriter, ",", 1);
+	}
+	writeToken(pWriter, pParsed, key);
+	writeBytes(pWriter, ":", 1);
+	(*pMembers)++;
+}
+
+static void mergeObject(JsonWriter_t *pWriter, const ParsedJson_t *pOld, int32_t oldObject, const ParsedJson_t *pNew,
+		int32_t newObject);
+
+// Objects in an update lose their null members on the way into the document
+static void writeValue(JsonWriter_t *pWriter, const ParsedJson_t *pParsed, int32_t i) {
+	if (isObject(pParsed, i)) {
+		mergeObject(pWriter, NULL, -1, pParsed, i);
+	} else {
+		writeToken(pWriter, pParsed, i);
+	}
+}
+
+// Merges an update section into a document section the way the service does: members of the update
+// replace those of the document, null removes them and objects present in both are merged recursively
+static void mergeObject(JsonWriter_t *pWriter, const ParsedJson_t *pOld, int32_t oldObject, const ParsedJson_t *pNew,
+		int32_t newObject) {
+	uint32_t members = 0;
+	int32_t key;
+	int32_t newValue;
+
+	writeBytes(pWriter, "{", 1);
+
+	if (oldObject >= 0) {
+		for (key = oldObject + 1; isMember(pOld, oldObject, key); key = nextSibling(pOld, key + 1)) {
+			newValue = findMemberOfKey(pNew, newObject, pOld, key);
+			if (newValue < 0) {
+				writeKey(pWriter, &members, pOld, key);
+				writeToken(pWriter, pOld, key + 1);
+			} else if (isNull(pNew, newValue)) {
+				continue;
+			} else if (isObject(pOld, key + 1) && isObject(pNew, newValue)) {
+				writeKey(pWriter, &members, pOld, key);
+				mergeObject(pWriter, pOld, key + 1, pNew, newValue);
+			} else {
+				writeKey(pWriter, &members, pOld, key);
+				writeValue(pWriter, pNew, newValue);
+			}
+		}
+	}
+
+	for (key = newObject + 1; isMember(pNew, newObject, key); key = nextSibling(pNew, key + 1)) {
+		if ((oldObject >= 0 && findMemberOfKey(pOld, oldObject, pNew, key) >= 0) || isNull(pNew, key + 1)) {
+			continue;
+		}
+		writeKey(pWriter, &members, pNew, key);
+		writeValue(pWriter, pNew, key + 1);
+	}
+
+	writeBytes(pWriter, "}", 1);
+}
+
+// Writes the members of desired that reported lacks or holds with another value, returns their number
+static uint32_t writeDelta(JsonWriter_t *pWriter, const ParsedJson_t *pDesired, int32_t desiredObject,
+		const ParsedJson_t *pReported, int32_t reportedObject) {
+	uint32_t members = 0;
+	uint32_t membersBefore;
+	size_t lenBefore;
+	int32_t key;
+	int32_t reportedValue;
+
+	writeBytes(pWriter, "{", 1);
+
+	for (key = desiredObject + 1; isMember(pDesired, desiredObject, key); key = nextSibling(pDesired, key + 1)) {
+		reportedValue = findMemberOfKey(pReported, reportedObject, pDesired, key);
+		if (isObject(pDesired, key + 1) && isObject(pReported, reportedValue)) {
+			lenBefore = pWriter->len;
+			membersBefore = members;
+			writeKey(pWriter, &members, pDesired, key);
+			if (0 == writeDelta(pWriter, pDesired, key + 1, pReported, reportedValue)) {
+				rewindWriter(pWriter, lenBefore);
+				members = membersBefore;
+			}
+		} else if (reportedValue < 0 || !isValueEqual(pDesired, key + 1, pReported, reportedValue)) {
+			writeKey(pWriter, &members, pDesired, key);
+			writeToken(pWriter, pDesired, key + 1);
+		}
+	}
+
+	writeBytes(pWriter, "}", 1);
+
+	return members;
+}
+
+// Writes "key":{delta} after the members already written, or nothing if desired and reported agree
+static uint32_t writeDeltaMember(JsonWriter_t *pWriter, const char *pKey, uint32_t members, const EmulatedShadow_t *pShadow) {
+	ParsedJson_t desired;
+	ParsedJson_t reported;
+	size_t lenBefore = pWriter->len;
+
+	if (!parseJson(&desired, pShadow->desired, leftTokens) || !parseJson(&reported, pShadow->reported, rightTokens)) {
+		return members;
+	}
+
+	if (0 != members) {
+		writeString(pWriter, ",");
+	}
+	writeString(pWriter, pKey);
+	if (0 == writeDelta(pWriter, &desired, 0, &reported, 0)) {
+		rewindWriter(pWriter, lenBefore);
+		return members;
+	}
+
+	return members + 1;
+}
+
+// ============================================================================
+// Message queue
+// ============================================================================
+
+static bool isTopicMatching(const char *pFilter, const char *pTopic) {
+	while ('\0' != *pFilter) {
+		if ('#' == *pFilter) {
+			return true;
+		}
+		if ('+' == *pFilter) {
+			while ('\0' != *pTopic && '/' != *pTopic) {
+				pTopic++;
+			}
+			pFilter++;
+			continue;
+		}
+		if (*pFilter != *pTopic) {
+			return false;
+		}
+		pFilter++;
+		pTopic++;
+	}
+	return ('\0' == *pTopic);
+}
+
+// Like the MQTT client, a message goes to the first subscription that matches it
+static iot_message_handler findHandler(const char *pTopic) {
+	uint32_t i;
+	for (i = 0; i < EMULATOR_MAX_SUBSCRIPTIONS; i++) {
+		if (NULL != subscriptions[i].pTopic && isTopicMatching(subscriptions[i].pTopic, pTopic)) {
+			return subscriptions[i].handler;
+		}
+	}
+	return NULL;
+}
+
+static uint64_t responseDelay_us(void) {
+	uint64_t delay_us = (uint64_t) emulatorParams.responseLatency_ms * 1000ULL;
+	if (0 != emulatorParams.latencyJitter_ms) {
+		delay_us += (uint64_t) rand() % ((uint64_t) emulatorParams.latencyJitter_ms * 1000ULL + 1ULL);
+	}
+	return delay_us;
+}
+
+static EmulatedMessage_t *allocateMessage(const char *pTopic) {
+	uint32_t i;
+
+	if (strlen(pTopic) >= MAX_SHADOW_TOPIC_LENGTH_BYTES || NULL == findHandler(pTopic)) {
+		emulatorStats.unrouted++;
+		return NULL;
+	}
+
+	for (i = 0; i < AWS_IOT_SHADOW_EMULATOR_QUEUE_DEPTH; i++) {
+		if (!messages[i].isInUse) {
+			messages[i].isInUse = true;
+			messages[i].deliverAt_us = timestamp_us() + responseDelay_us();
+			messages[i].sequence = nextSequence++;
+			messages[i].payloadLen = 0;
+			strcpy(messages[i].topic, pTopic);
+			queuedMessages++;
+			if (queuedMessages > emulatorStats.maxQueueDepth) {
+				emulatorStats.maxQueueDepth = queuedMessages;
+			}
+			return &messages[i];
+		}
+	}
+
+	WARN("Emulator queue full, discarding message on %s", pTopic);
+	emulatorStats.queueOverflows++;
+	return NULL;
+}
+
+static void releaseMessage(EmulatedMessage_t *pMessage) {
+	pMessage->isInUse = false;
+	queuedMessages--;
+}
+
+static EmulatedMessage_t *findEarliestMessage(void) {
+	EmulatedMessage_t *pEarliest = NULL;
+	uint32_t i;
+
+	for (i = 0; i < AWS_IOT_SHADOW_EMULATOR_QUEUE_DEPTH; i++) {
+		if (messages[i].isInUse && (NULL == pEarliest || messages[i].deliverAt_us < pEarliest->deliverAt_us
+				|| (messages[i].deliverAt_us == pEarliest->deliverAt_us
+						&& (int32_t) (messages[i].sequence - pEarliest->sequence) < 0))) {
+			pEarliest = &messages[i];
+		}
+	}
+
+	return pEarliest;
+}
+
+static void deliverMessage(EmulatedMessage_t *pMessage) {
+	MQTTCallbackParams params = MQTTCallbackParamsDefault;
+	iot_message_handler handler;
+	uint32_t payloadLen = pMessage->payloadLen;
+
+	strcpy(deliveryTopic, pMessage->topic);
+	memcpy(deliveryPayload, pMessage->payload, payloadLen);
+	releaseMessage(pMessage);
+
+	// the subscription may have gone while the message was waiting
+	handler = findHandler(deliveryTopic);
+	if (NULL == handler) {
+		emulatorStats.unrouted++;
+		return;
+	}
+
+	params.pTopicName = deliveryTopic;
+	params.TopicNameLen = (uint16_t) strlen(deliveryTopic);
+	params.MessageParams.qos = QOS_0;
+	params.MessageParams.pPayload = deliveryPayload;
+	params.MessageParams.PayloadLen = payloadLen;
+
+	emulatorStats.delivered++;
+	handler(params);
+}
+
+// ============================================================================
+// Shadow service
+// ============================================================================
+
+static EmulatedShadow_t *findShadow(const char *pThingName, bool isCreated) {
+	EmulatedShadow_t *pFree = NULL;
+	uint32_t i;
+
+	for (i = 0; i < AWS_IOT_SHADOW_EMULATOR_MAX_THINGS; i++) {
+		if (shadows[i].isInUse && 0 == strcmp(shadows[i].thingName, pThingName)) {
+			return &shadows[i];
+		}
+		if (!shadows[i].isInUse && NULL == pFree) {
+			pFree = &shadows[i];
+		}
+	}
+
+	if (!isCreated || NULL == pFree) {
+		return NULL;
+	}
+
+	pFree->isInUse = true;
+	pFree->exists = false;
+	pFree->version = 0;
+	strcpy(pFree->thingName, pThingName);
+	strcpy(pFree->desired, "{}");
+	strcpy(pFree->reported, "{}");
+
+	return pFree;
+}
+
+static EmulatedMessage_t *beginResponse(JsonWriter_t *pWriter, const char *pThingName, ShadowActions_t action,
+		const char *pSuffix) {
+	char topic[MAX_SHADOW_TOPIC_LENGTH_BYTES];
+	EmulatedMessage_t *pMessage;
+
+	snprintf(topic, sizeof(topic), EMULATOR_SHADOW_TOPIC_PREFIX "%s/shadow/%s/%s", pThingName, actionNames[action],
+			pSuffix);
+	pMessage = allocateMessage(topic);
+	if (NULL != pMessage) {
+		initWriter(pWriter, pMessage->payload, sizeof(pMessage->payload));
+	}
+
+	return pMessage;
+}
+
+static void endResponse(EmulatedMessage_t *pMessage, JsonWriter_t *pWriter) {
+	if (pWriter->isTruncated) {
+		WARN("Emulated response on %s does not fit AWS_IOT_MQTT_RX_BUF_LEN, discarding it", pMessage->topic);
+		emulatorStats.oversized++;
+		releaseMessage(pMessage);
+		return;
+	}
+	pMessage->payloadLen = (uint32_t) pWriter->len;
+}
+
+// Writes the "version", "timestamp" and "clientToken" members closing every response
+static void writeResponseTail(JsonWriter_t *pWriter, bool isVersionIncluded, uint32_t version,
+		const ParsedJson_t *pRequest, int32_t clientToken) {
+	char members[48];
+
+	if (isVersionIncluded) {
+		snprintf(members, sizeof(members), "\"version\":%u,", version);
+		writeString(pWriter, members);
+	}
+	snprintf(members, sizeof(members), "\"timestamp\":%ld", (long) time(NULL));
+	writeString(pWriter, members);
+	if (clientToken >= 0) {
+		writeString(pWriter, ",\"clientToken\":");
+		writeToken(pWriter, pRequest, clientToken);
+	}
+	writeString(pWriter, "}");
+}
+
+static void reject(const char *pThingName, ShadowActions_t action, uint16_t code, const char *pMessage,
+		const ParsedJson_t *pRequest, int32_t clientToken) {
+	JsonWriter_t writer;
+	EmulatedMessage_t *pResponse;
+	char members[128];
+
+	emulatorStats.rejected++;
+
+	pResponse = beginResponse(&writer, pThingName, action, "rejected");
+	if (NULL == pResponse) {
+		return;
+	}
+	snprintf(members, sizeof(members), "{\"code\":%u,\"message\":\"%s\",", code, pMessage);
+	writeString(&writer, members);
+	writeResponseTail(&writer, false, 0, pRequest, clientToken);
+	endResponse(pResponse, &writer);
+}
+
+static void acceptGet(EmulatedShadow_t *pShadow, const ParsedJson_t *pRequest, int32_t clientToken) {
+	JsonWriter_t writer;
+	EmulatedMessage_t *pResponse;
+	uint32_t members = 0;
+
+	emulatorStats.accepted++;
+
+	pResponse = beginResponse(&writer, pShadow->thingName, SHADOW_GET, "accepted");
+	if (NULL == pResponse) {
+		return;
+	}
+	writeString(&writer, "{\"state\":{");
+	if (0 != strcmp(pShadow->desired, "{}")) {
+		writeString(&writer, "\"desired\":");
+		writeString(&writer, pShadow->desired);
+		members++;
+	}
+	if (0 != strcmp(pShadow->reported, "{}")) {
+		writeString(&writer, 0 != members ? ",\"reported\":" : "\"reported\":");
+		writeString(&writer, pShadow->reported);
+		members++;
+	}
+	writeDeltaMember(&writer, "\"delta\":", members, pShadow);
+	writeString(&writer, "},");
+	writeResponseTail(&writer, true, pShadow->version, pRequest, clientToken);
+	endResponse(pResponse, &writer);
+}
+
+static void acceptDelete(EmulatedShadow_t *pShadow, const ParsedJson_t *pRequest, int32_t clientToken) {
+	JsonWriter_t writer;
+	EmulatedMessage_t *pResponse;
+
+	pShadow->exists = false;
+	strcpy(pShadow->desired, "{}");
+	strcpy(pShadow->reported, "{}");
+	emulatorStats.accepted++;
+
+	pResponse = beginResponse(&writer, pShadow->thingName, SHADOW_DELETE, "accepted");
+	if (NULL == pResponse) {
+		return;
+	}
+	writeString(&writer, "{");
+	writeResponseTail(&writer, true, pShadow->version, pRequest, clientToken);
+	endResponse(pResponse, &writer);
+}
+
+static void publishDelta(EmulatedShadow_t *pShadow) {
+	JsonWriter_t writer;
+	EmulatedMessage_t *pDelta;
+	char members[48];
+
+	pDelta = beginResponse(&writer, pShadow->thingName, SHADOW_UPDATE, "delta");
+	if (NULL == pDelta) {
+		return;
+	}
+	snprintf(members, sizeof(members), "{\"version\":%u,\"timestamp\":%ld", pShadow->version, (long) time(NULL));
+	writeString(&writer, members);
+	if (1 == writeDeltaMember(&writer, "\"state\":", 1, pShadow)) {
+		// desired and reported agree
+		releaseMessage(pDelta);
+		return;
+	}
+	writeString(&writer, "}");
+	endResponse(pDelta, &writer);
+	if (pDelta->isInUse) {
+		emulatorStats.deltas++;
+	}
+}
+
+// Merges one section of an update into the stored one, false if the result does not fit
+static bool mergeSection(char *pMerged, const char *pStored, const ParsedJson_t *pRequest, int32_t section) {
+	JsonWriter_t writer;
+	ParsedJson_t stored;
+
+	initWriter(&writer, pMerged, AWS_IOT_SHADOW_EMULATOR_MAX_STATE_LEN);
+	if (section < 0) {
+		writeString(&writer, pStored);
+	} else if (isNull(pRequest, section)) {
+		writeString(&writer, "{}");
+	} else {
+		parseJson(&stored, pStored, leftTokens);
+		mergeObject(&writer, &stored, 0, pRequest, section);
+	}
+
+	return !writer.isTruncated;
+}
+
+static void handleUpdate(EmulatedShadow_t *pShadow, const ParsedJson_t *pRequest, int32_t clientToken) {
+	JsonWriter_t writer;
+	EmulatedMessage_t *pResponse;
+	int32_t state;
+	int32_t desired;
+	int32_t reported;
+	int32_t version;
+
+	state = findMember(pRequest, 0, "state", 5);
+	desired = findMember(pRequest, state, "desired", 7);
+	reported = findMember(pRequest, state, "reported", 8);
+	version = findMember(pRequest, 0, "version", 7);
+
+	if (!isObject(pRequest, state)) {
+		reject(pShadow->thingName, SHADOW_UPDATE, 400, "Missing required node: state", pRequest, clientToken);
+		return;
+	}
+
+	if ((desired >= 0 && !isObject(pRequest, desired) && !isNull(pRequest, desired))
+			|| (reported >= 0 && !isObject(pRequest, reported) && !isNull(pRequest, reported))) {
+		reject(pShadow->thingName, SHADOW_UPDATE, 400, "Desired and reported must be objects or null", pRequest,
+				clientToken);
+		return;
+	}
+
+	if (version >= 0 && pShadow->exists
+			&& strtoul(pRequest->pJson + pRequest->pTokens[version].start, NULL, 10) != pShadow->version) {
+		reject(pShadow->thingName, SHADOW_UPDATE, 409, "Version conflict", pRequest, clientToken);
+		return;
+	}
+
+	if (!mergeSection(mergedDesired, pShadow->desired, pRequest, desired)
+			|| !mergeSection(mergedReported, pShadow->reported, pRequest, reported)) {
+		reject(pShadow->thingName, SHADOW_UPDATE, 413, "The payload exceeds the maximum size allowed", pRequest,
+				clientToken);
+		return;
+	}
+
+	strcpy(pShadow->desired, mergedDesired);
+	strcpy(pShadow->reported, mergedReported);
+	pShadow->exists = true;
+	pShadow->version++;
+	emulatorStats.accepted++;
+
+	pResponse = beginResponse(&writer, pShadow->thingName, SHADOW_UPDATE, "accepted");
+	if (NULL != pResponse) {
+		writeString(&writer, "{\"state\":");
+		writeToken(&writer, pRequest, state);
+		writeString(&writer, ",");
+		writeResponseTail(&writer, true, pShadow->version, pRequest, clientToken);
+		endResponse(pResponse, &writer);
+	}
+
+	if (desired >= 0) {
+		publishDelta(pShadow);
+	}
+}
+
+static void handleShadowRequest(const char *pThingName, ShadowActions_t action, const char *pPayload,
+		size_t payloadLen, bool isInjectionApplied) {
+	ParsedJson_t request;
+	EmulatedShadow_t *pShadow;
+	int32_t clientToken = -1;
+	char message[48 + MAX_SIZE_OF_THING_NAME];
+
+	emulatorStats.requests++;
+
+	if (isInjectionApplied && 0 != emulatorParams.dropPercent && (uint32_t) (rand() % 100) < emulatorParams.dropPercent) {
+		emulatorStats.dropped++;
+		return;
+	}
+
+	if (payloadLen >= sizeof(requestBuf)) {
+		reject(pThingName, action, 413, "The payload exceeds the maximum size allowed", NULL, -1);
+		return;
+	}
+	memcpy(requestBuf, pPayload, payloadLen);
+	requestBuf[payloadLen] = '\0';
+
+	// get and delete may come without a document
+	request.pJson = requestBuf;
+	request.pTokens = requestTokens;
+	request.tokenCount = 0;
+	if (0 != payloadLen || SHADOW_UPDATE == action) {
+		if (!parseJson(&request, requestBuf, requestTokens)) {
+			reject(pThingName, action, 400, "Invalid JSON", NULL, -1);
+			return;
+		}
+		clientToken = findMember(&request, 0, "clientToken", 11);
+		if (clientToken >= 0 && JSMN_STRING != requestTokens[clientToken].type) {
+			clientToken = -1;
+		}
+	}
+
+	if (isInjectionApplied && 0 != emulatorParams.rejectPercent
+			&& (uint32_t) (rand() % 100) < emulatorParams.rejectPercent) {
+		emulatorStats.injectedRejections++;
+		reject(pThingName, action, emulatorParams.injectedRejectCode, "Injected rejection", &request, clientToken);
+		return;
+	}
+
+	pShadow = findShadow(pThingName, SHADOW_UPDATE == action);
+	if (SHADOW_UPDATE == action) {
+		if (NULL == pShadow) {
+			WARN("Emulator holds AWS_IOT_SHADOW_EMULATOR_MAX_THINGS shadows, rejecting update of %s", pThingName);
+			reject(pThingName, action, 500, "Internal service failure", &request, clientToken);
+			return;
+		}
+		handleUpdate(pShadow, &request, clientToken);
+	} else if (NULL == pShadow || !pShadow->exists) {
+		snprintf(message, sizeof(message), "No shadow exists with name: '%s'", pThingName);
+		reject(pThingName, action, 404, message, &request, clientToken);
+	} else if (SHADOW_GET == action) {
+		acceptGet(pShadow, &request, clientToken);
+	} else {
+		acceptDelete(pShadow, &request, clientToken);
+	}
+}
+
+// Splits $aws/things/{thingName}/shadow/{get|update|delete}, false for any other topic
+static bool parseShadowTopic(const char *pTopic, char *pThingName, ShadowActions_t *pAction) {
+	const char *pName;
+	const char *pNameEnd;
+	char requestTopic[16];
+	uint32_t i;
+
+	if (0 != strncmp(pTopic, EMULATOR_SHADOW_TOPIC_PREFIX, strlen(EMULATOR_SHADOW_TOPIC_PREFIX))) {
+		return false;
+	}
+	pName = pTopic + strlen(EMULATOR_SHADOW_TOPIC_PREFIX);
+	pNameEnd = strchr(pName, '/');
+	if (NULL == pNameEnd || pNameEnd == pName || (size_t) (pNameEnd - pName) >= MAX_SIZE_OF_THING_NAME) {
+		return false;
+	}
+
+	for (i = 0; i < sizeof(actionNames) / sizeof(actionNames[0]); i++) {
+		snprintf(requestTopic, sizeof(requestTopic), "/shadow/%s", actionNames[i]);
+		if (0 == strcmp(pNameEnd, requestTopic)) {
+			memcpy(pThingName, pName, (size_t) (pNameEnd - pName));
+			pThingName[pNameEnd - pName] = '\0';
+			*pAction = (ShadowActions_t) i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// ============================================================================
+// MQTT client interface
+// ============================================================================
+
+static IoT_Error_t emulatorConnect(MQTTConnectParams *pParams) {
+	if (NULL == pParams) {
+		return NULL_VALUE_ERROR;
+	}
+	if (isEmulatorConnected) {
+		return NETWORK_ALREADY_CONNECTED;
+	}
+	isEmulatorConnected = true;
+	isEmulatorAutoReconnectEnabled = (0 != pParams->enableAutoReconnect);
+	return NONE_ERROR;
+}
+
+static IoT_Error_t emulatorPublish(MQTTPublishParams *pParams) {
+	char thingName[MAX_SIZE_OF_THING_NAME];
+	ShadowActions_t action;
+	EmulatedMessage_t *pMessage;
+
+	if (NULL == pParams || NULL == pParams->pTopic) {
+		return NULL_VALUE_ERROR;
+	}
+	if (!isEmulatorConnected) {
+		return NETWORK_DISCONNECTED;
+	}
+
+	if (parseShadowTopic(pParams->pTopic, thingName, &action)) {
+		handleShadowRequest(thingName, action, (const char *) pParams->MessageParams.pPayload,
+				pParams->MessageParams.PayloadLen, true);
+		return NONE_ERROR;
+	}
+
+	if (pParams->MessageParams.PayloadLen > AWS_IOT_MQTT_RX_BUF_LEN) {
+		emulatorStats.oversized++;
+		return NONE_ERROR;
+	}
+	pMessage = allocateMessage(pParams->pTopic);
+	if (NULL != pMessage) {
+		memcpy(pMessage->payload, pParams->MessageParams.pPayload, pParams->MessageParams.PayloadLen);
+		pMessage->payloadLen = pParams->MessageParams.PayloadLen;
+	}
+
+	return NONE_ERROR;
+}
+
+static IoT_Error_t emulatorSubscribe(MQTTSubscribeParams *pParams) {
+	EmulatedSubscription_t *pFree = NULL;
+	uint32_t i;
+
+	if (NULL == pParams || NULL == pParams->pTopic || NULL == pParams->mHandler) {
+		return NULL_VALUE_ERROR;
+	}
+	if (!isEmulatorConnected) {
+		return NETWORK_DISCONNECTED;
+	}
+
+	for (i = 0; i < EMULATOR_MAX_SUBSCRIPTIONS; i++) {
+		if (NULL != subscriptions[i].pTopic && 0 == strcmp(subscriptions[i].pTopic, pParams->pTopic)) {
+			subscriptions[i].handler = pParams->mHandler;
+			return NONE_ERROR;
+		}
+		if (NULL == subscriptions[i].pTopic && NULL == pFree) {
+			pFree = &subscriptions[i];
+		}
+	}
+
+	if (NULL == pFree) {
+		return SUBSCRIBE_ERROR;
+	}
+	pFree->pTopic = pParams->pTopic;
+	pFree->handler = pParams->mHandler;
+
+	return NONE_ERROR;
+}
+
+static IoT_Error_t emulatorUnsubscribe(char *pTopic) {
+	uint32_t i;
+
+	if (NULL == pTopic) {
+		return NULL_VALUE_ERROR;
+	}
+	if (!isEmulatorConnected) {
+		return NETWORK_DISCONNECTED;
+	}
+
+	for (i = 0; i < EMULATOR_MAX_SUBSCRIPTIONS; i++) {
+		if (NULL != subscriptions[i].pTopic && 0 == strcmp(subscriptions[i].pTopic, pTopic)) {
+			subscriptions[i].pTopic = NULL;
+			subscriptions[i].handler = NULL;
+		}
+	}
+
+	return NONE_ERROR;
+}
+
+static IoT_Error_t emulatorDisconnect(void) {
+	uint32_t i;
+
+	if (!isEmulatorConnected) {
+		return NETWORK_DISCONNECTED;
+	}
+
+	// messages on their way are lost with the connection, subscriptions are restored on reconnect
+	for (i = 0; i < AWS_IOT_SHADOW_EMULATOR_QUEUE_DEPTH; i++) {
+		messages[i].isInUse = false;
+	}
+	queuedMessages = 0;
+	isEmulatorConnected = false;
+
+	return NONE_ERROR;
+}
+
+static IoT_Error_t emulatorYield(int timeout) {
+	EmulatedMessage_t *pMessage;
+	uint64_t deadline_us;
+	uint64_t wakeUp_us;
+	uint64_t now_us;
+	struct timespec sleepTime;
+	bool isDelivered = false;
+
+	if (!isEmulatorConnected) {
+		return NETWORK_DISCONNECTED;
+	}
+
+	deadline_us = timestamp_us() + (uint64_t) (timeout > 0 ? timeout : 0) * 1000ULL;
+
+	for (;;) {
+		now_us = timestamp_us();
+		while (isEmulatorConnected && NULL != (pMessage = findEarliestMessage()) && pMessage->deliverAt_us <= now_us) {
+			deliverMessage(pMessage);
+			isDelivered = true;
+		}
+
+		if (isDelivered || now_us >= deadline_us) {
+			return NONE_ERROR;
+		}
+
+		wakeUp_us = deadline_us;
+		pMessage = findEarliestMessage();
+		if (NULL != pMessage && pMessage->deliverAt_us < wakeUp_us) {
+			wakeUp_us = pMessage->deliverAt_us;
+		}
+		sleepTime.tv_sec = (time_t) ((wakeUp_us - now_us) / 1000000ULL);
+		sleepTime.tv_nsec = (long) (((wakeUp_us - now_us) % 1000000ULL) * 1000ULL);
+		nanosleep(&sleepTime, NULL);
+	}
+}
+
+static bool emulatorIsConnected(void) {
+	return isEmulatorConnected;
+}
+
+static IoT_Error_t emulatorReconnect(void) {
+	if (isEmulatorConnected) {
+		return NETWORK_ALREADY_CONNECTED;
+	}
+	isEmulatorConnected = true;
+	return NONE_ERROR;
+}
+
+static bool emulatorIsAutoReconnectEnabled(void) {
+	return isEmulatorAutoReconnectEnabled;
+}
+
+static IoT_Error_t emulatorSetAutoReconnectStatus(bool value) {
+	isEmulatorAutoReconnectEnabled = value;
+	return NONE_ERROR;
+}
+
+// Publishes complete synchronously, so none is ever waiting for a PUBACK
+static uint32_t emulatorGetInflightPublishCount(void) {
+	return 0;
+}
+
+IoT_Error_t aws_iot_shadow_emulator_init(MQTTClient_t *pClient, const ShadowEmulatorParams_t *pParams) {
+	if (NULL == pClient || NULL == pParams) {
+		return NULL_VALUE_ERROR;
+	}
+
+	emulatorParams = *pParams;
+	memset(&emulatorStats, 0, sizeof(emulatorStats));
+	memset(shadows, 0, sizeof(shadows));
+	memset(subscriptions, 0, sizeof(subscriptions));
+	memset(messages, 0, sizeof(messages));
+	queuedMessages = 0;
+	nextSequence = 0;
+	isEmulatorConnected = false;
+	isEmulatorAutoReconnectEnabled = false;
+
+	pClient->connect = emulatorConnect;
+	pClient->disconnect = emulatorDisconnect;
+	pClient->isConnected = emulatorIsConnected;
+	pClient->reconnect = emulatorReconnect;
+	pClient->publish = emulatorPublish;
+	pClient->subscribe = emulatorSubscribe;
+	pClient->unsubscribe = emulatorUnsubscribe;
+	pClient->yield = emulatorYield;
+	pClient->isAutoReconnectEnabled = emulatorIsAutoReconnectEnabled;
+	pClient->setAutoReconnectStatus = emulatorSetAutoReconnectStatus;
+	pClient->publishAsync = emulatorPublish;
+	pClient->getInflightPublishCount = emulatorGetInflightPublishCount;
+
+	return NONE_ERROR;
+}
+
+void aws_iot_shadow_emulator_set_params(const ShadowEmulatorParams_t *pParams) {
+	if (NULL != pParams) {
+		emulatorParams = *pParams;
+	}
+}
+
+IoT_Error_t aws_iot_shadow_emulator_update(const char *pThingName, const char *pJsonDocument) {
+	if (NULL == pThingName || NULL == pJsonDocument) {
+		return NULL_VALUE_ERROR;
+	}
+	if (strlen(pThingName) >= MAX_SIZE_OF_THING_NAME) {
+		return GENERIC_ERROR;
+	}
+
+	handleShadowRequest(pThingName, SHADOW_UPDATE, pJsonDocument, strlen(pJsonDocument), false);
+
+	return NONE_ERROR;
+}
+
+void aws_iot_shadow_emulator_get_stats(ShadowEmulatorStats_t *pStats) {
+	if (NULL != pStats) {
+		*pStats = emulatorStats;
+	}
+}
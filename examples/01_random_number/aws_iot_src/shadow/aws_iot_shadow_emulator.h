@@ -0,0 +1,121 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file aws_iot_shadow_emulator.h
+ * @brief In-process emulation of the AWS IoT Thing Shadow service
+ *
+ * The emulator implements the MQTTClient_t interface without a network connection.  Requests
+ * published on $aws/things/{thingName}/shadow/get, update and delete are answered on the
+ * accepted and rejected topics the way the Thing Shadow service does: documents are merged,
+ * versions incremented, deltas between desired and reported published on update/delta and the
+ * clientToken echoed.  Shadow code paths can then be exercised and benchmarked without AWS.
+ *
+ * Differences from the service:
+ *  - no metadata is kept or returned and nothing is published on update/documents
+ *  - arrays are compared as text when computing a delta
+ *  - messages published on any other topic are delivered back to matching subscriptions
+ *  - yield returns as soon as it has delivered messages instead of waiting out its timeout
+ */
+
+#ifndef SRC_SHADOW_AWS_IOT_SHADOW_EMULATOR_H_
+#define SRC_SHADOW_AWS_IOT_SHADOW_EMULATOR_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "aws_iot_error.h"
+#include "aws_iot_mqtt_interface.h"
+
+/**
+ * @brief Behaviour of the emulated service
+ *
+ * @note Always use the \c ShadowEmulatorParamsDefault to initialize this struct
+ */
+typedef struct {
+	uint32_t responseLatency_ms;	///< Time between a request and the delivery of its response
+	uint32_t latencyJitter_ms;		///< Random extra latency of up to this many milliseconds, per response
+	uint8_t rejectPercent;			///< Share of shadow requests rejected with injectedRejectCode before they are processed
+	uint16_t injectedRejectCode;	///< Error code of the injected rejections
+	uint8_t dropPercent;			///< Share of shadow requests discarded without a response, as if lost on the way to the service
+} ShadowEmulatorParams_t;
+
+/*!
+ * @brief Default emulator parameters: immediate responses, no injected failures
+ *
+ * \relates ShadowEmulatorParams_t
+ */
+extern const ShadowEmulatorParams_t ShadowEmulatorParamsDefault;
+
+/**
+ * @brief Counters of the emulated service
+ */
+typedef struct {
+	uint32_t requests;				///< Shadow get, update and delete requests received
+	uint32_t accepted;				///< Requests answered on the accepted topic
+	uint32_t rejected;				///< Requests answered on the rejected topic, injected rejections included
+	uint32_t injectedRejections;	///< Rejections caused by rejectPercent
+	uint32_t dropped;				///< Requests discarded because of dropPercent
+	uint32_t deltas;				///< Messages published on update/delta
+	uint32_t delivered;				///< Messages handed to subscription callbacks
+	uint32_t unrouted;				///< Messages discarded because no subscription matched their topic
+	uint32_t oversized;				///< Messages discarded because they do not fit AWS_IOT_MQTT_RX_BUF_LEN, as the client would
+	uint32_t queueOverflows;		///< Messages discarded because AWS_IOT_SHADOW_EMULATOR_QUEUE_DEPTH messages were waiting
+	uint32_t maxQueueDepth;			///< Most messages waiting for delivery at the same time
+} ShadowEmulatorStats_t;
+
+/**
+ * @brief Set up the emulator and point an MQTT client at it
+ *
+ * Clears all emulated shadows, subscriptions, waiting messages and counters and fills the
+ * function pointers of pClient.  The client can then be passed to \c aws_iot_shadow_init()
+ * and \c aws_iot_shadow_connect() instead of one set up with \c aws_iot_mqtt_init().
+ *
+ * @param pClient	MQTT client to fill with the emulated functions
+ * @param pParams	Behaviour of the emulated service
+ * @return NONE_ERROR, or NULL_VALUE_ERROR
+ */
+IoT_Error_t aws_iot_shadow_emulator_init(MQTTClient_t *pClient, const ShadowEmulatorParams_t *pParams);
+
+/**
+ * @brief Change latency and failure injection of a running emulator
+ *
+ * Applies to requests received from now on, responses already waiting keep their delivery time.
+ *
+ * @param pParams	Behaviour of the emulated service
+ */
+void aws_iot_shadow_emulator_set_params(const ShadowEmulatorParams_t *pParams);
+
+/**
+ * @brief Update a shadow as another client of the service would
+ *
+ * The document is processed like one published on $aws/things/{thingName}/shadow/update, its
+ * responses and deltas are delivered to the matching subscriptions.  Use it to change the desired
+ * state from the "cloud side" and trigger delta callbacks.  Injected failures do not apply.
+ *
+ * @param pThingName	Thing whose shadow is updated
+ * @param pJsonDocument	Null terminated update document, e.g. {"state":{"desired":{"on":true}}}
+ * @return NONE_ERROR, or NULL_VALUE_ERROR
+ */
+IoT_Error_t aws_iot_shadow_emulator_update(const char *pThingName, const char *pJsonDocument);
+
+/**
+ * @brief Read the counters of the emulated service
+ *
+ * @param pStats	Filled with the counters since \c aws_iot_shadow_emulator_init()
+ */
+void aws_iot_shadow_emulator_get_stats(ShadowEmulatorStats_t *pStats);
+
+#endif /* SRC_SHADOW_AWS_IOT_SHADOW_EMULATOR_H_ */
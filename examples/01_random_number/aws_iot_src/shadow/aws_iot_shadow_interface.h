@@ -155,6 +155,8 @@ typedef void (*fpActionCallback_t)(const char *pThingName, ShadowActions_t actio
  * 4. In the \c aws_iot_shadow_yield() function the response will be handled. In case of timeout or if the response is received, the subscription to shadow response topics are un-subscribed from.
  *    On the contrary if the persistent subscription is set to true then the un-subscribe will not be done. The topics will always be listened to.
  *
+ * @note While the client is disconnected the update is not sent but merged into one pending update per thing, see \c aws_iot_shadow_get_offline_stats().
+ *
  * @param pClient	MQTT Client used as the protocol layer
  * @param pThingName Thing Name of the shadow that needs to be Updated
  * @param pJsonString The update action expects a JSON document to send. The JSO String should be a null terminated string. This JSON document should adhere to the AWS IoT Thing Shadow specification. To help in the process of creating this document- SDK provides apis in \c aws_iot_shadow_json_data.h
@@ -167,6 +169,73 @@ typedef void (*fpActionCallback_t)(const char *pThingName, ShadowActions_t actio
 IoT_Error_t aws_iot_shadow_update(MQTTClient_t *pClient, const char *pThingName, char *pJsonString,
 		fpActionCallback_t callback, void *pContextData, uint8_t timeout_seconds, bool isPersistentSubscribe);
 
+/**
+ * @brief Updates made while disconnected
+ *
+ * While the MQTT client is disconnected, \c aws_iot_shadow_update() merges the "state" of every update
+ * into a pending update of its thing instead of failing: a value replaces the value at the same path
+ * of earlier updates, members of nested objects are merged one by one as the service would.  Once
+ * \c aws_iot_shadow_yield() finds the client connected again, which includes resubscribing, it sends
+ * one update per thing, so catching up after a reconnect costs one request per thing however many
+ * updates were made.  Only a member set inside an object that an earlier update replaced by null or
+ * another value takes a second update, sent after the first so the members deleted by the replacement
+ * stay deleted.  An update made while a pending update of its thing is not sent yet is merged into it
+ * as well, so the service always receives the values in the order they were set.
+ *
+ * The collapsed update carries a new client token and no version.  Its callback, context, timeout and
+ * subscription type are those of the latest update, callbacks of the updates merged into it are not
+ * called, nor is a callback for the first of two updates of a thing.  Up to #AWS_IOT_SHADOW_OFFLINE_MAX_THINGS things can have a pending update, each holding up to
+ * #AWS_IOT_SHADOW_OFFLINE_MAX_FIELDS values in #AWS_IOT_SHADOW_OFFLINE_BUFFER_LEN bytes.
+ */
+typedef struct {
+	uint32_t pendingThings;	///< Things with a pending update not sent yet
+	uint32_t heldUpdates;	///< Updates merged into a pending update since \c aws_iot_shadow_init()
+	uint32_t sentUpdates;	///< Pending updates sent after reconnecting
+} ShadowOfflineStats_t;
+
+/**
+ * @brief Read the statistics of updates made while disconnected
+ *
+ * @param pStats	Receives the statistics
+ */
+void aws_iot_shadow_get_offline_stats(ShadowOfflineStats_t *pStats);
+
+/**
+ * @brief Retry policy for updates rejected because of a version conflict
+ *
+ * @note Always use the \c ShadowConflictRetryPolicyDefault to initialize this struct
+ */
+typedef struct {
+	uint8_t maxRetries;			///< Times an update is retried after a version conflict, 0 turns the policy off
+	uint32_t initialBackoff_ms;	///< Wait before the first retry, doubled for every further retry. A random part of up to half of it is taken off
+	uint32_t maxBackoff_ms;		///< Upper bound of the wait before a retry
+} ShadowConflictRetryPolicy_t;
+
+/*!
+ * @brief Default conflict retry policy: 3 retries, backoff from 100 ms up to 2 seconds
+ *
+ * \relates ShadowConflictRetryPolicy_t
+ */
+extern const ShadowConflictRetryPolicy_t ShadowConflictRetryPolicyDefault;
+
+/**
+ * @brief Retry updates that the service rejects with a version conflict (error code 409)
+ *
+ * Applies to updates with a callback whose JSON document has a top-level "version" and "clientToken".
+ * On a conflict the update is not reported to the callback.  Instead, after the backoff, the current
+ * document is fetched with a get, the "version" of the pending update is set to the current version
+ * and the update is sent again with a new client token.  The fields of the pending update are sent
+ * unchanged, the service merges them into the current document.  The callback is called once, with
+ * the final outcome: accepted, the last rejection, or a timeout if the retry could not be completed.
+ *
+ * The retry is driven from \c aws_iot_shadow_yield() and does not block other requests.  Up to
+ * #AWS_IOT_SHADOW_CONFLICT_RETRY_SLOTS updates can be retried at the same time, further updates are sent
+ * without the policy.  Updates with a persistent subscription avoid the subscription wait on every retry.
+ *
+ * @param pPolicy	Policy to apply from the next update on, NULL turns retries off
+ */
+void aws_iot_shadow_set_conflict_retry_policy(const ShadowConflictRetryPolicy_t *pPolicy);
+
 /**
  * @brief This function is the one used to perform an Get action to a Thing Name's Shadow.
  *
@@ -183,6 +252,60 @@ IoT_Error_t aws_iot_shadow_update(MQTTClient_t *pClient, const char *pThingName,
  */
 IoT_Error_t aws_iot_shadow_get(MQTTClient_t *pClient, const char *pThingName, fpActionCallback_t callback,
 		void *pContextData, uint8_t timeout_seconds, bool isPersistentSubscribe);
+/**
+ * @brief Parameters of a bulk shadow get
+ *
+ * @note Always use the \c ShadowBulkGetParamsDefault to initialize this struct
+ */
+typedef struct {
+	const char **pThingNames;		///< Things whose shadow documents are requested. Names longer than MAX_SIZE_OF_THING_NAME - 1 are skipped
+	uint32_t thingCount;			///< Number of entries in pThingNames
+	uint32_t windowSize;			///< GET requests waiting for a response at the same time. 0 or more than AWS_IOT_SHADOW_BULK_GET_MAX_WINDOW uses the maximum
+	uint32_t timeout_ms;			///< Time to wait for the response to each request before reporting SHADOW_ACK_TIMEOUT
+	fpActionCallback_t callback;	///< Called with every document, rejection and timeout, in the order they happen
+	void *pContextData;				///< Passed to the callback
+	bool isPersistentSubscribe;		///< Keep the wildcard response subscriptions for the next bulk get instead of unsubscribing
+} ShadowBulkGetParams_t;
+
+/*!
+ * @brief Default bulk get parameters: maximum window, 5 second response timeout
+ *
+ * \relates ShadowBulkGetParams_t
+ */
+extern const ShadowBulkGetParams_t ShadowBulkGetParamsDefault;
+
+/**
+ * @brief Outcome of a bulk shadow get
+ */
+typedef struct {
+	uint32_t accepted;				///< Documents received
+	uint32_t rejected;				///< Requests rejected by the service, e.g. for things without a shadow
+	uint32_t timedOut;				///< Requests without a response within timeout_ms
+	uint32_t skipped;				///< Things not requested because their name is too long
+	uint32_t maxInFlight;			///< Largest number of requests that were waiting for a response at once
+	uint64_t elapsed_us;			///< Time from the first request until the last response or timeout
+	uint32_t responsesPerSecond;	///< Accepted and rejected responses per second of elapsed time
+} ShadowBulkGetStats_t;
+
+/**
+ * @brief Get the shadow documents of many things, e.g. to sync a gateway at startup
+ *
+ * Unlike calling aws_iot_shadow_get for every thing, which needs an acknowledgment slot and a
+ * subscription per thing, this subscribes once to the wildcard topics
+ * $aws/things/+/shadow/get/accepted and $aws/things/+/shadow/get/rejected and keeps up to
+ * windowSize GET requests in flight.  Every response is handed to the callback as it arrives,
+ * the next request is sent as soon as a slot frees up.
+ * @note Call is blocking.  It returns once every thing is answered or timed out, yielding the MQTT
+ * client meanwhile.  Single actions started before keep being served.
+ *
+ * @param pClient	MQTT Client used as the protocol layer
+ * @param pParams	Things to get and how
+ * @param pStats	Filled with the outcome, may be NULL
+ * @return An IoT Error Type, NONE_ERROR once every request has completed even if some were rejected or timed out
+ */
+IoT_Error_t aws_iot_shadow_bulk_get(MQTTClient_t *pClient, const ShadowBulkGetParams_t *pParams,
+		ShadowBulkGetStats_t *pStats);
+
 /**
  * @brief This function is the one used to perform an Delete action to a Thing Name's Shadow.
  *
@@ -211,6 +334,44 @@ IoT_Error_t aws_iot_shadow_delete(MQTTClient_t *pClient, const char *pThingName,
  */
 IoT_Error_t aws_iot_shadow_register_delta(MQTTClient_t *pClient, jsonStruct_t *pStruct);
 
+/**
+ * @brief One changed field of a delta message, as handed to the batch delta callback
+ */
+typedef struct {
+	uint32_t keyId;				///< Position of the field in the order of aws_iot_shadow_register_delta calls, starting at 0
+	jsonStruct_t *pStruct;		///< Registered struct, its pData already holds the new value
+	const char *pValue;			///< Value as received, not null terminated
+	uint32_t valueLength;		///< Length of pValue
+} ShadowDeltaField_t;
+
+/**
+ * @brief Function Pointer typedef used as the batch delta callback
+ *
+ * @param pThingName Thing Name of the shadow the delta belongs to
+ * @param version Version of the delta message, 0 if it has none
+ * @param pFields The changed registered fields, in registration order. Valid only during the call
+ * @param fieldCount Number of entries in pFields, at least 1
+ * @param pContextData The context given to aws_iot_shadow_register_delta_batch
+ */
+typedef void (*fpDeltaBatchCallback_t)(const char *pThingName, uint32_t version, const ShadowDeltaField_t *pFields,
+		uint32_t fieldCount, void *pContextData);
+
+/**
+ * @brief Receive all changed registered fields of a delta message in a single call
+ *
+ * The fields are still registered with \c aws_iot_shadow_register_delta(), the cb of the jsonStruct_t may be NULL.
+ * For every delta message all matching values are written to their pData first, then the callback is called
+ * once with the whole set, so related fields can be applied together.  Deltas without a registered field
+ * do not call it.  While a batch callback is set, the per-field callbacks are not called.
+ *
+ * @param pClient MQTT Client used as the protocol layer
+ * @param callback Called once per delta message, NULL goes back to the per-field callbacks
+ * @param pContextData Passed to the callback
+ * @return An IoT Error Type defining successful/failed registering
+ */
+IoT_Error_t aws_iot_shadow_register_delta_batch(MQTTClient_t *pClient, fpDeltaBatchCallback_t callback,
+		void *pContextData);
+
 /**
  * @brief Reset the last received version number to zero.
  * This will be useful if the Thing Shadow is deleted and would like to to reset the local version
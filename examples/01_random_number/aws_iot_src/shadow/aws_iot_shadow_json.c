@@ -19,6 +19,7 @@
 #include <stdbool.h>
 #include <inttypes.h>
 #include "aws_iot_json_utils.h"
+#include "aws_iot_json_escape.h"
 #include "aws_iot_log.h"
 #include "aws_iot_shadow_key.h"
 #include "aws_iot_config.h"
@@ -272,6 +273,23 @@ void FillWithClientToken(char *pBufferToBeUpdatedWithClientToken) {
 	sprintf(pBufferToBeUpdatedWithClientToken, "%s-%d", mqttClientID, clientTokenNum++);
 }
 
+static IoT_Error_t convertStringToJson(char *pStringBuffer, size_t maxSizoStringBuffer, const char *pString) {
+	size_t escapedLen = 0;
+
+	// Opening quote, then the escaped value followed by the closing quote, the comma and the NUL
+	if (maxSizoStringBuffer < 4) {
+		return SHADOW_JSON_BUFFER_TRUNCATED;
+	}
+	pStringBuffer[0] = '"';
+	if (NONE_ERROR != aws_iot_json_escape(pStringBuffer + 1, maxSizoStringBuffer - 3, pString, strlen(pString),
+			&escapedLen)) {
+		return SHADOW_JSON_BUFFER_TRUNCATED;
+	}
+	memcpy(pStringBuffer + 1 + escapedLen, "\",", 3);
+
+	return NONE_ERROR;
+}
+
 static IoT_Error_t convertDataToString(char *pStringBuffer, size_t maxSizoStringBuffer, JsonPrimitiveType type,
 		void *pData) {
 	int32_t snPrintfReturn = 0;
@@ -300,7 +318,7 @@ static IoT_Error_t convertDataToString(char *pStringBuffer, size_t maxSizoString
 	} else if (type == SHADOW_JSON_BOOL) {
 		snPrintfReturn = snprintf(pStringBuffer, maxSizoStringBuffer, "%s,", *(bool *)(pData)?"true":"false");
 	} else if (type == SHADOW_JSON_STRING) {
-		snPrintfReturn = snprintf(pStringBuffer, maxSizoStringBuffer, "\"%s\",", (char * )(pData));
+		return convertStringToJson(pStringBuffer, maxSizoStringBuffer, (const char *) pData);
 	}
 
 	ret_val = checkReturnValueOfSnPrintf(snPrintfReturn, maxSizoStringBuffer);
@@ -355,6 +373,8 @@ static IoT_Error_t UpdateValueIfNoObject(const char *pJsonString, jsonStruct_t *
 		ret_val = parseFloatValue(pDataStruct->pData, pJsonString, &token);
 	} else if (pDataStruct->type == SHADOW_JSON_DOUBLE) {
 		ret_val = parseDoubleValue(pDataStruct->pData, pJsonString, &token);
+	} else if (pDataStruct->type == SHADOW_JSON_STRING && 0 != pDataStruct->dataLength) {
+		ret_val = parseBoundedStringValue(pDataStruct->pData, pDataStruct->dataLength, pJsonString, &token);
 	}
 
 	return ret_val;
@@ -452,3 +472,133 @@ bool extractVersionNumber(const char *pJsonDocument, void *pJsonHandler, int32_t
 	return false;
 }
 
+
+// Index of the value of pKey in the top-level object, keys of nested objects are skipped
+static int32_t findTopLevelValue(const char *pJsonDocument, int32_t tokenCount, const char *pKey) {
+	int32_t i = 1;
+	int32_t valueEnd;
+
+	while (i + 1 < tokenCount) {
+		if (jsoneq(pJsonDocument, &jsonTokenStruct[i], pKey) == 0) {
+			return i + 1;
+		}
+		valueEnd = jsonTokenStruct[i + 1].end;
+		i += 2;
+		while (i < tokenCount && jsonTokenStruct[i].start < valueEnd) {
+			i++;
+		}
+	}
+	return -1;
+}
+
+bool extractTopLevelVersionNumber(const char *pJsonDocument, uint32_t *pVersionNumber) {
+	int32_t tokenCount, valueIndex;
+
+	if (!isJsonValidAndParse(pJsonDocument, NULL, &tokenCount)) {
+		return false;
+	}
+
+	valueIndex = findTopLevelValue(pJsonDocument, tokenCount, SHADOW_VERSION_STRING);
+	if (valueIndex < 0) {
+		return false;
+	}
+
+	return (NONE_ERROR == parseUnsignedInteger32Value(pVersionNumber, pJsonDocument, &jsonTokenStruct[valueIndex]));
+}
+
+bool isVersionedUpdateWithClientToken(const char *pJsonDocument) {
+	int32_t tokenCount, versionIndex, clientTokenIndex;
+
+	if (!isJsonValidAndParse(pJsonDocument, NULL, &tokenCount)) {
+		return false;
+	}
+
+	versionIndex = findTopLevelValue(pJsonDocument, tokenCount, SHADOW_VERSION_STRING);
+	clientTokenIndex = findTopLevelValue(pJsonDocument, tokenCount, SHADOW_CLIENT_TOKEN_STRING);
+
+	return (versionIndex >= 0 && JSMN_PRIMITIVE == jsonTokenStruct[versionIndex].type && clientTokenIndex >= 0
+			&& JSMN_STRING == jsonTokenStruct[clientTokenIndex].type);
+}
+
+bool isVersionConflict(const char *pJsonDocument) {
+	int32_t tokenCount, valueIndex;
+	uint32_t errorCode = 0;
+
+	if (NULL == pJsonDocument || !isJsonValidAndParse(pJsonDocument, NULL, &tokenCount)) {
+		return false;
+	}
+
+	valueIndex = findTopLevelValue(pJsonDocument, tokenCount, SHADOW_ERROR_CODE_STRING);
+	if (valueIndex < 0
+			|| NONE_ERROR != parseUnsignedInteger32Value(&errorCode, pJsonDocument, &jsonTokenStruct[valueIndex])) {
+		return false;
+	}
+
+	return (SHADOW_VERSION_CONFLICT_ERROR_CODE == errorCode);
+}
+
+static IoT_Error_t replaceJsonSpan(char *pJsonDocument, size_t maxSizeOfJsonDocument, int32_t start, int32_t end,
+		const char *pReplacement) {
+	size_t documentLength = strlen(pJsonDocument);
+	size_t replacementLength = strlen(pReplacement);
+
+	if (documentLength - (end - start) + replacementLength >= maxSizeOfJsonDocument) {
+		return SHADOW_JSON_BUFFER_TRUNCATED;
+	}
+
+	memmove(pJsonDocument + start + replacementLength, pJsonDocument + end, documentLength - end + 1);
+	memcpy(pJsonDocument + start, pReplacement, replacementLength);
+
+	return NONE_ERROR;
+}
+
+IoT_Error_t updateVersionAndClientToken(char *pJsonDocument, size_t maxSizeOfJsonDocument, uint32_t versionNumber) {
+	IoT_Error_t ret_val;
+	int32_t tokenCount, versionIndex, clientTokenIndex;
+	jsmntok_t versionToken, clientTokenToken;
+	char versionString[11];
+	char clientToken[MAX_SIZE_CLIENT_ID_WITH_SEQUENCE];
+
+	if (NULL == pJsonDocument) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if (!isJsonValidAndParse(pJsonDocument, NULL, &tokenCount)) {
+		return SHADOW_JSON_ERROR;
+	}
+
+	versionIndex = findTopLevelValue(pJsonDocument, tokenCount, SHADOW_VERSION_STRING);
+	clientTokenIndex = findTopLevelValue(pJsonDocument, tokenCount, SHADOW_CLIENT_TOKEN_STRING);
+	if (versionIndex < 0 || clientTokenIndex < 0) {
+		return SHADOW_JSON_ERROR;
+	}
+	versionToken = jsonTokenStruct[versionIndex];
+	clientTokenToken = jsonTokenStruct[clientTokenIndex];
+
+	snprintf(versionString, sizeof(versionString), "%" PRIu32, versionNumber);
+	// a new token keeps late responses to the previous attempt from completing this one
+	ret_val = checkReturnValueOfSnPrintf(FillWithClientTokenSize(clientToken, sizeof(clientToken)),
+			sizeof(clientToken));
+	if (NONE_ERROR != ret_val) {
+		return ret_val;
+	}
+
+	// replace the later value first so the position of the other one stays valid
+	if (versionToken.start > clientTokenToken.start) {
+		ret_val = replaceJsonSpan(pJsonDocument, maxSizeOfJsonDocument, versionToken.start, versionToken.end,
+				versionString);
+		if (NONE_ERROR == ret_val) {
+			ret_val = replaceJsonSpan(pJsonDocument, maxSizeOfJsonDocument, clientTokenToken.start,
+					clientTokenToken.end, clientToken);
+		}
+	} else {
+		ret_val = replaceJsonSpan(pJsonDocument, maxSizeOfJsonDocument, clientTokenToken.start, clientTokenToken.end,
+				clientToken);
+		if (NONE_ERROR == ret_val) {
+			ret_val = replaceJsonSpan(pJsonDocument, maxSizeOfJsonDocument, versionToken.start, versionToken.end,
+					versionString);
+		}
+	}
+
+	return ret_val;
+}
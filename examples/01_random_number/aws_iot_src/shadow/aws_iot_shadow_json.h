@@ -35,4 +35,8 @@ bool isReceivedJsonValid(const char *pJsonDocument);
 void FillWithClientToken(char *pStringToUpdateClientToken);
 bool extractClientToken(const char *pJsonDocumentToBeSent, char *pExtractedClientToken);
 bool extractVersionNumber(const char *pJsonDocument, void *pJsonHandler, int32_t tokenCount, uint32_t *pVersionNumber);
+bool extractTopLevelVersionNumber(const char *pJsonDocument, uint32_t *pVersionNumber);
+bool isVersionedUpdateWithClientToken(const char *pJsonDocument);
+bool isVersionConflict(const char *pJsonDocument);
+IoT_Error_t updateVersionAndClientToken(char *pJsonDocument, size_t maxSizeOfJsonDocument, uint32_t versionNumber);
 #endif // AWS_IOT_SDK_SRC_IOT_SHADOW_JSON_H_
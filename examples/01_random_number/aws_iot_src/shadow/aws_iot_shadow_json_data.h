@@ -60,6 +60,7 @@ struct jsonStruct {
 	void *pData; ///< pointer to the data (JSON value)
 	JsonPrimitiveType type; ///< type of JSON
 	jsonStructCallback_t cb; ///< callback to be executed on receiving the Key value pair
+	size_t dataLength; ///< size of the pData buffer of a SHADOW_JSON_STRING, received strings are unescaped into it and truncated to fit. 0 leaves pData untouched
 };
 
 /**
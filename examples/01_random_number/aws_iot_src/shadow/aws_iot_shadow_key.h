@@ -17,6 +17,9 @@
 #define SRC_SHADOW_AWS_IOT_SHADOW_KEY_H_
 
 #define SHADOW_CLIENT_TOKEN_STRING "clientToken"
+#define SHADOW_STATE_STRING "state"
 #define SHADOW_VERSION_STRING "version"
+#define SHADOW_ERROR_CODE_STRING "code"
+#define SHADOW_VERSION_CONFLICT_ERROR_CODE 409
 
 #endif /* SRC_SHADOW_AWS_IOT_SHADOW_KEY_H_ */
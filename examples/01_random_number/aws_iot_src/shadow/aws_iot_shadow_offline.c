@@ -0,0 +1,519 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "aws_iot_shadow_offline.h"
+
+#include <string.h>
+
+#include "aws_iot_json_utils.h"
+#include "aws_iot_log.h"
+#include "aws_iot_shadow_actions.h"
+#include "aws_iot_shadow_json_data.h"
+#include "aws_iot_shadow_key.h"
+#include "aws_iot_config.h"
+
+// Separates the member names of a path, it cannot occur in a null terminated update document
+#define PATH_SEPARATOR '\0'
+
+// One slot is kept when collapsing is turned off so the array is never empty
+#define OFFLINE_RECORD_SLOTS (AWS_IOT_SHADOW_OFFLINE_MAX_THINGS > 0 ? AWS_IOT_SHADOW_OFFLINE_MAX_THINGS : 1)
+
+typedef struct {
+	uint16_t offset;	///< Path followed by the value in the data of the record
+	uint16_t pathLen;	///< Member names from below "state" down to the value, separated by PATH_SEPARATOR
+	uint16_t valueLen;	///< JSON text of the value, strings with their quotes
+	uint8_t generation;	///< Update the value is sent in, lower generations are sent first
+} OfflineField_t;
+
+// The pending update of one thing, kept as its leaf values sorted by path so objects can be rebuilt in one pass
+typedef struct {
+	bool isPending;
+	char thingName[MAX_SIZE_OF_THING_NAME];
+	fpActionCallback_t callback;	///< Of the latest update, earlier callbacks are not called
+	void *pContextData;
+	uint8_t timeout_seconds;
+	bool isPersistentSubscribe;
+	uint16_t fieldCount;
+	uint16_t usedBytes;
+	uint8_t lastGeneration;	///< Updates still to be sent, minus one
+	OfflineField_t fields[AWS_IOT_SHADOW_OFFLINE_MAX_FIELDS];
+	char data[AWS_IOT_SHADOW_OFFLINE_BUFFER_LEN];
+} OfflineRecord_t;
+
+static OfflineRecord_t offlineRecords[OFFLINE_RECORD_SLOTS];
+static OfflineRecord_t savedRecord;		///< Restored when an update does not fit, so it is never merged in part
+static ShadowOfflineStats_t offlineStats;
+
+static jsmn_parser offlineJsonParser;
+static jsmntok_t offlineJsonTokens[MAX_JSON_TOKEN_EXPECTED];
+static char pathBuffer[AWS_IOT_SHADOW_OFFLINE_BUFFER_LEN];
+static char documentBuffer[AWS_IOT_MQTT_TX_BUF_LEN];
+
+void iot_shadow_offline_reset(void) {
+	uint8_t i;
+	for (i = 0; i < OFFLINE_RECORD_SLOTS; i++) {
+		offlineRecords[i].isPending = false;
+	}
+	memset(&offlineStats, 0, sizeof(offlineStats));
+}
+
+void aws_iot_shadow_get_offline_stats(ShadowOfflineStats_t *pStats) {
+	uint8_t i;
+
+	if (NULL == pStats) {
+		return;
+	}
+
+	*pStats = offlineStats;
+	pStats->pendingThings = 0;
+	for (i = 0; i < AWS_IOT_SHADOW_OFFLINE_MAX_THINGS; i++) {
+		if (offlineRecords[i].isPending) {
+			pStats->pendingThings++;
+		}
+	}
+}
+
+static OfflineRecord_t *findRecord(const char *pThingName) {
+	uint8_t i;
+	for (i = 0; i < AWS_IOT_SHADOW_OFFLINE_MAX_THINGS; i++) {
+		if (offlineRecords[i].isPending && 0 == strcmp(offlineRecords[i].thingName, pThingName)) {
+			return &offlineRecords[i];
+		}
+	}
+	return NULL;
+}
+
+static OfflineRecord_t *getFreeRecord(void) {
+	uint8_t i;
+	for (i = 0; i < AWS_IOT_SHADOW_OFFLINE_MAX_THINGS; i++) {
+		if (!offlineRecords[i].isPending) {
+			return &offlineRecords[i];
+		}
+	}
+	return NULL;
+}
+
+bool iot_shadow_offline_is_pending(const char *pThingName) {
+	return (NULL != pThingName && NULL != findRecord(pThingName));
+}
+
+static int comparePaths(const char *pA, size_t aLen, const char *pB, size_t bLen) {
+	int order = memcmp(pA, pB, (aLen < bLen) ? aLen : bLen);
+	if (0 != order) {
+		return order;
+	}
+	return (aLen < bLen) ? -1 : ((aLen > bLen) ? 1 : 0);
+}
+
+// Whether pPath lies inside the object at pPrefix
+static bool isInside(const char *pPrefix, size_t prefixLen, const char *pPath, size_t pathLen) {
+	return (prefixLen < pathLen && PATH_SEPARATOR == pPath[prefixLen] && 0 == memcmp(pPrefix, pPath, prefixLen));
+}
+
+static void removeField(OfflineRecord_t *pRecord, uint16_t index) {
+	OfflineField_t removed = pRecord->fields[index];
+	uint16_t removedLen = removed.pathLen + removed.valueLen;
+	uint16_t i;
+
+	memmove(&pRecord->data[removed.offset], &pRecord->data[removed.offset + removedLen],
+			pRecord->usedBytes - removed.offset - removedLen);
+	pRecord->usedBytes -= removedLen;
+
+	memmove(&pRecord->fields[index], &pRecord->fields[index + 1],
+			(pRecord->fieldCount - index - 1) * sizeof(OfflineField_t));
+	pRecord->fieldCount--;
+
+	for (i = 0; i < pRecord->fieldCount; i++) {
+		if (pRecord->fields[i].offset > removed.offset) {
+			pRecord->fields[i].offset -= removedLen;
+		}
+	}
+}
+
+// Last write wins: the value replaces the same path and everything inside it. A value at a path containing it, null or
+// any other non-object, replaced the whole object on the service and is kept: merged with the new member, the members
+// it deleted would come back. The new member goes into a later update than that value instead
+static IoT_Error_t setField(OfflineRecord_t *pRecord, const char *pPath, size_t pathLen, const char *pValue,
+		size_t valueLen) {
+	OfflineField_t *pField;
+	const char *pFieldPath;
+	uint8_t generation = pRecord->lastGeneration;
+	uint16_t i = 0;
+	uint16_t position;
+
+	while (i < pRecord->fieldCount) {
+		pField = &pRecord->fields[i];
+		pFieldPath = &pRecord->data[pField->offset];
+		if (0 == comparePaths(pFieldPath, pField->pathLen, pPath, pathLen)
+				|| isInside(pPath, pathLen, pFieldPath, pField->pathLen)) {
+			removeField(pRecord, i);
+			continue;
+		}
+		if (isInside(pFieldPath, pField->pathLen, pPath, pathLen) && pField->generation == generation) {
+			// An update never holds a value together with members inside it, the values above sit in other updates
+			generation++;
+		}
+		i++;
+	}
+
+	if (AWS_IOT_SHADOW_OFFLINE_MAX_FIELDS <= pRecord->fieldCount
+			|| AWS_IOT_SHADOW_OFFLINE_BUFFER_LEN - pRecord->usedBytes < pathLen + valueLen) {
+		return SHADOW_OFFLINE_FULL;
+	}
+
+	for (position = 0; position < pRecord->fieldCount; position++) {
+		pField = &pRecord->fields[position];
+		if (0 < comparePaths(&pRecord->data[pField->offset], pField->pathLen, pPath, pathLen)) {
+			break;
+		}
+	}
+	memmove(&pRecord->fields[position + 1], &pRecord->fields[position],
+			(pRecord->fieldCount - position) * sizeof(OfflineField_t));
+	pRecord->fieldCount++;
+
+	pField = &pRecord->fields[position];
+	pField->offset = pRecord->usedBytes;
+	pField->pathLen = (uint16_t) pathLen;
+	pField->valueLen = (uint16_t) valueLen;
+	pField->generation = generation;
+	memcpy(&pRecord->data[pRecord->usedBytes], pPath, pathLen);
+	memcpy(&pRecord->data[pRecord->usedBytes + pathLen], pValue, valueLen);
+	pRecord->usedBytes += pathLen + valueLen;
+	pRecord->lastGeneration = generation;
+
+	return NONE_ERROR;
+}
+
+// Number the updates left after values were replaced from 0 up again, in the order they are sent
+static void compactGenerations(OfflineRecord_t *pRecord) {
+	uint8_t generation = 0;
+	uint16_t i;
+	bool isUsed;
+
+	while (generation <= pRecord->lastGeneration) {
+		isUsed = false;
+		for (i = 0; !isUsed && i < pRecord->fieldCount; i++) {
+			isUsed = (pRecord->fields[i].generation == generation);
+		}
+		if (isUsed) {
+			generation++;
+			continue;
+		}
+		if (0 == pRecord->lastGeneration) {
+			break;
+		}
+		for (i = 0; i < pRecord->fieldCount; i++) {
+			if (pRecord->fields[i].generation > generation) {
+				pRecord->fields[i].generation--;
+			}
+		}
+		pRecord->lastGeneration--;
+	}
+}
+
+// Index of the first token after the value at index, nested tokens included
+static int32_t skipValue(int32_t index, int32_t tokenCount) {
+	int32_t end = offlineJsonTokens[index].end;
+
+	index++;
+	while (index < tokenCount && offlineJsonTokens[index].start < end) {
+		index++;
+	}
+	return index;
+}
+
+// Merge every leaf value of the object at objectIndex, pathBuffer holds the path of the object
+static IoT_Error_t mergeObject(OfflineRecord_t *pRecord, const char *pJsonString, int32_t tokenCount,
+		int32_t objectIndex, size_t pathLen) {
+	jsmntok_t *pKey, *pValue;
+	int32_t objectEnd = offlineJsonTokens[objectIndex].end;
+	int32_t i = objectIndex + 1;
+	size_t keyLen, childPathLen;
+	IoT_Error_t rc;
+
+	while (i + 1 < tokenCount && offlineJsonTokens[i].start < objectEnd) {
+		pKey = &offlineJsonTokens[i];
+		pValue = &offlineJsonTokens[i + 1];
+		if (JSMN_STRING != pKey->type) {
+			return SHADOW_JSON_ERROR;
+		}
+
+		keyLen = pKey->end - pKey->start;
+		if (0 == pathLen && 0 == keyLen) {
+			// reported or desired, an empty name could not be told apart from the path of its members
+			return SHADOW_JSON_ERROR;
+		}
+		childPathLen = pathLen + ((0 != pathLen) ? 1 : 0) + keyLen;
+		if (childPathLen > sizeof(pathBuffer)) {
+			return SHADOW_OFFLINE_FULL;
+		}
+		if (0 != pathLen) {
+			pathBuffer[pathLen] = PATH_SEPARATOR;
+		}
+		memcpy(&pathBuffer[childPathLen - keyLen], &pJsonString[pKey->start], keyLen);
+
+		if (JSMN_OBJECT == pValue->type) {
+			// An empty object changes nothing on the service, it does not replace what was set before
+			rc = mergeObject(pRecord, pJsonString, tokenCount, i + 1, childPathLen);
+		} else if (JSMN_STRING == pValue->type) {
+			rc = setField(pRecord, pathBuffer, childPathLen, &pJsonString[pValue->start - 1],
+					pValue->end - pValue->start + 2);
+		} else {
+			rc = setField(pRecord, pathBuffer, childPathLen, &pJsonString[pValue->start],
+					pValue->end - pValue->start);
+		}
+		if (NONE_ERROR != rc) {
+			return rc;
+		}
+
+		i = skipValue(i + 1, tokenCount);
+	}
+
+	return NONE_ERROR;
+}
+
+static int32_t findStateObject(const char *pJsonString, int32_t tokenCount) {
+	int32_t i = 1;
+
+	while (i + 1 < tokenCount) {
+		if (0 == jsoneq(pJsonString, &offlineJsonTokens[i], SHADOW_STATE_STRING)) {
+			return (JSMN_OBJECT == offlineJsonTokens[i + 1].type) ? i + 1 : -1;
+		}
+		i = skipValue(i + 1, tokenCount);
+	}
+	return -1;
+}
+
+static bool append(char *pBuffer, size_t bufferSize, size_t *pLength, const char *pText, size_t textLen) {
+	if (bufferSize - *pLength <= textLen) {
+		return false;
+	}
+	memcpy(pBuffer + *pLength, pText, textLen);
+	*pLength += textLen;
+	pBuffer[*pLength] = '\0';
+	return true;
+}
+
+static bool appendString(char *pBuffer, size_t bufferSize, size_t *pLength, const char *pText) {
+	return append(pBuffer, bufferSize, pLength, pText, strlen(pText));
+}
+
+// Rebuild {"state":{...},"clientToken":"..."} from the sorted fields of one generation, opening and closing objects
+// between them
+static IoT_Error_t buildDocument(const OfflineRecord_t *pRecord, uint8_t generation, char *pBuffer, size_t bufferSize) {
+	const OfflineField_t *pField;
+	const char *pPath;
+	const char *pPrevious = NULL;
+	const char *pSeparator;
+	size_t previousLen = 0;
+	size_t length = 0;
+	size_t commonLen, segmentStart;
+	uint16_t commonParents, openParents = 0;
+	uint16_t i;
+	bool isOk;
+
+	pBuffer[0] = '\0';
+	isOk = appendString(pBuffer, bufferSize, &length, "{\"" SHADOW_STATE_STRING "\":{");
+
+	for (i = 0; isOk && i < pRecord->fieldCount; i++) {
+		pField = &pRecord->fields[i];
+		pPath = &pRecord->data[pField->offset];
+		if (pField->generation != generation) {
+			continue;
+		}
+
+		// Objects both paths lie in stay open
+		commonLen = 0;
+		commonParents = 0;
+		while (NULL != pPrevious) {
+			pSeparator = memchr(pPath + commonLen, PATH_SEPARATOR, pField->pathLen - commonLen);
+			if (NULL == pSeparator || (size_t) (pSeparator - pPath) >= previousLen
+					|| PATH_SEPARATOR != pPrevious[pSeparator - pPath]
+					|| 0 != memcmp(pPath + commonLen, pPrevious + commonLen, pSeparator - pPath - commonLen)) {
+				break;
+			}
+			commonLen = pSeparator - pPath + 1;
+			commonParents++;
+		}
+
+		for (; isOk && openParents > commonParents; openParents--) {
+			isOk = appendString(pBuffer, bufferSize, &length, "}");
+		}
+		if (NULL != pPrevious) {
+			isOk = isOk && appendString(pBuffer, bufferSize, &length, ",");
+		}
+
+		segmentStart = commonLen;
+		while (isOk) {
+			pSeparator = memchr(pPath + segmentStart, PATH_SEPARATOR, pField->pathLen - segmentStart);
+			isOk = appendString(pBuffer, bufferSize, &length, "\"")
+					&& append(pBuffer, bufferSize, &length, pPath + segmentStart,
+							((NULL != pSeparator) ? (size_t) (pSeparator - pPath) : pField->pathLen) - segmentStart)
+					&& appendString(pBuffer, bufferSize, &length, (NULL != pSeparator) ? "\":{" : "\":");
+			if (NULL == pSeparator) {
+				break;
+			}
+			segmentStart = pSeparator - pPath + 1;
+			openParents++;
+		}
+		isOk = isOk && append(pBuffer, bufferSize, &length, pPath + pField->pathLen, pField->valueLen);
+
+		pPrevious = pPath;
+		previousLen = pField->pathLen;
+	}
+
+	for (; isOk && openParents > 0; openParents--) {
+		isOk = appendString(pBuffer, bufferSize, &length, "}");
+	}
+	isOk = isOk && appendString(pBuffer, bufferSize, &length, "}, \"" SHADOW_CLIENT_TOKEN_STRING "\":\"");
+	if (!isOk || NONE_ERROR != aws_iot_fill_with_client_token(pBuffer + length, bufferSize - length)) {
+		return SHADOW_JSON_BUFFER_TRUNCATED;
+	}
+	length += strlen(pBuffer + length);
+
+	return appendString(pBuffer, bufferSize, &length, "\"}") ? NONE_ERROR : SHADOW_JSON_BUFFER_TRUNCATED;
+}
+
+IoT_Error_t iot_shadow_offline_update(const char *pThingName, const char *pJsonString, fpActionCallback_t callback,
+		void *pContextData, uint8_t timeout_seconds, bool isPersistentSubscribe) {
+	OfflineRecord_t *pRecord;
+	int32_t tokenCount, stateIndex;
+	bool isNewRecord = false;
+	uint8_t generation;
+	IoT_Error_t rc;
+
+	if (0 == AWS_IOT_SHADOW_OFFLINE_MAX_THINGS) {
+		return CONNECTION_ERROR;
+	}
+	if (NULL == pThingName || NULL == pJsonString) {
+		return NULL_VALUE_ERROR;
+	}
+	if (strlen(pThingName) >= MAX_SIZE_OF_THING_NAME) {
+		return CONNECTION_ERROR;
+	}
+
+	jsmn_init(&offlineJsonParser);
+	tokenCount = jsmn_parse(&offlineJsonParser, pJsonString, strlen(pJsonString), offlineJsonTokens,
+			sizeof(offlineJsonTokens) / sizeof(offlineJsonTokens[0]));
+	if (tokenCount < 1 || JSMN_OBJECT != offlineJsonTokens[0].type) {
+		return SHADOW_JSON_ERROR;
+	}
+
+	// Only the state is collapsed, a version would no longer match what the merged fields were based on
+	stateIndex = findStateObject(pJsonString, tokenCount);
+	if (stateIndex < 0) {
+		return SHADOW_JSON_ERROR;
+	}
+
+	pRecord = findRecord(pThingName);
+	if (NULL == pRecord) {
+		pRecord = getFreeRecord();
+		if (NULL == pRecord) {
+			return SHADOW_OFFLINE_FULL;
+		}
+		isNewRecord = true;
+		strcpy(pRecord->thingName, pThingName);
+		pRecord->fieldCount = 0;
+		pRecord->usedBytes = 0;
+		pRecord->lastGeneration = 0;
+	}
+
+	savedRecord = *pRecord;
+	rc = mergeObject(pRecord, pJsonString, tokenCount, stateIndex, 0);
+	if (NONE_ERROR == rc) {
+		compactGenerations(pRecord);
+		for (generation = 0; NONE_ERROR == rc && generation <= pRecord->lastGeneration; generation++) {
+			rc = buildDocument(pRecord, generation, documentBuffer, sizeof(documentBuffer));
+		}
+	}
+	if (NONE_ERROR != rc) {
+		*pRecord = savedRecord;
+		return rc;
+	}
+	if (isNewRecord && 0 == pRecord->fieldCount) {
+		// Nothing but empty objects, there is nothing to send
+		return NONE_ERROR;
+	}
+
+	pRecord->isPending = true;
+	pRecord->callback = callback;
+	pRecord->pContextData = pContextData;
+	pRecord->timeout_seconds = timeout_seconds;
+	pRecord->isPersistentSubscribe = isPersistentSubscribe;
+	offlineStats.heldUpdates++;
+
+	return NONE_ERROR;
+}
+
+// Drop the values of the update that was sent, the next one becomes generation 0
+static void removeFirstGeneration(OfflineRecord_t *pRecord) {
+	uint16_t i = 0;
+
+	while (i < pRecord->fieldCount) {
+		if (0 == pRecord->fields[i].generation) {
+			removeField(pRecord, i);
+		} else {
+			pRecord->fields[i].generation--;
+			i++;
+		}
+	}
+	pRecord->lastGeneration--;
+}
+
+void iot_shadow_offline_flush(MQTTClient_t *pClient) {
+	OfflineRecord_t *pRecord;
+	IoT_Error_t rc;
+	bool isLast;
+	uint8_t i;
+
+	for (i = 0; i < AWS_IOT_SHADOW_OFFLINE_MAX_THINGS; i++) {
+		pRecord = &offlineRecords[i];
+		if (!pRecord->isPending) {
+			continue;
+		}
+		if (!pClient->isConnected()) {
+			return;
+		}
+
+		// Updates of one thing go out in order, the callback belongs to the last one
+		do {
+			isLast = (0 == pRecord->lastGeneration);
+			if (NONE_ERROR != buildDocument(pRecord, 0, documentBuffer, sizeof(documentBuffer))) {
+				// Only a longer client token can make a document that fit when it was merged overflow
+				ERROR("Collapsed update of %s does not fit into %d bytes", pRecord->thingName, AWS_IOT_MQTT_TX_BUF_LEN);
+				if (NULL != pRecord->callback) {
+					pRecord->callback(pRecord->thingName, SHADOW_UPDATE, SHADOW_ACK_REJECTED, NULL,
+							pRecord->pContextData);
+				}
+				pRecord->isPending = false;
+				break;
+			}
+			rc = iot_shadow_action(pClient, pRecord->thingName, SHADOW_UPDATE, documentBuffer,
+					isLast ? pRecord->callback : NULL, isLast ? pRecord->pContextData : NULL, pRecord->timeout_seconds,
+					pRecord->isPersistentSubscribe);
+			if (NONE_ERROR != rc) {
+				// No free acknowledgment slot or the connection dropped again, retried from the next yield
+				DEBUG("Collapsed update of %s not sent yet, error %d", pRecord->thingName, rc);
+				break;
+			}
+			offlineStats.sentUpdates++;
+			if (isLast) {
+				pRecord->isPending = false;
+			} else {
+				removeFirstGeneration(pRecord);
+			}
+		} while (pRecord->isPending);
+	}
+}
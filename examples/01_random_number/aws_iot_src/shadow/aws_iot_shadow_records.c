@@ -22,16 +22,23 @@
 #include "aws_iot_json_utils.h"
 #include "aws_iot_log.h"
 #include "aws_iot_shadow_json.h"
+#include "aws_iot_shadow_key.h"
+#include "aws_iot_shadow_bulk_get.h"
+#include "aws_iot_request.h"
 #include "aws_iot_config.h"
 
+#if AWS_IOT_REQUEST_MAX_PENDING < MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME
+#error "AWS_IOT_REQUEST_MAX_PENDING must be at least MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME"
+#endif
+#if AWS_IOT_REQUEST_MAX_CORRELATION_ID_LEN < MAX_SIZE_CLIENT_ID_WITH_SEQUENCE
+#error "AWS_IOT_REQUEST_MAX_CORRELATION_ID_LEN must be at least MAX_SIZE_CLIENT_ID_WITH_SEQUENCE"
+#endif
+
 typedef struct {
-	char clientTokenID[MAX_SIZE_CLIENT_ID_WITH_SEQUENCE];
 	char thingName[MAX_SIZE_OF_THING_NAME];
 	ShadowActions_t action;
 	fpActionCallback_t callback;
 	void *pCallbackContext;
-	bool isFree;
-	Timer timer;
 } ToBeReceivedAckRecord_t;
 
 typedef struct {
@@ -52,7 +59,9 @@ typedef enum {
 	SHADOW_ACCEPTED, SHADOW_REJECTED, SHADOW_ACTION
 } ShadowAckTopicTypes_t;
 
-ToBeReceivedAckRecord_t AckWaitList[MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME];
+// Actions waiting for accepted/rejected, correlated on the clientToken. Records are indexed like the engine's table
+static RequestEngine_t shadowRequestEngine;
+static ToBeReceivedAckRecord_t AckWaitList[AWS_IOT_REQUEST_MAX_PENDING];
 
 MQTTClient_t *pMqttClient;
 
@@ -67,9 +76,16 @@ SubscriptionRecord_t SubscriptionList[MAX_TOPICS_AT_ANY_GIVEN_TIME];
 #define SUBSCRIBE_SETTLING_TIME 2
 char shadowRxBuf[SHADOW_MAX_SIZE_OF_RX_BUFFER];
 
+static char bulkGetAcceptedTopic[] = "$aws/things/+/shadow/get/accepted";
+static char bulkGetRejectedTopic[] = "$aws/things/+/shadow/get/rejected";
+static bool bulkGetSubscribedFlag = false;
+
 static JsonTokenTable_t tokenTable[MAX_JSON_TOKEN_EXPECTED];
 static uint32_t tokenTableIndex = 0;
 static bool deltaTopicSubscribedFlag = false;
+static fpDeltaBatchCallback_t deltaBatchCallback = NULL;
+static void *pDeltaBatchContextData = NULL;
+static ShadowDeltaField_t deltaBatchFields[MAX_JSON_TOKEN_EXPECTED];
 uint32_t shadowJsonVersionNum = 0;
 bool shadowDiscardOldDeltaFlag = true;
 
@@ -79,7 +95,7 @@ static int shadow_delta_callback(MQTTCallbackParams params);
 static void topicNameFromThingAndAction(char *pTopic, const char *pThingName, ShadowActions_t action,
 		ShadowAckTopicTypes_t ackType);
 static int16_t getNextFreeIndexOfSubscriptionList(void);
-static void unsubscribeFromAcceptedAndRejected(uint8_t index);
+static void unsubscribeFromAcceptedAndRejected(const char *pThingName, ShadowActions_t action);
 
 void initDeltaTokens(void) {
 	uint32_t i;
@@ -88,14 +104,15 @@ void initDeltaTokens(void) {
 	}
 	tokenTableIndex = 0;
 	deltaTopicSubscribedFlag = false;
+	deltaBatchCallback = NULL;
+	pDeltaBatchContextData = NULL;
 }
 
-IoT_Error_t registerJsonTokenOnDelta(jsonStruct_t *pStruct) {
-
+static IoT_Error_t subscribeToDeltaTopic(void) {
 	IoT_Error_t rc = NONE_ERROR;
 
 	if (!deltaTopicSubscribedFlag) {
-		MQTTSubscribeParams subParams;
+		MQTTSubscribeParams subParams = MQTTSubscribeParamsDefault;
 		subParams.mHandler = shadow_delta_callback;
 		snprintf(shadowDeltaTopic,MAX_SHADOW_TOPIC_LENGTH_BYTES, "$aws/things/%s/shadow/update/delta", myThingName);
 		subParams.pTopic = shadowDeltaTopic;
@@ -105,6 +122,26 @@ IoT_Error_t registerJsonTokenOnDelta(jsonStruct_t *pStruct) {
 		deltaTopicSubscribedFlag = true;
 	}
 
+	return rc;
+}
+
+IoT_Error_t registerDeltaBatchCallback(fpDeltaBatchCallback_t callback, void *pContextData) {
+	deltaBatchCallback = callback;
+	pDeltaBatchContextData = pContextData;
+
+	if (NULL == callback) {
+		return NONE_ERROR;
+	}
+
+	return subscribeToDeltaTopic();
+}
+
+IoT_Error_t registerJsonTokenOnDelta(jsonStruct_t *pStruct) {
+
+	IoT_Error_t rc = NONE_ERROR;
+
+	rc = subscribeToDeltaTopic();
+
 	if (tokenTableIndex >= MAX_JSON_TOKEN_EXPECTED) {
 		return GENERIC_ERROR;
 	}
@@ -165,7 +202,7 @@ static bool isAckForMyThingName(const char *pTopicName) {
 
 static int AckStatusCallback(MQTTCallbackParams params) {
 	int32_t tokenCount;
-	int32_t i;
+	bool isResponseMatched = false;
 	void *pJsonHandler;
 	char temporaryClientToken[MAX_SIZE_CLIENT_ID_WITH_SEQUENCE];
 
@@ -191,26 +228,19 @@ static int AckStatusCallback(MQTTCallbackParams params) {
 	}
 
 	if (extractClientToken(shadowRxBuf, temporaryClientToken)) {
-		for (i = 0; i < MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME; i++) {
-			if (!AckWaitList[i].isFree) {
-				if (strcmp(AckWaitList[i].clientTokenID, temporaryClientToken) == 0) {
-					Shadow_Ack_Status_t status;
-					if (strstr(params.pTopicName, "accepted") != NULL) {
-						status = SHADOW_ACK_ACCEPTED;
-					} else if (strstr(params.pTopicName, "rejected") != NULL) {
-						status = SHADOW_ACK_REJECTED;
-					}
-					if (status == SHADOW_ACK_ACCEPTED || status == SHADOW_ACK_REJECTED) {
-						if (AckWaitList[i].callback != NULL) {
-							AckWaitList[i].callback(AckWaitList[i].thingName, AckWaitList[i].action, status,
-									shadowRxBuf, AckWaitList[i].pCallbackContext);
-						}
-						unsubscribeFromAcceptedAndRejected(i);
-						AckWaitList[i].isFree = true;
-						return NONE_ERROR;
-					}
-				}
-			}
+		if (strstr(params.pTopicName, "accepted") != NULL) {
+			isResponseMatched = aws_iot_request_complete(&shadowRequestEngine, temporaryClientToken, REQUEST_ACCEPTED,
+					shadowRxBuf, params.MessageParams.PayloadLen);
+		} else if (strstr(params.pTopicName, "rejected") != NULL) {
+			isResponseMatched = aws_iot_request_complete(&shadowRequestEngine, temporaryClientToken, REQUEST_REJECTED,
+					shadowRxBuf, params.MessageParams.PayloadLen);
+		}
+		if (isResponseMatched) {
+			return NONE_ERROR;
+		}
+		// Not a single action, it may answer one of the requests of a bulk get
+		if (iot_shadow_bulk_get_handle_ack(params.pTopicName, params.TopicNameLen, temporaryClientToken, shadowRxBuf)) {
+			return NONE_ERROR;
 		}
 	}
 
@@ -229,16 +259,14 @@ static int16_t findIndexOfSubscriptionList(const char *pTopic) {
 	return -1;
 }
 
-static void unsubscribeFromAcceptedAndRejected(uint8_t index) {
+static void unsubscribeFromAcceptedAndRejected(const char *pThingName, ShadowActions_t action) {
 
 	char TemporaryTopicNameAccepted[MAX_SHADOW_TOPIC_LENGTH_BYTES];
 	char TemporaryTopicNameRejected[MAX_SHADOW_TOPIC_LENGTH_BYTES];
 	IoT_Error_t ret_val = NONE_ERROR;
 
-	topicNameFromThingAndAction(TemporaryTopicNameAccepted, AckWaitList[index].thingName, AckWaitList[index].action,
-			SHADOW_ACCEPTED);
-	topicNameFromThingAndAction(TemporaryTopicNameRejected, AckWaitList[index].thingName, AckWaitList[index].action,
-			SHADOW_REJECTED);
+	topicNameFromThingAndAction(TemporaryTopicNameAccepted, pThingName, action, SHADOW_ACCEPTED);
+	topicNameFromThingAndAction(TemporaryTopicNameRejected, pThingName, action, SHADOW_REJECTED);
 
 	int16_t indexSubList;
 
@@ -269,17 +297,59 @@ static void unsubscribeFromAcceptedAndRejected(uint8_t index) {
 
 void initializeRecords(MQTTClient_t *pClient) {
 	uint8_t i;
-	for (i = 0; i < MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME; i++) {
-		AckWaitList[i].isFree = true;
-	}
+	RequestEngineParams_t requestParams = RequestEngineParamsDefault;
+
+	requestParams.pIdPrefix = mqttClientID;
+	requestParams.pCorrelationKey = SHADOW_CLIENT_TOKEN_STRING;
+	requestParams.window = MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME;
+	aws_iot_request_init(&shadowRequestEngine, &requestParams);
 	for (i = 0; i < MAX_TOPICS_AT_ANY_GIVEN_TIME; i++) {
 		SubscriptionList[i].isFree = true;
 		SubscriptionList[i].count = 0;
 		SubscriptionList[i].isSticky = false;
 	}
+	bulkGetSubscribedFlag = false;
 	pMqttClient = pClient;
 }
 
+IoT_Error_t subscribeToBulkGetAcks(bool *pIsNewSubscription) {
+	IoT_Error_t ret_val = NONE_ERROR;
+	MQTTSubscribeParams subParams = MQTTSubscribeParamsDefault;
+
+	*pIsNewSubscription = false;
+	if (bulkGetSubscribedFlag) {
+		return NONE_ERROR;
+	}
+
+	// Responses of all things share the handler of single actions, so whichever subscription matches first they are routed the same way
+	subParams.mHandler = AckStatusCallback;
+	subParams.qos = QOS_0;
+	subParams.pTopic = bulkGetAcceptedTopic;
+	ret_val = pMqttClient->subscribe(&subParams);
+	if (ret_val == NONE_ERROR) {
+		subParams.pTopic = bulkGetRejectedTopic;
+		ret_val = pMqttClient->subscribe(&subParams);
+		if (ret_val != NONE_ERROR) {
+			pMqttClient->unsubscribe(bulkGetAcceptedTopic);
+		}
+	}
+
+	if (ret_val == NONE_ERROR) {
+		bulkGetSubscribedFlag = true;
+		*pIsNewSubscription = true;
+	}
+
+	return ret_val;
+}
+
+void unsubscribeFromBulkGetAcks(void) {
+	if (bulkGetSubscribedFlag) {
+		pMqttClient->unsubscribe(bulkGetAcceptedTopic);
+		pMqttClient->unsubscribe(bulkGetRejectedTopic);
+		bulkGetSubscribedFlag = false;
+	}
+}
+
 bool isSubscriptionPresent(const char *pThingName, ShadowActions_t action) {
 
 	uint8_t i = 0;
@@ -395,46 +465,47 @@ IoT_Error_t publishToShadowAction(const char * pThingName, ShadowActions_t actio
 	return ret_val;
 }
 
-bool getNextFreeIndexOfAckWaitList(uint8_t *pIndex) {
-	uint8_t i;
-	if (pIndex != NULL) {
-		for (i = 0; i < MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME; i++) {
-			if (AckWaitList[i].isFree) {
-				*pIndex = i;
-				return true;
-			}
-		}
+bool hasFreeAckWaitSlot(void) {
+	return aws_iot_request_has_capacity(&shadowRequestEngine);
+}
+
+static void ackWaitCallback(const char *pCorrelationId, RequestStatus_t status, const char *pPayload,
+		size_t payloadLen, void *pContextData) {
+	// copied, the callback may start another action that reuses the record
+	ToBeReceivedAckRecord_t record = *(ToBeReceivedAckRecord_t *) pContextData;
+	Shadow_Ack_Status_t ackStatus = SHADOW_ACK_TIMEOUT;
+
+	if (REQUEST_ACCEPTED == status) {
+		ackStatus = SHADOW_ACK_ACCEPTED;
+	} else if (REQUEST_REJECTED == status) {
+		ackStatus = SHADOW_ACK_REJECTED;
 	}
-	return false;
+
+	if (record.callback != NULL) {
+		record.callback(record.thingName, record.action, ackStatus, shadowRxBuf, record.pCallbackContext);
+	}
+	unsubscribeFromAcceptedAndRejected(record.thingName, record.action);
 }
 
-void addToAckWaitList(uint8_t indexAckWaitList, const char *pThingName, ShadowActions_t action,
-		const char *pExtractedClientToken, fpActionCallback_t callback, void *pCallbackContext,
-		uint32_t timeout_seconds) {
-	AckWaitList[indexAckWaitList].callback = callback;
-	strncpy(AckWaitList[indexAckWaitList].clientTokenID, pExtractedClientToken, MAX_SIZE_CLIENT_ID_WITH_SEQUENCE);
-	strncpy(AckWaitList[indexAckWaitList].thingName, pThingName, MAX_SIZE_OF_THING_NAME);
-	AckWaitList[indexAckWaitList].pCallbackContext = pCallbackContext;
-	AckWaitList[indexAckWaitList].action = action;
-	InitTimer(&(AckWaitList[indexAckWaitList].timer));
-	countdown(&(AckWaitList[indexAckWaitList].timer), timeout_seconds);
-	AckWaitList[indexAckWaitList].isFree = false;
+IoT_Error_t addToAckWaitList(const char *pThingName, ShadowActions_t action, const char *pExtractedClientToken,
+		fpActionCallback_t callback, void *pCallbackContext, uint32_t timeout_seconds) {
+	int16_t slot = aws_iot_request_next_slot(&shadowRequestEngine);
+
+	if (slot < 0) {
+		return REQUEST_WINDOW_FULL;
+	}
+
+	AckWaitList[slot].callback = callback;
+	strncpy(AckWaitList[slot].thingName, pThingName, MAX_SIZE_OF_THING_NAME);
+	AckWaitList[slot].pCallbackContext = pCallbackContext;
+	AckWaitList[slot].action = action;
+
+	return aws_iot_request_add(&shadowRequestEngine, pExtractedClientToken, timeout_seconds * 1000, ackWaitCallback,
+			&AckWaitList[slot], NULL);
 }
 
 void HandleExpiredResponseCallbacks(void) {
-	uint8_t i;
-	for (i = 0; i < MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME; i++) {
-		if (!AckWaitList[i].isFree) {
-			if (expired(&(AckWaitList[i].timer))) {
-				if (AckWaitList[i].callback != NULL) {
-					AckWaitList[i].callback(AckWaitList[i].thingName, AckWaitList[i].action, SHADOW_ACK_TIMEOUT,
-							shadowRxBuf, AckWaitList[i].pCallbackContext);
-				}
-				AckWaitList[i].isFree = true;
-				unsubscribeFromAcceptedAndRejected(i);
-			}
-		}
-	}
+	aws_iot_request_process_timeouts(&shadowRequestEngine);
 }
 
 static int shadow_delta_callback(MQTTCallbackParams params) {
@@ -444,6 +515,9 @@ static int shadow_delta_callback(MQTTCallbackParams params) {
 	void *pJsonHandler;
 	int32_t DataPosition;
 	uint32_t dataLength;
+	uint32_t fieldCount = 0;
+	uint32_t tempVersionNumber = 0;
+	bool isVersionPresent;
 
 	if (params.MessageParams.PayloadLen > SHADOW_MAX_SIZE_OF_RX_BUFFER) {
 		return GENERIC_ERROR;
@@ -457,16 +531,14 @@ static int shadow_delta_callback(MQTTCallbackParams params) {
 		return GENERIC_ERROR;
 	}
 
-	if (shadowDiscardOldDeltaFlag) {
-		uint32_t tempVersionNumber = 0;
-		if (extractVersionNumber(shadowRxBuf, pJsonHandler, tokenCount, &tempVersionNumber)) {
-			if (tempVersionNumber > shadowJsonVersionNum) {
-				shadowJsonVersionNum = tempVersionNumber;
-				DEBUG("New Version number: %d", shadowJsonVersionNum);
-			} else {
-				WARN("Old Delta Message received - Ignoring rx: %d local: %d", tempVersionNumber, shadowJsonVersionNum);
-				return GENERIC_ERROR;
-			}
+	isVersionPresent = extractVersionNumber(shadowRxBuf, pJsonHandler, tokenCount, &tempVersionNumber);
+	if (shadowDiscardOldDeltaFlag && isVersionPresent) {
+		if (tempVersionNumber > shadowJsonVersionNum) {
+			shadowJsonVersionNum = tempVersionNumber;
+			DEBUG("New Version number: %d", shadowJsonVersionNum);
+		} else {
+			WARN("Old Delta Message received - Ignoring rx: %d local: %d", tempVersionNumber, shadowJsonVersionNum);
+			return GENERIC_ERROR;
 		}
 	}
 
@@ -474,12 +546,24 @@ static int shadow_delta_callback(MQTTCallbackParams params) {
 		if (!tokenTable[i].isFree) {
 			if (isJsonKeyMatchingAndUpdateValue(shadowRxBuf, pJsonHandler, tokenCount, tokenTable[i].pStruct,
 					&dataLength, &DataPosition)) {
-				if (tokenTable[i].callback != NULL) {
+				if (deltaBatchCallback != NULL) {
+					deltaBatchFields[fieldCount].keyId = i;
+					deltaBatchFields[fieldCount].pStruct = tokenTable[i].pStruct;
+					deltaBatchFields[fieldCount].pValue = shadowRxBuf + DataPosition;
+					deltaBatchFields[fieldCount].valueLength = dataLength;
+					fieldCount++;
+				} else if (tokenTable[i].callback != NULL) {
 					tokenTable[i].callback(shadowRxBuf + DataPosition, dataLength, tokenTable[i].pStruct);
 				}
 			}
 		}
 	}
 
+	// one call per delta, after every changed value has been written to its pData
+	if (deltaBatchCallback != NULL && fieldCount > 0) {
+		deltaBatchCallback(myThingName, isVersionPresent ? tempVersionNumber : 0, deltaBatchFields, fieldCount,
+				pDeltaBatchContextData);
+	}
+
 	return NONE_ERROR;
 }
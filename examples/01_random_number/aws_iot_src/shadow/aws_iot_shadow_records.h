@@ -32,14 +32,16 @@ void initializeRecords(MQTTClient_t *pClient);
 bool isSubscriptionPresent(const char *pThingName, ShadowActions_t action);
 IoT_Error_t subscribeToShadowActionAcks(const char *pThingName, ShadowActions_t action, bool isSticky);
 void incrementSubscriptionCnt(const char *pThingName, ShadowActions_t action, bool isSticky);
+IoT_Error_t subscribeToBulkGetAcks(bool *pIsNewSubscription);
+void unsubscribeFromBulkGetAcks(void);
 
 IoT_Error_t publishToShadowAction(const char * pThingName, ShadowActions_t action, const char *pJsonDocumentToBeSent);
-void addToAckWaitList(uint8_t indexAckWaitList, const char *pThingName, ShadowActions_t action,
-		const char *pExtractedClientToken, fpActionCallback_t callback, void *pCallbackContext,
-		uint32_t timeout_seconds);
-bool getNextFreeIndexOfAckWaitList(uint8_t *pIndex);
+IoT_Error_t addToAckWaitList(const char *pThingName, ShadowActions_t action, const char *pExtractedClientToken,
+		fpActionCallback_t callback, void *pCallbackContext, uint32_t timeout_seconds);
+bool hasFreeAckWaitSlot(void);
 void HandleExpiredResponseCallbacks(void);
 void initDeltaTokens(void);
 IoT_Error_t registerJsonTokenOnDelta(jsonStruct_t *pStruct);
+IoT_Error_t registerDeltaBatchCallback(fpDeltaBatchCallback_t callback, void *pContextData);
 
 #endif /* SRC_SHADOW_AWS_IOT_SHADOW_RECORDS_H_ */
@@ -0,0 +1,230 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "aws_iot_shadow_state.h"
+
+#include <sched.h>
+#include <string.h>
+
+static size_t valueSizeOfType(JsonPrimitiveType type, size_t valueSize) {
+	switch (type) {
+	case SHADOW_JSON_INT32:
+	case SHADOW_JSON_UINT32:
+		return sizeof(uint32_t);
+	case SHADOW_JSON_INT16:
+	case SHADOW_JSON_UINT16:
+		return sizeof(uint16_t);
+	case SHADOW_JSON_INT8:
+	case SHADOW_JSON_UINT8:
+		return sizeof(uint8_t);
+	case SHADOW_JSON_FLOAT:
+		return sizeof(float);
+	case SHADOW_JSON_DOUBLE:
+		return sizeof(double);
+	case SHADOW_JSON_BOOL:
+		return sizeof(bool);
+	default:
+		return valueSize;
+	}
+}
+
+static void copyFieldIn(ShadowStateStore_t *pStore, const ShadowStateField_t *pField) {
+	char *pValue = (char *) pStore->data + pField->offset;
+
+	memcpy(pValue, pField->pStruct->pData, pField->size);
+	if (SHADOW_JSON_STRING == pField->pStruct->type) {
+		pValue[pField->size - 1] = '\0';
+	}
+}
+
+// The writer side of the seqlock. Readers that saw the odd sequence, or a different one, discard their copy
+static void beginUpdate(ShadowStateStore_t *pStore) {
+	pStore->sequence++;
+	__sync_synchronize();
+}
+
+static void endUpdate(ShadowStateStore_t *pStore, uint32_t version) {
+	if (0 != version) {
+		pStore->version = version;
+	}
+	__sync_synchronize();
+	pStore->sequence++;
+}
+
+/* Copies len bytes at offset as they were between two updates. The copy itself may read a half written
+ * value, it is only kept when the sequence did not move while it was taken */
+static IoT_Error_t readConsistent(const ShadowStateStore_t *pStore, uint32_t offset, size_t len, void *pDest,
+		uint32_t *pSequence, uint32_t *pVersion, uint32_t *pRetries) {
+	uint32_t before, version, attempt;
+
+	for (attempt = 0; attempt < AWS_IOT_SHADOW_STATE_READ_RETRIES; attempt++) {
+		before = pStore->sequence;
+		if (0 != (before & 1)) {
+			// An update is running, let the writer finish it in case it shares this CPU
+			sched_yield();
+		} else {
+			__sync_synchronize();
+			memcpy(pDest, (const char *) pStore->data + offset, len);
+			version = pStore->version;
+			__sync_synchronize();
+			if (before == pStore->sequence) {
+				if (NULL != pSequence) {
+					*pSequence = before;
+				}
+				if (NULL != pVersion) {
+					*pVersion = version;
+				}
+				if (NULL != pRetries) {
+					*pRetries = attempt;
+				}
+				return NONE_ERROR;
+			}
+		}
+	}
+
+	return SHADOW_STATE_READ_CONTENDED;
+}
+
+IoT_Error_t aws_iot_shadow_state_init(ShadowStateStore_t *pStore) {
+	if (NULL == pStore) {
+		return NULL_VALUE_ERROR;
+	}
+
+	memset(pStore, 0, sizeof(ShadowStateStore_t));
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_shadow_state_add_field(ShadowStateStore_t *pStore, jsonStruct_t *pStruct, size_t valueSize,
+		uint32_t *pFieldId) {
+	ShadowStateField_t *pField;
+	size_t size;
+
+	if (NULL == pStore || NULL == pStruct || NULL == pStruct->pData) {
+		return NULL_VALUE_ERROR;
+	}
+
+	size = valueSizeOfType(pStruct->type, valueSize);
+	if (0 == size) {
+		return GENERIC_ERROR;
+	}
+	if (pStore->fieldCount >= AWS_IOT_SHADOW_STATE_MAX_FIELDS || size > sizeof(pStore->data) - pStore->usedBytes) {
+		return SHADOW_STATE_FULL;
+	}
+
+	pField = &(pStore->fields[pStore->fieldCount]);
+	pField->pStruct = pStruct;
+	pField->offset = pStore->usedBytes;
+	pField->size = (uint32_t) size;
+	copyFieldIn(pStore, pField);
+
+	// Keeps the next value aligned for every type, data is a whole number of uint64_t
+	pStore->usedBytes += (uint32_t) ((size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1));
+
+	if (NULL != pFieldId) {
+		*pFieldId = pStore->fieldCount;
+	}
+	pStore->fieldCount++;
+
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_shadow_state_apply_delta(ShadowStateStore_t *pStore, uint32_t version,
+		const ShadowDeltaField_t *pFields, uint32_t fieldCount) {
+	uint32_t i, j;
+
+	if (NULL == pStore || (NULL == pFields && 0 != fieldCount)) {
+		return NULL_VALUE_ERROR;
+	}
+
+	beginUpdate(pStore);
+	for (i = 0; i < fieldCount; i++) {
+		for (j = 0; j < pStore->fieldCount; j++) {
+			if (pStore->fields[j].pStruct == pFields[i].pStruct) {
+				copyFieldIn(pStore, &(pStore->fields[j]));
+				break;
+			}
+		}
+	}
+	endUpdate(pStore, version);
+
+	return NONE_ERROR;
+}
+
+void aws_iot_shadow_state_delta_callback(const char *pThingName, uint32_t version, const ShadowDeltaField_t *pFields,
+		uint32_t fieldCount, void *pContextData) {
+	(void) pThingName;
+	aws_iot_shadow_state_apply_delta((ShadowStateStore_t *) pContextData, version, pFields, fieldCount);
+}
+
+IoT_Error_t aws_iot_shadow_state_update_all(ShadowStateStore_t *pStore, uint32_t version) {
+	uint32_t i;
+
+	if (NULL == pStore) {
+		return NULL_VALUE_ERROR;
+	}
+
+	beginUpdate(pStore);
+	for (i = 0; i < pStore->fieldCount; i++) {
+		copyFieldIn(pStore, &(pStore->fields[i]));
+	}
+	endUpdate(pStore, version);
+
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_shadow_state_snapshot(const ShadowStateStore_t *pStore, ShadowStateSnapshot_t *pSnapshot) {
+	if (NULL == pStore || NULL == pSnapshot) {
+		return NULL_VALUE_ERROR;
+	}
+
+	return readConsistent(pStore, 0, pStore->usedBytes, pSnapshot->data, &(pSnapshot->sequence),
+			&(pSnapshot->version), &(pSnapshot->retries));
+}
+
+const void *aws_iot_shadow_state_get(const ShadowStateStore_t *pStore, const ShadowStateSnapshot_t *pSnapshot,
+		uint32_t fieldId) {
+	if (NULL == pStore || NULL == pSnapshot || fieldId >= pStore->fieldCount) {
+		return NULL;
+	}
+
+	return (const char *) pSnapshot->data + pStore->fields[fieldId].offset;
+}
+
+IoT_Error_t aws_iot_shadow_state_read_field(const ShadowStateStore_t *pStore, uint32_t fieldId, void *pDest,
+		size_t destSize, uint32_t *pVersion) {
+	const ShadowStateField_t *pField;
+
+	if (NULL == pStore || NULL == pDest) {
+		return NULL_VALUE_ERROR;
+	}
+	if (fieldId >= pStore->fieldCount) {
+		return GENERIC_ERROR;
+	}
+
+	pField = &(pStore->fields[fieldId]);
+	if (destSize < pField->size) {
+		return GENERIC_ERROR;
+	}
+
+	return readConsistent(pStore, pField->offset, pField->size, pDest, NULL, pVersion, NULL);
+}
+
+bool aws_iot_shadow_state_has_changed(const ShadowStateStore_t *pStore, const ShadowStateSnapshot_t *pSnapshot) {
+	if (NULL == pStore || NULL == pSnapshot) {
+		return false;
+	}
+
+	return pStore->sequence != pSnapshot->sequence;
+}
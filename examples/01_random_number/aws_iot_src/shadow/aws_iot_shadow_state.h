@@ -0,0 +1,184 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file aws_iot_shadow_state.h
+ * @brief Local copy of the shadow state that other threads read without locks
+ *
+ * The delta callback writes new values straight into the pData of the registered jsonStruct_t,
+ * so any other thread reading pData would have to share a lock with aws_iot_shadow_yield.  A
+ * state store instead keeps its own copy of every added field, guarded by a sequence counter
+ * (a seqlock).  The thread calling aws_iot_shadow_yield is the only writer: it applies each
+ * delta as one new version of the store and never waits for readers.  Readers copy the fields
+ * they need and retry in the rare case an update ran during the copy, so they never block the
+ * writer or each other and always see all fields of the same delta together.
+ *
+ * Typical use:
+ *  - add every registered field with aws_iot_shadow_state_add_field before the first yield
+ *  - register aws_iot_shadow_state_delta_callback with aws_iot_shadow_register_delta_batch,
+ *    or call aws_iot_shadow_state_apply_delta from an own batch callback
+ *  - read from other threads with aws_iot_shadow_state_snapshot or aws_iot_shadow_state_read_field,
+ *    never through pData
+ */
+
+#ifndef SRC_SHADOW_AWS_IOT_SHADOW_STATE_H_
+#define SRC_SHADOW_AWS_IOT_SHADOW_STATE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "aws_iot_shadow_interface.h"
+#include "aws_iot_config.h"
+
+/**
+ * @brief Where one field lives in the store
+ */
+typedef struct {
+	jsonStruct_t *pStruct;	///< Field as registered for deltas, its pData is the writer's copy
+	uint32_t offset;		///< Position of the value in the data of the store and of snapshots
+	uint32_t size;			///< Bytes kept of the value
+} ShadowStateField_t;
+
+/**
+ * @brief Shadow state shared between the writing thread and any number of reading threads
+ *
+ * @note Initialize with aws_iot_shadow_state_init and add all fields before readers start
+ */
+typedef struct {
+	volatile uint32_t sequence;	///< Incremented before and after every update, odd while one is running
+	uint32_t version;			///< Shadow version of the last applied delta, 0 before the first one
+	uint32_t fieldCount;		///< Entries used in fields
+	uint32_t usedBytes;			///< Bytes used in data
+	ShadowStateField_t fields[AWS_IOT_SHADOW_STATE_MAX_FIELDS];			///< Fields in the order they were added
+	uint64_t data[AWS_IOT_SHADOW_STATE_MAX_BYTES / sizeof(uint64_t)];	///< Values, 8 byte aligned
+} ShadowStateStore_t;
+
+/**
+ * @brief Consistent copy of all fields of a store, taken by aws_iot_shadow_state_snapshot
+ */
+typedef struct {
+	uint32_t sequence;	///< Sequence of the store the copy was taken at
+	uint32_t version;	///< Shadow version the values belong to
+	uint32_t retries;	///< Copies discarded because an update ran during them
+	uint64_t data[AWS_IOT_SHADOW_STATE_MAX_BYTES / sizeof(uint64_t)];	///< Values, see aws_iot_shadow_state_get
+} ShadowStateSnapshot_t;
+
+/**
+ * @brief Set up an empty store
+ *
+ * @param pStore Store to initialize
+ * @return NONE_ERROR or NULL_VALUE_ERROR
+ */
+IoT_Error_t aws_iot_shadow_state_init(ShadowStateStore_t *pStore);
+
+/**
+ * @brief Keep a field in the store, starting with the current value of its pData
+ *
+ * Only allowed before readers and the writer start using the store.
+ *
+ * @param pStore Store to add the field to
+ * @param pStruct Field, normally also registered with aws_iot_shadow_register_delta
+ * @param valueSize Size of the pData buffer for SHADOW_JSON_STRING and SHADOW_JSON_OBJECT fields,
+ *        ignored for the other types.  Strings are kept NUL terminated within this size
+ * @param pFieldId Receives the id used to read the field, may be NULL
+ * @return NONE_ERROR, NULL_VALUE_ERROR, GENERIC_ERROR for a string or object without a size, or
+ *         SHADOW_STATE_FULL once AWS_IOT_SHADOW_STATE_MAX_FIELDS or AWS_IOT_SHADOW_STATE_MAX_BYTES are used up
+ */
+IoT_Error_t aws_iot_shadow_state_add_field(ShadowStateStore_t *pStore, jsonStruct_t *pStruct, size_t valueSize,
+		uint32_t *pFieldId);
+
+/**
+ * @brief Publish the changed fields of a delta as a new version of the store
+ *
+ * Copies the pData of every field of the delta that was added to the store.  Only to be called by
+ * the thread that calls aws_iot_shadow_yield, normally from a batch delta callback.
+ *
+ * @param pStore Store to update
+ * @param version Version of the delta, 0 keeps the version of the store
+ * @param pFields Changed fields as given to the batch delta callback
+ * @param fieldCount Number of entries in pFields
+ * @return NONE_ERROR or NULL_VALUE_ERROR
+ */
+IoT_Error_t aws_iot_shadow_state_apply_delta(ShadowStateStore_t *pStore, uint32_t version,
+		const ShadowDeltaField_t *pFields, uint32_t fieldCount);
+
+/**
+ * @brief Batch delta callback that applies every delta to the store given as pContextData
+ *
+ * Register it with aws_iot_shadow_register_delta_batch when the store is the only consumer of deltas.
+ */
+void aws_iot_shadow_state_delta_callback(const char *pThingName, uint32_t version, const ShadowDeltaField_t *pFields,
+		uint32_t fieldCount, void *pContextData);
+
+/**
+ * @brief Publish the pData of all fields as a new version of the store
+ *
+ * For values the writing thread changed itself, e.g. before reporting them.  Same threading rule
+ * as aws_iot_shadow_state_apply_delta.
+ *
+ * @param pStore Store to update
+ * @param version New version, 0 keeps the version of the store
+ * @return NONE_ERROR or NULL_VALUE_ERROR
+ */
+IoT_Error_t aws_iot_shadow_state_update_all(ShadowStateStore_t *pStore, uint32_t version);
+
+/**
+ * @brief Copy all fields of the store as they were after one update
+ *
+ * Never blocks the writer.  Any number of threads may take snapshots at the same time.
+ *
+ * @param pStore Store to read
+ * @param pSnapshot Receives the values and the version they belong to
+ * @return NONE_ERROR, NULL_VALUE_ERROR, or SHADOW_STATE_READ_CONTENDED if updates kept running
+ *         during AWS_IOT_SHADOW_STATE_READ_RETRIES copies
+ */
+IoT_Error_t aws_iot_shadow_state_snapshot(const ShadowStateStore_t *pStore, ShadowStateSnapshot_t *pSnapshot);
+
+/**
+ * @brief Value of a field in a snapshot
+ *
+ * @param pStore Store the snapshot was taken from
+ * @param pSnapshot Snapshot to look into
+ * @param fieldId Id returned by aws_iot_shadow_state_add_field
+ * @return Pointer to the value, of the C type matching the JsonPrimitiveType of the field, NULL for an unknown id
+ */
+const void *aws_iot_shadow_state_get(const ShadowStateStore_t *pStore, const ShadowStateSnapshot_t *pSnapshot,
+		uint32_t fieldId);
+
+/**
+ * @brief Copy a single field of the store, cheaper than a snapshot when only one value is needed
+ *
+ * @param pStore Store to read
+ * @param fieldId Id returned by aws_iot_shadow_state_add_field
+ * @param pDest Receives the value
+ * @param destSize Size of pDest, at least the size of the field
+ * @param pVersion Receives the version the value belongs to, may be NULL
+ * @return NONE_ERROR, NULL_VALUE_ERROR, GENERIC_ERROR for an unknown id or a too small pDest,
+ *         or SHADOW_STATE_READ_CONTENDED
+ */
+IoT_Error_t aws_iot_shadow_state_read_field(const ShadowStateStore_t *pStore, uint32_t fieldId, void *pDest,
+		size_t destSize, uint32_t *pVersion);
+
+/**
+ * @brief Whether the store was updated after a snapshot was taken
+ *
+ * @param pStore Store the snapshot was taken from
+ * @param pSnapshot Earlier snapshot
+ * @return true if a newer version can be read
+ */
+bool aws_iot_shadow_state_has_changed(const ShadowStateStore_t *pStore, const ShadowStateSnapshot_t *pSnapshot);
+
+#endif /* SRC_SHADOW_AWS_IOT_SHADOW_STATE_H_ */
@@ -28,6 +28,10 @@
  * Enumeration of return values from the IoT_* functions within the SDK.
  */
 typedef enum {
+	/** Message log reader: no more records in the requested time range */
+	MESSAGE_LOG_END_OF_RANGE = 3,
+	/** Fragment reassembly: the last missing chunk was received and the checksum matched */
+	FRAGMENT_TRANSFER_COMPLETE = 2,
 	/** Return value of yield function to indicate auto-reconnect was successful */
 	RECONNECT_SUCCESSFUL = 1,
 	/** Success return value - no error occurred. */
@@ -87,7 +91,41 @@ typedef enum {
 	/** The MQTT RX buffer received corrupt message  */
 	RX_MESSAGE_INVALID = -27,
 	/** The MQTT RX buffer received a bigger message. The message will be dropped  */
-	RX_MESSAGE_BIGGER_THAN_MQTT_RX_BUF = -28
+	RX_MESSAGE_BIGGER_THAN_MQTT_RX_BUF = -28,
+	/** The maximum number of unacknowledged QoS 1 publishes is already in flight. Yield and retry */
+	PUBLISH_WINDOW_FULL = -29,
+	/** A received fragment has a malformed header or does not belong to the transfer being reassembled */
+	FRAGMENT_INVALID_CHUNK = -30,
+	/** The fragmented transfer does not fit into the reassembly buffer or bitmap */
+	FRAGMENT_BUFFER_TOO_SMALL = -31,
+	/** All fragments were received but the reassembled data does not match the transfer checksum */
+	FRAGMENT_CHECKSUM_MISMATCH = -32,
+	/** The fragmented transfer did not complete within the given time */
+	FRAGMENT_TIMEOUT_ERROR = -33,
+	/** A message log segment file could not be created, sized, mapped or read */
+	MESSAGE_LOG_IO_ERROR = -34,
+	/** The message log topic table is full, raise AWS_IOT_MESSAGE_LOG_MAX_TOPICS */
+	MESSAGE_LOG_TOPIC_TABLE_FULL = -35,
+	/** The record does not fit into an empty message log segment */
+	MESSAGE_LOG_RECORD_TOO_BIG = -36,
+	/** The send queue is above its high-water mark. Yield to let it drain and retry */
+	PUBLISH_WOULD_BLOCK = -37,
+	/** The request engine already has its window of requests in flight. Yield and retry */
+	REQUEST_WINDOW_FULL = -38,
+	/** The correlation id does not fit into its buffer or into the request document */
+	REQUEST_BUFFER_TOO_SMALL = -39,
+	/** The escaped or unescaped JSON string does not fit into the destination buffer */
+	JSON_STRING_BUFFER_TOO_SMALL = -40,
+	/** The shadow state store has no room for another field, raise AWS_IOT_SHADOW_STATE_MAX_FIELDS or AWS_IOT_SHADOW_STATE_MAX_BYTES */
+	SHADOW_STATE_FULL = -41,
+	/** Shadow state updates kept running while the store was read. Retry later */
+	SHADOW_STATE_READ_CONTENDED = -42,
+	/** The payload filter of a subscription is not a valid expression or needs more than AWS_IOT_MQTT_FILTER_MAX_INSTRUCTIONS instructions or AWS_IOT_MQTT_FILTER_MAX_TEXT_LEN bytes of text */
+	SUBSCRIBE_FILTER_ERROR = -43,
+	/** An update made while disconnected does not fit into the pending update of its thing, or all AWS_IOT_SHADOW_OFFLINE_MAX_THINGS things already have one */
+	SHADOW_OFFLINE_FULL = -44,
+	/** The adaptive rate control allows no further publish yet. Yield and retry */
+	PUBLISH_RATE_LIMITED = -45
 }IoT_Error_t;
 
 #endif /* AWS_IOT_SDK_SRC_IOT_ERROR_H_ */
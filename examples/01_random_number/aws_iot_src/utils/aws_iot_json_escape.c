@@ -0,0 +1,402 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "aws_iot_json_escape.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define JSON_ESCAPE_X86
+#include <immintrin.h>
+#endif
+
+// Returns the offset of the first byte in p[0..len) that the caller has to handle itself, len if none
+typedef size_t (*scanFunc_t)(const char *p, size_t len);
+
+static bool isEscapeByte(unsigned char c) {
+	return c < 0x20 || '"' == c || '\\' == c;
+}
+
+static size_t scanEscapeScalar(const char *p, size_t len) {
+	size_t i;
+	for (i = 0; i < len; i++) {
+		if (isEscapeByte((unsigned char) p[i])) {
+			break;
+		}
+	}
+	return i;
+}
+
+static size_t scanBackslashScalar(const char *p, size_t len) {
+	const char *pFound = memchr(p, '\\', len);
+	return (NULL == pFound) ? len : (size_t) (pFound - p);
+}
+
+#ifdef JSON_ESCAPE_X86
+
+__attribute__((target("sse2")))
+static size_t scanEscapeSse2(const char *p, size_t len) {
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i lastControl = _mm_set1_epi8(0x1F);
+	__m128i v, special;
+	uint32_t mask;
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16) {
+		v = _mm_loadu_si128((const __m128i *) (p + i));
+		// min(v, 0x1F) == v holds exactly for the control characters
+		special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+				_mm_cmpeq_epi8(_mm_min_epu8(v, lastControl), v));
+		mask = (uint32_t) _mm_movemask_epi8(special);
+		if (0 != mask) {
+			return i + (size_t) __builtin_ctz(mask);
+		}
+	}
+	return i + scanEscapeScalar(p + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static size_t scanBackslashSse2(const char *p, size_t len) {
+	const __m128i backslash = _mm_set1_epi8('\\');
+	uint32_t mask;
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16) {
+		mask = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (p + i)), backslash));
+		if (0 != mask) {
+			return i + (size_t) __builtin_ctz(mask);
+		}
+	}
+	return i + scanBackslashScalar(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t scanEscapeAvx2(const char *p, size_t len) {
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i lastControl = _mm256_set1_epi8(0x1F);
+	__m256i v, special;
+	uint32_t mask;
+	size_t i = 0;
+
+	for (; i + 32 <= len; i += 32) {
+		v = _mm256_loadu_si256((const __m256i *) (p + i));
+		special = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+				_mm256_cmpeq_epi8(_mm256_min_epu8(v, lastControl), v));
+		mask = (uint32_t) _mm256_movemask_epi8(special);
+		if (0 != mask) {
+			return i + (size_t) __builtin_ctz(mask);
+		}
+	}
+	// The tail stays in VEX encoded code, calling the SSE2 scan with dirty upper halves stalls
+	if (i + 16 <= len) {
+		__m128i v16 = _mm_loadu_si128((const __m128i *) (p + i));
+		mask = (uint32_t) _mm_movemask_epi8(_mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(v16, _mm256_castsi256_si128(quote)),
+						_mm_cmpeq_epi8(v16, _mm256_castsi256_si128(backslash))),
+				_mm_cmpeq_epi8(_mm_min_epu8(v16, _mm256_castsi256_si128(lastControl)), v16)));
+		if (0 != mask) {
+			return i + (size_t) __builtin_ctz(mask);
+		}
+		i += 16;
+	}
+	for (; i < len && !isEscapeByte((unsigned char) p[i]); i++) {
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t scanBackslashAvx2(const char *p, size_t len) {
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	uint32_t mask;
+	size_t i = 0;
+
+	for (; i + 32 <= len; i += 32) {
+		mask = (uint32_t) _mm256_movemask_epi8(
+				_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (p + i)), backslash));
+		if (0 != mask) {
+			return i + (size_t) __builtin_ctz(mask);
+		}
+	}
+	if (i + 16 <= len) {
+		mask = (uint32_t) _mm_movemask_epi8(
+				_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (p + i)), _mm256_castsi256_si128(backslash)));
+		if (0 != mask) {
+			return i + (size_t) __builtin_ctz(mask);
+		}
+		i += 16;
+	}
+	for (; i < len && '\\' != p[i]; i++) {
+	}
+	return i;
+}
+
+#endif /* JSON_ESCAPE_X86 */
+
+static scanFunc_t scanEscape = NULL;
+static scanFunc_t scanBackslash = NULL;
+
+JsonEscapeImpl_t aws_iot_json_escape_select(JsonEscapeImpl_t impl) {
+#ifdef JSON_ESCAPE_X86
+	__builtin_cpu_init();
+	if (JSON_ESCAPE_AVX2 == impl && __builtin_cpu_supports("avx2")) {
+		scanEscape = scanEscapeAvx2;
+		scanBackslash = scanBackslashAvx2;
+		return JSON_ESCAPE_AVX2;
+	}
+	if (JSON_ESCAPE_SCALAR != impl && __builtin_cpu_supports("sse2")) {
+		scanEscape = scanEscapeSse2;
+		scanBackslash = scanBackslashSse2;
+		return JSON_ESCAPE_SSE2;
+	}
+#endif
+	scanEscape = scanEscapeScalar;
+	scanBackslash = scanBackslashScalar;
+	return JSON_ESCAPE_SCALAR;
+}
+
+static void selectDefault(void) {
+	if (NULL == scanEscape) {
+		aws_iot_json_escape_select(JSON_ESCAPE_AVX2);
+	}
+}
+
+static void terminate(char *pDest, size_t destSize, size_t written, size_t *pWritten) {
+	if (0 != destSize) {
+		pDest[written] = '\0';
+	}
+	if (NULL != pWritten) {
+		*pWritten = written;
+	}
+}
+
+IoT_Error_t aws_iot_json_escape(char *pDest, size_t destSize, const char *pSrc, size_t srcLen, size_t *pWritten) {
+	static const char hexDigits[] = "0123456789abcdef";
+	size_t in = 0, out = 0, run;
+	unsigned char c;
+	char escape[6];
+	size_t escapeLen;
+
+	if (NULL == pDest || (NULL == pSrc && 0 != srcLen)) {
+		return NULL_VALUE_ERROR;
+	}
+	selectDefault();
+
+	while (in < srcLen) {
+		run = scanEscape(pSrc + in, srcLen - in);
+		if (out + run >= destSize) {
+			run = (destSize > out) ? destSize - out - 1 : 0;
+			memcpy(pDest + out, pSrc + in, run);
+			terminate(pDest, destSize, out + run, pWritten);
+			return JSON_STRING_BUFFER_TOO_SMALL;
+		}
+		memcpy(pDest + out, pSrc + in, run);
+		out += run;
+		in += run;
+		if (in == srcLen) {
+			break;
+		}
+
+		c = (unsigned char) pSrc[in++];
+		escape[0] = '\\';
+		escapeLen = 2;
+		switch (c) {
+		case '"':
+		case '\\':
+			escape[1] = (char) c;
+			break;
+		case '\b':
+			escape[1] = 'b';
+			break;
+		case '\f':
+			escape[1] = 'f';
+			break;
+		case '\n':
+			escape[1] = 'n';
+			break;
+		case '\r':
+			escape[1] = 'r';
+			break;
+		case '\t':
+			escape[1] = 't';
+			break;
+		default:
+			escape[1] = 'u';
+			escape[2] = '0';
+			escape[3] = '0';
+			escape[4] = hexDigits[c >> 4];
+			escape[5] = hexDigits[c & 0x0F];
+			escapeLen = 6;
+			break;
+		}
+		// An escape sequence is never split
+		if (out + escapeLen >= destSize) {
+			terminate(pDest, destSize, out, pWritten);
+			return JSON_STRING_BUFFER_TOO_SMALL;
+		}
+		memcpy(pDest + out, escape, escapeLen);
+		out += escapeLen;
+	}
+
+	if (out >= destSize) {
+		return JSON_STRING_BUFFER_TOO_SMALL;
+	}
+	terminate(pDest, destSize, out, pWritten);
+	return NONE_ERROR;
+}
+
+static bool parseHex4(const char *p, uint32_t *pValue) {
+	uint32_t value = 0;
+	uint32_t i;
+	char c;
+
+	for (i = 0; i < 4; i++) {
+		c = p[i];
+		value <<= 4;
+		if (c >= '0' && c <= '9') {
+			value |= (uint32_t) (c - '0');
+		} else if (c >= 'a' && c <= 'f') {
+			value |= (uint32_t) (c - 'a' + 10);
+		} else if (c >= 'A' && c <= 'F') {
+			value |= (uint32_t) (c - 'A' + 10);
+		} else {
+			return false;
+		}
+	}
+	*pValue = value;
+	return true;
+}
+
+// Decodes the \uXXXX escape, or surrogate pair, at p into UTF-8. Returns the escaped bytes consumed, 0 if invalid
+static size_t decodeUnicodeEscape(const char *p, size_t len, char *pUtf8, size_t *pUtf8Len) {
+	uint32_t codePoint, low;
+	size_t consumed = 6;
+
+	if (len < 6 || !parseHex4(p + 2, &codePoint) || 0 == codePoint) {
+		return 0;
+	}
+	if (codePoint >= 0xD800 && codePoint <= 0xDBFF) {
+		if (len < 12 || '\\' != p[6] || 'u' != p[7] || !parseHex4(p + 8, &low) || low < 0xDC00 || low > 0xDFFF) {
+			return 0;
+		}
+		codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+		consumed = 12;
+	} else if (codePoint >= 0xDC00 && codePoint <= 0xDFFF) {
+		return 0;
+	}
+
+	if (codePoint < 0x80) {
+		pUtf8[0] = (char) codePoint;
+		*pUtf8Len = 1;
+	} else if (codePoint < 0x800) {
+		pUtf8[0] = (char) (0xC0 | (codePoint >> 6));
+		pUtf8[1] = (char) (0x80 | (codePoint & 0x3F));
+		*pUtf8Len = 2;
+	} else if (codePoint < 0x10000) {
+		pUtf8[0] = (char) (0xE0 | (codePoint >> 12));
+		pUtf8[1] = (char) (0x80 | ((codePoint >> 6) & 0x3F));
+		pUtf8[2] = (char) (0x80 | (codePoint & 0x3F));
+		*pUtf8Len = 3;
+	} else {
+		pUtf8[0] = (char) (0xF0 | (codePoint >> 18));
+		pUtf8[1] = (char) (0x80 | ((codePoint >> 12) & 0x3F));
+		pUtf8[2] = (char) (0x80 | ((codePoint >> 6) & 0x3F));
+		pUtf8[3] = (char) (0x80 | (codePoint & 0x3F));
+		*pUtf8Len = 4;
+	}
+	return consumed;
+}
+
+IoT_Error_t aws_iot_json_unescape(char *pDest, size_t destSize, const char *pSrc, size_t srcLen, size_t *pWritten) {
+	size_t in = 0, out = 0, run, consumed;
+	char decoded[4];
+	size_t decodedLen;
+
+	if (NULL == pDest || (NULL == pSrc && 0 != srcLen)) {
+		return NULL_VALUE_ERROR;
+	}
+	selectDefault();
+
+	while (in < srcLen) {
+		run = scanBackslash(pSrc + in, srcLen - in);
+		if (out + run >= destSize) {
+			run = (destSize > out) ? destSize - out - 1 : 0;
+			memcpy(pDest + out, pSrc + in, run);
+			terminate(pDest, destSize, out + run, pWritten);
+			return JSON_STRING_BUFFER_TOO_SMALL;
+		}
+		memcpy(pDest + out, pSrc + in, run);
+		out += run;
+		in += run;
+		if (in == srcLen) {
+			break;
+		}
+
+		if (in + 1 == srcLen) {
+			terminate(pDest, destSize, out, pWritten);
+			return JSON_PARSE_ERROR;
+		}
+		consumed = 2;
+		decodedLen = 1;
+		switch (pSrc[in + 1]) {
+		case '"':
+		case '\\':
+		case '/':
+			decoded[0] = pSrc[in + 1];
+			break;
+		case 'b':
+			decoded[0] = '\b';
+			break;
+		case 'f':
+			decoded[0] = '\f';
+			break;
+		case 'n':
+			decoded[0] = '\n';
+			break;
+		case 'r':
+			decoded[0] = '\r';
+			break;
+		case 't':
+			decoded[0] = '\t';
+			break;
+		case 'u':
+			consumed = decodeUnicodeEscape(pSrc + in, srcLen - in, decoded, &decodedLen);
+			break;
+		default:
+			consumed = 0;
+			break;
+		}
+		if (0 == consumed) {
+			terminate(pDest, destSize, out, pWritten);
+			return JSON_PARSE_ERROR;
+		}
+		if (out + decodedLen >= destSize) {
+			terminate(pDest, destSize, out, pWritten);
+			return JSON_STRING_BUFFER_TOO_SMALL;
+		}
+		memcpy(pDest + out, decoded, decodedLen);
+		out += decodedLen;
+		in += consumed;
+	}
+
+	if (out >= destSize) {
+		return JSON_STRING_BUFFER_TOO_SMALL;
+	}
+	terminate(pDest, destSize, out, pWritten);
+	return NONE_ERROR;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file aws_iot_json_escape.h
+ * @brief Escaping and unescaping of JSON string values
+ *
+ * Most string fields contain nothing that needs escaping, so both directions look for the next
+ * special byte 16 (SSE2) or 32 (AVX2) bytes at a time and copy the plain runs in between with memcpy.
+ * The widest implementation the CPU supports is picked at the first call, builds for other
+ * architectures use the scalar one.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_JSON_ESCAPE_H_
+#define AWS_IOT_SDK_SRC_JSON_ESCAPE_H_
+
+#include <stddef.h>
+
+#include "aws_iot_error.h"
+
+/**
+ * @brief Implementations of the special byte search
+ */
+typedef enum {
+	JSON_ESCAPE_SCALAR,	///< One byte at a time, available everywhere
+	JSON_ESCAPE_SSE2,	///< 16 bytes at a time
+	JSON_ESCAPE_AVX2	///< 32 bytes at a time
+} JsonEscapeImpl_t;
+
+/**
+ * @brief Choose the implementation used by all later calls
+ *
+ * Only needed to compare the implementations, by default the widest supported one is used.
+ *
+ * @param impl Widest implementation wanted
+ * @return The widest implementation not wider than impl that this CPU supports
+ */
+JsonEscapeImpl_t aws_iot_json_escape_select(JsonEscapeImpl_t impl);
+
+/**
+ * @brief Escape a string for use as a JSON string value
+ *
+ * Quote and backslash become \" and \\, control characters their short escape or \\u00XX.  Other
+ * bytes, including UTF-8 sequences, are copied as they are.  The surrounding quotes are not written.
+ *
+ * @param pDest Receives the escaped string, always NUL terminated if destSize is not 0
+ * @param destSize Size of pDest including the terminating NUL
+ * @param pSrc String to escape
+ * @param srcLen Bytes of pSrc to escape
+ * @param pWritten Receives the length of the escaped string, may be NULL
+ * @return NONE_ERROR, JSON_STRING_BUFFER_TOO_SMALL with pDest holding the escaped prefix that fit
+ */
+IoT_Error_t aws_iot_json_escape(char *pDest, size_t destSize, const char *pSrc, size_t srcLen, size_t *pWritten);
+
+/**
+ * @brief Resolve the escapes of a JSON string value
+ *
+ * pSrc is the string between the quotes, as a jsmn string token delimits it.  \\uXXXX escapes,
+ * including surrogate pairs, are written as UTF-8.  The result is never longer than the input.
+ *
+ * @param pDest Receives the unescaped string, always NUL terminated if destSize is not 0
+ * @param destSize Size of pDest including the terminating NUL
+ * @param pSrc Escaped string
+ * @param srcLen Bytes of pSrc
+ * @param pWritten Receives the length of the unescaped string, may be NULL
+ * @return NONE_ERROR, JSON_STRING_BUFFER_TOO_SMALL, or JSON_PARSE_ERROR for an invalid escape,
+ *         a lone surrogate or \\u0000
+ */
+IoT_Error_t aws_iot_json_unescape(char *pDest, size_t destSize, const char *pSrc, size_t srcLen, size_t *pWritten);
+
+#endif /* AWS_IOT_SDK_SRC_JSON_ESCAPE_H_ */
@@ -23,6 +23,7 @@
  */
 
 #include "aws_iot_json_utils.h"
+#include "aws_iot_json_escape.h"
 
 #include <stdio.h>
 #include <stdint.h>
@@ -173,13 +174,19 @@ IoT_Error_t parseBooleanValue(bool *b, const char *jsonString, jsmntok_t *token)
 }
 
 IoT_Error_t parseStringValue(char *buf, const char *jsonString, jsmntok_t *token) {
-	uint16_t size = 0;
+	// Unescaping never makes the string longer, so the raw token size always fits
+	return parseBoundedStringValue(buf, (size_t) (token->end - token->start) + 1, jsonString, token);
+}
+
+IoT_Error_t parseBoundedStringValue(char *buf, size_t bufSize, const char *jsonString, jsmntok_t *token) {
+	IoT_Error_t rc;
 	if (token->type != JSMN_STRING) {
 		WARN("Token was not a string.");
 		return JSON_PARSE_ERROR;
 	}
-	size = token->end - token->start;
-	memcpy(buf, jsonString + token->start, size);
-	buf[size] = '\0';
-	return NONE_ERROR;
+	rc = aws_iot_json_unescape(buf, bufSize, jsonString + token->start, (size_t) (token->end - token->start), NULL);
+	if (JSON_PARSE_ERROR == rc) {
+		WARN("Token has an invalid escape.");
+	}
+	return rc;
 }
@@ -175,7 +175,8 @@ IoT_Error_t parseBooleanValue(bool *b, const char *jsonString, jsmntok_t *token)
 /**
  * @brief          Parse a string value from a JSON node.
  *
- * Given a JSON node parse the string value from the value.
+ * Given a JSON node parse the string value from the value, resolving its escapes.
+ * buf must hold the raw token plus the terminating NUL.
  *
  * @param jsonString	json string
  * @param tok     		json token - pointer to JSON node
@@ -186,4 +187,20 @@ IoT_Error_t parseBooleanValue(bool *b, const char *jsonString, jsmntok_t *token)
  */
 IoT_Error_t parseStringValue(char *buf, const char *jsonString, jsmntok_t *token);
 
+/**
+ * @brief          Parse a string value from a JSON node into a buffer of known size.
+ *
+ * Given a JSON node parse the string value from the value, resolving its escapes.
+ *
+ * @param buf			buffer receiving the NUL terminated string
+ * @param bufSize		size of buf
+ * @param jsonString	json string
+ * @param tok     		json token - pointer to JSON node
+ *
+ * @return         		NONE_ERROR - success
+ * @return				JSON_PARSE_ERROR - error parsing value
+ * @return				JSON_STRING_BUFFER_TOO_SMALL - the string was truncated to fit buf
+ */
+IoT_Error_t parseBoundedStringValue(char *buf, size_t bufSize, const char *jsonString, jsmntok_t *token);
+
 #endif /* AWS_IOT_SDK_SRC_JSON_UTILS_H_ */
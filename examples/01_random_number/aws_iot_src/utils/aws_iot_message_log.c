@@ -0,0 +1,569 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file aws_iot_message_log.c
+ * @brief Segmented binary log of received messages
+ *
+ * Segment layout, host byte order:
+ * header (MessageLogSegmentHeader_t) | records, each 8 byte aligned: payload length (4) | topic id (4) | timestamp (8)
+ * | wall time (8) | payload
+ *
+ * Timestamps, and with them the index, segment time ranges and rotation, follow CLOCK_MONOTONIC anchored to
+ * the wall clock when the log is opened, so a stepped wall clock never puts records out of order.
+ */
+
+#include "aws_iot_message_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "timer_interface.h"
+#include "aws_iot_log.h"
+
+#define MESSAGE_LOG_MAGIC "AIML"
+#define MESSAGE_LOG_VERSION 2
+#define MESSAGE_LOG_FILE_SUFFIX ".aiml"
+
+#define ALIGN8(x) (((x) + 7u) & ~7u)
+
+typedef struct {
+	uint64_t timestamp_us;
+	uint32_t offset;
+	uint32_t reserved;
+} MessageLogIndexEntry_t;
+
+typedef struct {
+	uint16_t len;
+	char name[AWS_IOT_MESSAGE_LOG_MAX_TOPIC_LEN];
+} MessageLogTopicEntry_t;
+
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t sequence;
+	uint32_t topicCount;
+	uint64_t firstTimestamp_us;
+	uint64_t lastTimestamp_us;
+	uint32_t usedBytes;			///< End of the last complete record. Written after the record itself
+	uint32_t indexCount;
+	uint32_t maxIndexEntries;	///< Layout parameters, a reader built with other values refuses the segment
+	uint32_t maxTopics;
+	uint32_t maxTopicLen;
+	uint32_t reserved;
+	MessageLogIndexEntry_t index[AWS_IOT_MESSAGE_LOG_INDEX_ENTRIES];
+	MessageLogTopicEntry_t topics[AWS_IOT_MESSAGE_LOG_MAX_TOPICS];
+} MessageLogSegmentHeader_t;
+
+typedef struct {
+	uint32_t payloadLen;
+	uint32_t topicId;
+	uint64_t timestamp_us;
+	uint64_t wallTime_us;
+} MessageLogRecordHeader_t;
+
+#define SEGMENT_DATA_START ALIGN8((uint32_t) sizeof(MessageLogSegmentHeader_t))
+
+const MessageLogParams MessageLogParamsDefault = {
+		.pDirectory = NULL,
+		.segmentSize = AWS_IOT_MESSAGE_LOG_SEGMENT_SIZE,
+		.maxSegmentAge_sec = AWS_IOT_MESSAGE_LOG_SEGMENT_MAX_AGE_SEC
+};
+
+static uint64_t wallClock_us(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
+}
+
+static bool parseSegmentFileName(const char *pName, uint32_t *pSequence) {
+	char suffix[8];
+
+	return 2 == sscanf(pName, "%8u%7s", pSequence, suffix) && 0 == strcmp(suffix, MESSAGE_LOG_FILE_SUFFIX);
+}
+
+static void segmentFileName(char *pPath, size_t pathLen, const char *pDirectory, uint32_t sequence) {
+	snprintf(pPath, pathLen, "%s/%08u%s", pDirectory, sequence, MESSAGE_LOG_FILE_SUFFIX);
+}
+
+static void copyTopicToSegment(MessageLogSegmentHeader_t *pHeader, const MessageLogSink *pSink, uint32_t topicId) {
+	pHeader->topics[topicId].len = pSink->topicLengths[topicId];
+	memcpy(pHeader->topics[topicId].name, pSink->topics[topicId], pSink->topicLengths[topicId]);
+	pHeader->topicCount = topicId + 1;
+}
+
+static IoT_Error_t startSegment(MessageLogSink *pSink) {
+	char path[PATH_MAX + 1];
+	MessageLogSegmentHeader_t *pHeader;
+	uint32_t i;
+	int fd;
+	void *pMapped;
+
+	segmentFileName(path, sizeof(path), pSink->directory, pSink->sequence);
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		ERROR("Unable to create message log segment %s", path);
+		return MESSAGE_LOG_IO_ERROR;
+	}
+
+	/* Reserve the blocks up front so appends never hit ENOSPC through a SIGBUS */
+	if (0 != posix_fallocate(fd, 0, (off_t) pSink->segmentSize)) {
+		ERROR("Unable to preallocate %u bytes for %s", pSink->segmentSize, path);
+		close(fd);
+		unlink(path);
+		return MESSAGE_LOG_IO_ERROR;
+	}
+
+	pMapped = mmap(NULL, pSink->segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (MAP_FAILED == pMapped) {
+		ERROR("Unable to map message log segment %s", path);
+		close(fd);
+		unlink(path);
+		return MESSAGE_LOG_IO_ERROR;
+	}
+
+	pSink->fd = fd;
+	pSink->pSegment = (uint8_t *) pMapped;
+	pSink->writeOffset = SEGMENT_DATA_START;
+
+	pHeader = (MessageLogSegmentHeader_t *) pSink->pSegment;
+	memcpy(pHeader->magic, MESSAGE_LOG_MAGIC, sizeof(pHeader->magic));
+	pHeader->version = MESSAGE_LOG_VERSION;
+	pHeader->sequence = pSink->sequence;
+	pHeader->maxIndexEntries = AWS_IOT_MESSAGE_LOG_INDEX_ENTRIES;
+	pHeader->maxTopics = AWS_IOT_MESSAGE_LOG_MAX_TOPICS;
+	pHeader->maxTopicLen = AWS_IOT_MESSAGE_LOG_MAX_TOPIC_LEN;
+	for (i = 0; i < pSink->topicCount; i++) {
+		copyTopicToSegment(pHeader, pSink, i);
+	}
+	pHeader->usedBytes = pSink->writeOffset;
+
+	return NONE_ERROR;
+}
+
+static IoT_Error_t finishSegment(MessageLogSink *pSink) {
+	MessageLogSegmentHeader_t *pHeader = (MessageLogSegmentHeader_t *) pSink->pSegment;
+	uint32_t usedBytes = pHeader->usedBytes;
+	IoT_Error_t rc = NONE_ERROR;
+
+	msync(pSink->pSegment, usedBytes, MS_ASYNC);
+	munmap(pSink->pSegment, pSink->segmentSize);
+	/* Give back the preallocated tail nobody wrote to */
+	if (0 != ftruncate(pSink->fd, (off_t) usedBytes)) {
+		rc = MESSAGE_LOG_IO_ERROR;
+	}
+	close(pSink->fd);
+
+	pSink->fd = -1;
+	pSink->pSegment = NULL;
+	pSink->sequence++;
+
+	return rc;
+}
+
+IoT_Error_t aws_iot_message_log_open(MessageLogSink *pSink, const MessageLogParams *pParams) {
+	DIR *pDir;
+	struct dirent *pEntry;
+	uint32_t sequence;
+	bool found = false;
+
+	if (NULL == pSink || NULL == pParams || NULL == pParams->pDirectory) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if (strlen(pParams->pDirectory) > PATH_MAX - 16) {
+		return MESSAGE_LOG_IO_ERROR;
+	}
+
+	/* A segment must hold at least its header, an index stride and one small record */
+	if (pParams->segmentSize < SEGMENT_DATA_START + AWS_IOT_MESSAGE_LOG_INDEX_ENTRIES
+			+ sizeof(MessageLogRecordHeader_t)) {
+		return MESSAGE_LOG_RECORD_TOO_BIG;
+	}
+
+	pDir = opendir(pParams->pDirectory);
+	if (NULL == pDir) {
+		ERROR("Unable to open message log directory %s", pParams->pDirectory);
+		return MESSAGE_LOG_IO_ERROR;
+	}
+
+	strcpy(pSink->directory, pParams->pDirectory);
+	pSink->segmentSize = pParams->segmentSize;
+	pSink->maxSegmentAge_sec = pParams->maxSegmentAge_sec;
+	pSink->sequence = 0;
+	pSink->fd = -1;
+	pSink->pSegment = NULL;
+	pSink->writeOffset = 0;
+	pSink->indexStride = (pParams->segmentSize - SEGMENT_DATA_START) / AWS_IOT_MESSAGE_LOG_INDEX_ENTRIES;
+	pSink->topicCount = 0;
+	pSink->clockOffset_us = wallClock_us() - timestamp_us();
+
+	/* Continue numbering after the segments of previous runs */
+	while (NULL != (pEntry = readdir(pDir))) {
+		if (parseSegmentFileName(pEntry->d_name, &sequence) && (!found || sequence >= pSink->sequence)) {
+			pSink->sequence = sequence + 1;
+			found = true;
+		}
+	}
+	closedir(pDir);
+
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_message_log_topic_id(MessageLogSink *pSink, const char *pTopic, uint16_t topicLen,
+		uint32_t *pTopicId) {
+	uint32_t i;
+
+	if (NULL == pSink || NULL == pTopic || NULL == pTopicId) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if (topicLen > AWS_IOT_MESSAGE_LOG_MAX_TOPIC_LEN) {
+		topicLen = AWS_IOT_MESSAGE_LOG_MAX_TOPIC_LEN;
+	}
+
+	for (i = 0; i < pSink->topicCount; i++) {
+		if (pSink->topicLengths[i] == topicLen && 0 == memcmp(pSink->topics[i], pTopic, topicLen)) {
+			*pTopicId = i;
+			return NONE_ERROR;
+		}
+	}
+
+	if (AWS_IOT_MESSAGE_LOG_MAX_TOPICS <= pSink->topicCount) {
+		return MESSAGE_LOG_TOPIC_TABLE_FULL;
+	}
+
+	memcpy(pSink->topics[pSink->topicCount], pTopic, topicLen);
+	pSink->topicLengths[pSink->topicCount] = topicLen;
+	if (NULL != pSink->pSegment) {
+		copyTopicToSegment((MessageLogSegmentHeader_t *) pSink->pSegment, pSink, pSink->topicCount);
+	}
+	*pTopicId = pSink->topicCount++;
+
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_message_log_append(MessageLogSink *pSink, uint32_t topicId, const void *pPayload,
+		uint32_t payloadLen) {
+	IoT_Error_t rc;
+	MessageLogSegmentHeader_t *pHeader;
+	MessageLogRecordHeader_t *pRecord;
+	uint64_t recordLen = ALIGN8((uint64_t) sizeof(MessageLogRecordHeader_t) + payloadLen);
+	uint64_t now_us;
+
+	if (NULL == pSink || (NULL == pPayload && 0 != payloadLen)) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if (topicId >= pSink->topicCount) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if (SEGMENT_DATA_START + recordLen > pSink->segmentSize) {
+		return MESSAGE_LOG_RECORD_TOO_BIG;
+	}
+
+	now_us = pSink->clockOffset_us + timestamp_us();
+
+	if (NULL != pSink->pSegment) {
+		pHeader = (MessageLogSegmentHeader_t *) pSink->pSegment;
+		if (pSink->writeOffset + recordLen > pSink->segmentSize || (0 != pSink->maxSegmentAge_sec
+				&& 0 != pHeader->firstTimestamp_us
+				&& now_us - pHeader->firstTimestamp_us >= (uint64_t) pSink->maxSegmentAge_sec * 1000000)) {
+			finishSegment(pSink);
+		}
+	}
+
+	if (NULL == pSink->pSegment) {
+		rc = startSegment(pSink);
+		if (NONE_ERROR != rc) {
+			return rc;
+		}
+	}
+
+	pHeader = (MessageLogSegmentHeader_t *) pSink->pSegment;
+	if (pHeader->indexCount < AWS_IOT_MESSAGE_LOG_INDEX_ENTRIES
+			&& pSink->writeOffset - SEGMENT_DATA_START >= pHeader->indexCount * pSink->indexStride) {
+		pHeader->index[pHeader->indexCount].timestamp_us = now_us;
+		pHeader->index[pHeader->indexCount].offset = pSink->writeOffset;
+		pHeader->indexCount++;
+	}
+
+	pRecord = (MessageLogRecordHeader_t *) (pSink->pSegment + pSink->writeOffset);
+	pRecord->payloadLen = payloadLen;
+	pRecord->topicId = topicId;
+	pRecord->timestamp_us = now_us;
+	pRecord->wallTime_us = wallClock_us();
+	if (0 != payloadLen) {
+		memcpy(pSink->pSegment + pSink->writeOffset + sizeof(MessageLogRecordHeader_t), pPayload, payloadLen);
+	}
+	pSink->writeOffset += (uint32_t) recordLen;
+
+	/* Readers mapping the live segment must never see usedBytes ahead of the record contents */
+	__sync_synchronize();
+	if (0 == pHeader->firstTimestamp_us) {
+		pHeader->firstTimestamp_us = now_us;
+	}
+	pHeader->lastTimestamp_us = now_us;
+	pHeader->usedBytes = pSink->writeOffset;
+
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_message_log_flush(MessageLogSink *pSink) {
+	if (NULL == pSink) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if (NULL != pSink->pSegment && 0 != msync(pSink->pSegment, pSink->writeOffset, MS_ASYNC)) {
+		return MESSAGE_LOG_IO_ERROR;
+	}
+
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_message_log_close(MessageLogSink *pSink) {
+	if (NULL == pSink) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if (NULL == pSink->pSegment) {
+		return NONE_ERROR;
+	}
+
+	return finishSegment(pSink);
+}
+
+static int compareSequences(const void *pA, const void *pB) {
+	uint32_t a = *(const uint32_t *) pA;
+	uint32_t b = *(const uint32_t *) pB;
+	return (a > b) - (a < b);
+}
+
+IoT_Error_t aws_iot_message_log_reader_open(MessageLogReader *pReader, const char *pDirectory, uint64_t from_us,
+		uint64_t to_us) {
+	DIR *pDir;
+	struct dirent *pEntry;
+	uint32_t sequence;
+	uint32_t capacity = 0;
+	uint32_t *pGrown;
+
+	if (NULL == pReader || NULL == pDirectory) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if (strlen(pDirectory) > PATH_MAX - 16) {
+		return MESSAGE_LOG_IO_ERROR;
+	}
+
+	pDir = opendir(pDirectory);
+	if (NULL == pDir) {
+		return MESSAGE_LOG_IO_ERROR;
+	}
+
+	strcpy(pReader->directory, pDirectory);
+	pReader->from_us = from_us;
+	pReader->to_us = to_us;
+	pReader->pSequences = NULL;
+	pReader->sequenceCount = 0;
+	pReader->nextSequenceIndex = 0;
+	pReader->fd = -1;
+	pReader->pSegment = NULL;
+	pReader->mappedLen = 0;
+	pReader->readOffset = 0;
+
+	while (NULL != (pEntry = readdir(pDir))) {
+		if (!parseSegmentFileName(pEntry->d_name, &sequence)) {
+			continue;
+		}
+		if (pReader->sequenceCount == capacity) {
+			capacity = (0 == capacity) ? 16 : capacity * 2;
+			pGrown = (uint32_t *) realloc(pReader->pSequences, capacity * sizeof(uint32_t));
+			if (NULL == pGrown) {
+				closedir(pDir);
+				aws_iot_message_log_reader_close(pReader);
+				return MESSAGE_LOG_IO_ERROR;
+			}
+			pReader->pSequences = pGrown;
+		}
+		pReader->pSequences[pReader->sequenceCount++] = sequence;
+	}
+	closedir(pDir);
+
+	if (0 != pReader->sequenceCount) {
+		qsort(pReader->pSequences, pReader->sequenceCount, sizeof(uint32_t), compareSequences);
+	}
+
+	return NONE_ERROR;
+}
+
+static void unmapReaderSegment(MessageLogReader *pReader) {
+	if (NULL != pReader->pSegment) {
+		munmap(pReader->pSegment, pReader->mappedLen);
+		pReader->pSegment = NULL;
+	}
+	if (0 <= pReader->fd) {
+		close(pReader->fd);
+		pReader->fd = -1;
+	}
+}
+
+/* Map the next segment overlapping the time range and position the reader at the index entry preceding from_us */
+static IoT_Error_t mapNextReaderSegment(MessageLogReader *pReader) {
+	char path[PATH_MAX + 1];
+	struct stat fileStat;
+	MessageLogSegmentHeader_t *pHeader;
+	void *pMapped;
+	uint32_t low;
+	uint32_t high;
+	uint32_t mid;
+
+	while (pReader->nextSequenceIndex < pReader->sequenceCount) {
+		segmentFileName(path, sizeof(path), pReader->directory, pReader->pSequences[pReader->nextSequenceIndex++]);
+
+		pReader->fd = open(path, O_RDONLY);
+		if (pReader->fd < 0) {
+			/* Removed by retention since the reader was opened */
+			continue;
+		}
+		if (0 != fstat(pReader->fd, &fileStat) || (size_t) fileStat.st_size < sizeof(MessageLogSegmentHeader_t)) {
+			unmapReaderSegment(pReader);
+			continue;
+		}
+
+		pMapped = mmap(NULL, (size_t) fileStat.st_size, PROT_READ, MAP_SHARED, pReader->fd, 0);
+		if (MAP_FAILED == pMapped) {
+			unmapReaderSegment(pReader);
+			return MESSAGE_LOG_IO_ERROR;
+		}
+		pReader->pSegment = (uint8_t *) pMapped;
+		pReader->mappedLen = (size_t) fileStat.st_size;
+
+		pHeader = (MessageLogSegmentHeader_t *) pReader->pSegment;
+		if (0 != memcmp(pHeader->magic, MESSAGE_LOG_MAGIC, sizeof(pHeader->magic))
+				|| MESSAGE_LOG_VERSION != pHeader->version
+				|| AWS_IOT_MESSAGE_LOG_INDEX_ENTRIES != pHeader->maxIndexEntries
+				|| AWS_IOT_MESSAGE_LOG_MAX_TOPICS != pHeader->maxTopics
+				|| AWS_IOT_MESSAGE_LOG_MAX_TOPIC_LEN != pHeader->maxTopicLen) {
+			WARN("Skipping incompatible message log segment %s", path);
+			unmapReaderSegment(pReader);
+			continue;
+		}
+
+		if (0 == pHeader->firstTimestamp_us || pHeader->lastTimestamp_us < pReader->from_us
+				|| pHeader->firstTimestamp_us > pReader->to_us) {
+			unmapReaderSegment(pReader);
+			continue;
+		}
+
+		/* Last index entry not later than from_us */
+		pReader->readOffset = SEGMENT_DATA_START;
+		low = 0;
+		high = pHeader->indexCount;
+		while (low < high) {
+			mid = low + (high - low) / 2;
+			if (pHeader->index[mid].timestamp_us <= pReader->from_us) {
+				pReader->readOffset = pHeader->index[mid].offset;
+				low = mid + 1;
+			} else {
+				high = mid;
+			}
+		}
+
+		return NONE_ERROR;
+	}
+
+	return MESSAGE_LOG_END_OF_RANGE;
+}
+
+IoT_Error_t aws_iot_message_log_reader_next(MessageLogReader *pReader, MessageLogRecord *pRecord) {
+	IoT_Error_t rc;
+	const MessageLogSegmentHeader_t *pHeader;
+	const MessageLogRecordHeader_t *pRecordHeader;
+	uint32_t usedBytes;
+
+	if (NULL == pReader || NULL == pRecord) {
+		return NULL_VALUE_ERROR;
+	}
+
+	for (;;) {
+		if (NULL == pReader->pSegment) {
+			rc = mapNextReaderSegment(pReader);
+			if (NONE_ERROR != rc) {
+				return rc;
+			}
+		}
+
+		pHeader = (const MessageLogSegmentHeader_t *) pReader->pSegment;
+		usedBytes = ((volatile const MessageLogSegmentHeader_t *) pHeader)->usedBytes;
+		__sync_synchronize();
+		if (usedBytes > pReader->mappedLen) {
+			usedBytes = (uint32_t) pReader->mappedLen;
+		}
+
+		if (pReader->readOffset + sizeof(MessageLogRecordHeader_t) > usedBytes) {
+			unmapReaderSegment(pReader);
+			continue;
+		}
+
+		pRecordHeader = (const MessageLogRecordHeader_t *) (pReader->pSegment + pReader->readOffset);
+		if (pReader->readOffset + sizeof(MessageLogRecordHeader_t) + pRecordHeader->payloadLen > usedBytes
+				|| pRecordHeader->topicId >= pHeader->topicCount) {
+			WARN("Corrupt message log record at offset %u", pReader->readOffset);
+			unmapReaderSegment(pReader);
+			continue;
+		}
+
+		if (pRecordHeader->timestamp_us > pReader->to_us) {
+			/* Records are appended in time order, the rest of this segment is out of range */
+			unmapReaderSegment(pReader);
+			continue;
+		}
+
+		pReader->readOffset += ALIGN8((uint32_t) sizeof(MessageLogRecordHeader_t) + pRecordHeader->payloadLen);
+
+		if (pRecordHeader->timestamp_us < pReader->from_us) {
+			continue;
+		}
+
+		pRecord->timestamp_us = pRecordHeader->timestamp_us;
+		pRecord->wallTime_us = pRecordHeader->wallTime_us;
+		pRecord->topicId = pRecordHeader->topicId;
+		pRecord->pTopic = pHeader->topics[pRecordHeader->topicId].name;
+		pRecord->topicLen = pHeader->topics[pRecordHeader->topicId].len;
+		pRecord->pPayload = (const uint8_t *) pRecordHeader + sizeof(MessageLogRecordHeader_t);
+		pRecord->payloadLen = pRecordHeader->payloadLen;
+
+		return NONE_ERROR;
+	}
+}
+
+void aws_iot_message_log_reader_close(MessageLogReader *pReader) {
+	if (NULL == pReader) {
+		return;
+	}
+
+	unmapReaderSegment(pReader);
+	free(pReader->pSequences);
+	pReader->pSequences = NULL;
+	pReader->sequenceCount = 0;
+}
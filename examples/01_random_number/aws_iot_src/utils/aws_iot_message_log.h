@@ -0,0 +1,192 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file aws_iot_message_log.h
+ * @brief Segmented binary log of received messages
+ *
+ * Records of (timestamp, topic id, payload) are appended to preallocated, memory mapped segment
+ * files named <sequence>.aiml in a directory. The payload is copied once, straight into the mapping,
+ * and nothing is synced per record: the kernel writes the pages back, and segments are flushed
+ * asynchronously when they roll over or when aws_iot_message_log_flush is called.
+ *
+ * Records are ordered by a timestamp that follows the monotonic clock, anchored to the wall clock when the
+ * log is opened, so stepping the wall clock does not reorder them. The wall clock time of every record is
+ * kept alongside for display.
+ *
+ * Every segment starts with a header holding the time range it covers, the topic table and a sparse
+ * time index with one entry every (segment size / AWS_IOT_MESSAGE_LOG_INDEX_ENTRIES) bytes, so a
+ * reader can skip whole segments and jump close to the first record of a time range.
+ *
+ * The writer is not thread safe, it is meant to be called from the thread yielding to the MQTT client.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_MESSAGE_LOG_H_
+#define AWS_IOT_SDK_SRC_MESSAGE_LOG_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+
+#include "aws_iot_error.h"
+#include "aws_iot_config.h"
+
+/**
+ * @brief Message log parameters
+ *
+ * @note Always use the \c MessageLogParamsDefault to initialize this struct
+ */
+typedef struct {
+	const char *pDirectory;		///< Existing directory the segment files are written to
+	uint32_t segmentSize;		///< Bytes every segment file is preallocated to
+	uint32_t maxSegmentAge_sec;	///< Roll over to a new segment once the current one is this old. 0 = size only
+} MessageLogParams;
+extern const MessageLogParams MessageLogParamsDefault;
+
+/**
+ * @brief Writer side of a message log
+ */
+typedef struct {
+	char directory[PATH_MAX + 1];
+	uint32_t segmentSize;
+	uint32_t maxSegmentAge_sec;
+
+	uint32_t sequence;			///< Sequence number of the current segment
+	int fd;						///< Current segment file, -1 if none is open
+	uint8_t *pSegment;			///< Mapping of the current segment
+	uint32_t writeOffset;		///< Where the next record goes
+	uint32_t indexStride;		///< Bytes between two index entries
+	uint64_t clockOffset_us;	///< Added to the monotonic clock to get record timestamps, set from the wall clock on open
+
+	uint32_t topicCount;
+	char topics[AWS_IOT_MESSAGE_LOG_MAX_TOPICS][AWS_IOT_MESSAGE_LOG_MAX_TOPIC_LEN];
+	uint16_t topicLengths[AWS_IOT_MESSAGE_LOG_MAX_TOPICS];
+} MessageLogSink;
+
+/**
+ * @brief One record returned by the reader
+ *
+ * The pointers refer to the reader's mapping and stay valid until the next call on the reader.
+ */
+typedef struct {
+	uint64_t timestamp_us;		///< Time the record was appended in log order, microseconds since the epoch
+	uint64_t wallTime_us;		///< Wall clock time the record was appended, microseconds since the epoch. For display only
+	uint32_t topicId;
+	const char *pTopic;			///< Topic name, not null terminated
+	uint16_t topicLen;
+	const void *pPayload;
+	uint32_t payloadLen;
+} MessageLogRecord;
+
+/**
+ * @brief Reader iterating the records of a message log within a time range
+ */
+typedef struct {
+	char directory[PATH_MAX + 1];
+	uint64_t from_us;
+	uint64_t to_us;
+
+	uint32_t *pSequences;		///< Sorted sequence numbers of the segments found when opening
+	uint32_t sequenceCount;
+	uint32_t nextSequenceIndex;
+
+	int fd;
+	uint8_t *pSegment;
+	size_t mappedLen;
+	uint32_t readOffset;
+} MessageLogReader;
+
+/**
+ * @brief Open a message log for appending
+ *
+ * Existing segments in the directory are kept, numbering continues after the highest one.
+ *
+ * @param pSink		Sink to initialize
+ * @param pParams	Message log parameters
+ * @return An IoT Error Type defining successful/failed open
+ */
+IoT_Error_t aws_iot_message_log_open(MessageLogSink *pSink, const MessageLogParams *pParams);
+
+/**
+ * @brief Get the id of a topic, assigning a new one on first use
+ *
+ * @param pSink		Message log
+ * @param pTopic	Topic name, does not need to be null terminated
+ * @param topicLen	Length of the topic name
+ * @param pTopicId	Receives the topic id
+ * @return An IoT Error Type defining successful/failed lookup
+ */
+IoT_Error_t aws_iot_message_log_topic_id(MessageLogSink *pSink, const char *pTopic, uint16_t topicLen,
+		uint32_t *pTopicId);
+
+/**
+ * @brief Append a record stamped with the current time
+ *
+ * @param pSink			Message log
+ * @param topicId		Id returned by aws_iot_message_log_topic_id
+ * @param pPayload		Message payload
+ * @param payloadLen	Length of the payload
+ * @return An IoT Error Type defining successful/failed append
+ */
+IoT_Error_t aws_iot_message_log_append(MessageLogSink *pSink, uint32_t topicId, const void *pPayload,
+		uint32_t payloadLen);
+
+/**
+ * @brief Schedule write back of the current segment without waiting for it
+ *
+ * @param pSink		Message log
+ * @return An IoT Error Type defining successful/failed flush
+ */
+IoT_Error_t aws_iot_message_log_flush(MessageLogSink *pSink);
+
+/**
+ * @brief Close the current segment, trimming it to the bytes used
+ *
+ * @param pSink		Message log
+ * @return An IoT Error Type defining successful/failed close
+ */
+IoT_Error_t aws_iot_message_log_close(MessageLogSink *pSink);
+
+/**
+ * @brief Start iterating the records appended between two points in time
+ *
+ * @param pReader	Reader to initialize
+ * @param pDirectory	Directory holding the segment files
+ * @param from_us	Earliest timestamp to return, microseconds since the epoch
+ * @param to_us		Latest timestamp to return, microseconds since the epoch
+ * @return An IoT Error Type defining successful/failed open
+ */
+IoT_Error_t aws_iot_message_log_reader_open(MessageLogReader *pReader, const char *pDirectory, uint64_t from_us,
+		uint64_t to_us);
+
+/**
+ * @brief Get the next record in the time range
+ *
+ * @param pReader	Reader
+ * @param pRecord	Receives the record
+ * @return NONE_ERROR if a record was returned, MESSAGE_LOG_END_OF_RANGE once the range is exhausted,
+ *         otherwise an IoT Error Type describing the failure
+ */
+IoT_Error_t aws_iot_message_log_reader_next(MessageLogReader *pReader, MessageLogRecord *pRecord);
+
+/**
+ * @brief Release the resources held by a reader
+ *
+ * @param pReader	Reader
+ */
+void aws_iot_message_log_reader_close(MessageLogReader *pReader);
+
+#endif /* AWS_IOT_SDK_SRC_MESSAGE_LOG_H_ */
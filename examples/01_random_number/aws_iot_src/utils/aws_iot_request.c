@@ -0,0 +1,471 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "aws_iot_request.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "timer_interface.h"
+#include "aws_iot_log.h"
+
+#define NO_REQUEST (-1)
+
+const RequestEngineParams_t RequestEngineParamsDefault = {
+		.pIdPrefix = "request",
+		.pCorrelationKey = "clientToken",
+		.pAcceptedSuffix = "/accepted",
+		.pRejectedSuffix = "/rejected",
+		.window = AWS_IOT_REQUEST_MAX_PENDING
+};
+
+static uint32_t hashId(const char *pId) {
+	uint32_t hash = 2166136261u;	// FNV-1a
+	while ('\0' != *pId) {
+		hash ^= (uint8_t) *pId++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static uint32_t currentTimeTick(const RequestEngine_t *pEngine) {
+	return (uint32_t) ((timestamp_us() - pEngine->startTime_us) / (1000ULL * AWS_IOT_REQUEST_TIMER_WHEEL_TICK_MS));
+}
+
+IoT_Error_t aws_iot_request_init(RequestEngine_t *pEngine, const RequestEngineParams_t *pParams) {
+	int16_t i;
+
+	if (NULL == pEngine || NULL == pParams || NULL == pParams->pIdPrefix || NULL == pParams->pCorrelationKey) {
+		return NULL_VALUE_ERROR;
+	}
+
+	memset(pEngine, 0, sizeof(RequestEngine_t));
+	pEngine->params = *pParams;
+	if (0 == pEngine->params.window || AWS_IOT_REQUEST_MAX_PENDING < pEngine->params.window) {
+		pEngine->params.window = AWS_IOT_REQUEST_MAX_PENDING;
+	}
+
+	for (i = 0; i < REQUEST_HASH_BUCKETS; i++) {
+		pEngine->hashBuckets[i] = NO_REQUEST;
+	}
+	for (i = 0; i < AWS_IOT_REQUEST_TIMER_WHEEL_SLOTS; i++) {
+		pEngine->wheel[i] = NO_REQUEST;
+	}
+	for (i = 0; i < AWS_IOT_REQUEST_MAX_PENDING; i++) {
+		pEngine->requests[i].hashNext = (i + 1 < AWS_IOT_REQUEST_MAX_PENDING) ? i + 1 : NO_REQUEST;
+	}
+	pEngine->freeList = 0;
+	pEngine->startTime_us = timestamp_us();
+
+	return NONE_ERROR;
+}
+
+bool aws_iot_request_has_capacity(const RequestEngine_t *pEngine) {
+	return (pEngine->pendingCount < pEngine->params.window);
+}
+
+int16_t aws_iot_request_next_slot(const RequestEngine_t *pEngine) {
+	return aws_iot_request_has_capacity(pEngine) ? pEngine->freeList : NO_REQUEST;
+}
+
+uint32_t aws_iot_request_pending_count(const RequestEngine_t *pEngine) {
+	return pEngine->pendingCount;
+}
+
+const RequestEngineStats_t *aws_iot_request_get_stats(const RequestEngine_t *pEngine) {
+	return &(pEngine->stats);
+}
+
+IoT_Error_t aws_iot_request_new_id(RequestEngine_t *pEngine, char *pId, size_t idSize) {
+	int32_t length = snprintf(pId, idSize, "%s-%u", pEngine->params.pIdPrefix, pEngine->nextSequence++);
+
+	if (length < 0 || (size_t) length >= idSize) {
+		return REQUEST_BUFFER_TOO_SMALL;
+	}
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_request_inject_id(const RequestEngine_t *pEngine, char *pJsonDocument,
+		size_t maxSizeOfJsonDocument, const char *pId) {
+	char member[AWS_IOT_REQUEST_MAX_CORRELATION_ID_LEN + 64];
+	size_t documentLength;
+	size_t memberLength;
+	size_t position = 0;
+	size_t next;
+	int32_t length;
+
+	if (NULL == pJsonDocument || NULL == pId) {
+		return NULL_VALUE_ERROR;
+	}
+
+	while (' ' == pJsonDocument[position] || '\t' == pJsonDocument[position] || '\r' == pJsonDocument[position]
+			|| '\n' == pJsonDocument[position]) {
+		position++;
+	}
+	if ('{' != pJsonDocument[position]) {
+		return JSON_PARSE_ERROR;
+	}
+	position++;
+
+	next = position;
+	while (' ' == pJsonDocument[next] || '\t' == pJsonDocument[next] || '\r' == pJsonDocument[next]
+			|| '\n' == pJsonDocument[next]) {
+		next++;
+	}
+
+	length = snprintf(member, sizeof(member), "\"%s\":\"%s\"%s", pEngine->params.pCorrelationKey, pId,
+			('}' == pJsonDocument[next]) ? "" : ",");
+	if (length < 0 || (size_t) length >= sizeof(member)) {
+		return REQUEST_BUFFER_TOO_SMALL;
+	}
+	memberLength = (size_t) length;
+
+	documentLength = strlen(pJsonDocument);
+	if (documentLength + memberLength >= maxSizeOfJsonDocument) {
+		return REQUEST_BUFFER_TOO_SMALL;
+	}
+
+	memmove(pJsonDocument + position + memberLength, pJsonDocument + position, documentLength - position + 1);
+	memcpy(pJsonDocument + position, member, memberLength);
+
+	return NONE_ERROR;
+}
+
+static size_t skipWhitespace(const char *pPayload, size_t payloadLen, size_t position) {
+	while (position < payloadLen && (' ' == pPayload[position] || '\t' == pPayload[position]
+			|| '\r' == pPayload[position] || '\n' == pPayload[position])) {
+		position++;
+	}
+	return position;
+}
+
+// Returns the position after the closing quote of the string starting at position, or payloadLen
+static size_t skipString(const char *pPayload, size_t payloadLen, size_t position) {
+	position++;
+	while (position < payloadLen && '"' != pPayload[position]) {
+		position += ('\\' == pPayload[position]) ? 2 : 1;
+	}
+	return (position < payloadLen) ? position + 1 : payloadLen;
+}
+
+// Returns the position of the ',' or '}' ending the value starting at position
+static size_t skipValue(const char *pPayload, size_t payloadLen, size_t position) {
+	uint32_t depth = 0;
+
+	while (position < payloadLen) {
+		char c = pPayload[position];
+		if ('"' == c) {
+			position = skipString(pPayload, payloadLen, position);
+			continue;
+		}
+		if ('{' == c || '[' == c) {
+			depth++;
+		} else if ('}' == c || ']' == c) {
+			if (0 == depth) {
+				return position;
+			}
+			depth--;
+		} else if (',' == c && 0 == depth) {
+			return position;
+		}
+		position++;
+	}
+	return position;
+}
+
+// Only the members of the top-level object are looked at, without tokenizing the nested ones
+bool aws_iot_request_extract_id(const RequestEngine_t *pEngine, const char *pPayload, size_t payloadLen, char *pId,
+		size_t idSize) {
+	size_t keyLength = strlen(pEngine->params.pCorrelationKey);
+	size_t position;
+	size_t keyStart, keyEnd, valueEnd;
+
+	position = skipWhitespace(pPayload, payloadLen, 0);
+	if (position >= payloadLen || '{' != pPayload[position]) {
+		return false;
+	}
+	position = skipWhitespace(pPayload, payloadLen, position + 1);
+
+	while (position < payloadLen && '"' == pPayload[position]) {
+		keyStart = position + 1;
+		keyEnd = skipString(pPayload, payloadLen, position) - 1;
+		position = skipWhitespace(pPayload, payloadLen, keyEnd + 1);
+		if (position >= payloadLen || ':' != pPayload[position]) {
+			return false;
+		}
+		position = skipWhitespace(pPayload, payloadLen, position + 1);
+
+		if (keyEnd - keyStart == keyLength && 0 == memcmp(pPayload + keyStart, pEngine->params.pCorrelationKey,
+				keyLength)) {
+			if (position >= payloadLen || '"' != pPayload[position]) {
+				return false;
+			}
+			valueEnd = skipString(pPayload, payloadLen, position) - 1;
+			if (valueEnd - (position + 1) >= idSize) {
+				return false;
+			}
+			memcpy(pId, pPayload + position + 1, valueEnd - (position + 1));
+			pId[valueEnd - (position + 1)] = '\0';
+			return true;
+		}
+
+		position = skipValue(pPayload, payloadLen, position);
+		if (position >= payloadLen || ',' != pPayload[position]) {
+			return false;
+		}
+		position = skipWhitespace(pPayload, payloadLen, position + 1);
+	}
+
+	return false;
+}
+
+static int16_t findRequest(const RequestEngine_t *pEngine, const char *pCorrelationId, uint32_t idHash) {
+	int16_t index = pEngine->hashBuckets[idHash % REQUEST_HASH_BUCKETS];
+
+	while (NO_REQUEST != index) {
+		const PendingRequest_t *pRequest = &(pEngine->requests[index]);
+		if (pRequest->idHash == idHash && 0 == strcmp(pRequest->correlationId, pCorrelationId)) {
+			return index;
+		}
+		index = pRequest->hashNext;
+	}
+	return NO_REQUEST;
+}
+
+static void unlinkRequest(RequestEngine_t *pEngine, int16_t index) {
+	PendingRequest_t *pRequest = &(pEngine->requests[index]);
+	int16_t *pLink = &(pEngine->hashBuckets[pRequest->idHash % REQUEST_HASH_BUCKETS]);
+
+	while (*pLink != index) {
+		pLink = &(pEngine->requests[*pLink].hashNext);
+	}
+	*pLink = pRequest->hashNext;
+
+	if (NO_REQUEST != pRequest->wheelPrev) {
+		pEngine->requests[pRequest->wheelPrev].wheelNext = pRequest->wheelNext;
+	} else {
+		pEngine->wheel[pRequest->expiryTick % AWS_IOT_REQUEST_TIMER_WHEEL_SLOTS] = pRequest->wheelNext;
+	}
+	if (NO_REQUEST != pRequest->wheelNext) {
+		pEngine->requests[pRequest->wheelNext].wheelPrev = pRequest->wheelPrev;
+	}
+
+	pRequest->isPending = false;
+	pRequest->hashNext = pEngine->freeList;
+	pEngine->freeList = index;
+	pEngine->pendingCount--;
+}
+
+IoT_Error_t aws_iot_request_add(RequestEngine_t *pEngine, const char *pCorrelationId, uint32_t timeout_ms,
+		fpRequestCallback_t callback, void *pContextData, uint16_t *pSlot) {
+	PendingRequest_t *pRequest;
+	int16_t index;
+	uint32_t bucket;
+	uint32_t nowTick;
+
+	if (NULL == pEngine || NULL == pCorrelationId) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if (!aws_iot_request_has_capacity(pEngine) || NO_REQUEST == pEngine->freeList) {
+		return REQUEST_WINDOW_FULL;
+	}
+
+	if (strlen(pCorrelationId) >= AWS_IOT_REQUEST_MAX_CORRELATION_ID_LEN) {
+		return REQUEST_BUFFER_TOO_SMALL;
+	}
+
+	index = pEngine->freeList;
+	pRequest = &(pEngine->requests[index]);
+	pEngine->freeList = pRequest->hashNext;
+
+	strcpy(pRequest->correlationId, pCorrelationId);
+	pRequest->idHash = hashId(pCorrelationId);
+	pRequest->callback = callback;
+	pRequest->pContextData = pContextData;
+	pRequest->isPending = true;
+
+	bucket = pRequest->idHash % REQUEST_HASH_BUCKETS;
+	pRequest->hashNext = pEngine->hashBuckets[bucket];
+	pEngine->hashBuckets[bucket] = index;
+
+	// rounded up and one tick added, so a request never expires early
+	nowTick = currentTimeTick(pEngine);
+	pRequest->expiryTick = nowTick + 1 + (timeout_ms + AWS_IOT_REQUEST_TIMER_WHEEL_TICK_MS - 1)
+			/ AWS_IOT_REQUEST_TIMER_WHEEL_TICK_MS;
+	if ((int32_t) (pRequest->expiryTick - pEngine->currentTick) <= 0) {
+		pRequest->expiryTick = pEngine->currentTick + 1;
+	}
+	bucket = pRequest->expiryTick % AWS_IOT_REQUEST_TIMER_WHEEL_SLOTS;
+	pRequest->wheelPrev = NO_REQUEST;
+	pRequest->wheelNext = pEngine->wheel[bucket];
+	if (NO_REQUEST != pRequest->wheelNext) {
+		pEngine->requests[pRequest->wheelNext].wheelPrev = index;
+	}
+	pEngine->wheel[bucket] = index;
+
+	pEngine->pendingCount++;
+	pEngine->stats.sent++;
+	if (pEngine->pendingCount > pEngine->stats.maxPending) {
+		pEngine->stats.maxPending = pEngine->pendingCount;
+	}
+
+	if (NULL != pSlot) {
+		*pSlot = (uint16_t) index;
+	}
+
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_request_publish(RequestEngine_t *pEngine, MQTTClient_t *pClient, const char *pTopic,
+		char *pJsonDocument, size_t maxSizeOfJsonDocument, QoSLevel qos, uint32_t timeout_ms,
+		fpRequestCallback_t callback, void *pContextData) {
+	IoT_Error_t rc;
+	char correlationId[AWS_IOT_REQUEST_MAX_CORRELATION_ID_LEN];
+	MQTTPublishParams pubParams = MQTTPublishParamsDefault;
+	int16_t index;
+
+	if (NULL == pEngine || NULL == pClient || NULL == pTopic || NULL == pJsonDocument) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if (!aws_iot_request_has_capacity(pEngine)) {
+		return REQUEST_WINDOW_FULL;
+	}
+
+	rc = aws_iot_request_new_id(pEngine, correlationId, sizeof(correlationId));
+	if (NONE_ERROR == rc) {
+		rc = aws_iot_request_inject_id(pEngine, pJsonDocument, maxSizeOfJsonDocument, correlationId);
+	}
+	if (NONE_ERROR != rc) {
+		return rc;
+	}
+
+	// tracked before publishing, the response may arrive while the publish waits for its PUBACK
+	rc = aws_iot_request_add(pEngine, correlationId, timeout_ms, callback, pContextData, NULL);
+	if (NONE_ERROR != rc) {
+		return rc;
+	}
+
+	pubParams.pTopic = (char *) pTopic;
+	pubParams.MessageParams.qos = qos;
+	pubParams.MessageParams.pPayload = pJsonDocument;
+	pubParams.MessageParams.PayloadLen = strlen(pJsonDocument);
+	rc = pClient->publish(&pubParams);
+
+	if (NONE_ERROR != rc) {
+		index = findRequest(pEngine, correlationId, hashId(correlationId));
+		if (NO_REQUEST != index) {
+			unlinkRequest(pEngine, index);
+			pEngine->stats.sent--;
+		}
+	}
+
+	return rc;
+}
+
+bool aws_iot_request_complete(RequestEngine_t *pEngine, const char *pCorrelationId, RequestStatus_t status,
+		const char *pPayload, size_t payloadLen) {
+	PendingRequest_t *pRequest;
+	fpRequestCallback_t callback;
+	void *pContextData;
+	char correlationId[AWS_IOT_REQUEST_MAX_CORRELATION_ID_LEN];
+	int16_t index;
+
+	index = findRequest(pEngine, pCorrelationId, hashId(pCorrelationId));
+	if (NO_REQUEST == index) {
+		pEngine->stats.unmatched++;
+		return false;
+	}
+
+	pRequest = &(pEngine->requests[index]);
+	callback = pRequest->callback;
+	pContextData = pRequest->pContextData;
+	strcpy(correlationId, pRequest->correlationId);
+	unlinkRequest(pEngine, index);
+
+	if (REQUEST_ACCEPTED == status) {
+		pEngine->stats.accepted++;
+	} else if (REQUEST_REJECTED == status) {
+		pEngine->stats.rejected++;
+	} else {
+		pEngine->stats.timedOut++;
+	}
+
+	if (NULL != callback) {
+		callback(correlationId, status, pPayload, payloadLen, pContextData);
+	}
+
+	return true;
+}
+
+static bool isTopicEndingWith(const char *pTopicName, uint16_t topicNameLen, const char *pSuffix) {
+	size_t suffixLen;
+
+	if (NULL == pSuffix) {
+		return false;
+	}
+	suffixLen = strlen(pSuffix);
+	return (topicNameLen >= suffixLen && 0 == memcmp(pTopicName + topicNameLen - suffixLen, pSuffix, suffixLen));
+}
+
+bool aws_iot_request_handle_response(RequestEngine_t *pEngine, const char *pTopicName, uint16_t topicNameLen,
+		const char *pPayload, size_t payloadLen) {
+	char correlationId[AWS_IOT_REQUEST_MAX_CORRELATION_ID_LEN];
+	RequestStatus_t status;
+
+	if (isTopicEndingWith(pTopicName, topicNameLen, pEngine->params.pRejectedSuffix)) {
+		status = REQUEST_REJECTED;
+	} else if (NULL == pEngine->params.pAcceptedSuffix
+			|| isTopicEndingWith(pTopicName, topicNameLen, pEngine->params.pAcceptedSuffix)) {
+		status = REQUEST_ACCEPTED;
+	} else {
+		return false;
+	}
+
+	if (!aws_iot_request_extract_id(pEngine, pPayload, payloadLen, correlationId, sizeof(correlationId))) {
+		pEngine->stats.unmatched++;
+		return false;
+	}
+
+	return aws_iot_request_complete(pEngine, correlationId, status, pPayload, payloadLen);
+}
+
+void aws_iot_request_process_timeouts(RequestEngine_t *pEngine) {
+	uint32_t nowTick = currentTimeTick(pEngine);
+	uint32_t ticksToVisit = nowTick - pEngine->currentTick;
+	uint32_t tick;
+	int16_t index;
+
+	// after a long pause every slot is due once, visiting each of them is enough
+	if (ticksToVisit > AWS_IOT_REQUEST_TIMER_WHEEL_SLOTS) {
+		ticksToVisit = AWS_IOT_REQUEST_TIMER_WHEEL_SLOTS;
+	}
+
+	for (tick = nowTick - ticksToVisit + 1; ticksToVisit > 0; tick++, ticksToVisit--) {
+		index = pEngine->wheel[tick % AWS_IOT_REQUEST_TIMER_WHEEL_SLOTS];
+		while (NO_REQUEST != index) {
+			if ((int32_t) (pEngine->requests[index].expiryTick - nowTick) <= 0) {
+				// the callback may add or complete requests, so the slot is walked again from its head
+				aws_iot_request_complete(pEngine, pEngine->requests[index].correlationId, REQUEST_TIMEOUT, NULL, 0);
+				index = pEngine->wheel[tick % AWS_IOT_REQUEST_TIMER_WHEEL_SLOTS];
+			} else {
+				index = pEngine->requests[index].wheelNext;
+			}
+		}
+	}
+
+	pEngine->currentTick = nowTick;
+}
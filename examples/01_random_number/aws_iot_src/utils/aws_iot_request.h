@@ -0,0 +1,255 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file aws_iot_request.h
+ * @brief Correlation of requests and responses exchanged over MQTT topics
+ *
+ * A request carries a correlation id, the response echoes it back.  The engine keeps the pending
+ * requests in a fixed table indexed by a hash of the id, so matching a response costs the same
+ * whatever the number of requests in flight.  Timeouts are kept in a hashed timer wheel and expire
+ * in time proportional to the number of requests due, not to the number pending.  The number of
+ * requests in flight is limited by a window, callers pipeline requests up to it.
+ *
+ * The engine does not own subscriptions.  The application subscribes to its response topics and
+ * hands every response to \c aws_iot_request_handle_response(), or, when it extracts the id itself,
+ * to \c aws_iot_request_complete().  Callbacks and timeouts run from the thread calling those
+ * functions and \c aws_iot_request_process_timeouts(), usually the one calling yield.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_REQUEST_H_
+#define AWS_IOT_SDK_SRC_REQUEST_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "aws_iot_error.h"
+#include "aws_iot_mqtt_interface.h"
+#include "aws_iot_config.h"
+
+#define REQUEST_HASH_BUCKETS (2 * AWS_IOT_REQUEST_MAX_PENDING)
+
+/**
+ * @brief Outcome of a request
+ */
+typedef enum {
+	REQUEST_ACCEPTED,	///< Response received on a topic ending with the accepted suffix, or any response if no suffixes are set
+	REQUEST_REJECTED,	///< Response received on a topic ending with the rejected suffix
+	REQUEST_TIMEOUT		///< No response within the timeout of the request
+} RequestStatus_t;
+
+/**
+ * @brief Called once per request with its outcome
+ *
+ * The request is already removed when the callback runs, so the callback may send further requests.
+ *
+ * @param pCorrelationId Id of the request
+ * @param status Outcome of the request
+ * @param pPayload Response payload, NULL on timeout.  Valid only during the call
+ * @param payloadLen Length of pPayload
+ * @param pContextData Context given with the request
+ */
+typedef void (*fpRequestCallback_t)(const char *pCorrelationId, RequestStatus_t status, const char *pPayload,
+		size_t payloadLen, void *pContextData);
+
+/**
+ * @brief Parameters of a request engine
+ *
+ * @note Always use the \c RequestEngineParamsDefault to initialize this struct
+ */
+typedef struct {
+	const char *pIdPrefix;			///< Prefix of generated correlation ids, e.g. the MQTT client id.  Must stay valid while the engine is used
+	const char *pCorrelationKey;	///< Top-level JSON key carrying the correlation id in requests and responses
+	const char *pAcceptedSuffix;	///< Response topics ending with this report REQUEST_ACCEPTED, NULL to accept every response
+	const char *pRejectedSuffix;	///< Response topics ending with this report REQUEST_REJECTED, may be NULL
+	uint32_t window;				///< Requests in flight at the same time, at most AWS_IOT_REQUEST_MAX_PENDING.  0 uses the maximum
+} RequestEngineParams_t;
+
+/*!
+ * @brief Default engine parameters: "clientToken" key, "/accepted" and "/rejected" suffixes, maximum window
+ *
+ * \relates RequestEngineParams_t
+ */
+extern const RequestEngineParams_t RequestEngineParamsDefault;
+
+/**
+ * @brief Counters of a request engine
+ */
+typedef struct {
+	uint32_t sent;			///< Requests added
+	uint32_t accepted;		///< Requests completed with REQUEST_ACCEPTED
+	uint32_t rejected;		///< Requests completed with REQUEST_REJECTED
+	uint32_t timedOut;		///< Requests completed with REQUEST_TIMEOUT
+	uint32_t unmatched;		///< Responses without a pending request, e.g. late responses to timed out requests
+	uint32_t maxPending;	///< Largest number of requests in flight at once
+} RequestEngineStats_t;
+
+typedef struct {
+	char correlationId[AWS_IOT_REQUEST_MAX_CORRELATION_ID_LEN];
+	uint32_t idHash;
+	uint32_t expiryTick;
+	fpRequestCallback_t callback;
+	void *pContextData;
+	int16_t hashNext;		///< Next request in the same hash bucket, or in the free list
+	int16_t wheelNext;		///< Next request in the same timer wheel slot
+	int16_t wheelPrev;
+	bool isPending;
+} PendingRequest_t;
+
+/**
+ * @brief State of a request engine.  Its members are private, use the functions below
+ */
+typedef struct {
+	RequestEngineParams_t params;
+	PendingRequest_t requests[AWS_IOT_REQUEST_MAX_PENDING];
+	int16_t hashBuckets[REQUEST_HASH_BUCKETS];
+	int16_t wheel[AWS_IOT_REQUEST_TIMER_WHEEL_SLOTS];
+	int16_t freeList;
+	uint32_t pendingCount;
+	uint32_t currentTick;
+	uint64_t startTime_us;
+	uint32_t nextSequence;
+	RequestEngineStats_t stats;
+} RequestEngine_t;
+
+/**
+ * @brief Initialize an engine, dropping any pending request without calling its callback
+ *
+ * @param pEngine	Engine to initialize
+ * @param pParams	Parameters of the engine, copied
+ * @return NULL_VALUE_ERROR for missing parameters, NONE_ERROR otherwise
+ */
+IoT_Error_t aws_iot_request_init(RequestEngine_t *pEngine, const RequestEngineParams_t *pParams);
+
+/**
+ * @brief Whether another request fits into the window
+ */
+bool aws_iot_request_has_capacity(const RequestEngine_t *pEngine);
+
+/**
+ * @brief Index in the pending table the next added request will get
+ *
+ * Lets callers keep per-request data in their own table indexed like the engine's.
+ *
+ * @return Index below AWS_IOT_REQUEST_MAX_PENDING, -1 if the window is full
+ */
+int16_t aws_iot_request_next_slot(const RequestEngine_t *pEngine);
+
+/**
+ * @brief Number of requests in flight
+ */
+uint32_t aws_iot_request_pending_count(const RequestEngine_t *pEngine);
+
+/**
+ * @brief Generate a new correlation id, "<prefix>-<sequence>"
+ *
+ * @param pEngine	Engine whose prefix and sequence are used
+ * @param pId		Filled with the null terminated id
+ * @param idSize	Size of pId, at most AWS_IOT_REQUEST_MAX_CORRELATION_ID_LEN is needed
+ * @return REQUEST_BUFFER_TOO_SMALL if the id does not fit, NONE_ERROR otherwise
+ */
+IoT_Error_t aws_iot_request_new_id(RequestEngine_t *pEngine, char *pId, size_t idSize);
+
+/**
+ * @brief Insert "<correlation key>":"<id>" as the first member of a JSON object
+ *
+ * @param pEngine		Engine whose correlation key is used
+ * @param pJsonDocument	Null terminated JSON object, modified in place
+ * @param maxSizeOfJsonDocument	Size of the buffer holding pJsonDocument
+ * @param pId			Correlation id to insert
+ * @return REQUEST_BUFFER_TOO_SMALL if the result does not fit, JSON_PARSE_ERROR if the document is not an object
+ */
+IoT_Error_t aws_iot_request_inject_id(const RequestEngine_t *pEngine, char *pJsonDocument,
+		size_t maxSizeOfJsonDocument, const char *pId);
+
+/**
+ * @brief Extract the correlation id from a JSON response
+ *
+ * @param pEngine		Engine whose correlation key is used
+ * @param pPayload		JSON payload, does not need to be null terminated
+ * @param payloadLen	Length of pPayload
+ * @param pId			Filled with the null terminated id
+ * @param idSize		Size of pId
+ * @return true if a string value for the correlation key was found at the top level and fits into pId
+ */
+bool aws_iot_request_extract_id(const RequestEngine_t *pEngine, const char *pPayload, size_t payloadLen, char *pId,
+		size_t idSize);
+
+/**
+ * @brief Start tracking a request whose correlation id is already in the sent message
+ *
+ * @param pEngine		Engine tracking the request
+ * @param pCorrelationId	Id the response will carry, unique among pending requests
+ * @param timeout_ms	Time after which the callback is called with REQUEST_TIMEOUT
+ * @param callback		Called with the outcome, may be NULL
+ * @param pContextData	Passed to the callback
+ * @param pSlot			Set to the index of the request in the pending table, below AWS_IOT_REQUEST_MAX_PENDING.  May be NULL
+ * @return REQUEST_WINDOW_FULL if the window is full, REQUEST_BUFFER_TOO_SMALL if the id is too long, NONE_ERROR otherwise
+ */
+IoT_Error_t aws_iot_request_add(RequestEngine_t *pEngine, const char *pCorrelationId, uint32_t timeout_ms,
+		fpRequestCallback_t callback, void *pContextData, uint16_t *pSlot);
+
+/**
+ * @brief Publish a request on a topic and track its response
+ *
+ * A new correlation id is generated and inserted into the JSON document before it is published.
+ *
+ * @param pEngine		Engine tracking the request
+ * @param pClient		MQTT Client used as the protocol layer
+ * @param pTopic		Request topic
+ * @param pJsonDocument	Null terminated JSON object, the correlation id is inserted in place
+ * @param maxSizeOfJsonDocument	Size of the buffer holding pJsonDocument
+ * @param qos			QoS of the request
+ * @param timeout_ms	Time after which the callback is called with REQUEST_TIMEOUT
+ * @param callback		Called with the outcome, may be NULL
+ * @param pContextData	Passed to the callback
+ * @return REQUEST_WINDOW_FULL if the window is full, the publish error, or NONE_ERROR
+ */
+IoT_Error_t aws_iot_request_publish(RequestEngine_t *pEngine, MQTTClient_t *pClient, const char *pTopic,
+		char *pJsonDocument, size_t maxSizeOfJsonDocument, QoSLevel qos, uint32_t timeout_ms,
+		fpRequestCallback_t callback, void *pContextData);
+
+/**
+ * @brief Complete the pending request with the given id
+ *
+ * @return true if a request was pending for the id
+ */
+bool aws_iot_request_complete(RequestEngine_t *pEngine, const char *pCorrelationId, RequestStatus_t status,
+		const char *pPayload, size_t payloadLen);
+
+/**
+ * @brief Match a received response to its request, e.g. from the subscription callback of the response topics
+ *
+ * The status is derived from the topic suffix, the id from the correlation key of the payload.
+ *
+ * @return true if the response completed a pending request
+ */
+bool aws_iot_request_handle_response(RequestEngine_t *pEngine, const char *pTopicName, uint16_t topicNameLen,
+		const char *pPayload, size_t payloadLen);
+
+/**
+ * @brief Call the callbacks of requests whose timeout has passed
+ *
+ * Call regularly, e.g. before every yield.
+ */
+void aws_iot_request_process_timeouts(RequestEngine_t *pEngine);
+
+/**
+ * @brief Counters of the engine since aws_iot_request_init
+ */
+const RequestEngineStats_t *aws_iot_request_get_stats(const RequestEngine_t *pEngine);
+
+#endif /* AWS_IOT_SDK_SRC_REQUEST_H_ */
@@ -0,0 +1,182 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file aws_iot_topic_stats.c
+ * @brief Bounded memory heavy-hitter statistics per topic
+ */
+
+#include "aws_iot_topic_stats.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#if (AWS_IOT_TOPIC_STATS_SKETCH_WIDTH & (AWS_IOT_TOPIC_STATS_SKETCH_WIDTH - 1)) != 0
+#error "AWS_IOT_TOPIC_STATS_SKETCH_WIDTH must be a power of two"
+#endif
+
+#define FNV_OFFSET_BASIS 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+static uint64_t hashTopic(const char *pTopic, uint16_t topicLen) {
+	uint64_t hash = FNV_OFFSET_BASIS;
+	uint16_t i;
+
+	for (i = 0; i < topicLen; i++) {
+		hash ^= (uint8_t) pTopic[i];
+		hash *= FNV_PRIME;
+	}
+
+	return hash;
+}
+
+/* Row i uses h1 + i * h2, the usual double hashing trick to derive independent columns from one hash */
+static void sketchColumns(uint64_t hash, uint32_t *pColumns) {
+	uint32_t h1 = (uint32_t) hash;
+	uint32_t h2 = (uint32_t) (hash >> 32) | 1;
+	uint32_t i;
+
+	for (i = 0; i < AWS_IOT_TOPIC_STATS_SKETCH_DEPTH; i++) {
+		pColumns[i] = (h1 + i * h2) & (AWS_IOT_TOPIC_STATS_SKETCH_WIDTH - 1);
+	}
+}
+
+static uint64_t entryMetric(const TopicStatsEntry *pEntry, TopicStatsOrder_t order) {
+	return (TOPIC_STATS_BY_MESSAGES == order) ? pEntry->messages : pEntry->bytes;
+}
+
+/* Space-saving style maintenance: update the topic if tracked, otherwise let it evict the lightest entry it outweighs */
+static void updateTopK(TopicStatsEntry *pTop, uint32_t *pCount, TopicStatsOrder_t order, const char *pTopic,
+		uint16_t topicLen, uint64_t hash, uint32_t messages, uint64_t bytes) {
+	TopicStatsEntry *pEntry = NULL;
+	uint32_t minIndex = 0;
+	uint32_t i;
+	uint16_t storedLen = (topicLen > AWS_IOT_TOPIC_STATS_MAX_TOPIC_LEN) ? AWS_IOT_TOPIC_STATS_MAX_TOPIC_LEN : topicLen;
+	uint64_t metric = (TOPIC_STATS_BY_MESSAGES == order) ? messages : bytes;
+
+	for (i = 0; i < *pCount; i++) {
+		if (pTop[i].hash == hash && pTop[i].topicLen == storedLen && 0 == memcmp(pTop[i].topic, pTopic, storedLen)) {
+			pTop[i].messages = messages;
+			pTop[i].bytes = bytes;
+			return;
+		}
+		if (entryMetric(&pTop[i], order) < entryMetric(&pTop[minIndex], order)) {
+			minIndex = i;
+		}
+	}
+
+	if (*pCount < AWS_IOT_TOPIC_STATS_TOP_K) {
+		pEntry = &pTop[(*pCount)++];
+	} else if (metric > entryMetric(&pTop[minIndex], order)) {
+		pEntry = &pTop[minIndex];
+	}
+
+	if (NULL != pEntry) {
+		memcpy(pEntry->topic, pTopic, storedLen);
+		pEntry->topicLen = storedLen;
+		pEntry->hash = hash;
+		pEntry->messages = messages;
+		pEntry->bytes = bytes;
+	}
+}
+
+void aws_iot_topic_stats_reset(TopicStats *pStats) {
+	if (NULL != pStats) {
+		memset(pStats, 0, sizeof(TopicStats));
+	}
+}
+
+void aws_iot_topic_stats_record(TopicStats *pStats, const char *pTopic, uint16_t topicLen, uint32_t bytes) {
+	uint32_t columns[AWS_IOT_TOPIC_STATS_SKETCH_DEPTH];
+	uint32_t minMessages = UINT32_MAX;
+	uint64_t minBytes = UINT64_MAX;
+	uint64_t hash;
+	uint32_t i;
+
+	if (NULL == pStats || NULL == pTopic) {
+		return;
+	}
+
+	hash = hashTopic(pTopic, topicLen);
+	sketchColumns(hash, columns);
+
+	for (i = 0; i < AWS_IOT_TOPIC_STATS_SKETCH_DEPTH; i++) {
+		if (pStats->messageSketch[i][columns[i]] < minMessages) {
+			minMessages = pStats->messageSketch[i][columns[i]];
+		}
+		if (pStats->byteSketch[i][columns[i]] < minBytes) {
+			minBytes = pStats->byteSketch[i][columns[i]];
+		}
+	}
+	minMessages++;
+	minBytes += bytes;
+
+	/* Conservative update: a counter only grows as far as the new estimate, which keeps collisions from compounding */
+	for (i = 0; i < AWS_IOT_TOPIC_STATS_SKETCH_DEPTH; i++) {
+		if (pStats->messageSketch[i][columns[i]] < minMessages) {
+			pStats->messageSketch[i][columns[i]] = minMessages;
+		}
+		if (pStats->byteSketch[i][columns[i]] < minBytes) {
+			pStats->byteSketch[i][columns[i]] = minBytes;
+		}
+	}
+
+	pStats->totalMessages++;
+	pStats->totalBytes += bytes;
+
+	updateTopK(pStats->topByMessages, &pStats->topByMessagesCount, TOPIC_STATS_BY_MESSAGES, pTopic, topicLen, hash,
+			minMessages, minBytes);
+	updateTopK(pStats->topByBytes, &pStats->topByBytesCount, TOPIC_STATS_BY_BYTES, pTopic, topicLen, hash,
+			minMessages, minBytes);
+}
+
+static int compareByMessages(const void *pA, const void *pB) {
+	uint32_t a = ((const TopicStatsEntry *) pA)->messages;
+	uint32_t b = ((const TopicStatsEntry *) pB)->messages;
+	return (a < b) - (a > b);
+}
+
+static int compareByBytes(const void *pA, const void *pB) {
+	uint64_t a = ((const TopicStatsEntry *) pA)->bytes;
+	uint64_t b = ((const TopicStatsEntry *) pB)->bytes;
+	return (a < b) - (a > b);
+}
+
+uint32_t aws_iot_topic_stats_top(const TopicStats *pStats, TopicStatsOrder_t order, TopicStatsEntry *pEntries,
+		uint32_t maxEntries) {
+	TopicStatsEntry sorted[AWS_IOT_TOPIC_STATS_TOP_K];
+	uint32_t count;
+
+	if (NULL == pStats || NULL == pEntries) {
+		return 0;
+	}
+
+	if (TOPIC_STATS_BY_MESSAGES == order) {
+		count = pStats->topByMessagesCount;
+		memcpy(sorted, pStats->topByMessages, count * sizeof(TopicStatsEntry));
+		qsort(sorted, count, sizeof(TopicStatsEntry), compareByMessages);
+	} else {
+		count = pStats->topByBytesCount;
+		memcpy(sorted, pStats->topByBytes, count * sizeof(TopicStatsEntry));
+		qsort(sorted, count, sizeof(TopicStatsEntry), compareByBytes);
+	}
+
+	if (count > maxEntries) {
+		count = maxEntries;
+	}
+	memcpy(pEntries, sorted, count * sizeof(TopicStatsEntry));
+
+	return count;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file aws_iot_topic_stats.h
+ * @brief Bounded memory heavy-hitter statistics per topic
+ *
+ * Message and byte counts are accumulated in count-min sketches, so memory does not grow with
+ * the number of distinct topics. Alongside, the AWS_IOT_TOPIC_STATS_TOP_K topics with the highest
+ * estimated message count and the highest estimated byte count are kept by name. Estimates never
+ * under-count; they may over-count when topics collide in every sketch row.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_TOPIC_STATS_H_
+#define AWS_IOT_SDK_SRC_TOPIC_STATS_H_
+
+#include <stdint.h>
+
+#include "aws_iot_config.h"
+
+/**
+ * @brief Ranking used when reading the top topics
+ */
+typedef enum {
+	TOPIC_STATS_BY_MESSAGES,	///< Highest estimated number of messages first
+	TOPIC_STATS_BY_BYTES		///< Highest estimated number of payload bytes first
+} TopicStatsOrder_t;
+
+/**
+ * @brief Estimated traffic of one topic
+ */
+typedef struct {
+	char topic[AWS_IOT_TOPIC_STATS_MAX_TOPIC_LEN];	///< Topic name, not null terminated
+	uint16_t topicLen;
+	uint64_t hash;
+	uint32_t messages;	///< Estimated number of messages
+	uint64_t bytes;		///< Estimated number of payload bytes
+} TopicStatsEntry;
+
+/**
+ * @brief Sketches and top-K tables of one traffic direction
+ */
+typedef struct {
+	uint32_t messageSketch[AWS_IOT_TOPIC_STATS_SKETCH_DEPTH][AWS_IOT_TOPIC_STATS_SKETCH_WIDTH];
+	uint64_t byteSketch[AWS_IOT_TOPIC_STATS_SKETCH_DEPTH][AWS_IOT_TOPIC_STATS_SKETCH_WIDTH];
+	TopicStatsEntry topByMessages[AWS_IOT_TOPIC_STATS_TOP_K];
+	uint32_t topByMessagesCount;
+	TopicStatsEntry topByBytes[AWS_IOT_TOPIC_STATS_TOP_K];
+	uint32_t topByBytesCount;
+	uint64_t totalMessages;
+	uint64_t totalBytes;
+} TopicStats;
+
+/**
+ * @brief Clear all counters and top-K tables
+ *
+ * @param pStats	Statistics to reset
+ */
+void aws_iot_topic_stats_reset(TopicStats *pStats);
+
+/**
+ * @brief Account one message
+ *
+ * @param pStats	Statistics to update
+ * @param pTopic	Topic name, does not need to be null terminated
+ * @param topicLen	Length of the topic name
+ * @param bytes		Payload length of the message
+ */
+void aws_iot_topic_stats_record(TopicStats *pStats, const char *pTopic, uint16_t topicLen, uint32_t bytes);
+
+/**
+ * @brief Read the heaviest topics
+ *
+ * @param pStats		Statistics to read
+ * @param order			Ranking to sort by
+ * @param pEntries		Receives up to maxEntries entries, heaviest first
+ * @param maxEntries	Size of pEntries
+ * @return Number of entries written
+ */
+uint32_t aws_iot_topic_stats_top(const TopicStats *pStats, TopicStatsOrder_t order, TopicStatsEntry *pEntries,
+		uint32_t maxEntries);
+
+#endif /* AWS_IOT_SDK_SRC_TOPIC_STATS_H_ */
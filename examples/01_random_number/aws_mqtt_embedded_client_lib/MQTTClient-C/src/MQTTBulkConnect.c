@@ -0,0 +1,159 @@
+/*******************************************************************************
+ * Copyright (c) 2014 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Concurrent connection bring-up for multiple client instances
+ *******************************************************************************/
+
+#include "MQTTBulkConnect.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    Client **clients;
+    MQTTPacket_connectData *options;
+    size_t count;
+    MQTTBulkConnectResult *results;
+
+    pthread_mutex_t lock;
+    size_t nextIndex;
+    uint32_t succeeded;
+    uint32_t failed;
+
+    uint32_t maxConnectionsPerSec;
+    uint64_t startTimeUs;
+} BulkConnectJob;
+
+static void sleepUntil(uint64_t deadlineUs) {
+    uint64_t now = timestamp_us();
+    struct timespec delay;
+
+    while (now < deadlineUs) {
+        delay.tv_sec = (time_t)((deadlineUs - now) / 1000000);
+        delay.tv_nsec = (long)(((deadlineUs - now) % 1000000) * 1000);
+        nanosleep(&delay, NULL);
+        now = timestamp_us();
+    }
+}
+
+static void *bulkConnectWorker(void *arg) {
+    BulkConnectJob *job = (BulkConnectJob *)arg;
+    size_t index;
+    uint64_t connectStartUs;
+    MQTTReturnCode rc;
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        index = job->nextIndex++;
+        pthread_mutex_unlock(&job->lock);
+
+        if (index >= job->count) {
+            break;
+        }
+
+        /* The n-th connect may not start before n / rate seconds into the run */
+        if (0 != job->maxConnectionsPerSec) {
+            sleepUntil(job->startTimeUs + ((uint64_t)index * 1000000) / job->maxConnectionsPerSec);
+        }
+
+        connectStartUs = timestamp_us();
+        rc = MQTTConnect(job->clients[index], (NULL != job->options) ? &(job->options[index]) : NULL);
+
+        if (NULL != job->results) {
+            job->results[index].rc = rc;
+            job->results[index].connectTimeMs = (uint32_t)((timestamp_us() - connectStartUs) / 1000);
+        }
+
+        pthread_mutex_lock(&job->lock);
+        if (SUCCESS == rc) {
+            job->succeeded++;
+        } else {
+            job->failed++;
+        }
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    return NULL;
+}
+
+MQTTReturnCode MQTTBulkConnect(Client **clients, MQTTPacket_connectData *options, size_t count,
+                               const MQTTBulkConnectParams *params, MQTTBulkConnectResult *results,
+                               MQTTBulkConnectSummary *summary) {
+    BulkConnectJob job;
+    pthread_t *workers;
+    size_t threadCount = 0;
+    size_t started;
+    size_t i;
+    long cores;
+    uint64_t elapsedUs;
+
+    if (NULL == clients) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    if (NULL != params) {
+        threadCount = params->threadCount;
+    }
+    if (0 == threadCount) {
+        cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = (cores > 0) ? (size_t)cores : 1;
+    }
+    if (threadCount > count) {
+        threadCount = count;
+    }
+
+    job.clients = clients;
+    job.options = options;
+    job.count = count;
+    job.results = results;
+    job.nextIndex = 0;
+    job.succeeded = 0;
+    job.failed = 0;
+    job.maxConnectionsPerSec = (NULL != params) ? params->maxConnectionsPerSec : 0;
+    job.startTimeUs = timestamp_us();
+    pthread_mutex_init(&job.lock, NULL);
+
+    workers = (0 != threadCount) ? (pthread_t *)malloc(threadCount * sizeof(pthread_t)) : NULL;
+    started = 0;
+    if (NULL != workers) {
+        for (started = 0; started < threadCount; started++) {
+            if (0 != pthread_create(&workers[started], NULL, bulkConnectWorker, &job)) {
+                break;
+            }
+        }
+    }
+
+    /* No worker could be started, connect on the calling thread */
+    if (0 == started) {
+        bulkConnectWorker(&job);
+    }
+
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    pthread_mutex_destroy(&job.lock);
+
+    elapsedUs = timestamp_us() - job.startTimeUs;
+
+    if (NULL != summary) {
+        summary->succeeded = job.succeeded;
+        summary->failed = job.failed;
+        summary->elapsedMs = (uint32_t)(elapsedUs / 1000);
+        summary->handshakesPerSec = (0 != elapsedUs) ? ((double)job.succeeded * 1000000.0) / (double)elapsedUs : 0.0;
+    }
+
+    return (0 == job.failed) ? SUCCESS : FAILURE;
+}
@@ -0,0 +1,74 @@
+/*******************************************************************************
+ * Copyright (c) 2014 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Concurrent connection bring-up for multiple client instances
+ *******************************************************************************/
+
+#ifndef __MQTT_BULK_CONNECT_H
+#define __MQTT_BULK_CONNECT_H
+
+#include "MQTTClient.h"
+
+/**
+ * @brief Parameters controlling a bulk connect
+ *
+ * threadCount of 0 sizes the worker pool to the number of online cores.
+ * maxConnectionsPerSec of 0 disables the connection-rate ceiling.
+ */
+typedef struct {
+    uint32_t threadCount;
+    uint32_t maxConnectionsPerSec;
+} MQTTBulkConnectParams;
+
+#define MQTTBulkConnectParams_initializer {0, 0}
+
+/**
+ * @brief Outcome of a single client connect within a bulk connect
+ */
+typedef struct {
+    MQTTReturnCode rc;      ///< Return code of MQTTConnect for this client
+    uint32_t connectTimeMs; ///< Time spent in MQTTConnect (TCP + TLS handshake + CONNACK)
+} MQTTBulkConnectResult;
+
+/**
+ * @brief Aggregate outcome of a bulk connect
+ */
+typedef struct {
+    uint32_t succeeded;
+    uint32_t failed;
+    uint32_t elapsedMs;
+    double handshakesPerSec; ///< Successful connects divided by wall clock time
+} MQTTBulkConnectSummary;
+
+/**
+ * @brief Connect many clients concurrently
+ *
+ * Runs MQTTConnect for every client on a pool of worker threads so that the CPU bound
+ * part of the TLS handshakes is spread over all cores. Connects are started no faster
+ * than params->maxConnectionsPerSec. Each client must have been set up with MQTTClient()
+ * and must not be used by any other thread until this call returns.
+ *
+ * @param clients array of count client pointers
+ * @param options array of count connect options, or NULL to reuse each client's stored options
+ * @param count number of clients
+ * @param params pool size and rate ceiling, NULL for defaults
+ * @param results array of count entries receiving the per-client outcome, may be NULL
+ * @param summary receives the aggregate outcome, may be NULL
+ *
+ * @return SUCCESS if every client connected, FAILURE if any of them failed
+ */
+MQTTReturnCode MQTTBulkConnect(Client **clients, MQTTPacket_connectData *options, size_t count,
+                               const MQTTBulkConnectParams *params, MQTTBulkConnectResult *results,
+                               MQTTBulkConnectSummary *summary);
+
+#endif //__MQTT_BULK_CONNECT_H
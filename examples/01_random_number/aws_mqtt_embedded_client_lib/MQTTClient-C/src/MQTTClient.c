@@ -15,20 +15,341 @@
  *******************************************************************************/
 
 #include "MQTTClient.h"
+#include "aws_iot_log.h"
 #include <string.h>
+#include <time.h>
 
 static void MQTTForceDisconnect(Client *c);
 
-void NewMessageData(MessageData *md, MQTTString *aTopicName, MQTTMessage *aMessage, pApplicationHandler_t applicationHandler) {
+void NewMessageData(MessageData *md, MQTTString *aTopicName, const char *aTopicFilter, MQTTMessage *aMessage,
+                    pApplicationHandler_t applicationHandler) {
     md->topicName = aTopicName;
+    md->topicFilter = aTopicFilter;
     md->message = aMessage;
     md->applicationHandler = applicationHandler;
 }
 
+static uint32_t recordCallbackDuration(CallbackTimingStats *stats, uint64_t startUs) {
+    uint32_t durationMs = (uint32_t)((timestamp_us() - startUs) / 1000);
+    uint32_t bucket = 0;
+
+    while(bucket < CALLBACK_HISTOGRAM_BUCKETS - 1 && durationMs >= (1u << bucket)) {
+        bucket++;
+    }
+    stats->histogram[bucket]++;
+
+    if(durationMs > stats->maxDurationMs) {
+        stats->maxDurationMs = durationMs;
+    }
+    if(durationMs > stats->budgetMs) {
+        stats->overruns++;
+    }
+
+    return durationMs;
+}
+
+/* Blocking waits of all clients of the process, for the wakeup statistics */
+static MQTTWakeupStats wakeupStats;
+
+void MQTTRecordWait(uint8_t isIdle) {
+    if(0 == wakeupStats.sinceUs) {
+        __sync_bool_compare_and_swap(&(wakeupStats.sinceUs), 0, timestamp_us());
+    }
+    __sync_fetch_and_add(&(wakeupStats.waits), 1);
+    if(isIdle) {
+        __sync_fetch_and_add(&(wakeupStats.idleWakeups), 1);
+    }
+}
+
+/* Keepalive timers may expire this much late to share a wakeup, never more than a quarter of the
+ * interval so the broker still sees a packet within one and a half intervals */
+static uint32_t keepaliveSlackMs(Client *c) {
+    uint32_t slackMs = KEEPALIVE_SLACK_MS;
+
+    if(slackMs > c->keepAliveInterval * 250) {
+        slackMs = c->keepAliveInterval * 250;
+    }
+    return slackMs;
+}
+
+static void sleepMs(uint32_t ms) {
+    struct timespec delay;
+
+    delay.tv_sec = (time_t)(ms / 1000);
+    delay.tv_nsec = (long)(ms % 1000) * 1000000L;
+    nanosleep(&delay, NULL);
+}
+
+static void startPingTimer(Client *c, uint32_t timeoutMs) {
+    countdown_ms_slack(&(c->pingTimer), timeoutMs, keepaliveSlackMs(c));
+}
+
+static void startReconnectDelayTimer(Client *c) {
+    countdown_ms_slack(&(c->reconnectDelayTimer), c->currentReconnectWaitInterval,
+                       c->currentReconnectWaitInterval / 100 * RECONNECT_SLACK_PERCENT);
+}
+
 uint16_t getNextPacketId(Client *c) {
     return c->nextPacketId = (uint16_t)((MAX_PACKET_ID == c->nextPacketId) ? 1 : (c->nextPacketId + 1));
 }
 
+/* Return every queued block to the free list, dropping unsent bytes */
+static void resetSendQueue(MQTTSendQueue *q) {
+    SendQueueBlock *block;
+
+    while(NULL != q->head) {
+        block = q->head;
+        q->head = block->next;
+        block->next = q->freeBlocks;
+        q->freeBlocks = block;
+        q->freeBlockCount++;
+    }
+    q->tail = NULL;
+    q->queuedBytes = 0;
+    q->corkStartUs = 0;
+    q->writtenTotal = q->enqueuedTotal;
+    q->traceId = 0;
+}
+
+/* Copy the serialized packet in c->buf behind the bytes already queued */
+static MQTTReturnCode enqueuePacket(Client *c, uint32_t length) {
+    MQTTSendQueue *q = &(c->sendQueue);
+    SendQueueBlock *block;
+    size_t space = 0;
+    uint32_t copied = 0;
+    uint32_t chunk;
+
+    if(NULL != q->tail) {
+        space = SEND_QUEUE_BLOCK_SIZE - q->tail->end;
+    }
+    if(space + q->freeBlockCount * SEND_QUEUE_BLOCK_SIZE < length) {
+        return MQTT_WOULD_BLOCK;
+    }
+
+    while(copied < length) {
+        if(NULL == q->tail || SEND_QUEUE_BLOCK_SIZE == q->tail->end) {
+            block = q->freeBlocks;
+            q->freeBlocks = block->next;
+            q->freeBlockCount--;
+            block->next = NULL;
+            block->start = 0;
+            block->end = 0;
+            if(NULL == q->tail) {
+                q->head = block;
+            } else {
+                q->tail->next = block;
+            }
+            q->tail = block;
+        }
+        chunk = SEND_QUEUE_BLOCK_SIZE - q->tail->end;
+        if(chunk > length - copied) {
+            chunk = length - copied;
+        }
+        memcpy(&(q->tail->data[q->tail->end]), &(c->buf[copied]), chunk);
+        q->tail->end += chunk;
+        copied += chunk;
+    }
+    q->queuedBytes += length;
+
+    /* Follow a sampled publish until its last byte is written */
+    if(0 != c->publishTraceId && 0 == q->traceId) {
+        q->traceId = c->publishTraceId;
+        q->traceStart = q->enqueuedTotal;
+        q->traceEnd = q->enqueuedTotal + length;
+        q->isTraceWriteStarted = 0;
+    }
+    q->enqueuedTotal += length;
+
+    return SUCCESS;
+}
+
+/* Write queued bytes to the network in order, gathering consecutive blocks into writes of up to the
+ * flush threshold so held packets share TLS records. Without a timer only what the socket accepts
+ * right now is written and MQTT_WOULD_BLOCK is returned if bytes remain */
+static MQTTReturnCode flushSendQueue(Client *c, Timer *timer) {
+    MQTTSendQueue *q = &(c->sendQueue);
+    SendQueueBlock *block;
+    unsigned char *data;
+    size_t limit = (0 != q->corkFlushBytes && q->corkFlushBytes < SEND_QUEUE_GATHER_SIZE) ? q->corkFlushBytes
+                                                                                          : SEND_QUEUE_GATHER_SIZE;
+    size_t length, chunk, consumed;
+    int32_t sentLen;
+
+    while(NULL != q->head) {
+        block = q->head;
+        length = block->end - block->start;
+        if(NULL == block->next || length >= limit) {
+            /* Nothing to gather, the block is written as it is */
+            data = &(block->data[block->start]);
+        } else {
+            data = q->gather;
+            length = 0;
+            for(; NULL != block && length < limit; block = block->next) {
+                chunk = block->end - block->start;
+                if(chunk > limit - length) {
+                    chunk = limit - length;
+                }
+                memcpy(&(data[length]), &(block->data[block->start]), chunk);
+                length += chunk;
+            }
+        }
+
+        if(0 != q->traceId && !q->isTraceWriteStarted && q->writtenTotal + length > q->traceStart) {
+            MQTTTraceRecord(q->traceId, TRACE_PUBLISH_WRITE_START, 0);
+            q->isTraceWriteStarted = 1;
+        }
+        if(NULL == timer) {
+            sentLen = c->networkStack.mqtttrywrite(&(c->networkStack), data, (int)length);
+            if(0 == sentLen) {
+                return MQTT_WOULD_BLOCK;
+            }
+        } else {
+            if(expired(timer)) {
+                return FAILURE;
+            }
+            sentLen = c->networkStack.mqttwrite(&(c->networkStack), data, (int)length, left_ms(timer));
+        }
+        if(sentLen < 0) {
+            return FAILURE;
+        }
+
+        q->queuedBytes -= (size_t)sentLen;
+        q->writtenTotal += (uint64_t)sentLen;
+        if(0 != q->traceId && q->writtenTotal >= q->traceEnd) {
+            MQTTTraceRecord(q->traceId, TRACE_PUBLISH_WRITE_DONE, 0);
+            q->traceId = 0;
+        }
+
+        /* Free the blocks the written bytes came from, a partly written one stays at the head */
+        consumed = (size_t)sentLen;
+        while(0 != consumed) {
+            block = q->head;
+            chunk = block->end - block->start;
+            if(chunk > consumed) {
+                chunk = consumed;
+            }
+            block->start += (uint32_t)chunk;
+            consumed -= chunk;
+            if(block->start == block->end) {
+                q->head = block->next;
+                if(NULL == q->head) {
+                    q->tail = NULL;
+                }
+                block->next = q->freeBlocks;
+                q->freeBlocks = block;
+                q->freeBlockCount++;
+            }
+        }
+    }
+
+    return SUCCESS;
+}
+
+/* Stop holding packets back, they go out with the next flush */
+static void uncork(Client *c, AutoCorkFlushReason reason) {
+    MQTTSendQueue *q = &(c->sendQueue);
+    uint32_t holdUs;
+
+    if(0 == q->corkStartUs) {
+        return;
+    }
+
+    holdUs = (uint32_t)(timestamp_us() - q->corkStartUs);
+    q->corkStats.flushes[reason]++;
+    q->corkStats.totalHoldUs += holdUs;
+    if(holdUs > q->corkStats.maxHoldUs) {
+        q->corkStats.maxHoldUs = holdUs;
+    }
+    q->corkStartUs = 0;
+}
+
+static uint8_t isCorkDue(MQTTSendQueue *q) {
+    return (0 != q->corkStartUs && timestamp_us() - q->corkStartUs >= q->corkLatencyBudgetUs) ? 1 : 0;
+}
+
+/* Milliseconds, rounded up, until the oldest held packet has to be written */
+static uint32_t corkLeftMs(MQTTSendQueue *q) {
+    uint64_t heldUs = timestamp_us() - q->corkStartUs;
+
+    if(heldUs >= q->corkLatencyBudgetUs) {
+        return 0;
+    }
+    return (uint32_t)((q->corkLatencyBudgetUs - heldUs + 999) / 1000);
+}
+
+/* Decide after queuing a publish of length bytes whether it may wait for more packets to share its
+ * TLS record. Returns 1 while the queue is held */
+static uint8_t holdInCork(Client *c, uint32_t length, QoS qos) {
+    MQTTSendQueue *q = &(c->sendQueue);
+
+    if(0 == q->corkLatencyBudgetUs) {
+        return 0;
+    }
+
+    if(0 == q->corkStartUs) {
+        if(q->queuedBytes != length) {
+            /* Joins bytes already waiting for the socket, holding would only delay them */
+            return 0;
+        }
+        q->corkStartUs = timestamp_us();
+    }
+    q->corkStats.heldPackets++;
+
+    if(q->queuedBytes >= q->corkFlushBytes || q->queuedBytes >= q->highWaterMark) {
+        uncork(c, AUTO_CORK_FLUSH_SIZE);
+        return 0;
+    }
+    if(QOS1 == qos && c->inflightPublishCount + 1 >= MAX_INFLIGHT_PUBLISH) {
+        uncork(c, AUTO_CORK_FLUSH_WINDOW);
+        return 0;
+    }
+
+    return 1;
+}
+
+/* Queue the serialized PUBLISH in c->buf and write as much as the socket accepts now, unless
+ * auto-cork holds it back. The rest is left to MQTTYield */
+static MQTTReturnCode queuePublish(Client *c, uint32_t length, QoS qos) {
+    MQTTSendQueue *q = &(c->sendQueue);
+    MQTTReturnCode rc;
+
+    if(isCorkDue(q)) {
+        uncork(c, AUTO_CORK_FLUSH_LATENCY);
+    }
+
+    /* Make room, held packets stay where they are */
+    if(0 == q->corkStartUs) {
+        rc = flushSendQueue(c, NULL);
+        if(FAILURE == rc) {
+            return rc;
+        }
+    }
+    if(q->queuedBytes >= q->highWaterMark) {
+        return MQTT_WOULD_BLOCK;
+    }
+
+    rc = enqueuePacket(c, length);
+    if(MQTT_WOULD_BLOCK == rc && 0 != q->corkStartUs) {
+        uncork(c, AUTO_CORK_FLUSH_SIZE);
+        if(FAILURE == flushSendQueue(c, NULL)) {
+            return FAILURE;
+        }
+        rc = enqueuePacket(c, length);
+    }
+    if(SUCCESS != rc) {
+        return rc;
+    }
+
+    if(0 == holdInCork(c, length, qos)) {
+        rc = flushSendQueue(c, NULL);
+        if(FAILURE == rc) {
+            return rc;
+        }
+    }
+
+    return SUCCESS;
+}
+
 MQTTReturnCode sendPacket(Client *c, uint32_t length, Timer *timer) {
     int32_t sentLen = 0;
     uint32_t sent = 0;
@@ -41,8 +362,22 @@ MQTTReturnCode sendPacket(Client *c, uint32_t length, Timer *timer) {
     	return MQTTPACKET_BUFFER_TOO_SHORT;
     }
 
+    /* Held packets leave together with this one, coalesced into the same writes */
+    if(0 != c->sendQueue.corkStartUs) {
+        uncork(c, AUTO_CORK_FLUSH_SYNC);
+        if(SUCCESS == enqueuePacket(c, length)) {
+            return (SUCCESS == flushSendQueue(c, timer)) ? SUCCESS : FAILURE;
+        }
+    }
+
+    /* Packets queued by MQTTPublishAsync have to reach the broker first */
+    if(SUCCESS != flushSendQueue(c, timer)) {
+        return FAILURE;
+    }
+
+    MQTTTraceRecord(c->publishTraceId, TRACE_PUBLISH_WRITE_START, 0);
     while(sent < length && !expired(timer)) {
-        sentLen = c->networkStack.mqttwrite(&(c->networkStack), &c->buf[sent], (int)length, left_ms(timer));
+        sentLen = c->networkStack.mqttwrite(&(c->networkStack), &c->buf[sent], (int)(length - sent), left_ms(timer));
         if(sentLen < 0) {
             /* there was an error writing the data */
             break;
@@ -51,6 +386,7 @@ MQTTReturnCode sendPacket(Client *c, uint32_t length, Timer *timer) {
     }
 
     if(sent == length) {
+        MQTTTraceRecord(c->publishTraceId, TRACE_PUBLISH_WRITE_DONE, 0);
         /* record the fact that we have successfully sent the packet */
         //countdown(&c->pingTimer, c->keepAliveInterval);
         return SUCCESS;
@@ -105,9 +441,33 @@ MQTTReturnCode MQTTClient(Client *c, uint32_t commandTimeoutMs,
     c->isPingOutstanding = 0;
     c->wasManuallyDisconnected = 0;
     c->counterNetworkDisconnected = 0;
+    c->inflightPublishCount = 0;
+    c->timedOutPublishCount = 0;
+    c->sendQueue.head = NULL;
+    c->sendQueue.tail = NULL;
+    c->sendQueue.freeBlocks = NULL;
+    c->sendQueue.freeBlockCount = 0;
+    c->sendQueue.queuedBytes = 0;
+    c->sendQueue.highWaterMark = 0;
+    c->sendQueue.isEnabled = 0;
+    c->sendQueue.corkLatencyBudgetUs = AUTO_CORK_LATENCY_BUDGET_MS * 1000;
+    c->sendQueue.corkFlushBytes = AUTO_CORK_FLUSH_BYTES;
+    c->sendQueue.corkStartUs = 0;
+    c->sendQueue.enqueuedTotal = 0;
+    c->sendQueue.writtenTotal = 0;
+    c->sendQueue.traceId = 0;
+    MQTTResetAutoCorkStats(c);
+    MQTTRateControlInit(&(c->rateControl), RATE_CONTROL_MIN_RATE, RATE_CONTROL_MAX_RATE);
+    c->lastPublishUs = 0;
+    c->publishTraceId = 0;
+    c->receiveTraceId = 0;
+    c->readStartUs = 0;
     c->isAutoReconnectEnabled = enableAutoReconnect;
     c->defaultMessageHandler = NULL;
     c->disconnectHandler = NULL;
+    MQTTResetCallbackStats(c);
+    c->callbackStats.messageHandlers.budgetMs = MESSAGE_HANDLER_BUDGET_MS;
+    c->callbackStats.disconnectHandler.budgetMs = DISCONNECT_HANDLER_BUDGET_MS;
     copyMQTTConnectData(&(c->options), &default_options);
 
     c->networkInitHandler = networkInitHandler;
@@ -118,6 +478,7 @@ MQTTReturnCode MQTTClient(Client *c, uint32_t commandTimeoutMs,
     c->tlsConnectParams.pRootCALocation = tlsConnectParams->pRootCALocation;
     c->tlsConnectParams.timeout_ms = tlsConnectParams->timeout_ms;
     c->tlsConnectParams.ServerVerificationFlag = tlsConnectParams->ServerVerificationFlag;
+    c->tlsConnectParams.pSessionCacheLocation = tlsConnectParams->pSessionCacheLocation;
 
     InitTimer(&(c->pingTimer));
     InitTimer(&(c->reconnectDelayTimer));
@@ -158,7 +519,9 @@ MQTTReturnCode decodePacket(Client *c, uint32_t *value, uint32_t timeout) {
     return SUCCESS;
 }
 
-MQTTReturnCode readPacket(Client *c, Timer *timer, uint8_t *packet_type) {
+/* Read one packet, waiting at most headerWaitMs for it to start. *packetLen receives its size on the wire */
+static MQTTReturnCode readPacketWithin(Client *c, Timer *timer, int headerWaitMs, uint8_t *packet_type,
+                                       uint32_t *packetLen) {
     MQTTHeader header = {0};
     uint32_t len = 0;
     uint32_t rem_len = 0;
@@ -171,14 +534,20 @@ MQTTReturnCode readPacket(Client *c, Timer *timer, uint8_t *packet_type) {
         return MQTT_NULL_VALUE_ERROR;
     }
 
+    /* Held packets must not wait for the next packet to arrive longer than their latency budget */
+    if(0 != c->sendQueue.corkStartUs && corkLeftMs(&(c->sendQueue)) < (uint32_t)headerWaitMs) {
+        headerWaitMs = (int)corkLeftMs(&(c->sendQueue));
+    }
+
     /* 1. read the header byte.  This has the packet type in it */
-    if(1 != c->networkStack.mqttread(&(c->networkStack), c->readbuf, 1, left_ms(timer))) {
+    if(1 != c->networkStack.mqttread(&(c->networkStack), c->readbuf, 1, headerWaitMs)) {
         /* If a network disconnect has occurred it would have been caught by keepalive already.
          * If nothing is found at this point means there was nothing to read. Not 100% correct,
          * but the only way to be sure is to pass proper error codes from the network stack
          * which the mbedtls/openssl implementations do not return */
         return MQTT_NOTHING_TO_READ;
     }
+    c->readStartUs = timestamp_us();
 
     len = 1;
     /* 2. read the remaining length.  This is variable in itself */
@@ -189,6 +558,7 @@ MQTTReturnCode readPacket(Client *c, Timer *timer, uint8_t *packet_type) {
 
     /* if the buffer is too short then the message will be dropped silently */
 	if (rem_len >= c->readBufSize) {
+		*packetLen = 1 + rem_len;
 		bytes_to_be_read = c->readBufSize;
 		do {
 			ret_val = c->networkStack.mqttread(&(c->networkStack), c->readbuf, bytes_to_be_read, left_ms(timer));
@@ -207,6 +577,7 @@ MQTTReturnCode readPacket(Client *c, Timer *timer, uint8_t *packet_type) {
 
     /* put the original remaining length back into the buffer */
     len += MQTTPacket_encode(c->readbuf + 1, rem_len);
+    *packetLen = len + rem_len;
 
     /* 3. read the rest of the buffer using a callback to supply the rest of the data */
     if(rem_len > 0 && (c->networkStack.mqttread(&(c->networkStack), c->readbuf + len, (int)rem_len, left_ms(timer)) != (int)rem_len)) {
@@ -219,6 +590,16 @@ MQTTReturnCode readPacket(Client *c, Timer *timer, uint8_t *packet_type) {
     return SUCCESS;
 }
 
+MQTTReturnCode readPacket(Client *c, Timer *timer, uint8_t *packet_type) {
+    uint32_t packetLen;
+
+    if(NULL == timer) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    return readPacketWithin(c, timer, left_ms(timer), packet_type, &packetLen);
+}
+
 // assume topic filter and name is in correct format
 // # can only be at end
 // + and # can only be next to separator
@@ -261,6 +642,8 @@ char isTopicMatched(char *topicFilter, MQTTString *topicName) {
 
 MQTTReturnCode deliverMessage(Client *c, MQTTString *topicName, MQTTMessage *message) {
     uint32_t i;
+    uint32_t durationMs;
+    uint64_t startUs;
     MessageData md;
 
     if(NULL == c || NULL == topicName || NULL == message) {
@@ -273,16 +656,38 @@ MQTTReturnCode deliverMessage(Client *c, MQTTString *topicName, MQTTMessage *mes
            && (MQTTPacket_equals(topicName, (char*)c->messageHandlers[i].topicFilter) ||
                 isTopicMatched((char*)c->messageHandlers[i].topicFilter, topicName))) {
             if(c->messageHandlers[i].fp != NULL) {
-                NewMessageData(&md, topicName, message, c->messageHandlers[i].applicationHandler);
+                if(!MQTTFilterMatch(&(c->messageHandlers[i].filter), message->payload, message->payloadlen)) {
+                    /* Filtered out, the caller still acknowledges it */
+                    return SUCCESS;
+                }
+                NewMessageData(&md, topicName, c->messageHandlers[i].topicFilter, message,
+                               c->messageHandlers[i].applicationHandler);
+                MQTTTraceRecord(c->receiveTraceId, TRACE_RECEIVE_DISPATCH, message->id);
+                startUs = timestamp_us();
                 c->messageHandlers[i].fp(&md);
+                MQTTTraceRecord(c->receiveTraceId, TRACE_RECEIVE_HANDLER_END, message->id);
+                durationMs = recordCallbackDuration(&(c->callbackStats.messageHandlers), startUs);
+                if(durationMs > c->callbackStats.messageHandlers.budgetMs) {
+                    WARN("Message handler for subscription %s took %u ms on topic %.*s, budget is %u ms",
+                         c->messageHandlers[i].topicFilter, durationMs, (int)topicName->lenstring.len,
+                         topicName->lenstring.data, c->callbackStats.messageHandlers.budgetMs);
+                }
                 return SUCCESS;
             }
         }
     }
 
     if(NULL != c->defaultMessageHandler) {
-        NewMessageData(&md, topicName, message, NULL);
+        NewMessageData(&md, topicName, NULL, message, NULL);
+        MQTTTraceRecord(c->receiveTraceId, TRACE_RECEIVE_DISPATCH, message->id);
+        startUs = timestamp_us();
         c->defaultMessageHandler(&md);
+        MQTTTraceRecord(c->receiveTraceId, TRACE_RECEIVE_HANDLER_END, message->id);
+        durationMs = recordCallbackDuration(&(c->callbackStats.messageHandlers), startUs);
+        if(durationMs > c->callbackStats.messageHandlers.budgetMs) {
+            WARN("Default message handler took %u ms on topic %.*s, budget is %u ms", durationMs,
+                 (int)topicName->lenstring.len, topicName->lenstring.data, c->callbackStats.messageHandlers.budgetMs);
+        }
         return SUCCESS;
     }
 
@@ -292,6 +697,8 @@ MQTTReturnCode deliverMessage(Client *c, MQTTString *topicName, MQTTMessage *mes
 
 MQTTReturnCode handleDisconnect(Client *c) {
     MQTTReturnCode rc;
+    uint32_t durationMs;
+    uint64_t startUs;
 
     if(NULL == c) {
         return MQTT_NULL_VALUE_ERROR;
@@ -303,8 +710,19 @@ MQTTReturnCode handleDisconnect(Client *c) {
     	MQTTForceDisconnect(c);
     }
 
+    /* Brokers throttle clients by closing the connection, one dropped while publishing is taken as that */
+    if(0 != c->lastPublishUs && timestamp_us() - c->lastPublishUs <= RATE_CONTROL_DISCONNECT_WINDOW_MS * 1000ull) {
+        MQTTRateControlOnCongestion(&(c->rateControl), RATE_CONTROL_DISCONNECT, timestamp_us());
+    }
+
     if(NULL != c->disconnectHandler) {
+        startUs = timestamp_us();
         c->disconnectHandler();
+        durationMs = recordCallbackDuration(&(c->callbackStats.disconnectHandler), startUs);
+        if(durationMs > c->callbackStats.disconnectHandler.budgetMs) {
+            WARN("Disconnect handler took %u ms, budget is %u ms", durationMs,
+                 c->callbackStats.disconnectHandler.budgetMs);
+        }
     }
 
     /* Reset to 0 since this was not a manual disconnect */
@@ -369,11 +787,13 @@ MQTTReturnCode handleReconnect(Client *c) {
     if(MAX_RECONNECT_WAIT_INTERVAL < c->currentReconnectWaitInterval) {
         return MQTT_RECONNECT_TIMED_OUT;
     }
-    countdown_ms(&(c->reconnectDelayTimer), c->currentReconnectWaitInterval);
+    startReconnectDelayTimer(c);
     return rc;
 }
 
-MQTTReturnCode keepalive(Client *c) {
+/* Send a keepalive ping once the timer expired, or aheadMs before that to share a wakeup with the
+ * pings of other connections */
+static MQTTReturnCode keepaliveAhead(Client *c, uint32_t aheadMs) {
     MQTTReturnCode rc = SUCCESS;
     Timer timer;
     uint32_t serialized_len = 0;
@@ -386,7 +806,8 @@ MQTTReturnCode keepalive(Client *c) {
 		return SUCCESS;
 	}
 
-	if(!expired(&c->pingTimer)) {
+	if(!expired(&c->pingTimer)
+	   && (c->isPingOutstanding || 0 == aheadMs || (uint32_t)left_ms(&c->pingTimer) > aheadMs)) {
         return SUCCESS;
     }
 
@@ -411,17 +832,26 @@ MQTTReturnCode keepalive(Client *c) {
 
     c->isPingOutstanding = 1;
     /* start a timer to wait for PINGRESP from server */
-    countdown(&c->pingTimer, c->keepAliveInterval / 2);
+    startPingTimer(c, c->keepAliveInterval * 500);
 
     return SUCCESS;
 }
 
+MQTTReturnCode keepalive(Client *c) {
+    return keepaliveAhead(c, 0);
+}
+
 MQTTReturnCode handlePublish(Client *c, Timer *timer) {
     MQTTString topicName;
     MQTTMessage msg;
     MQTTReturnCode rc;
     uint32_t len = 0;
+    uint32_t traceId;
+
+    traceId = MQTTTraceSample();
+    MQTTTraceRecordAt(traceId, TRACE_RECEIVE_READ, 0, c->readStartUs);
 
+    msg.id = 0;
     rc = MQTTDeserialize_publish((unsigned char *) &msg.dup, (QoS *) &msg.qos, (unsigned char *) &msg.retained,
                                  (uint16_t *)&msg.id, &topicName,
                                  (unsigned char **) &msg.payload, (uint32_t *) &msg.payloadlen, c->readbuf,
@@ -429,8 +859,11 @@ MQTTReturnCode handlePublish(Client *c, Timer *timer) {
     if(SUCCESS != rc) {
         return rc;
     }
+    MQTTTraceRecord(traceId, TRACE_RECEIVE_PARSED, msg.id);
 
+    c->receiveTraceId = traceId;
     rc = deliverMessage(c, &topicName, &msg);
+    c->receiveTraceId = 0;
     if(SUCCESS != rc) {
         return rc;
     }
@@ -458,6 +891,45 @@ MQTTReturnCode handlePublish(Client *c, Timer *timer) {
     return SUCCESS;
 }
 
+/* Forget in-flight slot i, the last slot takes its place */
+static void removeInflightPublish(Client *c, uint32_t i) {
+    if(0 == c->inflightPublishSentUs[i]) {
+        c->timedOutPublishCount--;
+    }
+    c->inflightPublishCount--;
+    c->inflightPublishIds[i] = c->inflightPublishIds[c->inflightPublishCount];
+    c->inflightPublishSentUs[i] = c->inflightPublishSentUs[c->inflightPublishCount];
+    c->inflightPublishTraceIds[i] = c->inflightPublishTraceIds[c->inflightPublishCount];
+}
+
+MQTTReturnCode handlePuback(Client *c) {
+    uint16_t packet_id;
+    unsigned char dup, type;
+    MQTTReturnCode rc;
+    uint32_t i;
+    uint64_t nowUs;
+
+    rc = MQTTDeserialize_ack(&type, &dup, &packet_id, c->readbuf, c->readBufSize);
+    if(SUCCESS != rc) {
+        return rc;
+    }
+
+    /* Release the in-flight slot if this acknowledges an asynchronous publish */
+    for(i = 0; i < c->inflightPublishCount; ++i) {
+        if(c->inflightPublishIds[i] == packet_id) {
+            nowUs = timestamp_us();
+            if(0 != c->inflightPublishSentUs[i]) {
+                MQTTRateControlOnAck(&(c->rateControl), (uint32_t)(nowUs - c->inflightPublishSentUs[i]), nowUs);
+            }
+            MQTTTraceRecordAt(c->inflightPublishTraceIds[i], TRACE_PUBLISH_ACKED, packet_id, nowUs);
+            removeInflightPublish(c, i);
+            break;
+        }
+    }
+
+    return SUCCESS;
+}
+
 MQTTReturnCode handlePubrec(Client *c, Timer *timer) {
     uint16_t packet_id;
     unsigned char dup, type;
@@ -484,25 +956,26 @@ MQTTReturnCode handlePubrec(Client *c, Timer *timer) {
     return SUCCESS;
 }
 
-MQTTReturnCode cycle(Client *c, Timer *timer, uint8_t *packet_type) {
+/* Read and handle one packet. Returns MQTT_NOTHING_TO_READ if none started within headerWaitMs */
+static MQTTReturnCode cycleWithin(Client *c, Timer *timer, int headerWaitMs, uint8_t *packet_type,
+                                  uint32_t *packetLen) {
     MQTTReturnCode rc;
     if(NULL == c || NULL == timer) {
         return MQTT_NULL_VALUE_ERROR;
     }
 
     /* read the socket, see what work is due */
-    rc = readPacket(c, timer, packet_type);
-    if(MQTT_NOTHING_TO_READ == rc) {
-        /* Nothing to read, not a cycle failure */
-        return SUCCESS;
-    }
+    rc = readPacketWithin(c, timer, headerWaitMs, packet_type, packetLen);
     if(SUCCESS != rc) {
         return rc;
     }
 
     switch(*packet_type) {
+        case PUBACK: {
+            rc = handlePuback(c);
+            break;
+        }
         case CONNACK:
-        case PUBACK:
         case SUBACK:
         case UNSUBACK:
             break;
@@ -518,7 +991,7 @@ MQTTReturnCode cycle(Client *c, Timer *timer, uint8_t *packet_type) {
             break;
         case PINGRESP: {
             c->isPingOutstanding = 0;
-            countdown(&c->pingTimer, c->keepAliveInterval);
+            startPingTimer(c, c->keepAliveInterval * 1000);
             break;
         }
         default: {
@@ -532,10 +1005,58 @@ MQTTReturnCode cycle(Client *c, Timer *timer, uint8_t *packet_type) {
     return rc;
 }
 
+MQTTReturnCode cycle(Client *c, Timer *timer, uint8_t *packet_type) {
+    MQTTReturnCode rc;
+    uint32_t packetLen;
+
+    if(NULL == timer) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    rc = cycleWithin(c, timer, left_ms(timer), packet_type, &packetLen);
+    if(MQTT_NOTHING_TO_READ == rc) {
+        /* Nothing to read, not a cycle failure */
+        return SUCCESS;
+    }
+
+    return rc;
+}
+
+/* Start the auto-reconnect back-off after the connection dropped */
+static MQTTReturnCode startReconnect(Client *c) {
+    c->currentReconnectWaitInterval = MIN_RECONNECT_WAIT_INTERVAL;
+    startReconnectDelayTimer(c);
+    c->counterNetworkDisconnected++;
+    return MQTT_ATTEMPTING_RECONNECT;
+}
+
+/* Write what the socket accepts of the send queue, held packets once their latency budget is used up */
+static MQTTReturnCode drainSendQueue(Client *c) {
+    MQTTReturnCode rc = SUCCESS;
+
+    if(isCorkDue(&(c->sendQueue))) {
+        uncork(c, AUTO_CORK_FLUSH_LATENCY);
+    }
+    if(0 == c->sendQueue.corkStartUs) {
+        rc = flushSendQueue(c, NULL);
+    }
+    if(MQTT_WOULD_BLOCK == rc) {
+        rc = SUCCESS;
+    } else if(SUCCESS != rc) {
+        rc = handleDisconnect(c);
+    }
+
+    return rc;
+}
+
 MQTTReturnCode MQTTYield(Client *c, uint32_t timeout_ms) {
     MQTTReturnCode rc = SUCCESS;
     Timer timer;
     uint8_t packet_type;
+    uint32_t packetLen;
+    uint32_t waitMs;
+    uint32_t iterationMs;
+    uint32_t watchdogMarginMs;
 
     if(NULL == c) {
         return MQTT_NULL_VALUE_ERROR;
@@ -560,26 +1081,67 @@ MQTTReturnCode MQTTYield(Client *c, uint32_t timeout_ms) {
                 rc = MQTT_RECONNECT_TIMED_OUT;
                 break;
             }
+            /* Sleep through the back-off instead of polling the reconnect timer */
+            waitMs = MQTTGetNextTimerMs(c);
+            if(waitMs > (uint32_t)left_ms(&timer)) {
+                waitMs = (uint32_t)left_ms(&timer);
+            }
+            if(0 != waitMs) {
+                sleepMs(waitMs);
+                MQTTRecordWait(1);
+                continue;
+            }
             rc = handleReconnect(c);
             /* Network reconnect attempted, check if yield timer expired before
              * doing anything else */
             continue;
         }
 
-        rc = cycle(c, &timer, &packet_type);
+        /* Wait for input only until the next timer of the client, which then wakes the thread once */
+        waitMs = MQTTGetNextTimerMs(c);
+        if(waitMs > (uint32_t)left_ms(&timer)) {
+            waitMs = (uint32_t)left_ms(&timer);
+        }
+
+        c->readStartUs = 0;
+        rc = cycleWithin(c, &timer, (int)waitMs, &packet_type, &packetLen);
+        if(0 != waitMs) {
+            MQTTRecordWait(MQTT_NOTHING_TO_READ == rc);
+        }
+        if(MQTT_NOTHING_TO_READ == rc) {
+            rc = SUCCESS;
+        }
+
+        /* A long iteration delays reading the PINGRESP and is the usual cause of unexplained disconnects.
+         * Only the time from the first byte of a packet on counts, waiting for one to arrive is idle */
+        if(0 != c->readStartUs) {
+            iterationMs = (uint32_t)((timestamp_us() - c->readStartUs) / 1000);
+            watchdogMarginMs = c->keepAliveInterval * 10 * YIELD_WATCHDOG_MARGIN_PERCENT;
+            if(iterationMs > c->callbackStats.maxYieldIterationMs) {
+                c->callbackStats.maxYieldIterationMs = iterationMs;
+            }
+            if(0 != watchdogMarginMs && iterationMs > watchdogMarginMs) {
+                c->callbackStats.yieldWatchdogTriggers++;
+                WARN("Yield iteration took %u ms, more than %u%% of the %u s keepalive interval", iterationMs,
+                     YIELD_WATCHDOG_MARGIN_PERCENT, c->keepAliveInterval);
+            }
+        }
+
         if(SUCCESS != rc) {
             break;
         }
 
-        rc = keepalive(c);
+        /* Drain packets queued by MQTTPublishAsync as far as the socket accepts them */
+        rc = drainSendQueue(c);
+
+        if(SUCCESS == rc) {
+            rc = keepalive(c);
+        }
         if(MQTT_NETWORK_DISCONNECTED_ERROR == rc && 1 == c->isAutoReconnectEnabled) {
-            c->currentReconnectWaitInterval = MIN_RECONNECT_WAIT_INTERVAL;
-            countdown_ms(&(c->reconnectDelayTimer), c->currentReconnectWaitInterval);
-            c->counterNetworkDisconnected++;
             /* Depending on timer values, it is possible that yield timer has expired
              * Set to rc to attempting reconnect to inform client that autoreconnect
              * attempt has started */
-            rc = MQTT_ATTEMPTING_RECONNECT;
+            rc = startReconnect(c);
         } else if(SUCCESS != rc) {
             break;
         }
@@ -588,6 +1150,122 @@ MQTTReturnCode MQTTYield(Client *c, uint32_t timeout_ms) {
     return rc;
 }
 
+MQTTReturnCode MQTTServiceTimers(Client *c) {
+    return MQTTServiceTimersAhead(c, 0);
+}
+
+MQTTReturnCode MQTTServiceTimersAhead(Client *c, uint32_t aheadMs) {
+    MQTTReturnCode rc;
+
+    if(NULL == c) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    if(0 == c->isConnected) {
+        if(1 == c->wasManuallyDisconnected) {
+            return MQTT_NETWORK_MANUALLY_DISCONNECTED;
+        }
+        if(0 == c->isAutoReconnectEnabled) {
+            return MQTT_NETWORK_DISCONNECTED_ERROR;
+        }
+        if(MAX_RECONNECT_WAIT_INTERVAL < c->currentReconnectWaitInterval) {
+            return MQTT_RECONNECT_TIMED_OUT;
+        }
+        return handleReconnect(c);
+    }
+
+    /* A due keepalive ping takes held packets along */
+    if(isCorkDue(&(c->sendQueue))) {
+        uncork(c, AUTO_CORK_FLUSH_LATENCY);
+    }
+    rc = keepaliveAhead(c, aheadMs);
+    if(MQTT_NETWORK_DISCONNECTED_ERROR == rc && 1 == c->isAutoReconnectEnabled) {
+        rc = startReconnect(c);
+    }
+
+    return rc;
+}
+
+uint32_t MQTTGetNextTimerMs(Client *c) {
+    uint32_t nextMs = MQTT_NO_TIMER;
+
+    if(NULL == c) {
+        return MQTT_NO_TIMER;
+    }
+
+    if(0 == c->isConnected) {
+        if(1 == c->wasManuallyDisconnected || 0 == c->isAutoReconnectEnabled
+           || MAX_RECONNECT_WAIT_INTERVAL < c->currentReconnectWaitInterval) {
+            return MQTT_NO_TIMER;
+        }
+        return (uint32_t)left_ms(&(c->reconnectDelayTimer));
+    }
+
+    if(0 != c->keepAliveInterval) {
+        nextMs = (uint32_t)left_ms(&(c->pingTimer));
+    }
+    if(0 != c->sendQueue.corkStartUs && corkLeftMs(&(c->sendQueue)) < nextMs) {
+        nextMs = corkLeftMs(&(c->sendQueue));
+    }
+
+    return nextMs;
+}
+
+uint8_t MQTTIsKeepaliveDue(Client *c) {
+    if(NULL == c || 0 == c->isConnected || 0 == c->keepAliveInterval || c->isPingOutstanding) {
+        return 0;
+    }
+    return expired(&(c->pingTimer)) ? 1 : 0;
+}
+
+MQTTReturnCode MQTTPoll(Client *c, uint32_t maxPackets, size_t maxBytes, MQTTPollResult *result) {
+    MQTTReturnCode rc = SUCCESS;
+    Timer timer;
+    uint8_t packetType;
+    uint32_t packetLen;
+
+    if(NULL == c || NULL == result) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    result->packets = 0;
+    result->bytes = 0;
+    result->isBudgetExhausted = 0;
+
+    if(0 == c->isConnected) {
+        return MQTT_NETWORK_DISCONNECTED_ERROR;
+    }
+
+    /* Only packets already readable are handled, the header wait is 0 */
+    while(result->packets < maxPackets && result->bytes < maxBytes) {
+        InitTimer(&timer);
+        countdown_ms(&timer, c->commandTimeoutMs);
+        packetLen = 0;
+        rc = cycleWithin(c, &timer, 0, &packetType, &packetLen);
+        result->bytes += packetLen;
+        if(MQTT_NOTHING_TO_READ == rc) {
+            rc = SUCCESS;
+            break;
+        }
+        result->packets++;
+        if(SUCCESS != rc) {
+            break;
+        }
+    }
+    if(SUCCESS == rc && (result->packets >= maxPackets || result->bytes >= maxBytes)) {
+        result->isBudgetExhausted = 1;
+    }
+
+    if(SUCCESS == rc && 1 == c->isConnected) {
+        rc = drainSendQueue(c);
+    }
+    if(MQTT_NETWORK_DISCONNECTED_ERROR == rc && 1 == c->isAutoReconnectEnabled) {
+        rc = startReconnect(c);
+    }
+
+    return rc;
+}
+
 /* only used in single-threaded mode where one command at a time is in process */
 MQTTReturnCode waitfor(Client *c, uint8_t packet_type, Timer *timer) {
     MQTTReturnCode rc = FAILURE;
@@ -636,6 +1314,9 @@ MQTTReturnCode MQTTConnect(Client *c, MQTTPacket_connectData *options) {
         copyMQTTConnectData(&(c->options), options);
     }
 
+    /* Bytes a dropped connection left queued, possibly the tail of a packet, must not precede CONNECT */
+    resetSendQueue(&(c->sendQueue));
+
     c->networkInitHandler(&(c->networkStack));
     rc = c->networkStack.connect(&(c->networkStack), c->tlsConnectParams);
     if(0 != rc) {
@@ -674,7 +1355,10 @@ MQTTReturnCode MQTTConnect(Client *c, MQTTPacket_connectData *options) {
     c->isConnected = 1;
     c->wasManuallyDisconnected = 0;
     c->isPingOutstanding = 0;
-    countdown(&c->pingTimer, c->keepAliveInterval);
+    /* Publishes left unacknowledged by a previous connection are not retransmitted */
+    c->inflightPublishCount = 0;
+    c->timedOutPublishCount = 0;
+    startPingTimer(c, c->keepAliveInterval * 1000);
 
     return SUCCESS;
 }
@@ -693,6 +1377,11 @@ uint32_t GetFreeMessageHandlerIndex(Client *c) {
 
 MQTTReturnCode MQTTSubscribe(Client *c, const char *topicFilter, QoS qos,
                   messageHandler messageHandler, pApplicationHandler_t applicationHandler) {
+    return MQTTSubscribeWithFilter(c, topicFilter, qos, messageHandler, applicationHandler, NULL);
+}
+
+MQTTReturnCode MQTTSubscribeWithFilter(Client *c, const char *topicFilter, QoS qos, messageHandler messageHandler,
+                                       pApplicationHandler_t applicationHandler, const char *filterExpression) {
     MQTTReturnCode rc = FAILURE;
     Timer timer;
     uint32_t len = 0;
@@ -726,6 +1415,12 @@ MQTTReturnCode MQTTSubscribe(Client *c, const char *topicFilter, QoS qos,
         return MQTT_MAX_SUBSCRIPTIONS_REACHED_ERROR;
     }
 
+    /* The slot is unused until the handler is set below, compile straight into it */
+    rc = MQTTFilterCompile(&(c->messageHandlers[indexOfFreeMessageHandler].filter), filterExpression);
+    if(SUCCESS != rc) {
+        return rc;
+    }
+
     /* send the subscribe packet */
     rc = sendPacket(c, len, &timer);
     if(SUCCESS != rc) {
@@ -754,6 +1449,23 @@ MQTTReturnCode MQTTSubscribe(Client *c, const char *topicFilter, QoS qos,
     return SUCCESS;
 }
 
+MQTTReturnCode MQTTGetFilterStats(Client *c, const char *topicFilter, MQTTFilterStats *stats) {
+    uint32_t i;
+
+    if(NULL == c || NULL == topicFilter || NULL == stats) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    for(i = 0; i < MAX_MESSAGE_HANDLERS; ++i) {
+        if(NULL != c->messageHandlers[i].topicFilter && 0 == strcmp(c->messageHandlers[i].topicFilter, topicFilter)) {
+            *stats = c->messageHandlers[i].filter.stats;
+            return SUCCESS;
+        }
+    }
+
+    return FAILURE;
+}
+
 MQTTReturnCode MQTTResubscribe(Client *c) {
     MQTTReturnCode rc = FAILURE;
     Timer timer;
@@ -864,6 +1576,24 @@ MQTTReturnCode MQTTUnsubscribe(Client *c, const char *topicFilter) {
     return SUCCESS;
 }
 
+/* A PUBACK overdue for an asynchronous publish slows the rate down once. The slot is kept so a late
+ * PUBACK still matches, but no longer counts against the window */
+static void checkPublishAckTimeouts(Client *c, uint64_t nowUs) {
+    uint32_t i;
+
+    if(!MQTTRateControlIsEnabled(&(c->rateControl))) {
+        return;
+    }
+    for(i = 0; i < c->inflightPublishCount; ++i) {
+        if(0 != c->inflightPublishSentUs[i]
+           && nowUs - c->inflightPublishSentUs[i] >= RATE_CONTROL_ACK_TIMEOUT_MS * 1000ull) {
+            c->inflightPublishSentUs[i] = 0;
+            c->timedOutPublishCount++;
+            MQTTRateControlOnCongestion(&(c->rateControl), RATE_CONTROL_TIMEOUT, nowUs);
+        }
+    }
+}
+
 MQTTReturnCode MQTTPublish(Client *c, const char *topicName, MQTTMessage *message) {
     Timer timer;
     MQTTString topic = MQTTString_initializer;
@@ -872,6 +1602,8 @@ MQTTReturnCode MQTTPublish(Client *c, const char *topicName, MQTTMessage *messag
     uint8_t packetType = PUBACK;
     uint16_t packet_id;
     unsigned char dup, type;
+    uint64_t delayUs, sentUs;
+    uint32_t traceId;
     MQTTReturnCode rc = FAILURE;
 
     if(NULL == c || NULL == topicName || NULL == message) {
@@ -887,6 +1619,19 @@ MQTTReturnCode MQTTPublish(Client *c, const char *topicName, MQTTMessage *messag
     InitTimer(&timer);
     countdown_ms(&timer, c->commandTimeoutMs);
 
+    /* A blocking publish waits for the rate rather than fail, as long as the command timeout allows */
+    delayUs = MQTTRateControlDelayUs(&(c->rateControl), timestamp_us());
+    if(0 != delayUs) {
+        c->rateControl.stats.limitedPublishes++;
+        if((int64_t)(delayUs / 1000) >= left_ms(&timer)) {
+            return MQTT_RATE_LIMITED;
+        }
+        sleepMs((uint32_t)((delayUs + 999) / 1000));
+    }
+
+    traceId = MQTTTraceSample();
+    MQTTTraceRecord(traceId, TRACE_PUBLISH_START, 0);
+
     if(QOS1 == message->qos || QOS2 == message->qos) {
         message->id = getNextPacketId(c);
         waitForAck = 1;
@@ -900,19 +1645,38 @@ MQTTReturnCode MQTTPublish(Client *c, const char *topicName, MQTTMessage *messag
     if(SUCCESS != rc) {
         return rc;
     }
+    MQTTTraceRecord(traceId, TRACE_PUBLISH_SERIALIZED, (QOS0 == message->qos) ? 0 : message->id);
+    c->publishTraceId = traceId;
+
+    /* Nothing waits on a QoS0 publish, with auto-cork it may share a TLS record with later packets */
+    rc = MQTT_WOULD_BLOCK;
+    if(QOS0 == message->qos && c->sendQueue.isEnabled && 0 != c->sendQueue.corkLatencyBudgetUs) {
+        rc = queuePublish(c, len, message->qos);
+    }
 
     /* send the publish packet */
-    rc = sendPacket(c, len, &timer);
+    if(MQTT_WOULD_BLOCK == rc) {
+        rc = sendPacket(c, len, &timer);
+    }
+    c->publishTraceId = 0;
     if(SUCCESS != rc) {
         return rc;
     }
+    sentUs = timestamp_us();
+    c->lastPublishUs = sentUs;
+    MQTTRateControlOnPublish(&(c->rateControl), sentUs);
 
     /* Wait for ack if QoS1 or QoS2 */
     if(1 == waitForAck) {
         rc = waitfor(c, packetType, &timer);
         if(SUCCESS != rc) {
+            MQTTRateControlOnCongestion(&(c->rateControl), RATE_CONTROL_TIMEOUT, timestamp_us());
             return rc;
         }
+        MQTTTraceRecord(traceId, TRACE_PUBLISH_ACKED, message->id);
+        if(QOS1 == message->qos) {
+            MQTTRateControlOnAck(&(c->rateControl), (uint32_t)(timestamp_us() - sentUs), timestamp_us());
+        }
 
         rc = MQTTDeserialize_ack(&type, &dup, &packet_id, c->readbuf, c->readBufSize);
         if(SUCCESS != rc) {
@@ -922,6 +1686,97 @@ MQTTReturnCode MQTTPublish(Client *c, const char *topicName, MQTTMessage *messag
 
     return SUCCESS;
 }
+
+MQTTReturnCode MQTTPublishAsync(Client *c, const char *topicName, MQTTMessage *message) {
+    Timer timer;
+    MQTTString topic = MQTTString_initializer;
+    uint32_t len = 0;
+    uint64_t nowUs;
+    uint32_t traceId;
+    uint32_t i;
+    MQTTReturnCode rc = FAILURE;
+
+    if(NULL == c || NULL == topicName || NULL == message) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    /* Only QoS1 is tracked, there is no PUBREC/PUBREL/PUBCOMP state for QoS2 */
+    if(QOS2 == message->qos) {
+        return FAILURE;
+    }
+
+    topic.cstring = (char *)topicName;
+
+    if(!c->isConnected) {
+        return MQTT_NETWORK_DISCONNECTED_ERROR;
+    }
+
+    nowUs = timestamp_us();
+    checkPublishAckTimeouts(c, nowUs);
+
+    if(QOS1 == message->qos) {
+        if(MAX_INFLIGHT_PUBLISH <= c->inflightPublishCount) {
+            if(0 == c->timedOutPublishCount) {
+                return MQTT_INFLIGHT_WINDOW_FULL;
+            }
+            /* Make room by giving up on a publish whose PUBACK timed out, a late PUBACK for it is ignored */
+            i = 0;
+            while(0 != c->inflightPublishSentUs[i]) {
+                ++i;
+            }
+            removeInflightPublish(c, i);
+        }
+        if(c->rateControl.window <= c->inflightPublishCount - c->timedOutPublishCount) {
+            c->rateControl.stats.limitedPublishes++;
+            return MQTT_INFLIGHT_WINDOW_FULL;
+        }
+    }
+    if(0 != MQTTRateControlDelayUs(&(c->rateControl), nowUs)) {
+        c->rateControl.stats.limitedPublishes++;
+        return MQTT_RATE_LIMITED;
+    }
+    traceId = MQTTTraceSample();
+    MQTTTraceRecordAt(traceId, TRACE_PUBLISH_START, 0, nowUs);
+
+    if(QOS1 == message->qos) {
+        message->id = getNextPacketId(c);
+    }
+
+    InitTimer(&timer);
+    countdown_ms(&timer, c->commandTimeoutMs);
+
+    rc = MQTTSerialize_publish(c->buf, c->bufSize, 0, message->qos, message->retained, message->id,
+              topic, (unsigned char*)message->payload, message->payloadlen, &len);
+    if(SUCCESS != rc) {
+        return rc;
+    }
+    MQTTTraceRecord(traceId, TRACE_PUBLISH_SERIALIZED, (QOS1 == message->qos) ? message->id : 0);
+
+    c->publishTraceId = traceId;
+    if(c->sendQueue.isEnabled) {
+        rc = queuePublish(c, len, message->qos);
+    } else {
+        /* send the publish packet */
+        rc = sendPacket(c, len, &timer);
+    }
+    c->publishTraceId = 0;
+    if(SUCCESS != rc) {
+        return rc;
+    }
+
+    c->lastPublishUs = nowUs;
+    MQTTRateControlOnPublish(&(c->rateControl), nowUs);
+
+    /* The PUBACK is consumed later by cycle(), from MQTTYield or any blocking call */
+    if(QOS1 == message->qos) {
+        c->inflightPublishSentUs[c->inflightPublishCount] = nowUs;
+        c->inflightPublishTraceIds[c->inflightPublishCount] = traceId;
+        c->inflightPublishIds[c->inflightPublishCount++] = message->id;
+    }
+
+    return SUCCESS;
+}
+
 /**
  * This is for the case when the sendPacket Fails.
  */
@@ -1018,3 +1873,158 @@ uint32_t MQTTGetNetworkDisconnectedCount(Client *c) {
 void MQTTResetNetworkDisconnectedCount(Client *c) {
     c->counterNetworkDisconnected = 0;
 }
+
+uint32_t MQTTGetInflightPublishCount(Client *c) {
+    return c->inflightPublishCount;
+}
+
+MQTTReturnCode MQTTSetSendQueue(Client *c, SendQueueBlock *blocks, size_t blockCount, size_t highWaterMark) {
+    size_t i;
+
+    if(NULL == c || (NULL == blocks && 0 != blockCount)) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    if(NULL != c->sendQueue.head) {
+        /* Storage can not be swapped while it holds unsent packets */
+        return FAILURE;
+    }
+
+    c->sendQueue.freeBlocks = NULL;
+    for(i = 0; i < blockCount; ++i) {
+        blocks[i].next = c->sendQueue.freeBlocks;
+        c->sendQueue.freeBlocks = &blocks[i];
+    }
+    c->sendQueue.freeBlockCount = blockCount;
+    c->sendQueue.highWaterMark = highWaterMark;
+    c->sendQueue.isEnabled = (0 != blockCount) ? 1 : 0;
+
+    return SUCCESS;
+}
+
+MQTTReturnCode MQTTFlushSendQueue(Client *c) {
+    if(NULL == c) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    if(!c->isConnected) {
+        return MQTT_NETWORK_DISCONNECTED_ERROR;
+    }
+
+    uncork(c, AUTO_CORK_FLUSH_SYNC);
+    return flushSendQueue(c, NULL);
+}
+
+size_t MQTTGetSendQueueLength(Client *c) {
+    return c->sendQueue.queuedBytes;
+}
+
+MQTTReturnCode MQTTSetAutoCork(Client *c, uint32_t latencyBudgetMs, size_t flushBytes) {
+    if(NULL == c) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    /* Packets held under the old settings go out with the next flush */
+    uncork(c, AUTO_CORK_FLUSH_SYNC);
+    c->sendQueue.corkLatencyBudgetUs = latencyBudgetMs * 1000;
+    c->sendQueue.corkFlushBytes = flushBytes;
+    return SUCCESS;
+}
+
+const MQTTAutoCorkStats *MQTTGetAutoCorkStats(Client *c) {
+    if(NULL == c) {
+        return NULL;
+    }
+
+    return &(c->sendQueue.corkStats);
+}
+
+void MQTTResetAutoCorkStats(Client *c) {
+    if(NULL == c) {
+        return;
+    }
+
+    memset(&(c->sendQueue.corkStats), 0, sizeof(MQTTAutoCorkStats));
+}
+
+MQTTReturnCode MQTTSetRateControl(Client *c, uint32_t minRate, uint32_t maxRate) {
+    MQTTRateControlStats stats;
+
+    if(NULL == c) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    /* Restart the controller from the new limits, the counters carry on */
+    stats = c->rateControl.stats;
+    MQTTRateControlInit(&(c->rateControl), minRate, maxRate);
+    c->rateControl.stats = stats;
+    return SUCCESS;
+}
+
+const MQTTRateControl *MQTTGetRateControl(Client *c) {
+    if(NULL == c) {
+        return NULL;
+    }
+    return &(c->rateControl);
+}
+
+void MQTTResetRateControlStats(Client *c) {
+    if(NULL == c) {
+        return;
+    }
+    memset(&(c->rateControl.stats), 0, sizeof(MQTTRateControlStats));
+}
+
+MQTTReturnCode MQTTSetCallbackBudgets(Client *c, uint32_t messageHandlerBudgetMs, uint32_t disconnectHandlerBudgetMs) {
+    if(NULL == c) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    c->callbackStats.messageHandlers.budgetMs = messageHandlerBudgetMs;
+    c->callbackStats.disconnectHandler.budgetMs = disconnectHandlerBudgetMs;
+    return SUCCESS;
+}
+
+const MQTTCallbackStats *MQTTGetCallbackStats(Client *c) {
+    if(NULL == c) {
+        return NULL;
+    }
+
+    return &(c->callbackStats);
+}
+
+void MQTTResetCallbackStats(Client *c) {
+    uint32_t messageHandlerBudgetMs;
+    uint32_t disconnectHandlerBudgetMs;
+
+    if(NULL == c) {
+        return;
+    }
+
+    /* Budgets are configuration, not statistics */
+    messageHandlerBudgetMs = c->callbackStats.messageHandlers.budgetMs;
+    disconnectHandlerBudgetMs = c->callbackStats.disconnectHandler.budgetMs;
+    memset(&(c->callbackStats), 0, sizeof(MQTTCallbackStats));
+    c->callbackStats.messageHandlers.budgetMs = messageHandlerBudgetMs;
+    c->callbackStats.disconnectHandler.budgetMs = disconnectHandlerBudgetMs;
+}
+
+void MQTTGetWakeupStats(MQTTWakeupStats *stats) {
+    uint64_t elapsedUs;
+
+    if(NULL == stats) {
+        return;
+    }
+
+    stats->waits = wakeupStats.waits;
+    stats->idleWakeups = wakeupStats.idleWakeups;
+    stats->sinceUs = wakeupStats.sinceUs;
+    elapsedUs = (0 != stats->sinceUs) ? timestamp_us() - stats->sinceUs : 0;
+    stats->idleWakeupsPerHour = (0 != elapsedUs) ? (uint32_t)((uint64_t)stats->idleWakeups * 3600000000ULL / elapsedUs) : 0;
+}
+
+void MQTTResetWakeupStats(void) {
+    wakeupStats.waits = 0;
+    wakeupStats.idleWakeups = 0;
+    wakeupStats.sinceUs = timestamp_us();
+}
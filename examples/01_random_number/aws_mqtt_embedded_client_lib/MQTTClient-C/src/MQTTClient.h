@@ -26,6 +26,9 @@
 #include "MQTTReturnCodes.h"
 #include "MQTTMessage.h"
 #include "MQTTPacket.h"
+#include "MQTTFilter.h"
+#include "MQTTRateControl.h"
+#include "MQTTTrace.h"
 
 /* AWS Specific header files */
 #include "aws_iot_config.h"
@@ -36,10 +39,33 @@
 
 #define MAX_PACKET_ID 65535
 #define MAX_MESSAGE_HANDLERS AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS
+#define MAX_INFLIGHT_PUBLISH AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH
+
+/* Send queue storage is handed out in blocks of this many bytes */
+#define SEND_QUEUE_BLOCK_SIZE 512
+
+#define MESSAGE_HANDLER_BUDGET_MS AWS_IOT_MQTT_MESSAGE_HANDLER_BUDGET_MS
+#define DISCONNECT_HANDLER_BUDGET_MS AWS_IOT_MQTT_DISCONNECT_HANDLER_BUDGET_MS
+#define YIELD_WATCHDOG_MARGIN_PERCENT AWS_IOT_MQTT_YIELD_WATCHDOG_MARGIN_PERCENT
+
+#define AUTO_CORK_LATENCY_BUDGET_MS AWS_IOT_MQTT_AUTO_CORK_LATENCY_BUDGET_MS
+#define AUTO_CORK_FLUSH_BYTES AWS_IOT_MQTT_AUTO_CORK_FLUSH_BYTES
+
+/* Queued blocks are gathered into writes of up to this many bytes, the flush threshold caps them further */
+#define SEND_QUEUE_GATHER_SIZE (AUTO_CORK_FLUSH_BYTES > SEND_QUEUE_BLOCK_SIZE ? AUTO_CORK_FLUSH_BYTES : SEND_QUEUE_BLOCK_SIZE)
+
+/* Bucket i counts durations below 2^i ms, the last bucket everything longer */
+#define CALLBACK_HISTOGRAM_BUCKETS 12
 
 #define MIN_RECONNECT_WAIT_INTERVAL AWS_IOT_MQTT_MIN_RECONNECT_WAIT_INTERVAL
 #define MAX_RECONNECT_WAIT_INTERVAL AWS_IOT_MQTT_MAX_RECONNECT_WAIT_INTERVAL
 
+#define KEEPALIVE_SLACK_MS AWS_IOT_MQTT_KEEPALIVE_SLACK_MS
+#define RECONNECT_SLACK_PERCENT AWS_IOT_MQTT_RECONNECT_SLACK_PERCENT
+
+/* Returned by MQTTGetNextTimerMs when no timer of the client is running */
+#define MQTT_NO_TIMER 0xFFFFFFFFu
+
 void NewTimer(Timer *);
 
 typedef struct Client Client;
@@ -51,22 +77,119 @@ typedef void (*pApplicationHandler_t)(void);
 typedef void (*disconnectHandler_t)(void);
 typedef int (*networkInitHandler_t)(Network *);
 
+typedef struct {
+    uint32_t histogram[CALLBACK_HISTOGRAM_BUCKETS];
+    uint32_t budgetMs;
+    uint32_t overruns;
+    uint32_t maxDurationMs;
+} CallbackTimingStats;
+
+typedef struct {
+    CallbackTimingStats messageHandlers;
+    CallbackTimingStats disconnectHandler;
+    uint32_t yieldWatchdogTriggers;    /* Yield iterations longer than the keepalive margin */
+    uint32_t maxYieldIterationMs;
+} MQTTCallbackStats;
+
+/* Why auto-cork stopped holding packets back, indexes MQTTAutoCorkStats.flushes */
+typedef enum {
+    AUTO_CORK_FLUSH_SIZE = 0,    /* Held bytes reached the flush threshold or the queue high-water mark */
+    AUTO_CORK_FLUSH_LATENCY,     /* The oldest held packet used up the latency budget */
+    AUTO_CORK_FLUSH_WINDOW,      /* The QoS1 in-flight window filled up, PUBACKs must not wait on the cork */
+    AUTO_CORK_FLUSH_SYNC,        /* A blocking command, keepalive ping or explicit flush had to go out */
+    AUTO_CORK_FLUSH_REASONS
+} AutoCorkFlushReason;
+
+typedef struct {
+    uint32_t flushes[AUTO_CORK_FLUSH_REASONS];
+    uint32_t heldPackets;      /* Publishes that went through the cork */
+    uint32_t maxHoldUs;        /* Longest time from holding the first packet to the flush */
+    uint64_t totalHoldUs;
+} MQTTAutoCorkStats;
+
+typedef struct SendQueueBlock {
+    struct SendQueueBlock *next;
+    uint32_t start;    /* First byte not yet written to the network */
+    uint32_t end;      /* One past the last queued byte */
+    unsigned char data[SEND_QUEUE_BLOCK_SIZE];
+} SendQueueBlock;
+
+typedef struct {
+    SendQueueBlock *head;
+    SendQueueBlock *tail;
+    SendQueueBlock *freeBlocks;
+    size_t freeBlockCount;
+    size_t queuedBytes;
+    size_t highWaterMark;
+    uint8_t isEnabled;
+    uint32_t corkLatencyBudgetUs;    /* Auto-cork holds publishes at most this long, 0 turns it off */
+    size_t corkFlushBytes;           /* Auto-cork flushes as soon as this many bytes are held */
+    uint64_t corkStartUs;            /* When the oldest held packet was queued, 0 while nothing is held */
+    uint64_t enqueuedTotal;          /* Bytes ever queued, dropped ones included */
+    uint64_t writtenTotal;           /* Bytes ever written or dropped */
+    uint32_t traceId;                /* Sampled publish waiting in the queue, 0 if none, only one is followed */
+    uint64_t traceStart;             /* Its first and one past its last byte, counted like enqueuedTotal */
+    uint64_t traceEnd;
+    uint8_t isTraceWriteStarted;
+    MQTTAutoCorkStats corkStats;
+    unsigned char gather[SEND_QUEUE_GATHER_SIZE];    /* Bytes of several blocks copied together for one write */
+} MQTTSendQueue;
+
+/* Blocking waits for input or a timer, counted over all clients of the process */
+typedef struct {
+    uint32_t waits;                /* Waits of MQTTYield and the scheduler that blocked */
+    uint32_t idleWakeups;          /* Waits that ended on a timer or the end of the yield, without input */
+    uint32_t idleWakeupsPerHour;   /* idleWakeups scaled to the time since sinceUs */
+    uint64_t sinceUs;              /* timestamp_us() of the reset or of the first wait */
+} MQTTWakeupStats;
+
+typedef struct {
+    uint32_t packets;            /* Packets read and handled */
+    size_t bytes;                /* Their size on the wire */
+    uint8_t isBudgetExhausted;   /* Stopped on the budget, more input may be waiting */
+} MQTTPollResult;
+
 struct MessageData {
     MQTTMessage *message;
     MQTTString *topicName;
+    const char *topicFilter;    /* Subscription the message matched, NULL for the default handler */
     pApplicationHandler_t applicationHandler;
 };
 
 MQTTReturnCode MQTTConnect(Client *c, MQTTPacket_connectData *options);
 MQTTReturnCode MQTTPublish (Client *, const char *, MQTTMessage *);
+MQTTReturnCode MQTTPublishAsync(Client *c, const char *topicName, MQTTMessage *message);
 MQTTReturnCode MQTTSubscribe(Client *c, const char *topicFilter, QoS qos,
                              messageHandler messageHandler, pApplicationHandler_t applicationHandler);
+/* MQTTSubscribe delivering only messages whose payload matches filterExpression, see MQTTFilter.h.
+ * The expression is compiled before the subscribe is sent. MQTTGetFilterStats reads its counters */
+MQTTReturnCode MQTTSubscribeWithFilter(Client *c, const char *topicFilter, QoS qos, messageHandler messageHandler,
+                                       pApplicationHandler_t applicationHandler, const char *filterExpression);
+MQTTReturnCode MQTTGetFilterStats(Client *c, const char *topicFilter, MQTTFilterStats *stats);
 MQTTReturnCode MQTTResubscribe(Client *c);
 MQTTReturnCode MQTTUnsubscribe(Client *c, const char *topicFilter);
 MQTTReturnCode MQTTDisconnect (Client *);
 MQTTReturnCode MQTTYield (Client *, uint32_t);
 MQTTReturnCode MQTTAttemptReconnect(Client *c);
 
+/* The two halves of MQTTYield for callers multiplexing several clients. MQTTServiceTimers sends a due
+ * keepalive ping and paces auto-reconnect, MQTTPoll handles packets that are already readable until
+ * maxPackets or maxBytes are reached, then drains the send queue. Neither waits for input */
+MQTTReturnCode MQTTServiceTimers(Client *c);
+MQTTReturnCode MQTTPoll(Client *c, uint32_t maxPackets, size_t maxBytes, MQTTPollResult *result);
+
+/* MQTTServiceTimers that also sends a keepalive ping falling due within aheadMs, so the pings of several
+ * connections leave in one wakeup. MQTTIsKeepaliveDue tells whether a ping is due now, MQTTGetNextTimerMs
+ * how long a caller may wait for input before a keepalive, reconnect or auto-cork deadline needs it */
+MQTTReturnCode MQTTServiceTimersAhead(Client *c, uint32_t aheadMs);
+uint8_t MQTTIsKeepaliveDue(Client *c);
+uint32_t MQTTGetNextTimerMs(Client *c);
+
+/* Count a blocking wait, isIdle when it ended without input. MQTTYield and the scheduler call it */
+void MQTTRecordWait(uint8_t isIdle);
+void MQTTGetWakeupStats(MQTTWakeupStats *stats);
+void MQTTResetWakeupStats(void);
+
 uint8_t MQTTIsConnected(Client *);
 uint8_t MQTTIsAutoReconnectEnabled(Client *c);
 
@@ -79,6 +202,26 @@ MQTTReturnCode MQTTClient(Client *, uint32_t, unsigned char *, size_t, unsigned
 
 uint32_t MQTTGetNetworkDisconnectedCount(Client *c);
 void MQTTResetNetworkDisconnectedCount(Client *c);
+uint32_t MQTTGetInflightPublishCount(Client *c);
+
+MQTTReturnCode MQTTSetSendQueue(Client *c, SendQueueBlock *blocks, size_t blockCount, size_t highWaterMark);
+MQTTReturnCode MQTTFlushSendQueue(Client *c);
+size_t MQTTGetSendQueueLength(Client *c);
+
+MQTTReturnCode MQTTSetAutoCork(Client *c, uint32_t latencyBudgetMs, size_t flushBytes);
+const MQTTAutoCorkStats *MQTTGetAutoCorkStats(Client *c);
+void MQTTResetAutoCorkStats(Client *c);
+
+/* Adapt publish rate and QoS1 in-flight window to PUBACK latency, a maxRate of 0 turns it off.
+ * Publishes exceeding the rate fail with MQTT_RATE_LIMITED, MQTTPublish waits for the rate if it can
+ * within the command timeout */
+MQTTReturnCode MQTTSetRateControl(Client *c, uint32_t minRate, uint32_t maxRate);
+const MQTTRateControl *MQTTGetRateControl(Client *c);
+void MQTTResetRateControlStats(Client *c);
+
+MQTTReturnCode MQTTSetCallbackBudgets(Client *c, uint32_t messageHandlerBudgetMs, uint32_t disconnectHandlerBudgetMs);
+const MQTTCallbackStats *MQTTGetCallbackStats(Client *c);
+void MQTTResetCallbackStats(Client *c);
 
 struct Client {
     uint8_t isConnected;
@@ -92,6 +235,8 @@ struct Client {
     uint32_t keepAliveInterval;
     uint32_t currentReconnectWaitInterval;
     uint32_t counterNetworkDisconnected;
+    uint32_t inflightPublishCount;
+    uint32_t timedOutPublishCount;   /* In-flight publishes whose PUBACK timed out, not counted against the window */
 
     size_t bufSize;
     size_t readBufSize;
@@ -99,6 +244,14 @@ struct Client {
     unsigned char *buf;  
     unsigned char *readbuf;
 
+    uint16_t inflightPublishIds[MAX_INFLIGHT_PUBLISH];   /* QoS1 publishes sent by MQTTPublishAsync awaiting PUBACK */
+    uint64_t inflightPublishSentUs[MAX_INFLIGHT_PUBLISH];   /* When each was sent, 0 once its PUBACK timed out */
+    uint32_t inflightPublishTraceIds[MAX_INFLIGHT_PUBLISH];   /* Trace id of each, 0 if it is not sampled */
+    uint32_t publishTraceId;     /* Sampled publish being written by sendPacket or queued, 0 if none */
+    uint32_t receiveTraceId;     /* Sampled PUBLISH being delivered, 0 if none */
+    uint64_t readStartUs;        /* When the first byte of the packet being read arrived */
+    uint64_t lastPublishUs;
+
     TLSConnectParams tlsConnectParams;
     MQTTPacket_connectData options;
 
@@ -106,11 +259,18 @@ struct Client {
     Timer pingTimer;
     Timer reconnectDelayTimer;
 
+    MQTTCallbackStats callbackStats;
+
+    MQTTSendQueue sendQueue;   /* Packets from MQTTPublishAsync waiting for the socket to become writable */
+
+    MQTTRateControl rateControl;
+
     struct MessageHandlers {
         const char *topicFilter;
         void (*fp) (MessageData *);
         pApplicationHandler_t applicationHandler;
         QoS qos;
+        MQTTFilter filter;     /* Messages whose payload does not match are acknowledged but not delivered */
     } messageHandlers[MAX_MESSAGE_HANDLERS];      /* Message handlers are indexed by subscription topic */
     
     void (* defaultMessageHandler) (MessageData *);
@@ -0,0 +1,613 @@
+/*******************************************************************************
+ * Copyright (c) 2014 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Compiled payload filters evaluated before message handler dispatch
+ *******************************************************************************/
+
+#include "MQTTFilter.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+    FILTER_EQ = 0,
+    FILTER_NE,
+    FILTER_LT,
+    FILTER_LE,
+    FILTER_GT,
+    FILTER_GE
+} FilterComparison;
+
+typedef enum {
+    FILTER_VALUE_NUMBER = 0,
+    FILTER_VALUE_STRING,
+    FILTER_VALUE_TRUE,
+    FILTER_VALUE_FALSE,
+    FILTER_VALUE_NULL,
+    FILTER_VALUE_OTHER       /* Objects, arrays and malformed scalars, never equal to a literal */
+} FilterValueType;
+
+/* Longest number token converted with strtod, longer ones are not numbers */
+#define FILTER_MAX_NUMBER_LEN 32
+
+typedef struct {
+    MQTTFilter *filter;
+    const char *p;
+    uint8_t depth;           /* Nesting of ( and !, bounded like the program so parsing cannot recurse deeply */
+    uint8_t isError;
+} FilterParser;
+
+static void skipSpace(FilterParser *parser) {
+    while(' ' == *parser->p || '\t' == *parser->p || '\r' == *parser->p || '\n' == *parser->p) {
+        parser->p++;
+    }
+}
+
+static uint8_t isPathChar(char ch) {
+    return (('a' <= ch && 'z' >= ch) || ('A' <= ch && 'Z' >= ch) || ('0' <= ch && '9' >= ch)
+            || '_' == ch || '$' == ch || '-' == ch || '.' == ch) ? 1 : 0;
+}
+
+static MQTTFilterInstruction *emit(FilterParser *parser, MQTTFilterOpcode opcode) {
+    MQTTFilter *f = parser->filter;
+    MQTTFilterInstruction *instruction;
+
+    if(FILTER_MAX_INSTRUCTIONS <= f->instructionCount) {
+        parser->isError = 1;
+        return NULL;
+    }
+
+    instruction = &(f->instructions[f->instructionCount++]);
+    memset(instruction, 0, sizeof(MQTTFilterInstruction));
+    instruction->opcode = (uint8_t)opcode;
+    return instruction;
+}
+
+/* Copy into the text buffer of the filter, returns the offset */
+static uint16_t addText(FilterParser *parser, const char *text, size_t len) {
+    MQTTFilter *f = parser->filter;
+    uint16_t offset = f->textLen;
+
+    if((size_t)(FILTER_MAX_TEXT_LEN - f->textLen) < len) {
+        parser->isError = 1;
+        return 0;
+    }
+
+    memcpy(&(f->text[offset]), text, len);
+    f->textLen = (uint16_t)(f->textLen + len);
+    return offset;
+}
+
+/* Comparisons of the same path share one lookup per message */
+static uint8_t internField(FilterParser *parser, const char *path, size_t len) {
+    MQTTFilter *f = parser->filter;
+    uint8_t i;
+
+    for(i = 0; i < f->fieldCount; ++i) {
+        if(f->fields[i].pathLen == len && 0 == memcmp(&(f->text[f->fields[i].pathOffset]), path, len)) {
+            return i;
+        }
+    }
+
+    f->fields[i].pathOffset = addText(parser, path, len);
+    f->fields[i].pathLen = (uint16_t)len;
+    f->fieldCount++;
+    return i;
+}
+
+static uint8_t parseComparisonOperator(FilterParser *parser, uint8_t *comparison) {
+    const char *p = parser->p;
+
+    if('=' == p[0] && '=' == p[1]) {
+        *comparison = FILTER_EQ;
+    } else if('!' == p[0] && '=' == p[1]) {
+        *comparison = FILTER_NE;
+    } else if('<' == p[0] && '=' == p[1]) {
+        *comparison = FILTER_LE;
+    } else if('>' == p[0] && '=' == p[1]) {
+        *comparison = FILTER_GE;
+    } else if('<' == p[0]) {
+        *comparison = FILTER_LT;
+        parser->p += 1;
+        return 1;
+    } else if('>' == p[0]) {
+        *comparison = FILTER_GT;
+        parser->p += 1;
+        return 1;
+    } else {
+        return 0;
+    }
+
+    parser->p += 2;
+    return 1;
+}
+
+static uint8_t isKeyword(const char *p, const char *keyword) {
+    size_t len = strlen(keyword);
+
+    return (0 == strncmp(p, keyword, len) && !isPathChar(p[len])) ? 1 : 0;
+}
+
+/* field <op> literal */
+static void parseComparison(FilterParser *parser) {
+    MQTTFilterInstruction *instruction;
+    const char *start = parser->p;
+    const char *literal;
+    char *numberEnd;
+    uint8_t comparison;
+
+    while(isPathChar(*parser->p)) {
+        parser->p++;
+    }
+    if(start == parser->p) {
+        parser->isError = 1;
+        return;
+    }
+
+    instruction = emit(parser, FILTER_OP_COMPARE);
+    if(NULL == instruction) {
+        return;
+    }
+    instruction->field = internField(parser, start, (size_t)(parser->p - start));
+
+    skipSpace(parser);
+    if(!parseComparisonOperator(parser, &comparison)) {
+        parser->isError = 1;
+        return;
+    }
+    instruction->comparison = comparison;
+
+    skipSpace(parser);
+    if('"' == *parser->p) {
+        literal = ++parser->p;
+        while('\0' != *parser->p && '"' != *parser->p) {
+            /* Escapes are kept as written, they compare with the escapes in the payload */
+            if('\\' == *parser->p && '\0' != parser->p[1]) {
+                parser->p++;
+            }
+            parser->p++;
+        }
+        if('"' != *parser->p) {
+            parser->isError = 1;
+            return;
+        }
+        instruction->literalType = FILTER_VALUE_STRING;
+        instruction->literalLen = (uint16_t)(parser->p - literal);
+        instruction->literalOffset = addText(parser, literal, instruction->literalLen);
+        parser->p++;
+        return;
+    }
+
+    if(isKeyword(parser->p, "true")) {
+        instruction->literalType = FILTER_VALUE_TRUE;
+        parser->p += 4;
+    } else if(isKeyword(parser->p, "false")) {
+        instruction->literalType = FILTER_VALUE_FALSE;
+        parser->p += 5;
+    } else if(isKeyword(parser->p, "null")) {
+        instruction->literalType = FILTER_VALUE_NULL;
+        parser->p += 4;
+    } else {
+        instruction->number = strtod(parser->p, &numberEnd);
+        if(numberEnd == parser->p) {
+            parser->isError = 1;
+            return;
+        }
+        instruction->literalType = FILTER_VALUE_NUMBER;
+        parser->p = numberEnd;
+        return;
+    }
+
+    /* true, false and null have no order */
+    if(FILTER_EQ != comparison && FILTER_NE != comparison) {
+        parser->isError = 1;
+    }
+}
+
+static void parseOr(FilterParser *parser);
+
+static void parseUnary(FilterParser *parser) {
+    skipSpace(parser);
+    if(FILTER_MAX_INSTRUCTIONS <= parser->depth) {
+        parser->isError = 1;
+        return;
+    }
+
+    if('!' == *parser->p && '=' != parser->p[1]) {
+        parser->p++;
+        parser->depth++;
+        parseUnary(parser);
+        parser->depth--;
+        emit(parser, FILTER_OP_NOT);
+    } else if('(' == *parser->p) {
+        parser->p++;
+        parser->depth++;
+        parseOr(parser);
+        parser->depth--;
+        skipSpace(parser);
+        if(')' != *parser->p) {
+            parser->isError = 1;
+            return;
+        }
+        parser->p++;
+    } else {
+        parseComparison(parser);
+    }
+}
+
+/* Operands joined by && or ||. Each operator jumps past the next operand once the outcome is known */
+static void parseBinary(FilterParser *parser, MQTTFilterOpcode opcode, const char *token,
+                        void (*parseOperand)(FilterParser *)) {
+    MQTTFilterInstruction *instruction;
+    uint8_t index;
+
+    parseOperand(parser);
+    for(;;) {
+        skipSpace(parser);
+        if(parser->isError || token[0] != parser->p[0] || token[1] != parser->p[1]) {
+            return;
+        }
+        parser->p += 2;
+
+        index = parser->filter->instructionCount;
+        instruction = emit(parser, opcode);
+        if(NULL == instruction) {
+            return;
+        }
+        parseOperand(parser);
+        parser->filter->instructions[index].jumpTarget = parser->filter->instructionCount;
+    }
+}
+
+static void parseAnd(FilterParser *parser) {
+    parseBinary(parser, FILTER_OP_AND, "&&", parseUnary);
+}
+
+static void parseOr(FilterParser *parser) {
+    parseBinary(parser, FILTER_OP_OR, "||", parseAnd);
+}
+
+MQTTReturnCode MQTTFilterCompile(MQTTFilter *filter, const char *expression) {
+    FilterParser parser;
+
+    if(NULL == filter) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    memset(filter, 0, sizeof(MQTTFilter));
+    if(NULL == expression) {
+        return SUCCESS;
+    }
+
+    parser.filter = filter;
+    parser.p = expression;
+    parser.depth = 0;
+    parser.isError = 0;
+
+    skipSpace(&parser);
+    if('\0' == *parser.p) {
+        return SUCCESS;
+    }
+
+    parseOr(&parser);
+    skipSpace(&parser);
+    if(parser.isError || '\0' != *parser.p) {
+        memset(filter, 0, sizeof(MQTTFilter));
+        return MQTT_FILTER_SYNTAX_ERROR;
+    }
+
+    return SUCCESS;
+}
+
+/* Payload scanning. Only the members on the way to a field are looked at, values in between are skipped */
+
+typedef struct {
+    const char *value;       /* Contents of strings without the quotes, the token otherwise */
+    size_t len;
+    uint8_t type;            /* FilterValueType */
+    uint8_t isLookedUp;
+    uint8_t isFound;
+} FilterFieldValue;
+
+static const char *skipWhitespace(const char *p, const char *end) {
+    while(p < end && (' ' == *p || '\t' == *p || '\r' == *p || '\n' == *p)) {
+        p++;
+    }
+    return p;
+}
+
+/* p is at the opening quote, returns the position after the closing one or NULL */
+static const char *skipString(const char *p, const char *end) {
+    for(p++; p < end; p++) {
+        if('\\' == *p) {
+            p++;
+        } else if('"' == *p) {
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+static const char *skipValue(const char *p, const char *end) {
+    uint32_t depth = 0;
+
+    if(p >= end) {
+        return NULL;
+    }
+
+    if('"' == *p) {
+        return skipString(p, end);
+    }
+
+    if('{' != *p && '[' != *p) {
+        while(p < end && ',' != *p && '}' != *p && ']' != *p && ' ' != *p && '\t' != *p && '\r' != *p
+              && '\n' != *p) {
+            p++;
+        }
+        return p;
+    }
+
+    while(p < end) {
+        if('"' == *p) {
+            p = skipString(p, end);
+            if(NULL == p) {
+                return NULL;
+            }
+            continue;
+        }
+        if('{' == *p || '[' == *p) {
+            depth++;
+        } else if('}' == *p || ']' == *p) {
+            if(0 == --depth) {
+                return p + 1;
+            }
+        }
+        p++;
+    }
+
+    return NULL;
+}
+
+static void classifyValue(const char *p, const char *valueEnd, FilterFieldValue *out) {
+    char number[FILTER_MAX_NUMBER_LEN];
+    char *numberEnd;
+    size_t len = (size_t)(valueEnd - p);
+
+    out->value = p;
+    out->len = len;
+
+    if('"' == *p) {
+        out->type = FILTER_VALUE_STRING;
+        out->value = p + 1;
+        out->len = len - 2;
+    } else if(4 == len && 0 == memcmp(p, "true", 4)) {
+        out->type = FILTER_VALUE_TRUE;
+    } else if(5 == len && 0 == memcmp(p, "false", 5)) {
+        out->type = FILTER_VALUE_FALSE;
+    } else if(4 == len && 0 == memcmp(p, "null", 4)) {
+        out->type = FILTER_VALUE_NULL;
+    } else {
+        out->type = FILTER_VALUE_OTHER;
+        if(0 < len && FILTER_MAX_NUMBER_LEN > len && '{' != *p && '[' != *p) {
+            /* The payload is not null terminated, strtod gets a copy */
+            memcpy(number, p, len);
+            number[len] = '\0';
+            strtod(number, &numberEnd);
+            if(numberEnd == &(number[len])) {
+                out->type = FILTER_VALUE_NUMBER;
+            }
+        }
+    }
+}
+
+/* Find the value at a dotted path of member names */
+static uint8_t findField(const char *payload, size_t payloadLen, const char *path, size_t pathLen,
+                         FilterFieldValue *out) {
+    const char *p = payload;
+    const char *end = payload + payloadLen;
+    const char *pathEnd = path + pathLen;
+    const char *segment = path;
+    const char *segmentEnd;
+    const char *key;
+    const char *keyEnd;
+    const char *valueEnd;
+
+    while(segment < pathEnd) {
+        segmentEnd = memchr(segment, '.', (size_t)(pathEnd - segment));
+        if(NULL == segmentEnd) {
+            segmentEnd = pathEnd;
+        }
+
+        p = skipWhitespace(p, end);
+        if(p >= end || '{' != *p) {
+            return 0;
+        }
+        p++;
+
+        for(;;) {
+            p = skipWhitespace(p, end);
+            if(p >= end || '"' != *p) {
+                return 0;
+            }
+            key = p + 1;
+            p = skipString(p, end);
+            if(NULL == p) {
+                return 0;
+            }
+            keyEnd = p - 1;
+
+            p = skipWhitespace(p, end);
+            if(p >= end || ':' != *p) {
+                return 0;
+            }
+            p = skipWhitespace(p + 1, end);
+
+            valueEnd = skipValue(p, end);
+            if(NULL == valueEnd) {
+                return 0;
+            }
+
+            if((size_t)(keyEnd - key) == (size_t)(segmentEnd - segment)
+               && 0 == memcmp(key, segment, (size_t)(segmentEnd - segment))) {
+                break;
+            }
+
+            p = skipWhitespace(valueEnd, end);
+            if(p >= end || ',' != *p) {
+                return 0;
+            }
+            p++;
+        }
+
+        if(segmentEnd == pathEnd) {
+            classifyValue(p, valueEnd, out);
+            return 1;
+        }
+        segment = segmentEnd + 1;
+    }
+
+    return 0;
+}
+
+static int compareStrings(const char *a, size_t aLen, const char *b, size_t bLen) {
+    int order = memcmp(a, b, (aLen < bLen) ? aLen : bLen);
+
+    if(0 != order) {
+        return order;
+    }
+    return (aLen < bLen) ? -1 : ((aLen > bLen) ? 1 : 0);
+}
+
+static uint8_t compare(const MQTTFilter *filter, const MQTTFilterInstruction *instruction,
+                       const FilterFieldValue *field) {
+    char number[FILTER_MAX_NUMBER_LEN];
+    double value;
+    int order;
+
+    if(!field->isFound) {
+        return 0;
+    }
+
+    switch(instruction->literalType) {
+        case FILTER_VALUE_NUMBER:
+            if(FILTER_VALUE_NUMBER != field->type) {
+                return 0;
+            }
+            memcpy(number, field->value, field->len);
+            number[field->len] = '\0';
+            value = strtod(number, NULL);
+            order = (value < instruction->number) ? -1 : ((value > instruction->number) ? 1 : 0);
+            break;
+        case FILTER_VALUE_STRING:
+            if(FILTER_VALUE_STRING != field->type) {
+                return 0;
+            }
+            order = compareStrings(field->value, field->len, &(filter->text[instruction->literalOffset]),
+                                   instruction->literalLen);
+            break;
+        case FILTER_VALUE_NULL:
+            /* != null holds for every value that is present */
+            return (FILTER_EQ == instruction->comparison) ? (FILTER_VALUE_NULL == field->type)
+                                                          : (FILTER_VALUE_NULL != field->type);
+        default:
+            if(FILTER_VALUE_TRUE != field->type && FILTER_VALUE_FALSE != field->type) {
+                return 0;
+            }
+            order = (field->type == instruction->literalType) ? 0 : 1;
+            break;
+    }
+
+    switch(instruction->comparison) {
+        case FILTER_EQ:
+            return (0 == order) ? 1 : 0;
+        case FILTER_NE:
+            return (0 != order) ? 1 : 0;
+        case FILTER_LT:
+            return (0 > order) ? 1 : 0;
+        case FILTER_LE:
+            return (0 >= order) ? 1 : 0;
+        case FILTER_GT:
+            return (0 < order) ? 1 : 0;
+        default:
+            return (0 <= order) ? 1 : 0;
+    }
+}
+
+uint8_t MQTTFilterMatch(MQTTFilter *filter, const void *payload, size_t payloadLen) {
+    FilterFieldValue fields[FILTER_MAX_INSTRUCTIONS];
+    uint8_t stack[FILTER_MAX_INSTRUCTIONS];
+    const MQTTFilterInstruction *instruction;
+    const MQTTFilterField *path;
+    const char *p;
+    uint8_t depth = 0;
+    uint8_t pc = 0;
+    uint8_t i;
+
+    if(NULL == filter || 0 == filter->instructionCount) {
+        return 1;
+    }
+
+    filter->stats.evaluated++;
+    if(NULL == payload) {
+        payloadLen = 0;
+        payload = "";
+    }
+    p = skipWhitespace((const char *)payload, (const char *)payload + payloadLen);
+    if(p >= (const char *)payload + payloadLen || '{' != *p) {
+        /* Every field counts as missing */
+        filter->stats.invalidPayloads++;
+    }
+
+    for(i = 0; i < filter->fieldCount; ++i) {
+        fields[i].isLookedUp = 0;
+    }
+
+    while(pc < filter->instructionCount) {
+        instruction = &(filter->instructions[pc]);
+        switch(instruction->opcode) {
+            case FILTER_OP_COMPARE:
+                if(!fields[instruction->field].isLookedUp) {
+                    path = &(filter->fields[instruction->field]);
+                    fields[instruction->field].isLookedUp = 1;
+                    fields[instruction->field].isFound = findField((const char *)payload, payloadLen, &(filter->text[path->pathOffset]),
+                                         path->pathLen, &(fields[instruction->field]));
+                }
+                stack[depth++] = compare(filter, instruction, &(fields[instruction->field]));
+                break;
+            case FILTER_OP_AND:
+                if(!stack[depth - 1]) {
+                    pc = instruction->jumpTarget;
+                    continue;
+                }
+                depth--;
+                break;
+            case FILTER_OP_OR:
+                if(stack[depth - 1]) {
+                    pc = instruction->jumpTarget;
+                    continue;
+                }
+                depth--;
+                break;
+            default:
+                stack[depth - 1] = !stack[depth - 1];
+                break;
+        }
+        pc++;
+    }
+
+    if(stack[0]) {
+        filter->stats.matched++;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,103 @@
+/*******************************************************************************
+ * Copyright (c) 2014 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Compiled payload filters evaluated before message handler dispatch
+ *******************************************************************************/
+
+#ifndef __MQTT_FILTER_H
+#define __MQTT_FILTER_H
+
+#include "stdint.h"
+#include "stddef.h"
+
+#include "MQTTReturnCodes.h"
+#include "aws_iot_config.h"
+
+#define FILTER_MAX_INSTRUCTIONS AWS_IOT_MQTT_FILTER_MAX_INSTRUCTIONS
+#define FILTER_MAX_TEXT_LEN AWS_IOT_MQTT_FILTER_MAX_TEXT_LEN
+
+/*
+ * A filter is an expression over fields of a JSON object payload, for example
+ *
+ *     temperature > 80 && (deviceType == "pump" || state.reported.alarm == true)
+ *
+ * Fields are member names, dotted for nested objects. Comparisons are ==, !=, <, <=, > and >= against
+ * a number, a double quoted string, true, false or null, combined with &&, || and ! and grouped with
+ * parentheses. Strings compare byte by byte as they appear in the payload, escapes are not decoded.
+ * A comparison with a missing field or a value of another type is false, != included, except that
+ * != null holds for any value present. A payload that is not a JSON object has no fields.
+ *
+ * MQTTFilterCompile turns the expression into a short program once. MQTTFilterMatch runs it against a
+ * payload without parsing it: a field is looked up by scanning the payload the first time an
+ * instruction needs it, && and || skip the rest of their operands once the outcome is known, so a
+ * message failing the first condition costs one key scan.
+ */
+
+typedef enum {
+    FILTER_OP_COMPARE = 0,   /* Push the result of comparing a field with a literal */
+    FILTER_OP_AND,           /* Leave a false result on the stack and jump, otherwise pop it */
+    FILTER_OP_OR,            /* Leave a true result on the stack and jump, otherwise pop it */
+    FILTER_OP_NOT            /* Negate the result on top of the stack */
+} MQTTFilterOpcode;
+
+typedef struct {
+    uint8_t opcode;          /* MQTTFilterOpcode */
+    uint8_t comparison;      /* ==, !=, <, <=, >, >= of FILTER_OP_COMPARE */
+    uint8_t literalType;     /* Number, string, true, false or null */
+    uint8_t field;           /* Index of the field, shared by all comparisons of the same path */
+    uint8_t jumpTarget;      /* Instruction FILTER_OP_AND and FILTER_OP_OR continue at */
+    uint16_t literalOffset;  /* String literal in text */
+    uint16_t literalLen;
+    double number;           /* Number literal */
+} MQTTFilterInstruction;
+
+typedef struct {
+    uint16_t pathOffset;     /* Dotted path in text */
+    uint16_t pathLen;
+} MQTTFilterField;
+
+typedef struct {
+    uint32_t evaluated;      /* Messages the filter was run on */
+    uint32_t matched;        /* Of those, messages passed on to the handler */
+    uint32_t invalidPayloads;  /* Of those, payloads that were not a JSON object */
+} MQTTFilterStats;
+
+typedef struct {
+    MQTTFilterInstruction instructions[FILTER_MAX_INSTRUCTIONS];
+    MQTTFilterField fields[FILTER_MAX_INSTRUCTIONS];
+    char text[FILTER_MAX_TEXT_LEN];   /* Paths and string literals */
+    uint8_t instructionCount;         /* 0 for no filter, every message matches */
+    uint8_t fieldCount;
+    uint16_t textLen;
+    MQTTFilterStats stats;
+} MQTTFilter;
+
+/**
+ * @brief Compile a filter expression
+ *
+ * @param filter receives the program, cleared to no filter on error
+ * @param expression null terminated expression, NULL or empty for no filter
+ *
+ * @return SUCCESS, MQTT_FILTER_SYNTAX_ERROR for an invalid expression or one that needs more than
+ *         FILTER_MAX_INSTRUCTIONS instructions or FILTER_MAX_TEXT_LEN bytes of paths and strings
+ */
+MQTTReturnCode MQTTFilterCompile(MQTTFilter *filter, const char *expression);
+
+/**
+ * @brief Run a compiled filter against a payload and count the outcome in its statistics
+ *
+ * @return 1 if the message should be delivered, always for an empty filter, 0 if it should be dropped
+ */
+uint8_t MQTTFilterMatch(MQTTFilter *filter, const void *payload, size_t payloadLen);
+
+#endif //__MQTT_FILTER_H
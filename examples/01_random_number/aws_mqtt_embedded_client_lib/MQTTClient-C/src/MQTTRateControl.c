@@ -0,0 +1,174 @@
+/*******************************************************************************
+ * Copyright (c) 2014 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Adaptive publish rate and in-flight window driven by PUBACK latency
+ *******************************************************************************/
+
+#include "MQTTRateControl.h"
+
+#include <string.h>
+
+/* Credit of one publish */
+#define CREDIT_PER_PUBLISH 1000000ull
+
+/* Smallest latency rise taken as congestion, below it scheduling jitter of a fast link would cut the rate */
+#define MIN_LATENCY_RISE_US 1000u
+
+/* The lowest latency seen moves up by 1/2^n of the difference per PUBACK, so a longer route is adopted */
+#define BASE_LATENCY_DRIFT_SHIFT 8
+
+static uint32_t maxWindow(void) {
+    return AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH > 0 ? AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH : 1;
+}
+
+static uint64_t creditCapacity(const MQTTRateControl *rc) {
+    /* A window worth of publishes may go out back to back after an idle period */
+    return (uint64_t)rc->window * CREDIT_PER_PUBLISH;
+}
+
+static void refill(MQTTRateControl *rc, uint64_t nowUs) {
+    uint64_t capacity = creditCapacity(rc);
+    uint64_t elapsedUs;
+
+    if(nowUs <= rc->lastRefillUs) {
+        return;
+    }
+    elapsedUs = nowUs - rc->lastRefillUs;
+    rc->lastRefillUs = nowUs;
+    /* Compare before multiplying, a long idle period would overflow the product */
+    if(elapsedUs >= capacity / rc->rate) {
+        rc->credit = capacity;
+        return;
+    }
+    rc->credit += elapsedUs * rc->rate;
+    if(rc->credit > capacity) {
+        rc->credit = capacity;
+    }
+}
+
+void MQTTRateControlInit(MQTTRateControl *rc, uint32_t minRate, uint32_t maxRate) {
+    memset(rc, 0, sizeof(MQTTRateControl));
+    rc->window = maxWindow();
+    if(0 == maxRate) {
+        return;
+    }
+    if(0 == minRate) {
+        minRate = 1;
+    }
+    if(minRate > maxRate) {
+        minRate = maxRate;
+    }
+    rc->minRate = minRate;
+    rc->maxRate = maxRate;
+    rc->rate = maxRate / 2 > minRate ? maxRate / 2 : minRate;
+    rc->window = maxWindow() / 2 > 0 ? maxWindow() / 2 : 1;
+    rc->credit = creditCapacity(rc);
+}
+
+uint8_t MQTTRateControlIsEnabled(const MQTTRateControl *rc) {
+    return 0 != rc->maxRate;
+}
+
+uint64_t MQTTRateControlDelayUs(MQTTRateControl *rc, uint64_t nowUs) {
+    if(!MQTTRateControlIsEnabled(rc)) {
+        return 0;
+    }
+    refill(rc, nowUs);
+    if(rc->credit >= CREDIT_PER_PUBLISH) {
+        return 0;
+    }
+    return (CREDIT_PER_PUBLISH - rc->credit + rc->rate - 1) / rc->rate;
+}
+
+void MQTTRateControlOnPublish(MQTTRateControl *rc, uint64_t nowUs) {
+    if(!MQTTRateControlIsEnabled(rc)) {
+        return;
+    }
+    refill(rc, nowUs);
+    rc->credit = rc->credit > CREDIT_PER_PUBLISH ? rc->credit - CREDIT_PER_PUBLISH : 0;
+}
+
+void MQTTRateControlOnAck(MQTTRateControl *rc, uint32_t latencyUs, uint64_t nowUs) {
+    uint64_t thresholdUs;
+    uint8_t grown = 0;
+
+    if(!MQTTRateControlIsEnabled(rc)) {
+        return;
+    }
+
+    if(0 == rc->smoothedLatencyUs) {
+        rc->smoothedLatencyUs = latencyUs;
+    } else {
+        rc->smoothedLatencyUs = (uint32_t)(((uint64_t)rc->smoothedLatencyUs * 7 + latencyUs) / 8);
+    }
+    if(0 == rc->baseLatencyUs || latencyUs < rc->baseLatencyUs) {
+        rc->baseLatencyUs = latencyUs;
+    } else {
+        rc->baseLatencyUs += (latencyUs - rc->baseLatencyUs) >> BASE_LATENCY_DRIFT_SHIFT;
+    }
+
+    thresholdUs = (uint64_t)rc->baseLatencyUs * (100 + RATE_CONTROL_LATENCY_TOLERANCE_PERCENT) / 100;
+    if(thresholdUs < (uint64_t)rc->baseLatencyUs + MIN_LATENCY_RISE_US) {
+        thresholdUs = (uint64_t)rc->baseLatencyUs + MIN_LATENCY_RISE_US;
+    }
+    if(rc->smoothedLatencyUs > thresholdUs) {
+        /* Queues are building up somewhere between here and the broker, do not grow into them */
+        rc->acksInRound = 0;
+        MQTTRateControlOnCongestion(rc, RATE_CONTROL_LATENCY, nowUs);
+        return;
+    }
+
+    if(++rc->acksInRound < rc->window) {
+        return;
+    }
+    rc->acksInRound = 0;
+    if(rc->window < maxWindow()) {
+        rc->window++;
+        grown = 1;
+    }
+    if(rc->rate < rc->maxRate) {
+        rc->rate = rc->maxRate - rc->rate > RATE_CONTROL_RATE_STEP ? rc->rate + RATE_CONTROL_RATE_STEP : rc->maxRate;
+        grown = 1;
+    }
+    if(grown) {
+        rc->stats.increases++;
+    }
+}
+
+void MQTTRateControlOnCongestion(MQTTRateControl *rc, MQTTRateControlReason reason, uint64_t nowUs) {
+    uint64_t capacity;
+
+    if(!MQTTRateControlIsEnabled(rc) || RATE_CONTROL_REASONS <= reason) {
+        return;
+    }
+    /* Packets sent before the last cut still report the old congestion, a disconnect is news regardless */
+    if(RATE_CONTROL_DISCONNECT != reason && nowUs < rc->holdUntilUs) {
+        return;
+    }
+
+    rc->window = rc->window * RATE_CONTROL_DECREASE_PERCENT / 100;
+    if(0 == rc->window) {
+        rc->window = 1;
+    }
+    rc->rate = (uint32_t)((uint64_t)rc->rate * RATE_CONTROL_DECREASE_PERCENT / 100);
+    if(rc->rate < rc->minRate) {
+        rc->rate = rc->minRate;
+    }
+    capacity = creditCapacity(rc);
+    if(rc->credit > capacity) {
+        rc->credit = capacity;
+    }
+    rc->acksInRound = 0;
+    rc->holdUntilUs = nowUs + rc->smoothedLatencyUs;
+    rc->stats.decreases[reason]++;
+}
@@ -0,0 +1,92 @@
+/*******************************************************************************
+ * Copyright (c) 2014 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Adaptive publish rate and in-flight window driven by PUBACK latency
+ *******************************************************************************/
+
+#ifndef __MQTT_RATE_CONTROL_H
+#define __MQTT_RATE_CONTROL_H
+
+#include "stdint.h"
+
+#include "aws_iot_config.h"
+
+#define RATE_CONTROL_MIN_RATE AWS_IOT_MQTT_RATE_CONTROL_MIN_RATE
+#define RATE_CONTROL_MAX_RATE AWS_IOT_MQTT_RATE_CONTROL_MAX_RATE
+#define RATE_CONTROL_RATE_STEP AWS_IOT_MQTT_RATE_CONTROL_RATE_STEP
+#define RATE_CONTROL_DECREASE_PERCENT AWS_IOT_MQTT_RATE_CONTROL_DECREASE_PERCENT
+#define RATE_CONTROL_LATENCY_TOLERANCE_PERCENT AWS_IOT_MQTT_RATE_CONTROL_LATENCY_TOLERANCE_PERCENT
+#define RATE_CONTROL_ACK_TIMEOUT_MS AWS_IOT_MQTT_RATE_CONTROL_ACK_TIMEOUT_MS
+#define RATE_CONTROL_DISCONNECT_WINDOW_MS AWS_IOT_MQTT_RATE_CONTROL_DISCONNECT_WINDOW_MS
+
+/*
+ * Additive increase, multiplicative decrease of the publish rate and of the QoS1 in-flight window.
+ * Every time a window worth of PUBACKs arrived without the smoothed ack latency rising more than
+ * RATE_CONTROL_LATENCY_TOLERANCE_PERCENT above the lowest latency seen, the window grows by one and the
+ * rate by RATE_CONTROL_RATE_STEP. Rising latency, a PUBACK missing for RATE_CONTROL_ACK_TIMEOUT_MS or a
+ * disconnect shortly after publishing, as a broker throttling the client would cause, cut both to
+ * RATE_CONTROL_DECREASE_PERCENT. After a cut the controller waits one smoothed latency for the packets
+ * already in flight before it cuts again, so one congestion event costs one decrease.
+ */
+
+/* What made the controller slow down, indexes MQTTRateControlStats.decreases */
+typedef enum {
+    RATE_CONTROL_LATENCY = 0,    /* The smoothed PUBACK latency rose above the tolerance */
+    RATE_CONTROL_TIMEOUT,        /* A PUBACK did not arrive in time */
+    RATE_CONTROL_DISCONNECT,     /* The connection dropped within RATE_CONTROL_DISCONNECT_WINDOW_MS of a publish */
+    RATE_CONTROL_REASONS
+} MQTTRateControlReason;
+
+typedef struct {
+    uint32_t increases;
+    uint32_t decreases[RATE_CONTROL_REASONS];
+    uint32_t limitedPublishes;   /* Publishes refused or delayed by the rate or the window */
+} MQTTRateControlStats;
+
+typedef struct {
+    uint32_t minRate;            /* Publishes per second the rate never goes below */
+    uint32_t maxRate;            /* Publishes per second the rate never exceeds, 0 while the controller is off */
+    uint32_t rate;               /* Publishes per second allowed now */
+    uint32_t window;             /* QoS1 publishes allowed to await a PUBACK now */
+    uint32_t acksInRound;        /* PUBACKs since the window last grew */
+    uint64_t credit;             /* Earned publishes in millionths, refilled at rate per second */
+    uint64_t lastRefillUs;
+    uint64_t holdUntilUs;        /* No further decrease before this, the effect of the last one is pending */
+    uint32_t smoothedLatencyUs;  /* Moving average of the PUBACK latency, 0 before the first sample */
+    uint32_t baseLatencyUs;      /* Lowest PUBACK latency, drifting up slowly to follow route changes */
+    MQTTRateControlStats stats;
+} MQTTRateControl;
+
+/**
+ * @brief Start the controller between minRate and maxRate, at half of maxRate and half of the in-flight
+ *        limit. A maxRate of 0 turns it off, publishes are then only limited by the in-flight limit
+ */
+void MQTTRateControlInit(MQTTRateControl *rc, uint32_t minRate, uint32_t maxRate);
+
+uint8_t MQTTRateControlIsEnabled(const MQTTRateControl *rc);
+
+/**
+ * @brief Microseconds until the rate allows the next publish, 0 if it may go out now
+ */
+uint64_t MQTTRateControlDelayUs(MQTTRateControl *rc, uint64_t nowUs);
+
+/* Account for a publish written to the network */
+void MQTTRateControlOnPublish(MQTTRateControl *rc, uint64_t nowUs);
+
+/* Feed the latency of a PUBACK, growing rate and window while it stays close to the lowest seen */
+void MQTTRateControlOnAck(MQTTRateControl *rc, uint32_t latencyUs, uint64_t nowUs);
+
+/* Cut rate and window because of a congestion signal */
+void MQTTRateControlOnCongestion(MQTTRateControl *rc, MQTTRateControlReason reason, uint64_t nowUs);
+
+#endif //__MQTT_RATE_CONTROL_H
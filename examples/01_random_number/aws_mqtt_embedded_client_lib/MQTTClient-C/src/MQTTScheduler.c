@@ -0,0 +1,254 @@
+/*******************************************************************************
+ * Copyright (c) 2014 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Fair scheduling of multiple client instances on one thread
+ *******************************************************************************/
+
+#include "MQTTScheduler.h"
+
+#include <string.h>
+#include <sys/select.h>
+
+static void recordRc(MQTTSchedulerConnection *conn, MQTTReturnCode rc) {
+    if(SUCCESS != rc) {
+        conn->stats.lastRc = rc;
+    }
+}
+
+MQTTReturnCode MQTTSchedulerInit(MQTTScheduler *s, MQTTSchedulerConnection *connections, Client **clients,
+                                 size_t count, const MQTTSchedulerParams *params) {
+    MQTTSchedulerParams defaultParams = MQTTSchedulerParams_initializer;
+    size_t i;
+
+    if(NULL == s || ((NULL == connections || NULL == clients) && 0 != count)) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    for(i = 0; i < count; ++i) {
+        if(NULL == clients[i]) {
+            return MQTT_NULL_VALUE_ERROR;
+        }
+    }
+
+    s->params = (NULL != params) ? *params : defaultParams;
+    if(0 == s->params.quantumBytes) {
+        s->params.quantumBytes = SCHEDULER_QUANTUM_BYTES;
+    }
+    if(0 == s->params.maxPacketsPerTurn) {
+        s->params.maxPacketsPerTurn = SCHEDULER_MAX_PACKETS_PER_TURN;
+    }
+    if(0 == s->params.starvationThresholdMs) {
+        s->params.starvationThresholdMs = SCHEDULER_STARVATION_MS;
+    }
+    if(0 == s->params.keepaliveBatchMs) {
+        s->params.keepaliveBatchMs = SCHEDULER_KEEPALIVE_BATCH_MS;
+    }
+
+    s->connections = connections;
+    s->count = count;
+    s->nextFirst = 0;
+    for(i = 0; i < count; ++i) {
+        connections[i].client = clients[i];
+        connections[i].deficitBytes = 0;
+        connections[i].hasBacklog = 0;
+        connections[i].backlogSinceUs = 0;
+    }
+    MQTTSchedulerResetStats(s);
+
+    return SUCCESS;
+}
+
+/* Keepalives, reconnects and application deadlines of every connection go before anybody reads. Once
+ * one connection has to ping, the others due soon ping in the same round rather than in a wakeup of their own */
+static void serviceTimers(MQTTScheduler *s) {
+    MQTTSchedulerConnection *conn;
+    MQTTReturnCode rc;
+    uint32_t aheadMs = 0;
+    uint8_t isAheadOfTimer;
+    size_t i;
+
+    for(i = 0; i < s->count; ++i) {
+        if(MQTTIsKeepaliveDue(s->connections[i].client)) {
+            aheadMs = s->params.keepaliveBatchMs;
+            break;
+        }
+    }
+
+    for(i = 0; i < s->count; ++i) {
+        conn = &(s->connections[i]);
+        isAheadOfTimer = (0 != aheadMs && !MQTTIsKeepaliveDue(conn->client) && !conn->client->isPingOutstanding) ? 1 : 0;
+        rc = MQTTServiceTimersAhead(conn->client, aheadMs);
+        if(isAheadOfTimer && conn->client->isPingOutstanding) {
+            conn->stats.batchedPings++;
+        }
+        recordRc(conn, rc);
+        if(SUCCESS == rc && NULL != s->params.timerHandler) {
+            recordRc(conn, s->params.timerHandler(conn->client, s->params.timerContext));
+        }
+    }
+}
+
+/* One deficit round robin turn. Returns the number of packets handled */
+static uint32_t serveConnection(MQTTScheduler *s, MQTTSchedulerConnection *conn) {
+    MQTTPollResult result;
+    uint32_t waitMs;
+    int32_t quantum = (int32_t)s->params.quantumBytes;
+
+    if(!MQTTIsConnected(conn->client)) {
+        conn->hasBacklog = 0;
+        conn->deficitBytes = 0;
+        return 0;
+    }
+
+    if(conn->hasBacklog) {
+        conn->deficitBytes += quantum;
+        waitMs = (uint32_t)((timestamp_us() - conn->backlogSinceUs) / 1000);
+        if(waitMs > conn->stats.maxWaitMs) {
+            conn->stats.maxWaitMs = waitMs;
+        }
+        if(waitMs > s->params.starvationThresholdMs) {
+            conn->stats.starvedTurns++;
+        }
+    } else {
+        /* An idle connection does not save up allowance */
+        conn->deficitBytes = quantum;
+    }
+
+    if(conn->deficitBytes <= 0) {
+        /* Still paying back a large packet. Its send queue is drained all the same */
+        conn->stats.deferredTurns++;
+        recordRc(conn, MQTTPoll(conn->client, 0, 0, &result));
+        return 0;
+    }
+
+    recordRc(conn, MQTTPoll(conn->client, s->params.maxPacketsPerTurn, (size_t)conn->deficitBytes, &result));
+    conn->stats.turns++;
+    conn->stats.packets += result.packets;
+    conn->stats.bytes += result.bytes;
+    conn->deficitBytes -= (int32_t)result.bytes;
+
+    if(result.isBudgetExhausted) {
+        conn->stats.budgetExhausted++;
+        conn->hasBacklog = 1;
+        conn->backlogSinceUs = timestamp_us();
+        /* Allowance left over by the packet cap must not build up into a burst */
+        if(conn->deficitBytes > quantum) {
+            conn->deficitBytes = quantum;
+        }
+    } else {
+        conn->hasBacklog = 0;
+        conn->deficitBytes = 0;
+    }
+
+    return result.packets;
+}
+
+/* Sleep until a connection has input or the next deadline of any of them */
+static void idleWait(MQTTScheduler *s, Timer *timer) {
+    MQTTSchedulerConnection *conn;
+    struct timeval timeout;
+    fd_set readFds;
+    uint32_t waitMs = (uint32_t)left_ms(timer);
+    uint32_t nextMs;
+    int maxFd = -1;
+    int fd;
+    int rc;
+    size_t i;
+
+    /* The deadlines of the timer handler are not known here */
+    if(NULL != s->params.timerHandler && SCHEDULER_IDLE_WAIT_MS < waitMs) {
+        waitMs = SCHEDULER_IDLE_WAIT_MS;
+    }
+
+    FD_ZERO(&readFds);
+    for(i = 0; i < s->count; ++i) {
+        conn = &(s->connections[i]);
+        nextMs = MQTTGetNextTimerMs(conn->client);
+        if(nextMs < waitMs) {
+            waitMs = nextMs;
+        }
+        if(!MQTTIsConnected(conn->client)) {
+            continue;
+        }
+        if(conn->hasBacklog) {
+            /* A deferred connection may hold input the TLS layer already decrypted, which select does not see */
+            return;
+        }
+        fd = conn->client->networkStack.my_socket;
+        if(0 <= fd && FD_SETSIZE > fd) {
+            FD_SET(fd, &readFds);
+            if(fd > maxFd) {
+                maxFd = fd;
+            }
+        } else if(SCHEDULER_IDLE_WAIT_MS < waitMs) {
+            /* A socket select can not watch is polled instead */
+            waitMs = SCHEDULER_IDLE_WAIT_MS;
+        }
+    }
+    if(0 == waitMs) {
+        return;
+    }
+
+    timeout.tv_sec = (time_t)(waitMs / 1000);
+    timeout.tv_usec = (suseconds_t)(waitMs % 1000) * 1000;
+    rc = select(maxFd + 1, &readFds, NULL, NULL, &timeout);
+    MQTTRecordWait(0 >= rc);
+}
+
+MQTTReturnCode MQTTSchedulerRun(MQTTScheduler *s, uint32_t timeout_ms) {
+    Timer timer;
+    uint32_t packets;
+    size_t i;
+
+    if(NULL == s) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    InitTimer(&timer);
+    countdown_ms(&timer, timeout_ms);
+
+    do {
+        serviceTimers(s);
+
+        packets = 0;
+        for(i = 0; i < s->count; ++i) {
+            packets += serveConnection(s, &(s->connections[(s->nextFirst + i) % s->count]));
+        }
+        if(0 != s->count) {
+            s->nextFirst = (s->nextFirst + 1) % s->count;
+        }
+
+        s->rounds++;
+        if(0 == packets) {
+            s->idleRounds++;
+            idleWait(s, &timer);
+        }
+    } while(!expired(&timer));
+
+    return SUCCESS;
+}
+
+void MQTTSchedulerResetStats(MQTTScheduler *s) {
+    size_t i;
+
+    if(NULL == s) {
+        return;
+    }
+
+    for(i = 0; i < s->count; ++i) {
+        memset(&(s->connections[i].stats), 0, sizeof(MQTTSchedulerConnectionStats));
+        s->connections[i].stats.lastRc = SUCCESS;
+    }
+    s->rounds = 0;
+    s->idleRounds = 0;
+}
@@ -0,0 +1,132 @@
+/*******************************************************************************
+ * Copyright (c) 2014 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Fair scheduling of multiple client instances on one thread
+ *******************************************************************************/
+
+#ifndef __MQTT_SCHEDULER_H
+#define __MQTT_SCHEDULER_H
+
+#include "MQTTClient.h"
+
+#define SCHEDULER_QUANTUM_BYTES AWS_IOT_MQTT_SCHEDULER_QUANTUM_BYTES
+#define SCHEDULER_MAX_PACKETS_PER_TURN AWS_IOT_MQTT_SCHEDULER_MAX_PACKETS_PER_TURN
+#define SCHEDULER_STARVATION_MS AWS_IOT_MQTT_SCHEDULER_STARVATION_MS
+#define SCHEDULER_IDLE_WAIT_MS AWS_IOT_MQTT_SCHEDULER_IDLE_WAIT_MS
+#define SCHEDULER_KEEPALIVE_BATCH_MS AWS_IOT_MQTT_KEEPALIVE_SLACK_MS
+
+/**
+ * @brief Work due on a timer, run for every connection before any connection reads
+ *
+ * Use it for deadlines that must not queue up behind bulk traffic, such as shadow request expiry.
+ * A return code other than SUCCESS is recorded in the connection's statistics.
+ */
+typedef MQTTReturnCode (*MQTTSchedulerTimerHandler)(Client *c, void *context);
+
+/**
+ * @brief Parameters of a scheduler
+ *
+ * Zero values select SCHEDULER_QUANTUM_BYTES, SCHEDULER_MAX_PACKETS_PER_TURN, SCHEDULER_STARVATION_MS and
+ * SCHEDULER_KEEPALIVE_BATCH_MS.
+ */
+typedef struct {
+    uint32_t quantumBytes;           ///< Bytes a connection may read per round, the deficit round robin quantum
+    uint32_t maxPacketsPerTurn;      ///< Packets a connection may handle per round, whatever their size
+    uint32_t starvationThresholdMs;  ///< Waiting longer than this for a turn with input pending counts as starved
+    MQTTSchedulerTimerHandler timerHandler;  ///< Optional, called for every connection at the start of a round
+    void *timerContext;              ///< Passed to timerHandler
+    uint32_t keepaliveBatchMs;       ///< When one connection sends a keepalive, others due within this send theirs too
+} MQTTSchedulerParams;
+
+#define MQTTSchedulerParams_initializer {0, 0, 0, NULL, NULL, 0}
+
+/**
+ * @brief Per-connection scheduling statistics
+ */
+typedef struct {
+    uint32_t turns;            ///< Rounds in which the connection read
+    uint32_t packets;          ///< Packets handled
+    uint64_t bytes;            ///< Bytes of those packets
+    uint32_t budgetExhausted;  ///< Turns that ended on the budget with input possibly still waiting
+    uint32_t deferredTurns;    ///< Rounds skipped to pay back a deficit overdrawn by a large packet
+    uint32_t starvedTurns;     ///< Turns that came more than starvationThresholdMs after input was left waiting
+    uint32_t maxWaitMs;        ///< Longest time input was left waiting for the next turn
+    uint32_t batchedPings;     ///< Keepalive pings sent ahead of their timer together with another connection's
+    MQTTReturnCode lastRc;     ///< Last return code other than SUCCESS, from the timers, the handler or the read
+} MQTTSchedulerConnectionStats;
+
+/**
+ * @brief Scheduling state of one connection, kept in storage provided by the caller
+ */
+typedef struct {
+    Client *client;
+    int32_t deficitBytes;      ///< Read allowance left, negative after a packet larger than the allowance
+    uint8_t hasBacklog;        ///< The last turn stopped on the budget
+    uint64_t backlogSinceUs;   ///< When that turn ended
+    MQTTSchedulerConnectionStats stats;
+} MQTTSchedulerConnection;
+
+/**
+ * @brief Scheduler over an array of connections
+ */
+typedef struct {
+    MQTTSchedulerConnection *connections;
+    size_t count;
+    size_t nextFirst;          ///< Connection that reads first in the next round, rotated every round
+    MQTTSchedulerParams params;
+    uint32_t rounds;
+    uint32_t idleRounds;       ///< Rounds in which no connection had anything to read
+} MQTTScheduler;
+
+/**
+ * @brief Set up a scheduler
+ *
+ * Each client must have been set up with MQTTClient() and is connected by the caller.
+ *
+ * @param s scheduler to set up
+ * @param connections storage for count connections
+ * @param clients array of count client pointers
+ * @param count number of clients
+ * @param params quantum, per-turn packet cap and timer handler, NULL for defaults
+ *
+ * @return SUCCESS, or MQTT_NULL_VALUE_ERROR for a missing argument
+ */
+MQTTReturnCode MQTTSchedulerInit(MQTTScheduler *s, MQTTSchedulerConnection *connections, Client **clients,
+                                 size_t count, const MQTTSchedulerParams *params);
+
+/**
+ * @brief Drive all connections for timeout_ms
+ *
+ * The replacement of MQTTYield when one thread serves many clients. Every round first sends due keepalive
+ * pings, paces reconnects and runs the timer handler for all connections, then lets each connection handle
+ * its readable packets within the per-round quantum using deficit round robin, so a connection receiving
+ * bulk traffic can not hold up the others. After a round in which nothing was read the thread sleeps until
+ * a socket becomes readable or the earliest keepalive, reconnect or auto-cork deadline of any connection,
+ * at most SCHEDULER_IDLE_WAIT_MS while a timer handler is installed. The timers accept some slack and due
+ * keepalives are sent together, so an idle process wakes up once for many connections. The waits are
+ * counted in MQTTGetWakeupStats. Errors of single connections are recorded in their statistics and do not
+ * stop the others.
+ *
+ * @param s scheduler
+ * @param timeout_ms time to run for
+ *
+ * @return SUCCESS, or MQTT_NULL_VALUE_ERROR for a missing scheduler
+ */
+MQTTReturnCode MQTTSchedulerRun(MQTTScheduler *s, uint32_t timeout_ms);
+
+/**
+ * @brief Clear the statistics of the scheduler and all its connections
+ */
+void MQTTSchedulerResetStats(MQTTScheduler *s);
+
+#endif //__MQTT_SCHEDULER_H
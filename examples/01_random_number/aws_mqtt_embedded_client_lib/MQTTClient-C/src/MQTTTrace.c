@@ -0,0 +1,175 @@
+/*******************************************************************************
+ * Copyright (c) 2014 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Sampled lifecycle trace points of published and received messages
+ *******************************************************************************/
+
+#include "MQTTTrace.h"
+
+#include <string.h>
+
+#include "timer_interface.h"
+
+/* The ring keeps one slot when tracing is compiled out, nothing is ever sampled into it */
+#define TRACE_RING_SLOTS (TRACE_EVENTS > 0 ? TRACE_EVENTS : 1)
+
+/* Name of each stage in the JSON dump */
+static const char *stageNames[TRACE_STAGES] = {
+    "publish", "serialized", "write_start", "write_done", "acked",
+    "read", "parsed", "dispatch", "handler_end"
+};
+
+/* Name of the wait that ends at each stage in the Chrome dump, the first stage of a message starts none */
+static const char *spanNames[TRACE_STAGES] = {
+    "publish", "serialize", "queue", "write", "ack",
+    "read", "read and parse", "filter and dispatch", "handler"
+};
+
+static MQTTTraceEvent traceRing[TRACE_RING_SLOTS];
+static uint32_t traceHead;           /* Events ever claimed, the next one goes to traceHead % TRACE_RING_SLOTS */
+static uint32_t traceMessages;       /* Messages offered to MQTTTraceSample */
+static volatile uint32_t traceSampleRate = TRACE_SAMPLE_RATE;
+
+void MQTTSetTraceSampling(uint32_t sampleRate) {
+    traceSampleRate = sampleRate;
+}
+
+uint8_t MQTTTraceIsEnabled(void) {
+    return (TRACE_EVENTS > 0 && 0 != traceSampleRate) ? 1 : 0;
+}
+
+uint32_t MQTTTraceSample(void) {
+    uint32_t sampleRate = traceSampleRate;
+    uint32_t message;
+
+    if(0 == TRACE_EVENTS || 0 == sampleRate) {
+        return 0;
+    }
+    message = __sync_add_and_fetch(&traceMessages, 1);
+    /* The counter itself is the trace id, unique until it wraps */
+    return (0 == message % sampleRate) ? message : 0;
+}
+
+void MQTTTraceRecordAt(uint32_t traceId, MQTTTraceStage stage, uint16_t packetId, uint64_t timestampUs) {
+    MQTTTraceEvent *event;
+    uint32_t position;
+
+    if(0 == traceId) {
+        return;
+    }
+
+    position = __sync_fetch_and_add(&traceHead, 1);
+    event = &(traceRing[position % TRACE_RING_SLOTS]);
+    /* Readers skip the slot until the sequence shows it complete again */
+    event->sequence = 0;
+    __sync_synchronize();
+    event->timestampUs = timestampUs;
+    event->traceId = traceId;
+    event->packetId = packetId;
+    event->stage = (uint8_t)stage;
+    __sync_synchronize();
+    event->sequence = position + 1;
+}
+
+void MQTTTraceRecord(uint32_t traceId, MQTTTraceStage stage, uint16_t packetId) {
+    if(0 == traceId) {
+        return;
+    }
+    MQTTTraceRecordAt(traceId, stage, packetId, timestamp_us());
+}
+
+/* Copy the event claimed at position, 0 if it was overwritten or is being written */
+static uint8_t readEvent(uint32_t position, MQTTTraceEvent *copy) {
+    const MQTTTraceEvent *event = &(traceRing[position % TRACE_RING_SLOTS]);
+
+    if(event->sequence != position + 1) {
+        return 0;
+    }
+    __sync_synchronize();
+    copy->timestampUs = event->timestampUs;
+    copy->traceId = event->traceId;
+    copy->packetId = event->packetId;
+    copy->stage = event->stage;
+    __sync_synchronize();
+    return (event->sequence == position + 1 && copy->stage < TRACE_STAGES) ? 1 : 0;
+}
+
+/* Position of the latest event of the same message before position, or position itself if none */
+static uint32_t findPrevious(uint32_t first, uint32_t position, uint32_t traceId, MQTTTraceEvent *previous) {
+    uint32_t i = position;
+
+    while(i > first) {
+        i--;
+        if(readEvent(i, previous) && previous->traceId == traceId) {
+            return i;
+        }
+    }
+    return position;
+}
+
+MQTTReturnCode MQTTTraceDump(FILE *out, MQTTTraceFormat format) {
+    MQTTTraceEvent event, previous;
+    uint32_t head, first, i;
+    uint64_t baseUs = 0;
+    uint8_t hasBase = 0;
+    const char *separator = "";
+    const char *category;
+
+    if(NULL == out) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    head = __sync_fetch_and_add(&traceHead, 0);
+    first = (head > TRACE_RING_SLOTS) ? head - TRACE_RING_SLOTS : 0;
+
+    fprintf(out, (TRACE_FORMAT_CHROME == format) ? "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" : "[");
+    for(i = first; i < head; i++) {
+        if(!readEvent(i, &event)) {
+            continue;
+        }
+
+        if(TRACE_FORMAT_JSON == format) {
+            fprintf(out, "%s\n{\"traceId\":%u,\"packetId\":%u,\"stage\":\"%s\",\"timestamp_us\":%llu}", separator,
+                    event.traceId, event.packetId, stageNames[event.stage], (unsigned long long)event.timestampUs);
+            separator = ",";
+            continue;
+        }
+
+        /* Chrome wants small timestamps, they count from the oldest event */
+        if(!hasBase) {
+            baseUs = event.timestampUs;
+            hasBase = 1;
+        }
+        category = (event.stage < TRACE_RECEIVE_READ) ? "publish" : "receive";
+        if(findPrevious(first, i, event.traceId, &previous) == i || previous.timestampUs < baseUs
+           || previous.timestampUs > event.timestampUs) {
+            fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%llu,\"pid\":1,"
+                    "\"tid\":%u,\"args\":{\"packetId\":%u}}", separator, spanNames[event.stage], category,
+                    (unsigned long long)(event.timestampUs - baseUs), event.traceId, event.packetId);
+        } else {
+            fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":1,"
+                    "\"tid\":%u,\"args\":{\"packetId\":%u}}", separator, spanNames[event.stage], category,
+                    (unsigned long long)(previous.timestampUs - baseUs),
+                    (unsigned long long)(event.timestampUs - previous.timestampUs), event.traceId, event.packetId);
+        }
+        separator = ",";
+    }
+    fprintf(out, (TRACE_FORMAT_CHROME == format) ? "\n]}\n" : "\n]\n");
+
+    return ferror(out) ? FAILURE : SUCCESS;
+}
+
+void MQTTTraceReset(void) {
+    memset(traceRing, 0, sizeof(traceRing));
+    traceHead = 0;
+}
@@ -0,0 +1,93 @@
+/*******************************************************************************
+ * Copyright (c) 2014 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Sampled lifecycle trace points of published and received messages
+ *******************************************************************************/
+
+#ifndef __MQTT_TRACE_H
+#define __MQTT_TRACE_H
+
+#include "stdio.h"
+#include "stdint.h"
+
+#include "MQTTReturnCodes.h"
+#include "aws_iot_config.h"
+
+#define TRACE_EVENTS AWS_IOT_MQTT_TRACE_EVENTS
+#define TRACE_SAMPLE_RATE AWS_IOT_MQTT_TRACE_SAMPLE_RATE
+
+/*
+ * One in every TRACE_SAMPLE_RATE messages, published or received, gets a trace id and leaves a
+ * timestamped event at each stage it passes. Events of all clients and threads go into one ring of
+ * TRACE_EVENTS entries that writers claim with an atomic increment, the oldest are overwritten. A dump
+ * copies out the events that are complete, skipping those a writer is in the middle of, so it can run
+ * while messages are traced. The gaps between consecutive events of a message show where it waited.
+ */
+
+typedef enum {
+    TRACE_PUBLISH_START = 0,     /* MQTTPublish or MQTTPublishAsync was called */
+    TRACE_PUBLISH_SERIALIZED,    /* The PUBLISH packet is in the send buffer */
+    TRACE_PUBLISH_WRITE_START,   /* The first write including bytes of the packet was attempted */
+    TRACE_PUBLISH_WRITE_DONE,    /* The last byte of the packet was accepted by the network stack */
+    TRACE_PUBLISH_ACKED,         /* The PUBACK, or the PUBCOMP of a QoS2 publish, was received */
+    TRACE_RECEIVE_READ,          /* The first byte of a PUBLISH packet arrived */
+    TRACE_RECEIVE_PARSED,        /* The packet was read completely and deserialized */
+    TRACE_RECEIVE_DISPATCH,      /* The message passed its filter and its handler is called */
+    TRACE_RECEIVE_HANDLER_END,   /* The handler returned */
+    TRACE_STAGES
+} MQTTTraceStage;
+
+typedef enum {
+    TRACE_FORMAT_CHROME = 0,     /* Trace Event Format, one complete event per wait between two stages */
+    TRACE_FORMAT_JSON            /* Array of the recorded events as they are */
+} MQTTTraceFormat;
+
+typedef struct {
+    uint64_t timestampUs;
+    uint32_t traceId;
+    uint16_t packetId;           /* 0 for QoS0 messages and where the stage does not know it */
+    uint8_t stage;               /* MQTTTraceStage */
+    volatile uint32_t sequence;  /* Ring position + 1 once the event is complete, 0 while it is written */
+} MQTTTraceEvent;
+
+/**
+ * @brief Trace one in every sampleRate messages from now on, 0 stops tracing
+ */
+void MQTTSetTraceSampling(uint32_t sampleRate);
+
+uint8_t MQTTTraceIsEnabled(void);
+
+/**
+ * @brief Decide whether a new message is traced
+ *
+ * @return Its trace id, 0 if it is not sampled
+ */
+uint32_t MQTTTraceSample(void);
+
+/* Record a stage of a sampled message now, nothing for a trace id of 0 */
+void MQTTTraceRecord(uint32_t traceId, MQTTTraceStage stage, uint16_t packetId);
+
+/* Record a stage of a sampled message that was reached at timestampUs */
+void MQTTTraceRecordAt(uint32_t traceId, MQTTTraceStage stage, uint16_t packetId, uint64_t timestampUs);
+
+/**
+ * @brief Write the events in the ring, oldest first
+ *
+ * @return SUCCESS, FAILURE if writing to out failed
+ */
+MQTTReturnCode MQTTTraceDump(FILE *out, MQTTTraceFormat format);
+
+/* Drop all recorded events. Not safe against concurrent writers, stop sampling first */
+void MQTTTraceReset(void);
+
+#endif //__MQTT_TRACE_H
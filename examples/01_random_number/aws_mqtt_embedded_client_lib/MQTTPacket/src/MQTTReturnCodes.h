@@ -46,7 +46,11 @@ typedef enum {
     MQTT_CONNACK_SERVER_UNAVAILABLE_ERROR = -15,
     MQTT_CONNACK_BAD_USERDATA_ERROR = -16,
     MQTT_CONNACK_NOT_AUTHORIZED_ERROR = -17,
-	MQTT_BUFFER_RX_MESSAGE_INVALID = -18
+	MQTT_BUFFER_RX_MESSAGE_INVALID = -18,
+    MQTT_INFLIGHT_WINDOW_FULL = -19,
+    MQTT_WOULD_BLOCK = -20,
+    MQTT_FILTER_SYNTAX_ERROR = -21,
+    MQTT_RATE_LIMITED = -22
 }MQTTReturnCode;
 
 #endif //__MQTT_ERRORCODES_H
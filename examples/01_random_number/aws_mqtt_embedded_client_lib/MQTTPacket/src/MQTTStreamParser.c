@@ -0,0 +1,171 @@
+/*******************************************************************************
+ * Copyright (c) 2014 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Resumable incremental packet parser for non-blocking transports
+ *******************************************************************************/
+
+#include "StackTrace.h"
+#include "MQTTStreamParser.h"
+
+#include <string.h>
+
+#define MAX_NO_OF_REMAINING_LENGTH_BYTES 4
+
+void MQTTStreamParser_init(MQTTStreamParser *parser, unsigned char *buf, size_t bufSize, uint8_t emitSlices) {
+	parser->buf = buf;
+	parser->bufSize = bufSize;
+	parser->emitSlices = emitSlices;
+	MQTTStreamParser_reset(parser);
+}
+
+void MQTTStreamParser_reset(MQTTStreamParser *parser) {
+	parser->state = MQTT_STREAM_STATE_HEADER;
+	parser->bufLen = 0;
+	parser->remainingLength = 0;
+	parser->multiplier = 1;
+	parser->lengthBytes = 0;
+	parser->bodyDone = 0;
+}
+
+static void fillEventHeader(MQTTStreamParser *parser, MQTTStreamEvent *event) {
+	event->header.byte = parser->buf[0];
+	event->remainingLength = parser->remainingLength;
+}
+
+/* Called once the remaining length is known, decides how the body is handled */
+static void startBody(MQTTStreamParser *parser) {
+	parser->bodyDone = 0;
+	if(parser->bufLen + parser->remainingLength <= parser->bufSize) {
+		parser->state = MQTT_STREAM_STATE_BODY;
+	} else if(parser->emitSlices) {
+		parser->state = MQTT_STREAM_STATE_SLICES;
+	} else {
+		parser->state = MQTT_STREAM_STATE_DISCARD;
+	}
+}
+
+MQTTReturnCode MQTTStreamParser_feed(MQTTStreamParser *parser, const unsigned char *data, size_t len,
+									 size_t *consumed, MQTTStreamEvent *event) {
+	size_t pos = 0;
+	size_t chunk;
+	unsigned char c;
+	MQTTHeader header;
+
+	FUNC_ENTRY;
+	if(NULL == parser || NULL == consumed || NULL == event || (NULL == data && 0 != len)) {
+		FUNC_EXIT_RC(MQTT_NULL_VALUE_ERROR);
+		return MQTT_NULL_VALUE_ERROR;
+	}
+
+	event->type = MQTT_STREAM_EVENT_NONE;
+	*consumed = 0;
+
+	while(pos < len || (MQTT_STREAM_STATE_BODY == parser->state && parser->bodyDone == parser->remainingLength)) {
+		switch(parser->state) {
+			case MQTT_STREAM_STATE_HEADER:
+				header.byte = data[pos];
+				/* Types 0 and 15 are reserved */
+				if(0 == header.bits.type || 15 == header.bits.type) {
+					*consumed = pos + 1;
+					MQTTStreamParser_reset(parser);
+					FUNC_EXIT_RC(MQTT_BUFFER_RX_MESSAGE_INVALID);
+					return MQTT_BUFFER_RX_MESSAGE_INVALID;
+				}
+				parser->buf[0] = data[pos++];
+				parser->bufLen = 1;
+				parser->remainingLength = 0;
+				parser->multiplier = 1;
+				parser->lengthBytes = 0;
+				parser->state = MQTT_STREAM_STATE_LENGTH;
+				break;
+
+			case MQTT_STREAM_STATE_LENGTH:
+				c = data[pos++];
+				if(++parser->lengthBytes > MAX_NO_OF_REMAINING_LENGTH_BYTES || parser->bufLen >= parser->bufSize) {
+					*consumed = pos;
+					MQTTStreamParser_reset(parser);
+					FUNC_EXIT_RC(MQTTPACKET_READ_ERROR);
+					return MQTTPACKET_READ_ERROR;
+				}
+				parser->buf[parser->bufLen++] = c;
+				parser->remainingLength += (c & 127) * parser->multiplier;
+				parser->multiplier *= 128;
+				if(0 == (c & 128)) {
+					startBody(parser);
+				}
+				break;
+
+			case MQTT_STREAM_STATE_BODY:
+				chunk = parser->remainingLength - parser->bodyDone;
+				if(chunk > len - pos) {
+					chunk = len - pos;
+				}
+				if(0 != chunk) {
+					memcpy(parser->buf + parser->bufLen, data + pos, chunk);
+					parser->bufLen += chunk;
+					parser->bodyDone += (uint32_t)chunk;
+					pos += chunk;
+				}
+				if(parser->bodyDone == parser->remainingLength) {
+					fillEventHeader(parser, event);
+					event->type = MQTT_STREAM_EVENT_PACKET;
+					event->packet = parser->buf;
+					event->packetLen = parser->bufLen;
+					parser->state = MQTT_STREAM_STATE_HEADER;
+					*consumed = pos;
+					FUNC_EXIT_RC(SUCCESS);
+					return SUCCESS;
+				}
+				break;
+
+			case MQTT_STREAM_STATE_SLICES:
+				chunk = parser->remainingLength - parser->bodyDone;
+				if(chunk > len - pos) {
+					chunk = len - pos;
+				}
+				fillEventHeader(parser, event);
+				event->type = MQTT_STREAM_EVENT_BODY_SLICE;
+				event->slice = data + pos;
+				event->sliceLen = chunk;
+				event->sliceOffset = parser->bodyDone;
+				parser->bodyDone += (uint32_t)chunk;
+				pos += chunk;
+				event->isLastSlice = (parser->bodyDone == parser->remainingLength) ? 1 : 0;
+				if(event->isLastSlice) {
+					parser->state = MQTT_STREAM_STATE_HEADER;
+				}
+				*consumed = pos;
+				FUNC_EXIT_RC(SUCCESS);
+				return SUCCESS;
+
+			case MQTT_STREAM_STATE_DISCARD:
+				chunk = parser->remainingLength - parser->bodyDone;
+				if(chunk > len - pos) {
+					chunk = len - pos;
+				}
+				parser->bodyDone += (uint32_t)chunk;
+				pos += chunk;
+				if(parser->bodyDone == parser->remainingLength) {
+					parser->state = MQTT_STREAM_STATE_HEADER;
+					*consumed = pos;
+					FUNC_EXIT_RC(MQTTPACKET_BUFFER_TOO_SHORT);
+					return MQTTPACKET_BUFFER_TOO_SHORT;
+				}
+				break;
+		}
+	}
+
+	*consumed = pos;
+	FUNC_EXIT_RC(SUCCESS);
+	return SUCCESS;
+}
@@ -0,0 +1,114 @@
+/*******************************************************************************
+ * Copyright (c) 2014 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Resumable incremental packet parser for non-blocking transports
+ *******************************************************************************/
+
+#ifndef MQTTSTREAMPARSER_H_
+#define MQTTSTREAMPARSER_H_
+
+#if defined(__cplusplus) /* If this is a C++ compiler, use C linkage */
+extern "C" {
+#endif
+
+#include "MQTTPacket.h"
+
+/**
+ * Where the parser is within the current packet
+ */
+typedef enum {
+	MQTT_STREAM_STATE_HEADER,	/**< waiting for the fixed header byte */
+	MQTT_STREAM_STATE_LENGTH,	/**< reading the variable length remaining length */
+	MQTT_STREAM_STATE_BODY,		/**< reading remaining length bytes into the buffer */
+	MQTT_STREAM_STATE_SLICES,	/**< passing the body of an oversized packet through as slices */
+	MQTT_STREAM_STATE_DISCARD	/**< skipping the body of an oversized packet */
+} MQTTStreamParserState;
+
+/**
+ * What, if anything, a call to MQTTStreamParser_feed produced
+ */
+typedef enum {
+	MQTT_STREAM_EVENT_NONE,			/**< all input consumed, the current packet is still incomplete */
+	MQTT_STREAM_EVENT_PACKET,		/**< a complete packet is available */
+	MQTT_STREAM_EVENT_BODY_SLICE	/**< the next part of the body of a packet bigger than the buffer */
+} MQTTStreamEventType;
+
+/**
+ * Output of MQTTStreamParser_feed
+ */
+typedef struct {
+	MQTTStreamEventType type;
+	MQTTHeader header;				/**< fixed header of the packet */
+	uint32_t remainingLength;		/**< body length of the packet */
+	const unsigned char *packet;	/**< PACKET: the whole packet, fixed header included, ready for MQTTDeserialize_* */
+	size_t packetLen;
+	const unsigned char *slice;		/**< BODY_SLICE: body bytes, points into the caller's input */
+	size_t sliceLen;
+	uint32_t sliceOffset;			/**< BODY_SLICE: offset of the slice within the body */
+	uint8_t isLastSlice;			/**< BODY_SLICE: set on the slice completing the body */
+} MQTTStreamEvent;
+
+/**
+ * Parser state, kept by the caller between reads
+ */
+typedef struct {
+	MQTTStreamParserState state;
+	unsigned char *buf;				/**< packet assembly buffer */
+	size_t bufSize;
+	uint8_t emitSlices;				/**< oversized packets are passed through as slices instead of being skipped */
+	size_t bufLen;					/**< bytes of the current packet in buf */
+	uint32_t remainingLength;
+	uint32_t multiplier;
+	uint8_t lengthBytes;
+	uint32_t bodyDone;				/**< body bytes received so far */
+} MQTTStreamParser;
+
+/**
+ * Prepare a parser
+ * @param parser the parser to initialize
+ * @param buf buffer complete packets are assembled in
+ * @param bufSize size of buf, packets bigger than this are sliced or skipped
+ * @param emitSlices 1 = deliver oversized packets as body slices, 0 = skip them and report MQTTPACKET_BUFFER_TOO_SHORT
+ */
+void MQTTStreamParser_init(MQTTStreamParser *parser, unsigned char *buf, size_t bufSize, uint8_t emitSlices);
+
+/**
+ * Drop any partially parsed packet, e.g. after the connection was reset
+ * @param parser the parser to reset
+ */
+void MQTTStreamParser_reset(MQTTStreamParser *parser);
+
+/**
+ * Feed received bytes into the parser
+ *
+ * Consumes input until an event is produced or the input is exhausted. Call again with the
+ * unconsumed rest of the input until it is all consumed. A PACKET event's data stays valid until
+ * the next call; a BODY_SLICE points into data.
+ *
+ * @param parser the parser
+ * @param data received bytes
+ * @param len number of received bytes
+ * @param consumed returns how many bytes of data were used
+ * @param event returns what was produced
+ * @return SUCCESS, MQTTPACKET_READ_ERROR for a malformed remaining length, MQTT_BUFFER_RX_MESSAGE_INVALID
+ * for an invalid packet type, or MQTTPACKET_BUFFER_TOO_SHORT once an oversized packet has been skipped.
+ * After an error other than MQTTPACKET_BUFFER_TOO_SHORT the stream is out of sync and the connection should be dropped.
+ */
+MQTTReturnCode MQTTStreamParser_feed(MQTTStreamParser *parser, const unsigned char *data, size_t len,
+									 size_t *consumed, MQTTStreamEvent *event);
+
+#ifdef __cplusplus /* If this is a C++ compiler, use C linkage */
+}
+#endif
+
+#endif /* MQTTSTREAMPARSER_H_ */
@@ -36,6 +36,59 @@
 #define AWS_IOT_MQTT_TX_BUF_LEN 512 ///< Any time a message is sent out through the MQTT layer. The message is copied into this buffer anytime a publish is done. This will also be used in the case of Thing Shadow
 #define AWS_IOT_MQTT_RX_BUF_LEN 512 ///< Any message that comes into the device should be less than this buffer size. If a received message is bigger than this buffer size the message will be dropped.
 #define AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS 5 ///< Maximum number of topic filters the MQTT client can handle at any given time. This should be increased appropriately when using Thing Shadow
+#define AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH 16 ///< Maximum number of QoS 1 messages published with aws_iot_mqtt_publish_async that may be awaiting a PUBACK at the same time
+#define AWS_IOT_MQTT_SEND_QUEUE_SIZE 8192 ///< Bytes of serialized packets aws_iot_mqtt_publish_async can queue while the socket is not writable. 0 makes asynchronous publishes write synchronously
+#define AWS_IOT_MQTT_SEND_QUEUE_HIGH_WATER_MARK 4096 ///< Once this many bytes are queued aws_iot_mqtt_publish_async returns PUBLISH_WOULD_BLOCK until yield has drained the queue below it
+#define AWS_IOT_MQTT_AUTO_CORK_LATENCY_BUDGET_MS 0 ///< Publishes are held in the send queue up to this long so several share one TLS record. 0 turns auto-cork off, it needs AWS_IOT_MQTT_SEND_QUEUE_SIZE > 0
+#define AWS_IOT_MQTT_AUTO_CORK_FLUSH_BYTES 1024 ///< Held publishes are written as soon as this many bytes are queued. Blocks of the send queue are gathered into writes of up to this many bytes, each one TLS record
+#define AWS_IOT_MQTT_KEEPALIVE_SLACK_MS 2000 ///< Keepalive pings may go out this much late so they share a wakeup with other timers of the process, and the multi-connection scheduler sends pings due within this together. At most a quarter of the keepalive interval is used
+#define AWS_IOT_MQTT_RECONNECT_SLACK_PERCENT 10 ///< Reconnect attempts may start this share of the back-off interval late so they share a wakeup with other timers of the process
+#define AWS_IOT_MQTT_FILTER_MAX_INSTRUCTIONS 16 ///< Comparisons and operators a subscription payload filter may compile to, each subscription reserves room for this many
+#define AWS_IOT_MQTT_FILTER_MAX_TEXT_LEN 96 ///< Bytes of field paths and string literals a subscription payload filter may hold
+
+// Publish rate control specific configs
+#define AWS_IOT_MQTT_RATE_CONTROL_MAX_RATE 0 ///< Publishes per second the adaptive rate control may grow to. 0 turns it off, publishing is then only limited by AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH
+#define AWS_IOT_MQTT_RATE_CONTROL_MIN_RATE 1 ///< Publishes per second the rate is never cut below
+#define AWS_IOT_MQTT_RATE_CONTROL_RATE_STEP 2 ///< Publishes per second the rate grows by each time a full in-flight window is acknowledged without the PUBACK latency rising
+#define AWS_IOT_MQTT_RATE_CONTROL_DECREASE_PERCENT 50 ///< Share of the rate and in-flight window kept after rising PUBACK latency, a missing PUBACK or a disconnect while publishing
+#define AWS_IOT_MQTT_RATE_CONTROL_LATENCY_TOLERANCE_PERCENT 50 ///< How far above the lowest PUBACK latency seen the smoothed latency may rise before the rate is cut
+#define AWS_IOT_MQTT_RATE_CONTROL_ACK_TIMEOUT_MS 5000 ///< A PUBACK missing for this long cuts the rate
+#define AWS_IOT_MQTT_RATE_CONTROL_DISCONNECT_WINDOW_MS 2000 ///< A disconnect within this long after a publish is taken as throttling by the broker and cuts the rate
+
+// Message lifecycle tracing specific configs
+#define AWS_IOT_MQTT_TRACE_EVENTS 512 ///< Trace events the process keeps, the oldest are overwritten. Each published message leaves up to five, each received one four. 0 compiles tracing out
+#define AWS_IOT_MQTT_TRACE_SAMPLE_RATE 0 ///< One in this many published and received messages is traced. 0 turns tracing off until aws_iot_mqtt_set_trace_sampling is called
+
+// Multi-connection scheduler specific configs
+#define AWS_IOT_MQTT_SCHEDULER_QUANTUM_BYTES 2048 ///< Bytes each connection may read per scheduler round. Larger quanta favour throughput, smaller ones latency
+#define AWS_IOT_MQTT_SCHEDULER_MAX_PACKETS_PER_TURN 8 ///< Packets each connection may handle per scheduler round, however small they are
+#define AWS_IOT_MQTT_SCHEDULER_STARVATION_MS 100 ///< A connection with input pending that waits longer than this for its turn is counted as starved
+#define AWS_IOT_MQTT_SCHEDULER_IDLE_WAIT_MS 50 ///< Longest pause after a round in which no connection had anything to read, while a timer handler is installed. Without one the pause lasts until input arrives or a keepalive, reconnect or auto-cork deadline is due
+
+// TLS session cache specific configs
+#define AWS_IOT_TLS_SESSION_CACHE_ENTRIES 8 ///< Endpoint and client certificate combinations the TLS session cache file holds a session for
+#define AWS_IOT_TLS_SESSION_CACHE_MAX_SESSION_LEN 4096 ///< Largest encoded TLS session, including the server certificate chain and session ticket, that is cached
+
+// TLS record sizing specific configs
+#define AWS_IOT_TLS_RECORD_MIN_SIZE 1400 ///< Payload size of TLS records after connecting and after an idle period, about one TCP segment so the first bytes can be decrypted without waiting for more. 0 always uses AWS_IOT_TLS_RECORD_MAX_SIZE
+#define AWS_IOT_TLS_RECORD_MAX_SIZE 16384 ///< Largest TLS record payload during sustained transfers, at most 16384. OpenSSL does not go below 512
+#define AWS_IOT_TLS_RECORD_GROWTH_BYTES 16384 ///< Bytes sent at one record size before the size doubles
+#define AWS_IOT_TLS_RECORD_IDLE_RESET_MS 1000 ///< A pause in sending longer than this starts again at AWS_IOT_TLS_RECORD_MIN_SIZE
+
+// Request/response engine specific configs
+#define AWS_IOT_REQUEST_MAX_PENDING 32 ///< Requests one request engine can track at the same time. Must be at least MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME and AWS_IOT_SHADOW_BULK_GET_MAX_WINDOW when using Thing Shadow
+#define AWS_IOT_REQUEST_MAX_CORRELATION_ID_LEN 96 ///< Longest correlation id, including the terminating null. Must be at least MAX_SIZE_CLIENT_ID_WITH_SEQUENCE when using Thing Shadow
+#define AWS_IOT_REQUEST_TIMER_WHEEL_SLOTS 64 ///< Slots of the timer wheel holding request timeouts. Timeouts longer than slots times tick cost one extra check per revolution
+#define AWS_IOT_REQUEST_TIMER_WHEEL_TICK_MS 50 ///< Resolution of request timeouts. A request times out up to one tick after its timeout
+
+// Callback stall watchdog specific configs
+#define AWS_IOT_MQTT_MESSAGE_HANDLER_BUDGET_MS 50 ///< A subscription callback running longer than this is reported as a warning with its topic and subscription
+#define AWS_IOT_MQTT_DISCONNECT_HANDLER_BUDGET_MS 500 ///< A disconnect callback running longer than this is reported as a warning
+#define AWS_IOT_MQTT_YIELD_WATCHDOG_MARGIN_PERCENT 50 ///< A single yield iteration taking longer than this share of the keepalive interval is reported, as it risks missing the PINGRESP
+
+// Fragmented transfer specific configs
+#define AWS_IOT_FRAGMENT_DEFAULT_WINDOW 8 ///< Default number of unacknowledged chunks a fragmented transfer keeps in flight. Must not exceed AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH
+#define AWS_IOT_FRAGMENT_YIELD_TIMEOUT_MS 5 ///< Time given to the MQTT client to process PUBACKs each time the transfer window is full
 
 // Thing Shadow specific configs
 #define SHADOW_MAX_SIZE_OF_RX_BUFFER AWS_IOT_MQTT_RX_BUF_LEN+1 ///< Maximum size of the SHADOW buffer to store the received Shadow message
@@ -48,6 +101,32 @@
 #define MAX_SHADOW_TOPIC_LENGTH_WITHOUT_THINGNAME 60 ///< All shadow actions have to be published or subscribed to a topic which is of the format $aws/things/{thingName}/shadow/update/accepted. This refers to the size of the topic without the Thing Name
 #define MAX_SIZE_OF_THING_NAME 20 ///< The Thing Name should not be bigger than this value. Modify this if the Thing Name needs to be bigger
 #define MAX_SHADOW_TOPIC_LENGTH_BYTES MAX_SHADOW_TOPIC_LENGTH_WITHOUT_THINGNAME + MAX_SIZE_OF_THING_NAME ///< This size includes the length of topic with Thing Name
+#define AWS_IOT_SHADOW_BULK_GET_MAX_WINDOW 32 ///< Maximum number of GET requests aws_iot_shadow_bulk_get keeps waiting for a response at the same time
+#define AWS_IOT_SHADOW_BULK_GET_YIELD_TIMEOUT_MS 10 ///< Time given to the MQTT client to receive responses each time aws_iot_shadow_bulk_get has filled its window
+#define AWS_IOT_SHADOW_BULK_GET_SETTLE_MS 2000 ///< Time responses are processed after subscribing to the wildcard response topics, before the first GET is sent
+#define AWS_IOT_SHADOW_CONFLICT_RETRY_SLOTS 4 ///< Updates that can wait for a version conflict retry at the same time. Further updates are sent without the retry policy
+#define AWS_IOT_SHADOW_EMULATOR_MAX_THINGS 16 ///< Shadows the shadow service emulator holds. Updates of further things are rejected with error code 500
+#define AWS_IOT_SHADOW_EMULATOR_MAX_STATE_LEN 256 ///< Size of the desired and of the reported section of every emulated shadow. Updates that do not fit are rejected with error code 413
+#define AWS_IOT_SHADOW_EMULATOR_QUEUE_DEPTH 32 ///< Responses and deltas the emulator holds until their delivery time. Further messages are discarded and counted
+#define AWS_IOT_SHADOW_STATE_MAX_FIELDS 16 ///< Fields a shadow state store can hold
+#define AWS_IOT_SHADOW_STATE_MAX_BYTES 512 ///< Size of the values of a shadow state store and of its snapshots, a multiple of 8. Every value takes its size rounded up to 8 bytes
+#define AWS_IOT_SHADOW_STATE_READ_RETRIES 1000 ///< Copies a reader of a shadow state store attempts while updates keep running before it gives up
+#define AWS_IOT_SHADOW_OFFLINE_MAX_THINGS 4 ///< Things whose updates made while disconnected are collapsed into one pending update, sent after reconnecting. 0 makes aws_iot_shadow_update fail with CONNECTION_ERROR while disconnected
+#define AWS_IOT_SHADOW_OFFLINE_MAX_FIELDS 16 ///< Values the pending update of each thing can hold, counting every member of nested objects separately
+#define AWS_IOT_SHADOW_OFFLINE_BUFFER_LEN 256 ///< Bytes of member names and values the pending update of each thing can hold
+
+// Topic statistics specific configs
+#define AWS_IOT_TOPIC_STATS_SKETCH_DEPTH 4 ///< Rows of the count-min sketch. More rows lower the chance of overestimating a topic
+#define AWS_IOT_TOPIC_STATS_SKETCH_WIDTH 256 ///< Counters per count-min sketch row, must be a power of two. Wider rows lower the overestimation
+#define AWS_IOT_TOPIC_STATS_TOP_K 16 ///< Number of heaviest topics tracked by name, per ranking
+#define AWS_IOT_TOPIC_STATS_MAX_TOPIC_LEN 64 ///< Longest topic name kept in a top-K entry, longer names are truncated
+
+// Message log specific configs
+#define AWS_IOT_MESSAGE_LOG_SEGMENT_SIZE (64 * 1024 * 1024) ///< Size every message log segment file is preallocated to. A segment rolls over once the next record does not fit
+#define AWS_IOT_MESSAGE_LOG_SEGMENT_MAX_AGE_SEC 3600 ///< A segment also rolls over once its first record is older than this
+#define AWS_IOT_MESSAGE_LOG_INDEX_ENTRIES 1024 ///< Number of sparse time index entries per segment. One entry is added every segment size / entries bytes
+#define AWS_IOT_MESSAGE_LOG_MAX_TOPICS 64 ///< Maximum number of distinct topics a message log can assign ids to
+#define AWS_IOT_MESSAGE_LOG_MAX_TOPIC_LEN 128 ///< Longest topic name stored in the message log topic table, longer names are truncated
 
 // Auto Reconnect specific config
 #define AWS_IOT_MQTT_MIN_RECONNECT_WAIT_INTERVAL 1000 ///< Minimum time before the First reconnect attempt is made as part of the exponential back-off algorithm
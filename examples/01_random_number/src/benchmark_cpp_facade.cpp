@@ -0,0 +1,254 @@
+/*
+ * Measures the cost of the C++ facade in aws_iot_mqtt_client.hpp against the C calls it wraps.
+ * Both run against the same in-process client table that stores subscriptions the way the C client
+ * does and hands each message to the stored iot_message_handler, so the difference is the facade
+ * alone: a C callback against a lambda reached through the generated trampoline, and subscribe and
+ * unsubscribe calls against Session::subscribe and the Subscription destructor.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include <string.h>
+
+#include "aws_iot_mqtt_client.hpp"
+
+extern "C" {
+#include "aws_iot_log.h"
+#include "aws_iot_version.h"
+#include "aws_iot_config.h"
+#include "timer_interface.h"
+}
+
+
+// ============================================================================
+// Global variables
+// ============================================================================
+
+// Messages dispatched and subscriptions made per measurement
+uint32_t iterationCount = 10000000;
+
+static constexpr char kTopic[] = "sample-application/+/reading";
+
+// Topic and payload every dispatched message carries
+static char messageTopic[] = "sample-application/sensor-7/reading";
+static char messagePayload[] = "{\"value\":21.5}";
+
+// The subscription the benchmark client table holds, one like the C client with a single handler
+static char *pSubscribedTopic;
+static iot_message_handler subscribedHandler;
+
+// Keeps the compiler from dropping the measured work
+volatile size_t sink;
+
+
+// ============================================================================
+// Benchmark client table
+// ============================================================================
+
+static IoT_Error_t benchmarkConnect(MQTTConnectParams *pParams) {
+	(void) pParams;
+	return NONE_ERROR;
+}
+
+static IoT_Error_t benchmarkSubscribe(MQTTSubscribeParams *pParams) {
+	if (NULL != subscribedHandler) {
+		return SUBSCRIBE_ERROR;
+	}
+	pSubscribedTopic = pParams->pTopic;
+	subscribedHandler = pParams->mHandler;
+	return NONE_ERROR;
+}
+
+static IoT_Error_t benchmarkUnsubscribe(char *pTopic) {
+	if (pTopic != pSubscribedTopic) {
+		return UNSUBSCRIBE_ERROR;
+	}
+	pSubscribedTopic = NULL;
+	subscribedHandler = NULL;
+	return NONE_ERROR;
+}
+
+static IoT_Error_t benchmarkDisconnect(void) {
+	return NONE_ERROR;
+}
+
+// Delivers timeout messages to the subscription, as many yields of the C client would
+static IoT_Error_t benchmarkYield(int timeout) {
+	MQTTCallbackParams params = MQTTCallbackParamsDefault;
+	int i;
+
+	params.pTopicName = messageTopic;
+	params.TopicNameLen = (uint16_t) strlen(messageTopic);
+	params.MessageParams.qos = QOS_0;
+	params.MessageParams.pPayload = messagePayload;
+	params.MessageParams.PayloadLen = (uint32_t) strlen(messagePayload);
+
+	for (i = 0; i < timeout; i++) {
+		subscribedHandler(params);
+	}
+	return NONE_ERROR;
+}
+
+static bool benchmarkIsConnected(void) {
+	return true;
+}
+
+static MQTTClient_t makeBenchmarkClient(void) {
+	MQTTClient_t table;
+
+	memset(&table, 0, sizeof(table));
+	table.connect = benchmarkConnect;
+	table.subscribe = benchmarkSubscribe;
+	table.unsubscribe = benchmarkUnsubscribe;
+	table.disconnect = benchmarkDisconnect;
+	table.yield = benchmarkYield;
+	table.isConnected = benchmarkIsConnected;
+	return table;
+}
+
+
+// ============================================================================
+// Functions
+// ============================================================================
+
+// The C handler, doing what the lambda does
+static int32_t cMessageHandler(MQTTCallbackParams params) {
+	sink += params.MessageParams.PayloadLen + params.TopicNameLen;
+	return 0;
+}
+
+static void printResult(const char *pPhase, uint64_t c_us, uint64_t cpp_us, uint32_t count) {
+	INFO("%-10s C %6llu ns, C++ %6llu ns per operation", pPhase,
+			(unsigned long long) (c_us * 1000 / count), (unsigned long long) (cpp_us * 1000 / count));
+}
+
+IoT_Error_t runDispatchPhase(awsiot::Client &client) {
+	const MQTTClient_t &table = client.functions();
+	MQTTSubscribeParams subParams = MQTTSubscribeParamsDefault;
+	uint64_t startTime_us, c_us, cpp_us;
+	IoT_Error_t rc;
+
+	subParams.pTopic = const_cast<char *>(kTopic);
+	subParams.qos = QOS_0;
+	subParams.mHandler = cMessageHandler;
+	rc = table.subscribe(&subParams);
+	if (NONE_ERROR != rc) {
+		ERROR("Error(%d) subscribing the C handler", rc);
+		return rc;
+	}
+	startTime_us = timestamp_us();
+	table.yield((int) iterationCount);
+	c_us = timestamp_us() - startTime_us;
+	table.unsubscribe(const_cast<char *>(kTopic));
+
+	awsiot::Session session(client, MQTTConnectParamsDefault);
+	auto subscription = session.subscribe<kTopic>([](awsiot::MessageView msg) {
+		sink += msg.size() + msg.topic().size();
+	});
+	if (NONE_ERROR != subscription.status()) {
+		ERROR("Error(%d) subscribing the C++ handler", subscription.status());
+		return subscription.status();
+	}
+	startTime_us = timestamp_us();
+	session.yield((int) iterationCount);
+	cpp_us = timestamp_us() - startTime_us;
+
+	printResult("dispatch", c_us, cpp_us, iterationCount);
+	return NONE_ERROR;
+}
+
+IoT_Error_t runSubscribePhase(awsiot::Client &client) {
+	const MQTTClient_t &table = client.functions();
+	MQTTSubscribeParams subParams = MQTTSubscribeParamsDefault;
+	uint64_t startTime_us, c_us, cpp_us;
+	uint32_t count = iterationCount / 10;
+	uint32_t i;
+	IoT_Error_t rc = NONE_ERROR;
+
+	startTime_us = timestamp_us();
+	for (i = 0; NONE_ERROR == rc && i < count; i++) {
+		subParams.pTopic = const_cast<char *>(kTopic);
+		subParams.qos = QOS_0;
+		subParams.mHandler = cMessageHandler;
+		rc = table.subscribe(&subParams);
+		if (NONE_ERROR == rc) {
+			rc = table.unsubscribe(const_cast<char *>(kTopic));
+		}
+	}
+	c_us = timestamp_us() - startTime_us;
+	if (NONE_ERROR != rc) {
+		ERROR("Error(%d) in the C subscribe cycle", rc);
+		return rc;
+	}
+
+	awsiot::Session session(client, MQTTConnectParamsDefault);
+	startTime_us = timestamp_us();
+	for (i = 0; NONE_ERROR == rc && i < count; i++) {
+		auto subscription = session.subscribe<kTopic>([](awsiot::MessageView msg) {
+			sink += msg.size() + msg.topic().size();
+		});
+		rc = subscription.status();
+	}
+	cpp_us = timestamp_us() - startTime_us;
+	if (NONE_ERROR != rc) {
+		ERROR("Error(%d) in the C++ subscribe cycle", rc);
+		return rc;
+	}
+
+	printResult("subscribe", c_us, cpp_us, count);
+	return NONE_ERROR;
+}
+
+// Parse the command line arguments containing the benchmark parameters
+void parseInputArgsForBenchmarkParams(int argc, char** argv) {
+	int opt;
+
+	while (-1 != (opt = getopt(argc, argv, "n:"))) {
+		switch (opt) {
+		case 'n':
+			iterationCount = atoi(optarg);
+			DEBUG("iterations %s", optarg);
+			break;
+		case '?':
+			if (isprint(optopt)) {
+				WARN("Unknown option `-%c'.", optopt);
+			} else {
+				WARN("Unknown option character `\\x%x'.", optopt);
+			}
+			break;
+		default:
+			ERROR("Error in command line argument parsing");
+			break;
+		}
+	}
+}
+
+
+// ============================================================================
+// Main function
+// ============================================================================
+
+int main(int argc, char** argv) {
+	IoT_Error_t rc;
+
+	parseInputArgsForBenchmarkParams(argc, argv);
+
+	INFO("\nAWS IoT SDK Version %d.%d.%d-%s\n", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH, VERSION_TAG);
+
+	if (iterationCount < 10) {
+		ERROR("At least 10 iterations are needed");
+		return GENERIC_ERROR;
+	}
+
+	awsiot::Client client(makeBenchmarkClient());
+
+	rc = runDispatchPhase(client);
+	if (NONE_ERROR == rc) {
+		rc = runSubscribePhase(client);
+	}
+
+	return rc;
+}
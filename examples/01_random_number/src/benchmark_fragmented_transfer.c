@@ -0,0 +1,237 @@
+/*
+ * Measures the throughput of fragmented transfers. A blob is published in chunks on a
+ * topic the application is itself subscribed to, so every chunk travels through the broker
+ * and is reassembled locally. Point it at a local broker (-h/-p) to measure client overhead
+ * rather than WAN latency.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include <memory.h>
+#include <limits.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_version.h"
+#include "aws_iot_mqtt_interface.h"
+#include "aws_iot_fragment_interface.h"
+#include "aws_iot_config.h"
+#include "timer_interface.h"
+
+
+// ============================================================================
+// Global variables
+// ============================================================================
+
+// Default cert location
+char certDirectory[PATH_MAX + 1] = "../../certs";
+
+// Default MQTT HOST URL is pulled from the aws_iot_config.h
+char HostAddress[255] = AWS_IOT_MQTT_HOST;
+
+// Default MQTT port is pulled from the aws_iot_config.h
+uint32_t port = AWS_IOT_MQTT_PORT;
+
+// Size of the generated blob in KB
+uint32_t blobSizeKB = 1024;
+
+// Number of unacknowledged chunks
+uint32_t windowSize = AWS_IOT_FRAGMENT_DEFAULT_WINDOW;
+
+// Reassembly state shared with the subscribe callback
+FragmentReassembler reassembler;
+
+
+// ============================================================================
+// Functions
+// ============================================================================
+
+// MQTT message received callback handler, every message is a chunk of the transfer
+int mqttChunkReceivedCallbackHandler(MQTTCallbackParams params) {
+	IoT_Error_t rc = aws_iot_fragment_reassembler_feed(&reassembler, params.MessageParams.pPayload,
+			params.MessageParams.PayloadLen);
+
+	if (NONE_ERROR != rc && FRAGMENT_TRANSFER_COMPLETE != rc) {
+		WARN("Chunk rejected - %d", rc);
+	}
+
+	return 0;
+}
+
+// Parse the command line arguments containing connection details
+void parseInputArgsForConnectParams(int argc, char** argv) {
+	int opt;
+
+	while (-1 != (opt = getopt(argc, argv, "h:p:c:s:w:"))) {
+		switch (opt) {
+		case 'h':
+			strcpy(HostAddress, optarg);
+			DEBUG("Host %s", optarg);
+			break;
+		case 'p':
+			port = atoi(optarg);
+			DEBUG("arg %s", optarg);
+			break;
+		case 'c':
+			strcpy(certDirectory, optarg);
+			DEBUG("cert root directory %s", optarg);
+			break;
+		case 's':
+			blobSizeKB = atoi(optarg);
+			DEBUG("blob size %s KB", optarg);
+			break;
+		case 'w':
+			windowSize = atoi(optarg);
+			DEBUG("window %s", optarg);
+			break;
+		case '?':
+			if (optopt == 'c') {
+				ERROR("Option -%c requires an argument.", optopt);
+			} else if (isprint(optopt)) {
+				WARN("Unknown option `-%c'.", optopt);
+			} else {
+				WARN("Unknown option character `\\x%x'.", optopt);
+			}
+			break;
+		default:
+			ERROR("Error in command line argument parsing");
+			break;
+		}
+	}
+}
+
+
+// ============================================================================
+// Main function
+// ============================================================================
+
+int main(int argc, char** argv) {
+	IoT_Error_t rc = NONE_ERROR;
+	MQTTClient_t mqttClient;
+
+	char rootCA[PATH_MAX + 1];
+	char clientCRT[PATH_MAX + 1];
+	char clientKey[PATH_MAX + 1];
+	char CurrentWD[PATH_MAX + 1];
+	char cafileName[] = AWS_IOT_ROOT_CA_FILENAME;
+	char clientCRTName[] = AWS_IOT_CERTIFICATE_FILENAME;
+	char clientKeyName[] = AWS_IOT_PRIVATE_KEY_FILENAME;
+
+	uint8_t *pBlob;
+	uint8_t *pReassemblyBuffer;
+	uint32_t *pBitmap;
+	uint32_t blobSize;
+	uint32_t i;
+	uint64_t startTime_us;
+	uint64_t elapsed_us;
+	FragmentPublishParams fragmentParams = FragmentPublishParamsDefault;
+	FragmentTransferStats stats;
+	Timer drainTimer;
+
+	parseInputArgsForConnectParams(argc, argv);
+
+	INFO("\nAWS IoT SDK Version %d.%d.%d-%s\n", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH, VERSION_TAG);
+
+	getcwd(CurrentWD, sizeof(CurrentWD));
+	sprintf(rootCA, "%s/%s/%s", CurrentWD, certDirectory, cafileName);
+	sprintf(clientCRT, "%s/%s/%s", CurrentWD, certDirectory, clientCRTName);
+	sprintf(clientKey, "%s/%s/%s", CurrentWD, certDirectory, clientKeyName);
+
+	// Prepare the blob and the reassembly buffers, one bit per chunk of at least one byte
+	blobSize = blobSizeKB * 1024;
+	pBlob = (uint8_t *) malloc(blobSize);
+	pReassemblyBuffer = (uint8_t *) malloc(blobSize);
+	pBitmap = (uint32_t *) calloc(blobSize / 32 + 1, sizeof(uint32_t));
+	if (NULL == pBlob || NULL == pReassemblyBuffer || NULL == pBitmap) {
+		ERROR("Unable to allocate %u bytes", blobSize);
+		return GENERIC_ERROR;
+	}
+	for (i = 0; i < blobSize; i++) {
+		pBlob[i] = (uint8_t) rand();
+	}
+	aws_iot_fragment_reassembler_init(&reassembler, pReassemblyBuffer, blobSize, pBitmap, blobSize / 32 + 1);
+
+	MQTTConnectParams connectParams = MQTTConnectParamsDefault;
+
+	connectParams.KeepAliveInterval_sec = 10;
+	connectParams.isCleansession = true;
+	connectParams.MQTTVersion = MQTT_3_1_1;
+	connectParams.pClientID = "benchmark-fragmented-transfer-application";
+	connectParams.pHostURL = HostAddress;
+	connectParams.port = port;
+	connectParams.isWillMsgPresent = false;
+	connectParams.pRootCALocation = rootCA;
+	connectParams.pDeviceCertLocation = clientCRT;
+	connectParams.pDevicePrivateKeyLocation = clientKey;
+	connectParams.mqttCommandTimeout_ms = 2000;
+	connectParams.tlsHandshakeTimeout_ms = 5000;
+	connectParams.isSSLHostnameVerify = true; // ensure this is set to true for production
+
+	aws_iot_mqtt_init(&mqttClient);
+
+	INFO("Connecting...");
+	rc = mqttClient.connect(&connectParams);
+	if (NONE_ERROR != rc) {
+		ERROR("Error(%d) connecting to %s:%d", rc, connectParams.pHostURL, connectParams.port);
+		return rc;
+	}
+
+	MQTTSubscribeParams subParams = MQTTSubscribeParamsDefault;
+	subParams.mHandler = mqttChunkReceivedCallbackHandler;
+	subParams.pTopic = "sample-application/fragmented-transfer";
+	subParams.qos = QOS_1;
+
+	rc = mqttClient.subscribe(&subParams);
+	if (NONE_ERROR != rc) {
+		ERROR("Error subscribing");
+		return rc;
+	}
+
+	fragmentParams.pTopic = subParams.pTopic;
+	fragmentParams.transferId = 1;
+	fragmentParams.windowSize = windowSize;
+
+	INFO("Sending %u KB with a window of %u chunks...", blobSizeKB, windowSize);
+	startTime_us = timestamp_us();
+
+	rc = aws_iot_fragment_publish(&mqttClient, &fragmentParams, pBlob, blobSize, &stats);
+	if (NONE_ERROR != rc) {
+		ERROR("Fragmented publish failed - %d", rc);
+		return rc;
+	}
+
+	// Chunks published last may still be on their way back from the broker
+	InitTimer(&drainTimer);
+	countdown_ms(&drainTimer, 10000);
+	while (!aws_iot_fragment_reassembler_is_complete(&reassembler) && !expired(&drainTimer)) {
+		rc = mqttClient.yield(10);
+		if (NONE_ERROR != rc) {
+			break;
+		}
+	}
+	elapsed_us = timestamp_us() - startTime_us;
+
+	INFO("Sent %u chunks, %u bytes in %u ms, %u window stalls: %.2f MB/s", stats.chunksSent, stats.bytesSent,
+			stats.elapsed_ms, stats.windowStalls, stats.throughputMBps);
+
+	if (!aws_iot_fragment_reassembler_is_complete(&reassembler)) {
+		ERROR("Reassembly incomplete, first missing chunk %u",
+				aws_iot_fragment_reassembler_next_missing(&reassembler, 0));
+		rc = FRAGMENT_TIMEOUT_ERROR;
+	} else if (0 != memcmp(pBlob, pReassemblyBuffer, blobSize)) {
+		ERROR("Reassembled data differs from the sent data");
+		rc = FRAGMENT_CHECKSUM_MISMATCH;
+	} else {
+		INFO("Reassembled %u bytes end to end in %u ms: %.2f MB/s", blobSize, (uint32_t) (elapsed_us / 1000),
+				(double) blobSize / (double) elapsed_us);
+	}
+
+	mqttClient.disconnect();
+	free(pBitmap);
+	free(pReassemblyBuffer);
+	free(pBlob);
+
+	return rc;
+}
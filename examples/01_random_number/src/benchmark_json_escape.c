@@ -0,0 +1,300 @@
+/*
+ * Measures JSON string escaping and unescaping on typical shadow string fields: short names and
+ * versions, free text with quotes and line breaks, Windows paths, UTF-8 text and long clean values.
+ * Every implementation the CPU supports is run on the same fields and checked against the scalar
+ * one, then building a shadow document with string fields is compared with writing them unescaped,
+ * and a delta carrying the escaped fields is parsed the way the shadow client does, checking every
+ * field comes back as it was reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include <string.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_version.h"
+#include "aws_iot_json_escape.h"
+#include "aws_iot_shadow_interface.h"
+#include "aws_iot_shadow_json.h"
+#include "aws_iot_shadow_json_data.h"
+#include "aws_iot_config.h"
+#include "timer_interface.h"
+
+
+// ============================================================================
+// Global variables
+// ============================================================================
+
+// Passes over the field set per measurement
+uint32_t iterationCount = 200000;
+
+// String fields as devices report them
+const char *fields[] = {
+		"thermostat-kitchen-01",
+		"1.4.2-rc3",
+		"Door \"front\" opened by user\nAlarm disarmed at 07:31",
+		"C:\\ProgramData\\Sensors\\logs\\current.log",
+		"Temp\xc3\xa9rature du salon, capteur \xc3\xa0 c\xc3\xb4t\xc3\xa9 de la fen\xc3\xaatre",
+		"eyJzZXJpYWwiOiJBQjEyMzQ1Njc4OSIsIm1vZGVsIjoiVEgtMjAwIiwiemlwIjoiOTgxMDkiLCJyZWdpb24iOiJ1cy13ZXN0LTIiLCJvd25lciI6ImFjbWUtY29ycCIsInNpdGUiOiJidWlsZGluZy00MiJ9",
+		"ok",
+		"Line one\tcolumn\r\nLine two \x01\x02 with raw control bytes"
+};
+
+#define FIELD_COUNT (sizeof(fields) / sizeof(fields[0]))
+
+// Shadow keys the fields are reported under
+const char *fieldKeys[FIELD_COUNT] = { "name", "version", "status", "logPath", "label", "certInfo", "health", "lastError" };
+
+// Escaping can grow a field six times, plus the NUL
+#define MAX_ESCAPED_LEN 1200
+
+char escapedFields[FIELD_COUNT][MAX_ESCAPED_LEN];
+size_t fieldLengths[FIELD_COUNT];
+size_t escapedLengths[FIELD_COUNT];
+size_t totalFieldBytes;
+
+const char *implNames[] = { "scalar", "sse2", "avx2" };
+
+// Keeps the compiler from dropping the measured work
+volatile size_t sink;
+
+
+// ============================================================================
+// Functions
+// ============================================================================
+
+void printThroughput(const char *pPhase, const char *pImpl, uint64_t bytes, uint64_t elapsed_us) {
+	INFO("%-8s %-6s %8llu MB/s, %6llu ns per field", pPhase, pImpl,
+			(unsigned long long) (0 != elapsed_us ? bytes / elapsed_us : 0),
+			(unsigned long long) (elapsed_us * 1000 / ((uint64_t) iterationCount * FIELD_COUNT)));
+}
+
+// Escapes and unescapes every field with the selected implementation, checking the results against the scalar ones
+IoT_Error_t runImplementation(JsonEscapeImpl_t impl) {
+	char buf[MAX_ESCAPED_LEN];
+	size_t written = 0;
+	uint64_t startTime_us;
+	uint32_t i, j;
+	IoT_Error_t rc;
+
+	for (j = 0; j < FIELD_COUNT; j++) {
+		rc = aws_iot_json_escape(buf, sizeof(buf), fields[j], fieldLengths[j], &written);
+		if (NONE_ERROR != rc || written != escapedLengths[j] || 0 != memcmp(buf, escapedFields[j], written)) {
+			ERROR("%s escapes field %u differently", implNames[impl], j);
+			return GENERIC_ERROR;
+		}
+		rc = aws_iot_json_unescape(buf, sizeof(buf), escapedFields[j], escapedLengths[j], &written);
+		if (NONE_ERROR != rc || written != fieldLengths[j] || 0 != memcmp(buf, fields[j], written)) {
+			ERROR("%s does not restore field %u", implNames[impl], j);
+			return GENERIC_ERROR;
+		}
+	}
+
+	startTime_us = timestamp_us();
+	for (i = 0; i < iterationCount; i++) {
+		for (j = 0; j < FIELD_COUNT; j++) {
+			aws_iot_json_escape(buf, sizeof(buf), fields[j], fieldLengths[j], &written);
+			sink += written;
+		}
+	}
+	printThroughput("escape", implNames[impl], (uint64_t) iterationCount * totalFieldBytes,
+			timestamp_us() - startTime_us);
+
+	startTime_us = timestamp_us();
+	for (i = 0; i < iterationCount; i++) {
+		for (j = 0; j < FIELD_COUNT; j++) {
+			aws_iot_json_unescape(buf, sizeof(buf), escapedFields[j], escapedLengths[j], &written);
+			sink += written;
+		}
+	}
+	printThroughput("unescape", implNames[impl], (uint64_t) iterationCount * totalFieldBytes,
+			timestamp_us() - startTime_us);
+
+	return NONE_ERROR;
+}
+
+// Builds a reported section of all fields, escaped as the shadow client writes it or unescaped as it used to
+IoT_Error_t runDocumentPhase(void) {
+	char document[FIELD_COUNT * MAX_ESCAPED_LEN];
+	jsonStruct_t handlers[FIELD_COUNT];
+	uint64_t startTime_us;
+	uint64_t escaped_us, unescaped_us;
+	uint32_t i, j;
+	size_t len;
+	IoT_Error_t rc = NONE_ERROR;
+
+	for (j = 0; j < FIELD_COUNT; j++) {
+		handlers[j].pKey = fieldKeys[j];
+		handlers[j].pData = (void *) fields[j];
+		handlers[j].type = SHADOW_JSON_STRING;
+		handlers[j].cb = NULL;
+		handlers[j].dataLength = fieldLengths[j] + 1;
+	}
+
+	startTime_us = timestamp_us();
+	for (i = 0; NONE_ERROR == rc && i < iterationCount / 10; i++) {
+		rc = aws_iot_shadow_init_json_document(document, sizeof(document));
+		if (NONE_ERROR == rc) {
+			rc = aws_iot_shadow_add_reported(document, sizeof(document), FIELD_COUNT, &handlers[0], &handlers[1],
+					&handlers[2], &handlers[3], &handlers[4], &handlers[5], &handlers[6], &handlers[7]);
+		}
+		sink += strlen(document);
+	}
+	escaped_us = timestamp_us() - startTime_us;
+	if (NONE_ERROR != rc) {
+		ERROR("Error(%d) building the shadow document", rc);
+		return rc;
+	}
+
+	// The same document with the values written as they are, which is what the shadow client used to do
+	startTime_us = timestamp_us();
+	for (i = 0; i < iterationCount / 10; i++) {
+		len = (size_t) snprintf(document, sizeof(document), "{\"state\":{\"reported\":{");
+		for (j = 0; j < FIELD_COUNT; j++) {
+			len += (size_t) snprintf(document + len, sizeof(document) - len, "\"%s\":\"%s\",", fieldKeys[j], fields[j]);
+		}
+		snprintf(document + len - 1, sizeof(document) - len + 1, "},");
+		sink += strlen(document);
+	}
+	unescaped_us = timestamp_us() - startTime_us;
+
+	INFO("document escaped %llu ns, unescaped %llu ns per document",
+			(unsigned long long) (escaped_us * 1000 / (iterationCount / 10)),
+			(unsigned long long) (unescaped_us * 1000 / (iterationCount / 10)));
+
+	return NONE_ERROR;
+}
+
+// Parses a delta of all escaped fields as the delta callback does, unescaping every field into its buffer
+IoT_Error_t runDeltaPhase(void) {
+	static char document[FIELD_COUNT * MAX_ESCAPED_LEN];
+	static char values[FIELD_COUNT][MAX_ESCAPED_LEN];
+	jsonStruct_t handlers[FIELD_COUNT];
+	void *pJsonHandler = NULL;
+	int32_t tokenCount = 0;
+	int32_t dataPosition;
+	uint32_t dataLength;
+	uint64_t startTime_us, elapsed_us;
+	uint32_t i, j;
+	size_t len;
+
+	len = (size_t) snprintf(document, sizeof(document), "{\"state\":{");
+	for (j = 0; j < FIELD_COUNT; j++) {
+		len += (size_t) snprintf(document + len, sizeof(document) - len, "\"%s\":\"%s\",", fieldKeys[j],
+				escapedFields[j]);
+	}
+	snprintf(document + len - 1, sizeof(document) - len + 1, "},\"version\":7}");
+
+	for (j = 0; j < FIELD_COUNT; j++) {
+		handlers[j].pKey = fieldKeys[j];
+		handlers[j].pData = values[j];
+		handlers[j].type = SHADOW_JSON_STRING;
+		handlers[j].cb = NULL;
+		handlers[j].dataLength = sizeof(values[j]);
+	}
+
+	startTime_us = timestamp_us();
+	for (i = 0; i < iterationCount / 10; i++) {
+		if (!isJsonValidAndParse(document, pJsonHandler, &tokenCount)) {
+			ERROR("The delta document does not parse");
+			return JSON_PARSE_ERROR;
+		}
+		for (j = 0; j < FIELD_COUNT; j++) {
+			if (isJsonKeyMatchingAndUpdateValue(document, pJsonHandler, tokenCount, &handlers[j], &dataLength,
+					&dataPosition)) {
+				sink += dataLength;
+			}
+		}
+	}
+	elapsed_us = timestamp_us() - startTime_us;
+
+	for (j = 0; j < FIELD_COUNT; j++) {
+		if (0 != strcmp(values[j], fields[j])) {
+			ERROR("Field %s changed on its way through the delta", fieldKeys[j]);
+			return GENERIC_ERROR;
+		}
+	}
+
+	INFO("delta    %llu ns per document", (unsigned long long) (elapsed_us * 1000 / (iterationCount / 10)));
+
+	return NONE_ERROR;
+}
+
+// Parse the command line arguments containing the benchmark parameters
+void parseInputArgsForBenchmarkParams(int argc, char** argv) {
+	int opt;
+
+	while (-1 != (opt = getopt(argc, argv, "n:"))) {
+		switch (opt) {
+		case 'n':
+			iterationCount = atoi(optarg);
+			DEBUG("iterations %s", optarg);
+			break;
+		case '?':
+			if (isprint(optopt)) {
+				WARN("Unknown option `-%c'.", optopt);
+			} else {
+				WARN("Unknown option character `\\x%x'.", optopt);
+			}
+			break;
+		default:
+			ERROR("Error in command line argument parsing");
+			break;
+		}
+	}
+}
+
+
+// ============================================================================
+// Main function
+// ============================================================================
+
+int main(int argc, char** argv) {
+	IoT_Error_t rc = NONE_ERROR;
+	JsonEscapeImpl_t impl, best;
+	uint32_t j;
+
+	parseInputArgsForBenchmarkParams(argc, argv);
+
+	INFO("\nAWS IoT SDK Version %d.%d.%d-%s\n", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH, VERSION_TAG);
+
+	if (iterationCount < 10) {
+		ERROR("At least 10 iterations are needed");
+		return GENERIC_ERROR;
+	}
+
+	// Reference results from the scalar implementation
+	aws_iot_json_escape_select(JSON_ESCAPE_SCALAR);
+	totalFieldBytes = 0;
+	for (j = 0; j < FIELD_COUNT; j++) {
+		fieldLengths[j] = strlen(fields[j]);
+		totalFieldBytes += fieldLengths[j];
+		rc = aws_iot_json_escape(escapedFields[j], MAX_ESCAPED_LEN, fields[j], fieldLengths[j], &escapedLengths[j]);
+		if (NONE_ERROR != rc) {
+			ERROR("Error(%d) escaping field %u", rc, j);
+			return rc;
+		}
+	}
+
+	INFO("%u fields of %llu bytes in total, %u iterations", (uint32_t) FIELD_COUNT,
+			(unsigned long long) totalFieldBytes, iterationCount);
+
+	best = aws_iot_json_escape_select(JSON_ESCAPE_AVX2);
+	for (impl = JSON_ESCAPE_SCALAR; NONE_ERROR == rc && impl <= best; impl++) {
+		aws_iot_json_escape_select(impl);
+		rc = runImplementation(impl);
+	}
+
+	if (NONE_ERROR == rc) {
+		aws_iot_json_escape_select(best);
+		rc = runDocumentPhase();
+	}
+	if (NONE_ERROR == rc) {
+		rc = runDeltaPhase();
+	}
+
+	return rc;
+}
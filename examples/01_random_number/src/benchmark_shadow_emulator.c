@@ -0,0 +1,362 @@
+/*
+ * Measures shadow get, update and delta throughput and latency offline. The shadow client runs
+ * against the in-process shadow service emulator, so the numbers show the cost of the client
+ * and of the configured service latency (-l/-j) rather than that of the network. Failures can be
+ * injected with -r (rejected requests) and -d (requests lost without a response).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include <memory.h>
+
+#include "aws_iot_log.h"
+#include "aws_iot_version.h"
+#include "aws_iot_shadow_interface.h"
+#include "aws_iot_shadow_json_data.h"
+#include "aws_iot_shadow_emulator.h"
+#include "aws_iot_config.h"
+#include "timer_interface.h"
+
+
+// ============================================================================
+// Global variables
+// ============================================================================
+
+// Thing whose shadow is exercised
+char thingName[MAX_SIZE_OF_THING_NAME] = "BenchmarkThing";
+
+// Number of requests per benchmark phase
+uint32_t requestCount = 1000;
+
+// Requests waiting for a response at the same time
+uint32_t windowSize = MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME;
+
+// Behaviour of the emulated shadow service
+ShadowEmulatorParams_t emulatorParams;
+
+// Time given to the service to respond before a request is reported as timed out
+#define REQUEST_TIMEOUT_SECONDS 2
+
+// Time a single yield may wait for responses
+#define YIELD_TIMEOUT_MS 5
+
+// Per phase state shared with the callbacks
+uint64_t *pStartTimes_us;
+uint32_t *pLatencies_us;
+uint32_t responseCount;
+uint32_t acceptedCount;
+uint32_t rejectedCount;
+uint32_t timedOutCount;
+
+// Value set by the last delta received
+int32_t deltaTarget = -1;
+
+
+// ============================================================================
+// Functions
+// ============================================================================
+
+// Shadow acknowledgment callback, the context points to the start time of the request
+void shadowAckCallback(const char *pThingName, ShadowActions_t action, Shadow_Ack_Status_t status,
+		const char *pReceivedJsonDocument, void *pContextData) {
+	uint64_t *pStartTime_us = (uint64_t *) pContextData;
+
+	pLatencies_us[responseCount++] = (uint32_t) (timestamp_us() - *pStartTime_us);
+
+	if (SHADOW_ACK_ACCEPTED == status) {
+		acceptedCount++;
+	} else if (SHADOW_ACK_REJECTED == status) {
+		rejectedCount++;
+	} else {
+		timedOutCount++;
+	}
+}
+
+// Delta callback of the registered "target" field, the value is the index of the request
+void deltaTargetCallback(const char *pJsonValueBuffer, uint32_t valueLength, jsonStruct_t *pJsonStruct) {
+	pLatencies_us[responseCount] = (uint32_t) (timestamp_us() - pStartTimes_us[deltaTarget]);
+	responseCount++;
+	acceptedCount++;
+}
+
+int compareLatencies(const void *pLeft, const void *pRight) {
+	uint32_t left = *(const uint32_t *) pLeft;
+	uint32_t right = *(const uint32_t *) pRight;
+	return (left > right) - (left < right);
+}
+
+void resetPhase(void) {
+	responseCount = 0;
+	acceptedCount = 0;
+	rejectedCount = 0;
+	timedOutCount = 0;
+}
+
+void printPhaseResults(const char *pPhase, uint64_t elapsed_us) {
+	if (0 == responseCount) {
+		INFO("%s: no responses", pPhase);
+		return;
+	}
+
+	qsort(pLatencies_us, responseCount, sizeof(uint32_t), compareLatencies);
+	INFO("%s: %u accepted, %u rejected, %u timed out in %llu ms, %llu ops/s", pPhase, acceptedCount, rejectedCount,
+			timedOutCount, (unsigned long long) (elapsed_us / 1000),
+			(unsigned long long) (0 != elapsed_us ? (uint64_t) responseCount * 1000000ULL / elapsed_us : 0));
+	INFO("%s latency us: p50 %u, p90 %u, p99 %u, max %u", pPhase, pLatencies_us[responseCount / 2],
+			pLatencies_us[(uint64_t) responseCount * 90 / 100], pLatencies_us[(uint64_t) responseCount * 99 / 100],
+			pLatencies_us[responseCount - 1]);
+}
+
+// Sends a get, or an update reporting counter = index, timed from pStartTimes_us[index]
+IoT_Error_t sendRequest(MQTTClient_t *pClient, ShadowActions_t action, uint32_t index) {
+	IoT_Error_t rc;
+	char jsonDocument[AWS_IOT_MQTT_TX_BUF_LEN];
+	int32_t counter = (int32_t) index;
+	jsonStruct_t counterHandler;
+
+	pStartTimes_us[index] = timestamp_us();
+
+	if (SHADOW_GET == action) {
+		return aws_iot_shadow_get(pClient, thingName, shadowAckCallback, &pStartTimes_us[index],
+				REQUEST_TIMEOUT_SECONDS, true);
+	}
+
+	counterHandler.pKey = "counter";
+	counterHandler.pData = &counter;
+	counterHandler.type = SHADOW_JSON_INT32;
+	counterHandler.cb = NULL;
+	counterHandler.dataLength = sizeof(counter);
+
+	rc = aws_iot_shadow_init_json_document(jsonDocument, sizeof(jsonDocument));
+	if (NONE_ERROR == rc) {
+		rc = aws_iot_shadow_add_reported(jsonDocument, sizeof(jsonDocument), 1, &counterHandler);
+	}
+	if (NONE_ERROR == rc) {
+		rc = aws_iot_finalize_json_document(jsonDocument, sizeof(jsonDocument));
+	}
+	if (NONE_ERROR == rc) {
+		rc = aws_iot_shadow_update(pClient, thingName, jsonDocument, shadowAckCallback, &pStartTimes_us[index],
+				REQUEST_TIMEOUT_SECONDS, true);
+	}
+
+	return rc;
+}
+
+// Sends requestCount gets or updates keeping up to windowSize of them in flight
+IoT_Error_t runRequestPhase(MQTTClient_t *pClient, ShadowActions_t action) {
+	IoT_Error_t rc = NONE_ERROR;
+	uint32_t sent = 0;
+	uint64_t startTime_us;
+
+	resetPhase();
+	startTime_us = timestamp_us();
+
+	while (NONE_ERROR == rc && responseCount < requestCount) {
+		while (sent < requestCount && sent - responseCount < windowSize) {
+			rc = sendRequest(pClient, action, sent);
+			if (GENERIC_ERROR == rc) {
+				// every acknowledgment slot is taken, wait for responses
+				rc = NONE_ERROR;
+				break;
+			}
+			if (NONE_ERROR != rc) {
+				ERROR("Request %u failed with error %d", sent, rc);
+				break;
+			}
+			sent++;
+		}
+
+		if (NONE_ERROR == rc) {
+			rc = aws_iot_shadow_yield(pClient, YIELD_TIMEOUT_MS);
+		}
+	}
+
+	printPhaseResults(SHADOW_UPDATE == action ? "update" : "get", timestamp_us() - startTime_us);
+
+	return rc;
+}
+
+// Changes the desired state from the service side requestCount times, one delta at a time
+IoT_Error_t runDeltaPhase(MQTTClient_t *pClient) {
+	IoT_Error_t rc = NONE_ERROR;
+	char jsonDocument[64];
+	uint32_t i;
+	uint64_t startTime_us;
+	Timer deltaTimer;
+
+	resetPhase();
+	startTime_us = timestamp_us();
+
+	for (i = 0; NONE_ERROR == rc && i < requestCount; i++) {
+		deltaTarget = (int32_t) i;
+		snprintf(jsonDocument, sizeof(jsonDocument), "{\"state\":{\"desired\":{\"target\":%u}}}", i);
+		pStartTimes_us[i] = timestamp_us();
+		rc = aws_iot_shadow_emulator_update(thingName, jsonDocument);
+
+		InitTimer(&deltaTimer);
+		countdown(&deltaTimer, REQUEST_TIMEOUT_SECONDS);
+		while (NONE_ERROR == rc && responseCount + timedOutCount <= i) {
+			if (expired(&deltaTimer)) {
+				timedOutCount++;
+				break;
+			}
+			rc = aws_iot_shadow_yield(pClient, YIELD_TIMEOUT_MS);
+		}
+	}
+
+	printPhaseResults("delta", timestamp_us() - startTime_us);
+
+	return rc;
+}
+
+// Parse the command line arguments containing the benchmark parameters
+void parseInputArgsForBenchmarkParams(int argc, char** argv) {
+	int opt;
+
+	while (-1 != (opt = getopt(argc, argv, "t:n:w:l:j:r:d:"))) {
+		switch (opt) {
+		case 't':
+			snprintf(thingName, sizeof(thingName), "%s", optarg);
+			DEBUG("thing %s", optarg);
+			break;
+		case 'n':
+			requestCount = atoi(optarg);
+			DEBUG("requests %s", optarg);
+			break;
+		case 'w':
+			windowSize = atoi(optarg);
+			DEBUG("window %s", optarg);
+			break;
+		case 'l':
+			emulatorParams.responseLatency_ms = atoi(optarg);
+			DEBUG("latency %s ms", optarg);
+			break;
+		case 'j':
+			emulatorParams.latencyJitter_ms = atoi(optarg);
+			DEBUG("jitter %s ms", optarg);
+			break;
+		case 'r':
+			emulatorParams.rejectPercent = atoi(optarg);
+			DEBUG("reject %s%%", optarg);
+			break;
+		case 'd':
+			emulatorParams.dropPercent = atoi(optarg);
+			DEBUG("drop %s%%", optarg);
+			break;
+		case '?':
+			if (isprint(optopt)) {
+				WARN("Unknown option `-%c'.", optopt);
+			} else {
+				WARN("Unknown option character `\\x%x'.", optopt);
+			}
+			break;
+		default:
+			ERROR("Error in command line argument parsing");
+			break;
+		}
+	}
+}
+
+
+// ============================================================================
+// Main function
+// ============================================================================
+
+int main(int argc, char** argv) {
+	IoT_Error_t rc = NONE_ERROR;
+	MQTTClient_t mqttClient;
+	ShadowParameters_t shadowParams = ShadowParametersDefault;
+	ShadowEmulatorStats_t emulatorStats;
+	jsonStruct_t targetHandler;
+	int32_t target = 0;
+
+	emulatorParams = ShadowEmulatorParamsDefault;
+	parseInputArgsForBenchmarkParams(argc, argv);
+
+	INFO("\nAWS IoT SDK Version %d.%d.%d-%s\n", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH, VERSION_TAG);
+
+	if (0 == requestCount) {
+		ERROR("At least one request is needed");
+		return GENERIC_ERROR;
+	}
+	if (0 == windowSize) {
+		windowSize = 1;
+	}
+
+	pStartTimes_us = (uint64_t *) calloc(requestCount, sizeof(uint64_t));
+	pLatencies_us = (uint32_t *) calloc(requestCount, sizeof(uint32_t));
+	if (NULL == pStartTimes_us || NULL == pLatencies_us) {
+		ERROR("Unable to allocate the latency buffers for %u requests", requestCount);
+		return GENERIC_ERROR;
+	}
+
+	aws_iot_shadow_emulator_init(&mqttClient, &emulatorParams);
+	aws_iot_shadow_init(&mqttClient);
+
+	shadowParams.pMyThingName = thingName;
+	shadowParams.pMqttClientId = "benchmark-shadow-emulator-application";
+
+	rc = aws_iot_shadow_connect(&mqttClient, &shadowParams);
+	if (NONE_ERROR != rc) {
+		ERROR("Error(%d) connecting to the emulator", rc);
+		return rc;
+	}
+
+	targetHandler.pKey = "target";
+	targetHandler.pData = &target;
+	targetHandler.type = SHADOW_JSON_INT32;
+	targetHandler.cb = deltaTargetCallback;
+	targetHandler.dataLength = sizeof(target);
+
+	rc = aws_iot_shadow_register_delta(&mqttClient, &targetHandler);
+	if (NONE_ERROR != rc) {
+		ERROR("Error(%d) registering the delta callback", rc);
+		return rc;
+	}
+
+	INFO("%u requests per phase, window %u, latency %u+%u ms, %u%% rejected, %u%% dropped", requestCount,
+			windowSize, emulatorParams.responseLatency_ms, emulatorParams.latencyJitter_ms,
+			emulatorParams.rejectPercent, emulatorParams.dropPercent);
+
+	// The first request of every action waits for its persistent subscriptions to settle, keep it out of the numbers
+	INFO("Subscribing...");
+	resetPhase();
+	rc = sendRequest(&mqttClient, SHADOW_UPDATE, 0);
+	if (NONE_ERROR == rc) {
+		rc = sendRequest(&mqttClient, SHADOW_GET, 0);
+	}
+	while (NONE_ERROR == rc && responseCount + timedOutCount < 2) {
+		rc = aws_iot_shadow_yield(&mqttClient, YIELD_TIMEOUT_MS);
+	}
+
+	if (NONE_ERROR == rc) {
+		rc = runRequestPhase(&mqttClient, SHADOW_UPDATE);
+	}
+	if (NONE_ERROR == rc) {
+		rc = runRequestPhase(&mqttClient, SHADOW_GET);
+	}
+	if (NONE_ERROR == rc) {
+		rc = runDeltaPhase(&mqttClient);
+	}
+
+	aws_iot_shadow_emulator_get_stats(&emulatorStats);
+	INFO("Emulator: %u requests, %u accepted, %u rejected (%u injected), %u dropped, %u deltas, %u delivered, "
+			"%u unrouted, %u oversized, %u queue overflows, queue depth up to %u", emulatorStats.requests,
+			emulatorStats.accepted, emulatorStats.rejected, emulatorStats.injectedRejections, emulatorStats.dropped,
+			emulatorStats.deltas, emulatorStats.delivered, emulatorStats.unrouted, emulatorStats.oversized,
+			emulatorStats.queueOverflows, emulatorStats.maxQueueDepth);
+
+	aws_iot_shadow_disconnect(&mqttClient);
+
+	if (NONE_ERROR != rc) {
+		ERROR("Benchmark stopped with error %d", rc);
+	}
+
+	free(pStartTimes_us);
+	free(pLatencies_us);
+
+	return rc;
+}
@@ -0,0 +1,383 @@
+/*
+ * Compares the TLS implementations the client can be built with. The same program is linked
+ * once against network_openssl_wrapper.c and once against network_mbedtls_wrapper.c (make
+ * benchmark_tls_mbedtls MBEDTLS_DIR=...), then measures against a broker on the local network:
+ *  - full and resumed handshakes per second, with the CPU time each one costs
+ *  - publish throughput in messages and MB per second across payload sizes, with CPU time per message
+ *  - resident memory per connection, including its AWS_IOT_MQTT_TX_BUF_LEN and RX_BUF_LEN buffers
+ * Point it at a local broker (-h/-p) so that the numbers show the client, not the WAN.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include <memory.h>
+#include <limits.h>
+#include <sys/resource.h>
+
+#include "aws_iot_error.h"
+#include "aws_iot_log.h"
+#include "aws_iot_version.h"
+#include "aws_iot_config.h"
+#include "MQTTClient.h"
+#include "network_interface.h"
+#include "timer_interface.h"
+
+#ifndef BENCHMARK_TLS_BACKEND
+#define BENCHMARK_TLS_BACKEND "unknown"
+#endif
+
+// Largest payload measured, the buffers of the throughput connection are sized for it
+#define MAX_PAYLOAD_LEN (16 * 1024)
+#define THROUGHPUT_BUF_LEN (MAX_PAYLOAD_LEN + 256)
+
+// Publishes between two checks of the clock and of the keepalive timer
+#define PUBLISHES_PER_CHECK 64
+
+
+// ============================================================================
+// Global variables
+// ============================================================================
+
+// Default cert location
+char certDirectory[PATH_MAX + 1] = "../../certs";
+
+// Default MQTT HOST URL is pulled from the aws_iot_config.h
+char HostAddress[255] = AWS_IOT_MQTT_HOST;
+
+// Default MQTT port is pulled from the aws_iot_config.h
+uint32_t port = AWS_IOT_MQTT_PORT;
+
+// Connects measured per handshake kind
+uint32_t handshakeCount = 20;
+
+// Seconds of publishing per payload size
+uint32_t publishSeconds = 2;
+
+// Connections held open at the same time for the memory measurement
+uint32_t connectionCount = 10;
+
+// QoS of the measured publishes
+QoS publishQos = QOS0;
+
+// Session cache file of the resumed handshakes, removed before and after the measurement
+char sessionCacheFile[PATH_MAX + 1] = "/tmp/benchmark_tls_sessions";
+
+// Payload sizes measured
+const size_t payloadSizes[] = { 16, 128, 1024, 4096, MAX_PAYLOAD_LEN };
+
+#define PAYLOAD_SIZE_COUNT (sizeof(payloadSizes) / sizeof(payloadSizes[0]))
+
+char rootCA[PATH_MAX + 1];
+char clientCRT[PATH_MAX + 1];
+char clientKey[PATH_MAX + 1];
+
+unsigned char throughputTxBuf[THROUGHPUT_BUF_LEN];
+unsigned char throughputRxBuf[THROUGHPUT_BUF_LEN];
+unsigned char payload[MAX_PAYLOAD_LEN];
+
+
+// ============================================================================
+// Functions
+// ============================================================================
+
+// User plus system CPU time of the process
+uint64_t cpuTime_us(void) {
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return (uint64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+			+ (uint64_t) (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+// Resident set size of the process in KB, 0 if it cannot be read
+uint64_t residentKB(void) {
+	FILE *pFile = fopen("/proc/self/statm", "r");
+	unsigned long sizePages = 0, residentPages = 0;
+
+	if (NULL == pFile) {
+		return 0;
+	}
+	if (2 != fscanf(pFile, "%lu %lu", &sizePages, &residentPages)) {
+		residentPages = 0;
+	}
+	fclose(pFile);
+
+	return (uint64_t) residentPages * (uint64_t) sysconf(_SC_PAGESIZE) / 1024;
+}
+
+// Set up a client and connect it, with the session cache or without it
+MQTTReturnCode connectClient(Client *pClient, unsigned char *pTxBuf, size_t txBufLen, unsigned char *pRxBuf,
+		size_t rxBufLen, const char *pClientId, char *pSessionCache) {
+	MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+	TLSConnectParams tlsParams;
+	MQTTReturnCode rc;
+
+	tlsParams.pRootCALocation = rootCA;
+	tlsParams.pDeviceCertLocation = clientCRT;
+	tlsParams.pDevicePrivateKeyLocation = clientKey;
+	tlsParams.pDestinationURL = HostAddress;
+	tlsParams.DestinationPort = (int) port;
+	tlsParams.timeout_ms = 5000;
+	tlsParams.ServerVerificationFlag = true;	// ensure this is set to true for production
+	tlsParams.pSessionCacheLocation = pSessionCache;
+
+	// MQTTClient leaves parts of the stored connect options as they are, a zeroed Client keeps them empty
+	memset(pClient, 0, sizeof(Client));
+	rc = MQTTClient(pClient, 2000, pTxBuf, txBufLen, pRxBuf, rxBufLen, 0, iot_tls_init, &tlsParams);
+	if (SUCCESS != rc) {
+		return rc;
+	}
+
+	data.MQTTVersion = 4;
+	data.clientID.cstring = (char *) pClientId;
+	data.keepAliveInterval = 60;
+	data.cleansession = 1;
+
+	return MQTTConnect(pClient, &data);
+}
+
+// Connect and disconnect handshakeCount times, the first connect only warms up and fills the session cache
+IoT_Error_t runHandshakes(const char *pKind, char *pSessionCache) {
+	Client client;
+	uint64_t startTime_us, startCpu_us, connect_us, total_us = 0, max_us = 0, cpu_us = 0;
+	uint32_t i;
+	MQTTReturnCode rc;
+
+	for (i = 0; i <= handshakeCount; i++) {
+		startCpu_us = cpuTime_us();
+		startTime_us = timestamp_us();
+		rc = connectClient(&client, throughputTxBuf, THROUGHPUT_BUF_LEN, throughputRxBuf, THROUGHPUT_BUF_LEN,
+				"benchmark-tls-backend", pSessionCache);
+		connect_us = timestamp_us() - startTime_us;
+		if (SUCCESS != rc) {
+			ERROR("Error(%d) connecting to %s:%u", rc, HostAddress, port);
+			return CONNECTION_ERROR;
+		}
+		if (0 != i) {
+			total_us += connect_us;
+			cpu_us += cpuTime_us() - startCpu_us;
+			if (connect_us > max_us) {
+				max_us = connect_us;
+			}
+		}
+		MQTTDisconnect(&client);
+	}
+
+	INFO("%-8s handshakes %8.1f per second, %7.2f ms mean, %7.2f ms max, %7.2f ms CPU each", pKind,
+			(double) handshakeCount * 1000000.0 / (double) total_us, (double) total_us / handshakeCount / 1000.0,
+			(double) max_us / 1000.0, (double) cpu_us / handshakeCount / 1000.0);
+
+	return NONE_ERROR;
+}
+
+// Publish each payload size for publishSeconds on one connection
+IoT_Error_t runThroughput(void) {
+	Client client;
+	MQTTMessage message;
+	uint64_t startTime_us, startCpu_us, elapsed_us, cpu_us, count;
+	size_t sizeIndex;
+	uint32_t i;
+	MQTTReturnCode rc;
+
+	rc = connectClient(&client, throughputTxBuf, THROUGHPUT_BUF_LEN, throughputRxBuf, THROUGHPUT_BUF_LEN,
+			"benchmark-tls-backend", NULL);
+	if (SUCCESS != rc) {
+		ERROR("Error(%d) connecting to %s:%u", rc, HostAddress, port);
+		return CONNECTION_ERROR;
+	}
+
+	for (sizeIndex = 0; sizeIndex < PAYLOAD_SIZE_COUNT; sizeIndex++) {
+		message.qos = publishQos;
+		message.retained = 0;
+		message.dup = 0;
+		message.payload = payload;
+		message.payloadlen = payloadSizes[sizeIndex];
+
+		count = 0;
+		startCpu_us = cpuTime_us();
+		startTime_us = timestamp_us();
+		do {
+			for (i = 0; SUCCESS == rc && i < PUBLISHES_PER_CHECK; i++) {
+				rc = MQTTPublish(&client, "sample-application/tls-benchmark", &message);
+			}
+			count += i;
+			// Keepalive only, nothing the broker sends back is read during a QoS 0 run
+			if (SUCCESS == rc) {
+				rc = MQTTServiceTimers(&client);
+			}
+			elapsed_us = timestamp_us() - startTime_us;
+		} while (SUCCESS == rc && elapsed_us < (uint64_t) publishSeconds * 1000000);
+		cpu_us = cpuTime_us() - startCpu_us;
+
+		if (SUCCESS != rc) {
+			ERROR("Error(%d) publishing %u byte messages", rc, (uint32_t) payloadSizes[sizeIndex]);
+			return PUBLISH_ERROR;
+		}
+
+		INFO("publish  %5u bytes %9.0f msg/s %8.2f MB/s %7.2f us CPU per message",
+				(uint32_t) payloadSizes[sizeIndex], (double) count * 1000000.0 / (double) elapsed_us,
+				(double) (count * payloadSizes[sizeIndex]) / (double) elapsed_us, (double) cpu_us / (double) count);
+	}
+
+	MQTTDisconnect(&client);
+
+	return NONE_ERROR;
+}
+
+// Hold connectionCount connections with the configured buffer sizes open at once
+IoT_Error_t runMemory(void) {
+	Client *pClients;
+	unsigned char *pBuffers;
+	unsigned char *pTxBuf;
+	char clientId[64];
+	uint64_t beforeKB, afterKB;
+	uint32_t i, connected = 0;
+	IoT_Error_t rc = NONE_ERROR;
+
+	pClients = (Client *) calloc(connectionCount, sizeof(Client));
+	pBuffers = (unsigned char *) calloc(connectionCount, AWS_IOT_MQTT_TX_BUF_LEN + AWS_IOT_MQTT_RX_BUF_LEN);
+	if (NULL == pClients || NULL == pBuffers) {
+		ERROR("Unable to allocate %u connections", connectionCount);
+		free(pClients);
+		free(pBuffers);
+		return GENERIC_ERROR;
+	}
+
+	beforeKB = residentKB();
+	for (i = 0; i < connectionCount; i++) {
+		snprintf(clientId, sizeof(clientId), "benchmark-tls-backend-%u", i);
+		pTxBuf = pBuffers + (size_t) i * (AWS_IOT_MQTT_TX_BUF_LEN + AWS_IOT_MQTT_RX_BUF_LEN);
+		if (SUCCESS != connectClient(&pClients[i], pTxBuf, AWS_IOT_MQTT_TX_BUF_LEN, pTxBuf + AWS_IOT_MQTT_TX_BUF_LEN,
+				AWS_IOT_MQTT_RX_BUF_LEN, clientId, NULL)) {
+			ERROR("Error connecting connection %u", i);
+			rc = CONNECTION_ERROR;
+			break;
+		}
+		connected++;
+	}
+	afterKB = residentKB();
+
+	if (NONE_ERROR == rc) {
+		INFO("memory   %u connections %8.1f KB resident each", connected,
+				(double) (afterKB - beforeKB) / (double) connected);
+	}
+
+	for (i = 0; i < connected; i++) {
+		MQTTDisconnect(&pClients[i]);
+	}
+	free(pBuffers);
+	free(pClients);
+
+	return rc;
+}
+
+// Parse the command line arguments containing connection details and benchmark parameters
+void parseInputArgsForConnectParams(int argc, char** argv) {
+	int opt;
+
+	while (-1 != (opt = getopt(argc, argv, "h:p:c:n:t:C:q:s:"))) {
+		switch (opt) {
+		case 'h':
+			strcpy(HostAddress, optarg);
+			DEBUG("Host %s", optarg);
+			break;
+		case 'p':
+			port = atoi(optarg);
+			DEBUG("arg %s", optarg);
+			break;
+		case 'c':
+			strcpy(certDirectory, optarg);
+			DEBUG("cert root directory %s", optarg);
+			break;
+		case 'n':
+			handshakeCount = atoi(optarg);
+			DEBUG("handshakes %s", optarg);
+			break;
+		case 't':
+			publishSeconds = atoi(optarg);
+			DEBUG("seconds per payload size %s", optarg);
+			break;
+		case 'C':
+			connectionCount = atoi(optarg);
+			DEBUG("connections %s", optarg);
+			break;
+		case 'q':
+			publishQos = (1 == atoi(optarg)) ? QOS1 : QOS0;
+			DEBUG("qos %s", optarg);
+			break;
+		case 's':
+			strcpy(sessionCacheFile, optarg);
+			DEBUG("session cache %s", optarg);
+			break;
+		case '?':
+			if (optopt == 'c') {
+				ERROR("Option -%c requires an argument.", optopt);
+			} else if (isprint(optopt)) {
+				WARN("Unknown option `-%c'.", optopt);
+			} else {
+				WARN("Unknown option character `\\x%x'.", optopt);
+			}
+			break;
+		default:
+			ERROR("Error in command line argument parsing");
+			break;
+		}
+	}
+}
+
+
+// ============================================================================
+// Main function
+// ============================================================================
+
+int main(int argc, char** argv) {
+	IoT_Error_t rc = NONE_ERROR;
+	char CurrentWD[PATH_MAX + 1];
+	char cafileName[] = AWS_IOT_ROOT_CA_FILENAME;
+	char clientCRTName[] = AWS_IOT_CERTIFICATE_FILENAME;
+	char clientKeyName[] = AWS_IOT_PRIVATE_KEY_FILENAME;
+	uint32_t i;
+
+	parseInputArgsForConnectParams(argc, argv);
+
+	INFO("\nAWS IoT SDK Version %d.%d.%d-%s\n", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH, VERSION_TAG);
+
+	if (0 == handshakeCount || 0 == publishSeconds || 0 == connectionCount) {
+		ERROR("Handshakes, seconds per payload size and connections must not be 0");
+		return GENERIC_ERROR;
+	}
+
+	getcwd(CurrentWD, sizeof(CurrentWD));
+	sprintf(rootCA, "%s/%s/%s", CurrentWD, certDirectory, cafileName);
+	sprintf(clientCRT, "%s/%s/%s", CurrentWD, certDirectory, clientCRTName);
+	sprintf(clientKey, "%s/%s/%s", CurrentWD, certDirectory, clientKeyName);
+
+	for (i = 0; i < MAX_PAYLOAD_LEN; i++) {
+		payload[i] = (unsigned char) rand();
+	}
+
+	INFO("TLS backend %s, broker %s:%u", BENCHMARK_TLS_BACKEND, HostAddress, port);
+
+	rc = runHandshakes("full", NULL);
+
+	// Backends without a session cache ignore it, their resumed numbers then match the full ones
+	if (NONE_ERROR == rc) {
+		unlink(sessionCacheFile);
+		rc = runHandshakes("resumed", sessionCacheFile);
+		unlink(sessionCacheFile);
+	}
+
+	if (NONE_ERROR == rc) {
+		rc = runThroughput();
+	}
+
+	if (NONE_ERROR == rc) {
+		rc = runMemory();
+	}
+
+	return rc;
+}
@@ -19,6 +19,7 @@
 #include "aws_iot_log.h"
 #include "aws_iot_version.h"
 #include "aws_iot_mqtt_interface.h"
+#include "aws_iot_message_log.h"
 #include "aws_iot_config.h"
 
 
@@ -35,6 +36,12 @@ char HostAddress[255] = AWS_IOT_MQTT_HOST;
 // Default MQTT port is pulled from the aws_iot_config.h
 uint32_t port = AWS_IOT_MQTT_PORT;
 
+// Directory received messages are recorded to, empty if recording is disabled
+char messageLogDirectory[PATH_MAX + 1] = "";
+
+// Binary log of the received messages
+MessageLogSink messageLog;
+
 
 // ============================================================================
 // Functions
@@ -47,6 +54,19 @@ int mqttMessageReceivedCallbackHandler(MQTTCallbackParams params) {
 			(int)params.TopicNameLen, params.pTopicName,
 			(int)params.MessageParams.PayloadLen, (char*)params.MessageParams.pPayload);
 
+	if ('\0' != messageLogDirectory[0]) {
+		uint32_t topicId;
+		IoT_Error_t rc = aws_iot_message_log_topic_id(&messageLog, params.pTopicName, params.TopicNameLen, &topicId);
+
+		if (NONE_ERROR == rc) {
+			rc = aws_iot_message_log_append(&messageLog, topicId, params.MessageParams.pPayload,
+					params.MessageParams.PayloadLen);
+		}
+		if (NONE_ERROR != rc) {
+			WARN("Unable to record message - %d", rc);
+		}
+	}
+
 	return 0;
 }
 
@@ -75,7 +95,7 @@ void mqttDisconnectCallbackHandler(void) {
 void parseInputArgsForConnectParams(int argc, char** argv) {
 	int opt;
 
-	while (-1 != (opt = getopt(argc, argv, "h:p:c:"))) {
+	while (-1 != (opt = getopt(argc, argv, "h:p:c:l:"))) {
 		switch (opt) {
 		case 'h':
 			strcpy(HostAddress, optarg);
@@ -89,6 +109,10 @@ void parseInputArgsForConnectParams(int argc, char** argv) {
 			strcpy(certDirectory, optarg);
 			DEBUG("cert root directory %s", optarg);
 			break;
+		case 'l':
+			strcpy(messageLogDirectory, optarg);
+			DEBUG("message log directory %s", optarg);
+			break;
 		case '?':
 			if (optopt == 'c') {
 				ERROR("Option -%c requires an argument.", optopt);
@@ -137,6 +161,20 @@ int main(int argc, char** argv) {
 	DEBUG("clientCRT %s", clientCRT);
 	DEBUG("clientKey %s", clientKey);
 
+	// Open the binary log of received messages if requested
+	if ('\0' != messageLogDirectory[0]) {
+		MessageLogParams messageLogParams = MessageLogParamsDefault;
+		messageLogParams.pDirectory = messageLogDirectory;
+
+		rc = aws_iot_message_log_open(&messageLog, &messageLogParams);
+
+		if (NONE_ERROR != rc) {
+			ERROR("Unable to open message log in %s - %d", messageLogDirectory, rc);
+
+			return rc;
+		}
+	}
+
     // Set MQTT connection parameters
 	MQTTConnectParams connectParams = MQTTConnectParamsDefault;
 
@@ -193,12 +231,8 @@ int main(int argc, char** argv) {
 
     while ((NETWORK_ATTEMPTING_RECONNECT == rc || RECONNECT_SUCCESSFUL == rc || NONE_ERROR == rc) 
             && (currStdinChar != 'q')) {
-        // Wait for 1 second
-        INFO("-->sleep");
-        sleep(1);
-
-        // Yield current thread to the MQTT client
-        rc = aws_iot_mqtt_yield(100);
+        // Yield current thread to the MQTT client for 1 second, it sleeps until a message or a timer is due
+        rc = aws_iot_mqtt_yield(1000);
 
         // Ask user if we should exit
         INFO("Enter \"q\" to exit or any other character to continue to receive messages.");
@@ -213,6 +247,10 @@ int main(int argc, char** argv) {
         INFO("Successfully received messages.\n");
     }
 
+    if ('\0' != messageLogDirectory[0]) {
+        aws_iot_message_log_close(&messageLog);
+    }
+
 	return rc;
 }
 
@@ -39,6 +39,9 @@ uint32_t port = AWS_IOT_MQTT_PORT;
 // Default number of MQTT messages to publish
 int publishCount = 10;
 
+// TLS session cache file, empty to always do a full handshake
+char sessionCacheFile[PATH_MAX + 1] = "";
+
 
 // ============================================================================
 // Functions
@@ -68,7 +71,7 @@ void mqttDisconnectCallbackHandler(void) {
 void parseInputArgsForConnectParams(int argc, char** argv) {
 	int opt;
 
-	while (-1 != (opt = getopt(argc, argv, "h:p:c:x:"))) {
+	while (-1 != (opt = getopt(argc, argv, "h:p:c:x:s:"))) {
 		switch (opt) {
 		case 'h':
 			strcpy(HostAddress, optarg);
@@ -86,6 +89,10 @@ void parseInputArgsForConnectParams(int argc, char** argv) {
 			publishCount = atoi(optarg);
 			DEBUG("publish %s times\n", optarg);
 			break;
+		case 's':
+			strcpy(sessionCacheFile, optarg);
+			DEBUG("TLS session cache %s", optarg);
+			break;
 		case '?':
 			if (optopt == 'c') {
 				ERROR("Option -%c requires an argument.", optopt);
@@ -149,6 +156,7 @@ int main(int argc, char** argv) {
 	connectParams.mqttCommandTimeout_ms = 2000;
 	connectParams.tlsHandshakeTimeout_ms = 5000;
 	connectParams.isSSLHostnameVerify = true; // ensure this is set to true for production
+	connectParams.pSessionCacheLocation = ('\0' != sessionCacheFile[0]) ? sessionCacheFile : NULL;
 	connectParams.disconnectHandler = mqttDisconnectCallbackHandler;
 
     // Connect to message broker via MQTT protocol